@@ -28,10 +28,18 @@ TARGET = Borderless
 QMAKE_EXTRA_TARGETS += SerializationCode
 TEMPLATE = app
 QMAKE_CXXFLAGS += -std=c++11
+# zlib, for ParallelEncoder. On Windows, the copy bundled with Qt is used.
+unix:LIBS += -lz
+# For the replay report, which shares the benchmarks' utilities.
+win32:LIBS += -lpsapi
 INCLUDEPATH += $$PWD/serialization/postsrc $$PWD/src
 
-SOURCES +=  src/ClangErrorMessage.cpp               \
+SOURCES +=  src/AnimationPlayer.cpp                 \
+            src/BackgroundColor.cpp                 \
+            src/BatchProcessor.cpp                  \
+            src/ClangErrorMessage.cpp               \
             src/DirectoryListing.cpp                \
+            src/FilterHistory.cpp                   \
             src/ImageViewerApplication.cpp          \
             src/ImageViewport.cpp                   \
             src/LoadedImage.cpp                     \
@@ -40,28 +48,47 @@ SOURCES +=  src/ClangErrorMessage.cpp               \
             src/MainWindowMovement.cpp              \
             src/MainWindowSettings.cpp              \
             src/MainWindowShortcuts.cpp             \
+            src/MetadataCache.cpp                   \
+            src/NavigationReplay.cpp                \
             src/OptionsDialog.cpp                   \
             src/RotateDialog.cpp                    \
             src/Shortcuts.cpp                       \
             src/SingleInstanceApplication.cpp       \
+            src/ThumbnailCache.cpp                  \
+            src/ThumbnailGrid.cpp                   \
             src/ZoomModeDropDown.cpp                \
+            src/bench/BenchUtility.cpp              \
             src/plugin-core/capi.cpp                \
+            src/plugin-core/Dither.cpp              \
+            src/plugin-core/FilterProfile.cpp       \
             src/plugin-core/ImageStore.cpp          \
+            src/plugin-core/LuaChunkCache.cpp       \
+            src/plugin-core/ParallelEncoder.cpp     \
+            src/plugin-core/PixelFormat.cpp         \
             src/plugin-core/PluginCoreState.cpp     \
+            src/plugin-core/SaveQueue.cpp           \
+            src/plugin-core/Trace.cpp               \
+            src/plugin-core/Wavefront.cpp           \
             src/serialization/Implementations.cpp   \
             src/serialization/Inlining.cpp          \
             src/serialization/MainSettings.cpp      \
             src/serialization/ShortcutsSettings.cpp \
             src/serialization/WindowState.cpp
 
-HEADERS += src/ClangErrorMessage.hpp         \
+HEADERS += src/AnimationPlayer.h             \
+           src/BackgroundColor.h             \
+           src/BatchProcessor.h              \
+           src/ClangErrorMessage.hpp         \
            src/DirectoryListing.h            \
            src/Enums.h                       \
+           src/FilterHistory.h               \
            src/GenericException.h            \
            src/ImageViewerApplication.h      \
            src/ImageViewport.h               \
            src/LoadedImage.h                 \
            src/MainWindow.h                  \
+           src/MetadataCache.h               \
+           src/NavigationReplay.h            \
            src/Misc.h                        \
            src/OptionsDialog.h               \
            src/Quadrangular.h                \
@@ -72,10 +99,24 @@ HEADERS += src/ClangErrorMessage.hpp         \
            src/SingleInstanceApplication.h   \
            src/stdafx.h                      \
            src/StreamRedirector.h            \
+           src/ThumbnailCache.h              \
+           src/ThumbnailGrid.h               \
            src/ZoomModeDropDown.h            \
+           src/bench/BenchUtility.h          \
            src/plugin-core/capi.h            \
+           src/plugin-core/traversal.h       \
+           src/plugin-core/Dither.h          \
+           src/plugin-core/FilterProfile.h   \
            src/plugin-core/ImageStore.h      \
+           src/plugin-core/LuaChunkCache.h   \
+           src/plugin-core/ParallelEncoder.h \
+           src/plugin-core/ParallelFor.h     \
+           src/plugin-core/PixelFormat.h     \
+           src/plugin-core/PluginCaller.h    \
            src/plugin-core/PluginCoreState.h \
+           src/plugin-core/SaveQueue.h       \
+           src/plugin-core/Trace.h           \
+           src/plugin-core/Wavefront.h       \
            src/plugin-core/Cpp/main.h        \
            src/plugin-core/Lua/main.h
 
@@ -0,0 +1,57 @@
+#-------------------------------------------------
+#
+# borderless-bench: headless filter benchmark runner.
+#
+# Usage: borderless-bench [-n <count>] [--csv <path>] [--json <path>]
+#                         <filter> <image>...
+#
+# The LuaInterpreter and CppInterpreter libraries must be visible to the
+# executable, just like for the viewer.
+#
+#-------------------------------------------------
+
+QT += core gui
+QT -= widgets
+
+TARGET = borderless-bench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+QMAKE_CXXFLAGS += -std=c++11
+INCLUDEPATH += $$PWD/../src
+win32:LIBS += -lpsapi
+unix:LIBS += -lz
+
+SOURCES +=  ../src/bench/BenchUtility.cpp          \
+            ../src/bench/FilterBench.cpp           \
+            ../src/plugin-core/capi.cpp            \
+            ../src/plugin-core/Dither.cpp          \
+            ../src/plugin-core/FilterProfile.cpp   \
+            ../src/plugin-core/ImageStore.cpp      \
+            ../src/plugin-core/LuaChunkCache.cpp   \
+            ../src/plugin-core/ParallelEncoder.cpp \
+            ../src/plugin-core/PixelFormat.cpp     \
+            ../src/plugin-core/PluginCoreState.cpp \
+            ../src/plugin-core/SaveQueue.cpp       \
+            ../src/plugin-core/Trace.cpp           \
+            ../src/plugin-core/Wavefront.cpp
+
+HEADERS +=  ../src/bench/BenchCaller.h             \
+            ../src/bench/BenchUtility.h            \
+            ../src/GenericException.h              \
+            ../src/plugin-core/capi.h              \
+            ../src/plugin-core/traversal.h         \
+            ../src/plugin-core/Dither.h            \
+            ../src/plugin-core/FilterProfile.h     \
+            ../src/plugin-core/ImageStore.h        \
+            ../src/plugin-core/LuaChunkCache.h     \
+            ../src/plugin-core/ParallelEncoder.h   \
+            ../src/plugin-core/ParallelFor.h       \
+            ../src/plugin-core/PixelFormat.h       \
+            ../src/plugin-core/PluginCaller.h      \
+            ../src/plugin-core/PluginCoreState.h   \
+            ../src/plugin-core/SaveQueue.h         \
+            ../src/plugin-core/Trace.h             \
+            ../src/plugin-core/Wavefront.h         \
+            ../src/plugin-core/Cpp/main.h          \
+            ../src/plugin-core/Lua/main.h
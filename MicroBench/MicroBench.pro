@@ -0,0 +1,67 @@
+#-------------------------------------------------
+#
+# borderless-microbench: times the viewer's hot paths in isolation.
+#
+# Usage: borderless-microbench [-n <count>] [--entries <count>]
+#                              [--filter <path>]... [--baseline <path>]
+#                              [--threshold <percent>] [--csv <path>]
+#                              [--json <path>] [<suite>...]
+#
+# A report saved with --json can be passed back as --baseline to a later
+# run. The exit code is 2 if any benchmark regressed past the threshold.
+#
+#-------------------------------------------------
+
+QT += core gui concurrent
+QT -= widgets
+
+TARGET = borderless-microbench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+QMAKE_CXXFLAGS += -std=c++11
+INCLUDEPATH += $$PWD/../src
+win32:LIBS += -lpsapi
+unix:LIBS += -lz
+
+SOURCES +=  ../src/BackgroundColor.cpp             \
+            ../src/DirectoryListing.cpp            \
+            ../src/bench/BenchFixtures.cpp         \
+            ../src/bench/BenchUtility.cpp          \
+            ../src/bench/MicroBench.cpp            \
+            ../src/plugin-core/capi.cpp            \
+            ../src/plugin-core/Dither.cpp          \
+            ../src/plugin-core/FilterProfile.cpp   \
+            ../src/plugin-core/ImageStore.cpp      \
+            ../src/plugin-core/LuaChunkCache.cpp   \
+            ../src/plugin-core/ParallelEncoder.cpp \
+            ../src/plugin-core/PixelFormat.cpp     \
+            ../src/plugin-core/PluginCoreState.cpp \
+            ../src/plugin-core/SaveQueue.cpp       \
+            ../src/plugin-core/Trace.cpp           \
+            ../src/plugin-core/Wavefront.cpp
+
+HEADERS +=  ../src/BackgroundColor.h               \
+            ../src/DirectoryListing.h              \
+            ../src/GenericException.h              \
+            ../src/Misc.h                          \
+            ../src/Quadrangular.h                  \
+            ../src/bench/BenchCaller.h             \
+            ../src/bench/BenchFixtures.h           \
+            ../src/bench/BenchUtility.h            \
+            ../src/plugin-core/capi.h              \
+            ../src/plugin-core/traversal.h         \
+            ../src/plugin-core/Dither.h            \
+            ../src/plugin-core/FilterProfile.h     \
+            ../src/plugin-core/ImageStore.h        \
+            ../src/plugin-core/LuaChunkCache.h     \
+            ../src/plugin-core/ParallelEncoder.h   \
+            ../src/plugin-core/ParallelFor.h       \
+            ../src/plugin-core/PixelFormat.h       \
+            ../src/plugin-core/PluginCaller.h      \
+            ../src/plugin-core/PluginCoreState.h   \
+            ../src/plugin-core/SaveQueue.h         \
+            ../src/plugin-core/Trace.h             \
+            ../src/plugin-core/Wavefront.h         \
+            ../src/plugin-core/Cpp/main.h          \
+            ../src/plugin-core/Lua/main.h
@@ -0,0 +1,37 @@
+#-------------------------------------------------
+#
+# borderless-coretests: checks of the plugin core that don't need an
+# interpreter or a window.
+#
+# Usage: borderless-coretests
+#
+# Exits with a non-zero status if any check fails.
+#
+#-------------------------------------------------
+
+QT += core gui concurrent
+QT -= widgets
+
+TARGET = borderless-coretests
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+QMAKE_CXXFLAGS += -std=c++11
+INCLUDEPATH += $$PWD/../src
+unix:LIBS += -lz
+
+SOURCES +=  ../src/plugin-core/Dither.cpp          \
+            ../src/plugin-core/ImageStore.cpp      \
+            ../src/plugin-core/ParallelEncoder.cpp \
+            ../src/plugin-core/PixelFormat.cpp     \
+            ../src/plugin-core/SaveQueue.cpp       \
+            ../src/tests/PluginCoreTests.cpp
+
+HEADERS +=  ../src/plugin-core/capi.h              \
+            ../src/plugin-core/traversal.h         \
+            ../src/plugin-core/Dither.h            \
+            ../src/plugin-core/ImageStore.h        \
+            ../src/plugin-core/ParallelEncoder.h   \
+            ../src/plugin-core/ParallelFor.h       \
+            ../src/plugin-core/PixelFormat.h       \
+            ../src/plugin-core/SaveQueue.h
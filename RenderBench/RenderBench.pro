@@ -0,0 +1,55 @@
+#-------------------------------------------------
+#
+# borderless-renderbench: times ImageViewport painting offscreen.
+#
+# Usage: borderless-renderbench [-n <count>] [--screen <width>x<height>]
+#                               [--kind pixmap|animation]
+#                               [--baseline <path>] [--threshold <percent>]
+#                               [--csv <path>] [--json <path>]
+#
+# Like the viewer, it needs the serialization code, so run
+# build_serialization.sh first. It uses the offscreen platform plugin unless
+# QT_QPA_PLATFORM says otherwise.
+#
+#-------------------------------------------------
+
+_BOOST_ROOT = $$BOOST_ROOT
+isEmpty(_BOOST_ROOT): _BOOST_ROOT = $$(BOOST_ROOT)
+!isEmpty(_BOOST_ROOT): INCLUDEPATH += $$_BOOST_ROOT
+
+QT += core gui concurrent widgets
+
+TARGET = borderless-renderbench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+QMAKE_CXXFLAGS += -std=c++11
+INCLUDEPATH += $$PWD/../serialization/postsrc $$PWD/../src
+win32:LIBS += -lpsapi
+
+SOURCES +=  ../src/AnimationPlayer.cpp                 \
+            ../src/BackgroundColor.cpp                 \
+            ../src/ImageViewport.cpp                   \
+            ../src/LoadedImage.cpp                     \
+            ../src/MetadataCache.cpp                   \
+            ../src/bench/BenchFixtures.cpp             \
+            ../src/bench/BenchUtility.cpp              \
+            ../src/bench/RenderBench.cpp               \
+            ../src/plugin-core/Trace.cpp               \
+            ../src/serialization/Implementations.cpp   \
+            ../src/serialization/Inlining.cpp          \
+            ../src/serialization/MainSettings.cpp      \
+            ../src/serialization/ShortcutsSettings.cpp \
+            ../src/serialization/WindowState.cpp
+
+HEADERS +=  ../src/AnimationPlayer.h                   \
+            ../src/BackgroundColor.h                   \
+            ../src/ImageViewport.h                     \
+            ../src/LoadedImage.h                       \
+            ../src/MetadataCache.h                     \
+            ../src/Misc.h                              \
+            ../src/Quadrangular.h                      \
+            ../src/bench/BenchFixtures.h               \
+            ../src/bench/BenchUtility.h                \
+            ../src/plugin-core/PluginCaller.h          \
+            ../src/plugin-core/Trace.h
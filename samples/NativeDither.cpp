@@ -0,0 +1,15 @@
+// This example applies the same dither as FSD.cpp, using the built-in
+// dithering engine, which runs the rows in parallel.
+
+#include "borderless.h"
+
+B::Image entry_point(B::Application &app, B::Image img){
+	auto t0 = borderless_clock();
+	
+	B::DitherOptions options(B::DitherAlgorithm::FloydSteinberg, 2);
+	img.dither(options);
+
+	auto t1 = borderless_clock();
+	B::Stream() << "Filter took " << t1 - t0 << " s." << B::msgbox;
+	return img;
+}
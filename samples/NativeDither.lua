@@ -0,0 +1,18 @@
+-- This example applies the same dither as FSD.lua, using the built-in
+-- dithering engine.
+
+is_pure_filter = true
+
+function main(img)
+	local t0 = os.clock()
+	dither_image(
+		img,
+		{
+			algorithm = "floyd-steinberg",
+			levels = 2,
+		}
+	)
+	local t1 = os.clock()
+	show_message_box("Elapsed time: " .. (t1 - t0) .. " s")
+	return img
+end
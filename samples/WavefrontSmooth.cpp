@@ -0,0 +1,41 @@
+// This example applies a causal smoothing filter, where each output pixel
+// depends on the outputs to its left and above it, so it can't simply be run
+// over the rows in parallel. B::parallel_wavefront() splits the image into
+// tiles and runs each tile as soon as the ones it depends on are done.
+
+#include "borderless.h"
+
+B::Image entry_point(B::Application &app, B::Image img){
+	auto t0 = borderless_clock();
+
+	img.convert(B::PixelFormat::RGBA8);
+	int w, h, stride, pitch;
+	u8 *pixels;
+	img.get_pixel_data(w, h, stride, pitch, pixels);
+
+	const int k = 3;
+	B::parallel_wavefront(w, h, { { -1, 0 }, { 0, -1 } }, [&](int x0, int y0, int x1, int y1){
+		for (int y = y0; y < y1; y++){
+			for (int x = x0; x < x1; x++){
+				u8 *pixel = pixels + x * stride + y * pitch;
+				for (int c = 0; c < 3; c++){
+					int sum = pixel[c] * (k + 1),
+						weight = k + 1;
+					if (x){
+						sum += pixel[c - stride] * k;
+						weight += k;
+					}
+					if (y){
+						sum += pixel[c - pitch] * k;
+						weight += k;
+					}
+					pixel[c] = (u8)(sum / weight);
+				}
+			}
+		}
+	}, 64, 64);
+
+	auto t1 = borderless_clock();
+	B::Stream() << "Filter took " << t1 - t0 << " s." << B::msgbox;
+	return img;
+}
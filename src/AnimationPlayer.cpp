@@ -0,0 +1,372 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "AnimationPlayer.h"
+#include "plugin-core/Trace.h"
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+
+// Animations up to this size are decoded once and kept whole.
+static const qint64 resident_budget = 128 << 20;
+// Otherwise, this much is decoded ahead.
+static const qint64 buffer_budget = 64 << 20;
+static const size_t min_buffered_frames = 2;
+static const size_t max_buffered_frames = 32;
+// Past this much lag, playback restarts from the current time instead of
+// catching up.
+static const qint64 max_lag_ms = 1000;
+static const int underrun_retry_ms = 5;
+
+static int get_frame_delay(const QImageReader &reader){
+	auto ret = reader.nextImageDelay();
+	// Like browsers do, treat the tiny delays some encoders write as "unset".
+	return ret <= 10 ? 100 : ret;
+}
+
+static qint64 get_frame_bytes(const QSize &size){
+	return std::max<qint64>((qint64)size.width() * size.height() * 4, 1);
+}
+
+AnimationPlayer::AnimationPlayer(const QString &path):
+		path(path),
+		reader(new QImageReader(path)),
+		loops_left(0),
+		capacity(min_buffered_frames),
+		resident(false),
+		position(0),
+		decoding_finished(false),
+		stop(false),
+		zoom(1),
+		next_serial(0),
+		next_due(0),
+		started(false),
+		shown_frames(0),
+		dropped_frames(0){
+	if (!this->decode_frame(this->current))
+		return;
+	this->loops_left = this->reader->loopCount();
+	this->size = this->reader->size();
+	if (!this->size.isValid())
+		this->size = this->current.image.size();
+
+	auto frame_bytes = get_frame_bytes(this->size);
+	auto frame_count = this->reader->imageCount();
+	if (frame_count > 0 && frame_count * frame_bytes <= resident_budget){
+		this->resident = true;
+		this->capacity = frame_count;
+		this->buffer.push_back(this->current);
+		this->position = 1;
+	}else
+		this->capacity = (size_t)std::max<qint64>(std::min<qint64>(buffer_budget / frame_bytes, max_buffered_frames), min_buffered_frames);
+
+	if (!this->reader->supportsAnimation() || frame_count == 1)
+		this->decoding_finished = true;
+	this->init_playback();
+}
+
+AnimationPlayer::AnimationPlayer(const std::vector<AnimationFrame> &frames):
+		loops_left(-1),
+		capacity(std::max<size_t>(frames.size(), 1)),
+		resident(true),
+		position(1),
+		decoding_finished(true),
+		stop(false),
+		zoom(1),
+		next_serial(0),
+		next_due(0),
+		started(false),
+		shown_frames(0),
+		dropped_frames(0){
+	for (auto &f : frames){
+		Frame frame;
+		frame.image = f.image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+		frame.scale = 1;
+		frame.delay = f.delay;
+		frame.serial = this->next_serial++;
+		this->buffer.push_back(frame);
+	}
+	if (!this->buffer.size())
+		return;
+	this->current = this->buffer.front();
+	this->size = this->current.image.size();
+	this->init_playback();
+}
+
+void AnimationPlayer::init_playback(){
+	this->timer.setSingleShot(true);
+	this->timer.setTimerType(Qt::PreciseTimer);
+	QObject::connect(&this->timer, &QTimer::timeout, [this](){ this->advance(); });
+	// Even once every frame is decoded, the thread is kept to rescale them.
+	if (!this->decoding_finished || this->buffer.size() > 1)
+		this->decoder = std::thread([this](){ this->decode_loop(); });
+}
+
+AnimationPlayer::~AnimationPlayer(){
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stop = true;
+	}
+	this->cv.notify_all();
+	if (this->decoder.joinable())
+		this->decoder.join();
+}
+
+static void scale_frame(AnimationPlayer::Frame &frame, double zoom, qint64 max_bytes){
+	frame.scale = zoom;
+	frame.scaled = QImage();
+	if (zoom == 1)
+		return;
+	QSize size(
+		(int)std::round(frame.image.width() * zoom),
+		(int)std::round(frame.image.height() * zoom)
+	);
+	// Frames that would be too large are scaled while drawing instead.
+	if (size.isEmpty() || get_frame_bytes(size) > max_bytes)
+		return;
+	frame.scaled = frame.image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+}
+
+qint64 AnimationPlayer::get_max_scaled_bytes() const{
+	return (this->resident ? resident_budget : buffer_budget) / (qint64)this->capacity;
+}
+
+bool AnimationPlayer::decode_frame(Frame &frame){
+	TRACE_SCOPE("AnimationPlayer::decode_frame");
+	auto image = this->reader->read();
+	if (image.isNull())
+		return false;
+	frame.image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	frame.delay = get_frame_delay(*this->reader);
+	frame.serial = this->next_serial++;
+	double zoom;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		zoom = this->zoom;
+	}
+	scale_frame(frame, zoom, this->get_max_scaled_bytes());
+	return true;
+}
+
+bool AnimationPlayer::rescale_one(){
+	Frame frame;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto it = std::find_if(this->buffer.begin(), this->buffer.end(), [this](const Frame &f){ return f.scale != this->zoom; });
+		if (it == this->buffer.end())
+			return false;
+		frame.image = it->image;
+		frame.serial = it->serial;
+		frame.scale = this->zoom;
+	}
+	auto zoom = frame.scale;
+	scale_frame(frame, zoom, this->get_max_scaled_bytes());
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (this->zoom != zoom)
+		return true;
+	for (auto &f : this->buffer){
+		if (f.serial != frame.serial)
+			continue;
+		f.scaled = frame.scaled;
+		f.scale = zoom;
+		break;
+	}
+	return true;
+}
+
+void AnimationPlayer::decode_loop(){
+	trace_set_thread_name("AnimationPlayer decoder");
+	while (true){
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->cv.wait(lock, [this](){
+				if (this->stop)
+					return true;
+				if (!this->decoding_finished && this->buffer.size() < this->capacity)
+					return true;
+				for (auto &f : this->buffer)
+					if (f.scale != this->zoom)
+						return true;
+				return false;
+			});
+			if (this->stop)
+				return;
+		}
+		if (this->rescale_one())
+			continue;
+
+		Frame frame;
+		bool ok = this->decode_frame(frame);
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (ok){
+			this->buffer.push_back(frame);
+			// In case imageCount() was short.
+			if (this->resident && this->buffer.size() >= this->capacity)
+				this->decoding_finished = true;
+			continue;
+		}
+		// Resident animations are looped by take_frame().
+		if (this->resident || !this->loops_left){
+			this->decoding_finished = true;
+			continue;
+		}
+		if (this->loops_left > 0)
+			this->loops_left--;
+		// QImageReader can't seek back, so start over with a new one.
+		this->reader.reset(new QImageReader(this->path));
+		if (!this->reader->canRead())
+			this->decoding_finished = true;
+	}
+}
+
+// Returns 1 if a frame was taken, 0 if the next frame hasn't been decoded yet,
+// and -1 if the animation is over.
+int AnimationPlayer::take_frame(Frame &dst){
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (this->resident){
+		if (this->position >= this->buffer.size()){
+			if (!this->decoding_finished)
+				return 0;
+			if (!this->loops_left || this->buffer.size() < 2)
+				return -1;
+			if (this->loops_left > 0)
+				this->loops_left--;
+			this->position = 0;
+		}
+		dst = this->buffer[this->position++];
+		return 1;
+	}
+	if (!this->buffer.size())
+		return this->decoding_finished ? -1 : 0;
+	dst = std::move(this->buffer.front());
+	this->buffer.pop_front();
+	this->cv.notify_all();
+	return 1;
+}
+
+void AnimationPlayer::start(){
+	if (this->started || !this->is_valid())
+		return;
+	this->started = true;
+	this->clock.start();
+	this->next_due = this->current.delay;
+	this->timer.start(this->current.delay);
+}
+
+void AnimationPlayer::advance(){
+	auto now = this->clock.elapsed();
+	if (now - this->next_due > max_lag_ms)
+		this->next_due = now;
+	// Take frames until one is due that's still current. Frames whose time
+	// has already passed are dropped, unless there's nothing after them.
+	Frame frame;
+	bool got_frame = false,
+		finished = false;
+	unsigned dropped = 0;
+	while (this->next_due <= now){
+		Frame candidate;
+		auto result = this->take_frame(candidate);
+		if (result <= 0){
+			finished = result < 0;
+			break;
+		}
+		if (got_frame)
+			dropped++;
+		frame = std::move(candidate);
+		got_frame = true;
+		this->next_due += frame.delay;
+	}
+	if (!got_frame){
+		if (!finished)
+			this->timer.start(underrun_retry_ms);
+		return;
+	}
+	this->current = std::move(frame);
+	this->shown_frames++;
+	if (dropped){
+		this->dropped_frames += dropped;
+		qDebug() << "AnimationPlayer: dropped" << dropped << "frames," << this->dropped_frames << "of" << this->shown_frames + this->dropped_frames << "so far.";
+	}
+	if (this->frame_changed)
+		this->frame_changed();
+	this->timer.start((int)std::max<qint64>(this->next_due - now, 0));
+}
+
+namespace{
+
+// The frames of a resident animation, shared with the player.
+class BufferedFrames : public FrameSource{
+	std::vector<AnimationFrame> frames;
+	size_t next;
+public:
+	BufferedFrames(std::vector<AnimationFrame> &&frames): frames(std::move(frames)), next(0){}
+	int get_count() const override{
+		return (int)this->frames.size();
+	}
+	bool read(AnimationFrame &dst) override{
+		if (this->next >= this->frames.size())
+			return false;
+		dst = this->frames[this->next];
+		this->frames[this->next++].image = QImage();
+		return true;
+	}
+};
+
+// Decodes the file again, a frame at a time.
+class DecodedFrames : public FrameSource{
+	QImageReader reader;
+	int count;
+public:
+	DecodedFrames(const QString &path): reader(path){
+		this->count = this->reader.imageCount();
+		if (this->count > 0)
+			return;
+		// Not every format knows without decoding.
+		QImageReader counter(path);
+		for (this->count = 0; !counter.read().isNull(); this->count++);
+	}
+	int get_count() const override{
+		return this->count;
+	}
+	bool read(AnimationFrame &dst) override{
+		dst.image = this->reader.read();
+		if (dst.image.isNull())
+			return false;
+		dst.delay = get_frame_delay(this->reader);
+		return true;
+	}
+};
+
+}
+
+std::unique_ptr<FrameSource> AnimationPlayer::open_frames(){
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->resident && this->decoding_finished){
+			std::vector<AnimationFrame> frames;
+			for (auto &f : this->buffer){
+				AnimationFrame frame;
+				frame.image = f.image;
+				frame.delay = f.delay;
+				frames.push_back(frame);
+			}
+			return std::unique_ptr<FrameSource>(new BufferedFrames(std::move(frames)));
+		}
+	}
+	// Rather than wait for the decoder to get to every frame.
+	return std::unique_ptr<FrameSource>(new DecodedFrames(this->path));
+}
+
+void AnimationPlayer::set_zoom(double zoom){
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->zoom == zoom)
+			return;
+		this->zoom = zoom;
+	}
+	this->cv.notify_all();
+}
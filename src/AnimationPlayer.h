@@ -0,0 +1,109 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef ANIMATIONPLAYER_H
+#define ANIMATIONPLAYER_H
+
+#include <QString>
+#include <QImage>
+#include <QImageReader>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <vector>
+#include "plugin-core/PluginCaller.h"
+
+// Plays an animated image. Frames are decoded ahead of time on a thread of
+// its own into a bounded buffer, and scaled there to the zoom they'll be
+// displayed at, so the GUI thread only ever draws them. Animations that fit
+// in memory whole are decoded only once. When the display falls behind, late
+// frames are dropped to keep to the timing of the animation.
+class AnimationPlayer{
+public:
+	struct Frame{
+		QImage image;
+		// image scaled by scale, or null.
+		QImage scaled;
+		double scale;
+		int delay;
+		unsigned serial;
+	};
+private:
+	QString path;
+	QSize size;
+	std::unique_ptr<QImageReader> reader;
+	int loops_left;
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<Frame> buffer;
+	size_t capacity;
+	// If set, every frame fits in the buffer, and frames are never evicted.
+	bool resident;
+	// Index into buffer of the next frame to show, if resident.
+	size_t position;
+	bool decoding_finished;
+	bool stop;
+	double zoom;
+	unsigned next_serial;
+	std::thread decoder;
+
+	// GUI thread only.
+	Frame current;
+	QTimer timer;
+	QElapsedTimer clock;
+	qint64 next_due;
+	bool started;
+	unsigned shown_frames,
+		dropped_frames;
+	std::function<void()> frame_changed;
+
+	void init_playback();
+	bool decode_frame(Frame &);
+	bool rescale_one();
+	void decode_loop();
+	qint64 get_max_scaled_bytes() const;
+	int take_frame(Frame &);
+	void advance();
+public:
+	AnimationPlayer(const QString &path);
+	// Plays frames that are already decoded, e.g. the output of a filter.
+	// Nothing else holds them, so they're all kept, whatever their size.
+	AnimationPlayer(const std::vector<AnimationFrame> &);
+	~AnimationPlayer();
+	bool is_valid() const{
+		return !this->current.image.isNull();
+	}
+	QSize get_size() const{
+		return this->size;
+	}
+	// Called on the GUI thread whenever a new frame should be shown.
+	void set_frame_changed_callback(const std::function<void()> &f){
+		this->frame_changed = f;
+	}
+	void start();
+	void set_zoom(double);
+	const Frame &get_current_frame() const{
+		return this->current;
+	}
+	// Every frame, unscaled. Unless the animation is resident, they're
+	// decoded again as they're read, on the reading thread.
+	std::unique_ptr<FrameSource> open_frames();
+	unsigned get_shown_frames() const{
+		return this->shown_frames;
+	}
+	unsigned get_dropped_frames() const{
+		return this->dropped_frames;
+	}
+};
+
+#endif
@@ -0,0 +1,46 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "BackgroundColor.h"
+#include "plugin-core/Trace.h"
+
+QColor get_average_color(QImage src){
+	if (src.depth() < 32)
+		src = src.convertToFormat(QImage::Format_ARGB32);
+	quint64 avg[3] = {0};
+	unsigned pixel_count=0;
+	for (auto y = src.height() * 0; y < src.height(); y++){
+		const uchar *p = src.constScanLine(y);
+		for (auto x = src.width() * 0; x < src.width(); x++){
+			avg[0] += quint64(p[2]) * quint64(p[3]) / 255;
+			avg[1] += quint64(p[1]) * quint64(p[3]) / 255;
+			avg[2] += quint64(p[0]) * quint64(p[3]) / 255;
+			p += 4;
+			pixel_count++;
+		}
+	}
+	// The header may have been fine and the data not.
+	if (pixel_count)
+		for (int a = 0; a < 3; a++)
+			avg[a] /= pixel_count;
+	return QColor(avg[0], avg[1], avg[2]);
+}
+
+QColor background_color_parallel_function(QImage img){
+	TRACE_SCOPE("background_color_parallel_function");
+	QColor avg = get_average_color(img),
+		negative = avg,
+		background;
+	negative.setRedF(1 - negative.redF());
+	negative.setGreenF(1 - negative.greenF());
+	negative.setBlueF(1 - negative.blueF());
+	if (negative.saturationF() <= .05 && negative.valueF() >= .45 && negative.valueF() <= .55)
+		background = Qt::white;
+	else
+		background = negative;
+	return background;
+}
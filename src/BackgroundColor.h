@@ -0,0 +1,20 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef BACKGROUNDCOLOR_H
+#define BACKGROUNDCOLOR_H
+
+#include <QColor>
+#include <QImage>
+
+// Mean of every pixel, premultiplied by alpha.
+QColor get_average_color(QImage);
+// The color to put behind an image: the negative of its average color, or
+// white where the negative would be a flat middle gray.
+QColor background_color_parallel_function(QImage);
+
+#endif
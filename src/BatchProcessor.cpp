@@ -0,0 +1,258 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "BatchProcessor.h"
+#include "DirectoryListing.h"
+#include "plugin-core/PluginCoreState.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+
+namespace{
+
+struct PendingEncode{
+	QFuture<QString> result;
+	size_t bytes;
+};
+
+}
+
+static QImage decode(const QString &path){
+	return QImage(path);
+}
+
+namespace{
+
+// The images of a directory, as the frames of a batch. A few are decoded
+// ahead on the thread pool. Images that can't be decoded are passed to
+// on_error and skipped.
+class ListingSource : public FrameSource{
+	DirectoryListing &listing;
+	size_t total,
+		lookahead;
+	std::deque<QFuture<QImage>> decoding;
+	size_t next_decode,
+		next_read;
+	int frames_read;
+	std::function<void(const QString &)> on_error;
+	std::vector<QString> paths;
+public:
+	std::uint64_t pixels;
+	ListingSource(DirectoryListing &listing, size_t lookahead, const std::function<void(const QString &)> &on_error):
+		listing(listing),
+		total(listing.size()),
+		lookahead(lookahead),
+		next_decode(0),
+		next_read(0),
+		frames_read(0),
+		on_error(on_error),
+		paths(total),
+		pixels(0){}
+	~ListingSource(){
+		for (auto &f : this->decoding)
+			f.waitForFinished();
+	}
+	int get_count() const override{
+		return (int)this->total;
+	}
+	bool read(AnimationFrame &frame) override{
+		while (this->next_read < this->total){
+			while (this->next_decode < this->total && this->decoding.size() < this->lookahead)
+				this->decoding.push_back(QtConcurrent::run(decode, this->listing[this->next_decode++]));
+			auto path = this->listing[this->next_read++];
+			auto image = this->decoding.front().result();
+			this->decoding.pop_front();
+			if (image.isNull()){
+				this->on_error(path);
+				continue;
+			}
+			this->pixels += (std::uint64_t)image.width() * image.height();
+			this->paths[this->frames_read++] = path;
+			frame.image = image;
+			frame.delay = 0;
+			return true;
+		}
+		return false;
+	}
+	// The path of the image that was read as the given frame.
+	const QString &get_path(int index) const{
+		return this->paths[index];
+	}
+};
+
+}
+
+static size_t get_image_size(const QImage &image){
+	return (size_t)image.bytesPerLine() * image.height();
+}
+
+// Returns an error message, or an empty string on success.
+static QString encode(const QImage &image, const QString &path){
+	if (!image.save(path))
+		return "Can't write " + path;
+	return QString();
+}
+
+// Inputs that can't be written back in their own format (e.g. SVG) are saved
+// as PNG.
+static QString get_output_path(const QString &output_directory, const QString &input_path){
+	QFileInfo info(input_path);
+	auto suffix = info.suffix().toLower().toUtf8();
+	auto name = info.fileName();
+	if (!QImageWriter::supportedImageFormats().contains(suffix))
+		name = info.completeBaseName() + ".png";
+	return QDir(output_directory).filePath(name);
+}
+
+QString BatchProcessor::Result::to_string() const{
+	QString ret = QString("%1 images processed").arg(this->processed);
+	if (this->failed)
+		ret += QString(", %1 failed").arg(this->failed);
+	if (this->skipped)
+		ret += QString(", %1 produced no image").arg(this->skipped);
+	ret += QString(" in %1 s").arg(this->seconds, 0, 'f', 2);
+	if (this->canceled)
+		ret += " (canceled)";
+	ret += ".\n";
+	if (this->seconds > 0)
+		ret += QString("Throughput: %1 images/s, %2 megapixels/s.\n")
+			.arg(this->processed / this->seconds, 0, 'f', 2)
+			.arg(this->input_pixels * 1e-6 / this->seconds, 0, 'f', 2);
+	for (auto &error : this->errors)
+		ret += '\n' + error;
+	return ret;
+}
+
+// Messages from a filter while it runs on an image go to that image's
+// FrameRun; these are the ones from outside of any image.
+void BatchProcessor::show_message_box(const QString &, const QString &message, bool is_error){
+	if (is_error)
+		this->messages << message;
+}
+
+// Only C++ filters have compiler errors, and they always run on the calling
+// thread.
+void BatchProcessor::show_compiler_error(const QString &message){
+	this->compiler_error = true;
+	this->messages << message;
+}
+
+BatchProcessor::Result BatchProcessor::run(const QString &filter, DirectoryListing &listing, const QString &output_directory, const progress_callback &callback){
+	Result ret;
+	QElapsedTimer timer;
+	timer.start();
+	if (!QDir().mkpath(output_directory)){
+		ret.errors << "Can't create " + output_directory;
+		return ret;
+	}
+
+	auto total = listing.size();
+	auto lookahead = (size_t)std::max(QThread::idealThreadCount(), 1);
+	// Guards ret, encoding, bytes_in_flight, and done, which images running
+	// on other threads update.
+	std::mutex mutex;
+	std::deque<PendingEncode> encoding;
+	size_t bytes_in_flight = 0,
+		done = 0;
+	std::atomic<bool> canceled(false);
+	auto caller_thread = QThread::currentThread();
+
+	auto finish_encode = [&](std::unique_lock<std::mutex> &lock){
+		auto front = encoding.front();
+		encoding.pop_front();
+		lock.unlock();
+		auto error = front.result.result();
+		lock.lock();
+		if (error.size()){
+			ret.failed++;
+			ret.errors << error;
+		}else
+			ret.processed++;
+		bytes_in_flight -= front.bytes;
+	};
+
+	// The progress callback may only be called from the thread that started
+	// the batch. Returns false if the batch should stop.
+	auto image_done = [&](std::unique_lock<std::mutex> &lock){
+		auto n = ++done;
+		lock.unlock();
+		if (callback && QThread::currentThread() == caller_thread && !callback(n, total))
+			canceled = true;
+		return !canceled;
+	};
+
+	ListingSource source(listing, lookahead, [&](const QString &path){
+		std::unique_lock<std::mutex> lock(mutex);
+		ret.failed++;
+		ret.errors << "Can't read " + QFileInfo(path).fileName();
+		image_done(lock);
+	});
+
+	auto sink = [&](PluginCoreState::FrameRun &run, AnimationFrame &frame){
+		auto &path = source.get_path(run.index);
+		std::unique_lock<std::mutex> lock(mutex);
+		if (this->compiler_error){
+			run.failed = true;
+			for (auto &message : this->messages)
+				run.messages.push_back(message);
+			this->messages.clear();
+		}
+		if (run.failed){
+			ret.failed++;
+			QStringList messages;
+			for (auto &message : run.messages)
+				messages << message;
+			ret.errors << QFileInfo(path).fileName() + ": " + messages.join('\n');
+		}else if (frame.image.isNull())
+			ret.skipped++;
+		else{
+			PendingEncode pending;
+			pending.bytes = get_image_size(frame.image);
+			pending.result = QtConcurrent::run(encode, frame.image, get_output_path(output_directory, path));
+			encoding.push_back(pending);
+			bytes_in_flight += pending.bytes;
+		}
+		// Informational messages would otherwise show up once per image.
+		run.messages.clear();
+		frame.image = QImage();
+		while (encoding.size() && (encoding.size() > lookahead || bytes_in_flight > max_bytes_in_flight))
+			finish_encode(lock);
+		// Every other image would fail the same way.
+		if (this->compiler_error)
+			return false;
+		return image_done(lock);
+	};
+
+	// The state is shared with the windows, so the caller is put back
+	// afterwards. Images the filter creates are unloaded after every image.
+	auto previous_caller = this->state->set_current_caller(this);
+	this->messages.clear();
+	try{
+		this->state->execute_batch(filter, source, sink);
+	}catch (std::exception &e){
+		ret.errors << e.what();
+	}
+	this->state->set_current_caller(previous_caller);
+	ret.errors << this->messages;
+	ret.input_pixels = source.pixels;
+	ret.canceled = canceled;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (encoding.size())
+		finish_encode(lock);
+	ret.seconds = timer.nsecsElapsed() * 1e-9;
+	return ret;
+}
@@ -0,0 +1,59 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef BATCHPROCESSOR_H
+#define BATCHPROCESSOR_H
+
+#include "plugin-core/PluginCaller.h"
+#include <QStringList>
+#include <cstdint>
+#include <functional>
+
+class PluginCoreState;
+class DirectoryListing;
+
+// Runs a filter over every image of a directory and saves whatever the filter
+// displays to an output directory, under the same file name. Images are
+// decoded ahead of the filter and encoded behind it on the global thread pool.
+// The images go through the filter like the frames of an animation: a pure
+// Lua filter runs on several of them at once, anything else on one at a time
+// on the calling thread. The number of images in flight is bounded, and so is
+// the memory they use.
+class BatchProcessor : public PluginCaller{
+public:
+	struct Result{
+		size_t processed,
+			failed,
+			skipped;
+		std::uint64_t input_pixels;
+		double seconds;
+		QStringList errors;
+		bool canceled;
+		Result(): processed(0), failed(0), skipped(0), input_pixels(0), seconds(0), canceled(false){}
+		QString to_string() const;
+	};
+	// Called after every image. Returning false cancels the batch.
+	typedef std::function<bool(size_t done, size_t total)> progress_callback;
+private:
+	PluginCoreState *state;
+	QStringList messages;
+	bool compiler_error;
+
+	static const size_t max_bytes_in_flight = 512 << 20;
+public:
+	BatchProcessor(PluginCoreState &state): state(&state), compiler_error(false){}
+	Result run(const QString &filter, DirectoryListing &input, const QString &output_directory, const progress_callback & = progress_callback());
+	// Every image runs as a frame, which has its own input and output.
+	QImage get_image() const override{
+		return QImage();
+	}
+	void display_filtered_image(const QImage &) override{}
+	void show_message_box(const QString &title, const QString &message, bool is_error) override;
+	void show_compiler_error(const QString &message) override;
+};
+
+#endif
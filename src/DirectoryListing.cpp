@@ -6,6 +6,7 @@ Distributed under a permissive license. See COPYING.txt for details.
 */
 
 #include "DirectoryListing.h"
+#include "plugin-core/Trace.h"
 #include <QDir>
 #include <QtConcurrent/QtConcurrentRun>
 #include <algorithm>
@@ -32,7 +33,13 @@ bool strcmpci(const QString &a, const QString &b){
 	return a.compare(a, b, CS) < 0;
 }
 
+void sort_entries(QStringList &entries){
+	auto f = strcmpci<platform_case>;
+	std::sort(entries.begin(), entries.end(), f);
+}
+
 QStringList get_entries(QString path){
+	TRACE_SCOPE("DirectoryListing get_entries");
 	QDir directory(path);
 	directory.setFilter(QDir::Files | QDir::Hidden);
 	directory.setSorting(QDir::Name);
@@ -41,8 +48,7 @@ QStringList get_entries(QString path){
 		filters << p;
 	directory.setNameFilters(filters);
 	auto ret = directory.entryList();
-	auto f = strcmpci<platform_case>;
-	std::sort(ret.begin(), ret.end(), f);
+	sort_entries(ret);
 	return ret;
 }
 
@@ -84,13 +90,12 @@ QString DirectoryListing::operator[](size_t i) const{
 }
 
 bool DirectoryListing::find(size_t &dst, const QString &s) const{
+	TRACE_SCOPE("DirectoryListing::find");
 	auto f = strcmpci<platform_case>;
 	auto entries = this->entries.result();
 	auto it = std::lower_bound(entries.begin(), entries.end(), s, f);
 	if (it == entries.end())
 		return false;
-	qDebug() << s;
-	qDebug() << *it;
 	if (f(s, *it))
 		return false;
 	dst = it - entries.begin();
@@ -14,6 +14,8 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include <vector>
 
 bool check_and_clean_path(QString &path);
+// Sorts file names in the order listings are presented in.
+void sort_entries(QStringList &);
 
 class DirectoryIterator;
 
@@ -44,6 +46,10 @@ public:
 			return true;
 		return this->in_position = this->dl->find(this->position, name);
 	}
+	bool go_to(const QString &name){
+		this->in_position = false;
+		return this->advance_to(name);
+	}
 	QString operator*() const{
 		return (*this->dl)[this->position];
 	}
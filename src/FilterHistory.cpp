@@ -0,0 +1,195 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "FilterHistory.h"
+#include <QDir>
+#include <QtConcurrent/QtConcurrentRun>
+#include <cstring>
+#include <algorithm>
+
+// Favor speed over ratio; XOR deltas are mostly zeroes anyway.
+static const int compression_level = 1;
+
+struct SerializedImageHeader{
+	int w, h, format, pitch;
+};
+
+static size_t get_image_size(const QImage &image){
+	return (size_t)image.bytesPerLine() * image.height();
+}
+
+static bool same_geometry(const QImage &a, const QImage &b){
+	return a.size() == b.size() && a.format() == b.format() && a.bytesPerLine() == b.bytesPerLine();
+}
+
+static QByteArray serialize(const QImage &image){
+	SerializedImageHeader header = { image.width(), image.height(), (int)image.format(), image.bytesPerLine() };
+	QByteArray buffer;
+	buffer.reserve((int)(sizeof(header) + get_image_size(image)));
+	buffer.append((const char *)&header, sizeof(header));
+	buffer.append((const char *)image.constBits(), (int)get_image_size(image));
+	return qCompress(buffer, compression_level);
+}
+
+static QImage deserialize(const QByteArray &data){
+	auto buffer = qUncompress(data);
+	SerializedImageHeader header;
+	if ((size_t)buffer.size() < sizeof(header))
+		return QImage();
+	memcpy(&header, buffer.constData(), sizeof(header));
+	if ((size_t)buffer.size() != sizeof(header) + (size_t)header.pitch * header.h)
+		return QImage();
+	QImage ret(header.w, header.h, (QImage::Format)header.format);
+	auto src = (const uchar *)buffer.constData() + sizeof(header);
+	auto row_size = std::min(header.pitch, ret.bytesPerLine());
+	for (int y = 0; y < header.h; y++)
+		memcpy(ret.scanLine(y), src + (size_t)y * header.pitch, row_size);
+	return ret;
+}
+
+static void xor_bytes(uchar *dst, const uchar *a, const uchar *b, size_t n){
+	for (size_t i = 0; i < n; i++)
+		dst[i] = a[i] ^ b[i];
+}
+
+static QByteArray compute_delta(const QImage &a, const QImage &b){
+	auto n = get_image_size(a);
+	QByteArray buffer((int)n, Qt::Uninitialized);
+	xor_bytes((uchar *)buffer.data(), a.constBits(), b.constBits(), n);
+	return qCompress(buffer, compression_level);
+}
+
+static QImage apply_delta(const QImage &image, const QByteArray &data){
+	auto delta = qUncompress(data);
+	auto n = get_image_size(image);
+	if ((size_t)delta.size() != n)
+		return QImage();
+	QImage ret(image.size(), image.format());
+	if (ret.bytesPerLine() != image.bytesPerLine())
+		return QImage();
+	ret.setColorTable(image.colorTable());
+	xor_bytes(ret.bits(), image.constBits(), (const uchar *)delta.constData(), n);
+	return ret;
+}
+
+QByteArray FilterHistory::Blob::get(){
+	if (!this->file)
+		return this->data.result();
+	if (!this->file->open())
+		return QByteArray();
+	this->file->seek(0);
+	auto ret = this->file->readAll();
+	this->file->close();
+	return ret;
+}
+
+size_t FilterHistory::Blob::get_memory_usage() const{
+	// Default-constructed futures are canceled, and hold no result.
+	if (this->file || this->data.isCanceled() || !this->data.isFinished())
+		return 0;
+	return this->data.result().size();
+}
+
+bool FilterHistory::Blob::spill(){
+	if (this->file || this->data.isCanceled() || !this->data.isFinished())
+		return false;
+	std::shared_ptr<QTemporaryFile> file(new QTemporaryFile(QDir::tempPath() + "/Borderless-history-XXXXXX"));
+	if (!file->open())
+		return false;
+	auto data = this->data.result();
+	if (file->write(data) != data.size())
+		return false;
+	file->close();
+	this->file = file;
+	this->data = QFuture<QByteArray>();
+	return true;
+}
+
+FilterHistory::Link FilterHistory::create_link(const QImage &older, const QImage &newer){
+	Link ret;
+	ret.is_delta = same_geometry(older, newer);
+	if (ret.is_delta)
+		ret.blobs[0] = QtConcurrent::run([older, newer](){ return compute_delta(older, newer); });
+	else{
+		ret.blobs[0] = QtConcurrent::run([older](){ return serialize(older); });
+		ret.blobs[1] = QtConcurrent::run([newer](){ return serialize(newer); });
+	}
+	return ret;
+}
+
+void FilterHistory::clear(){
+	this->links.clear();
+	this->current = QImage();
+	this->position = 0;
+}
+
+void FilterHistory::reset(const QImage &image){
+	this->clear();
+	this->current = image;
+}
+
+void FilterHistory::push(const QImage &image){
+	if (this->is_empty()){
+		this->reset(image);
+		return;
+	}
+	this->links.resize(this->position);
+	this->links.push_back(create_link(this->current, image));
+	this->position++;
+	this->current = image;
+	this->enforce_limits();
+}
+
+void FilterHistory::enforce_limits(){
+	while (this->links.size() >= max_states){
+		this->links.pop_front();
+		this->position--;
+	}
+	size_t usage = 0;
+	for (auto &link : this->links)
+		for (auto &blob : link.blobs)
+			usage += blob.get_memory_usage();
+	// Links that are still being compressed aren't counted. They'll be
+	// accounted for on the next push.
+	for (size_t distance = this->links.size(); distance-- && usage > this->memory_budget;){
+		size_t candidates[] = {
+			this->position - 1 - distance,
+			this->position + distance,
+		};
+		for (auto i : candidates){
+			if (i >= this->links.size())
+				continue;
+			for (auto &blob : this->links[i].blobs){
+				auto size = blob.get_memory_usage();
+				if (size && blob.spill())
+					usage -= size;
+			}
+		}
+	}
+}
+
+QImage FilterHistory::undo(){
+	if (!this->can_undo())
+		return this->current;
+	auto &link = this->links[this->position - 1];
+	auto image = link.is_delta ? apply_delta(this->current, link.blobs[0].get()) : deserialize(link.blobs[0].get());
+	if (image.isNull())
+		return this->current;
+	this->position--;
+	return this->current = image;
+}
+
+QImage FilterHistory::redo(){
+	if (!this->can_redo())
+		return this->current;
+	auto &link = this->links[this->position];
+	auto image = link.is_delta ? apply_delta(this->current, link.blobs[0].get()) : deserialize(link.blobs[1].get());
+	if (image.isNull())
+		return this->current;
+	this->position++;
+	return this->current = image;
+}
@@ -0,0 +1,73 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef FILTERHISTORY_H
+#define FILTERHISTORY_H
+
+#include <QImage>
+#include <QByteArray>
+#include <QFuture>
+#include <QTemporaryFile>
+#include <deque>
+#include <memory>
+
+// The states a window has gone through as filters were applied to it. Only
+// the current state is kept as an image. Consecutive states are linked by the
+// compressed XOR of the two (or by both images, if their geometries differ),
+// from which either state can be rebuilt from the other, so undoing and
+// redoing only cost one decompression. Links are compressed in the background,
+// and once they exceed the memory budget, those farthest from the current
+// state are moved to temporary files.
+class FilterHistory{
+	class Blob{
+		QFuture<QByteArray> data;
+		std::shared_ptr<QTemporaryFile> file;
+	public:
+		Blob(){}
+		Blob(const QFuture<QByteArray> &data): data(data){}
+		QByteArray get();
+		size_t get_memory_usage() const;
+		bool spill();
+	};
+	struct Link{
+		bool is_delta;
+		// For deltas only the first blob is used. Otherwise, the first holds
+		// the older state and the second the newer.
+		Blob blobs[2];
+	};
+	std::deque<Link> links;
+	QImage current;
+	size_t position;
+	size_t memory_budget;
+
+	static Link create_link(const QImage &older, const QImage &newer);
+	void enforce_limits();
+public:
+	static const size_t default_memory_budget = 256 << 20;
+	static const size_t max_states = 64;
+
+	FilterHistory(size_t memory_budget = default_memory_budget): position(0), memory_budget(memory_budget){}
+	void clear();
+	bool is_empty() const{
+		return this->current.isNull();
+	}
+	// Starts a new history at the given state.
+	void reset(const QImage &image);
+	// Makes the given image the current state, discarding any states that
+	// could have been redone.
+	void push(const QImage &image);
+	bool can_undo() const{
+		return this->position > 0;
+	}
+	bool can_redo() const{
+		return this->position < this->links.size();
+	}
+	QImage undo();
+	QImage redo();
+};
+
+#endif
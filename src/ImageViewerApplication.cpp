@@ -12,27 +12,49 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include "Misc.h"
 #include "OptionsDialog.h"
 #include "GenericException.h"
+#include "BatchProcessor.h"
+#include "NavigationReplay.h"
+#include "plugin-core/Trace.h"
 #include <QShortcut>
 #include <QMessageBox>
 #include <sstream>
+#include <algorithm>
 #include <cassert>
+#include <iostream>
 #include <QDir>
 #include <QStandardPaths>
+#include <QFileSystemWatcher>
+#include <QFileInfo>
+#include <QFileDialog>
+#include <QProgressDialog>
 
 ImageViewerApplication::ImageViewerApplication(int &argc, char **argv, const QString &unique_name):
 		SingleInstanceApplication(argc, argv, unique_name),
 		do_not_save(false),
+		replaying(false),
 		tray_icon(QIcon(":/icon16.png"), this){
+	TRACE_SCOPE("ImageViewerApplication::ImageViewerApplication");
+	if (this->args.size() >= 3 && this->args[1] == "--replay"){
+		this->replaying = true;
+		this->do_not_save = true;
+	}
 	if (!this->restore_settings())
 		this->settings = std::make_shared<MainSettings>();
 	this->reset_tray_menu();
 	this->conditional_tray_show();
+	// The replay closes windows as it goes, and is started by main() once
+	// the application is up.
+	if (this->replaying){
+		this->setQuitOnLastWindowClosed(false);
+		return;
+	}
 	this->setQuitOnLastWindowClosed(!this->settings->get_keep_application_in_background());
 	ImageViewerApplication::new_instance(this->args);
 	if (!this->windows.size() && !this->settings->get_keep_application_in_background())
 		throw NoWindowsException();
 	
 	this->setup_slots();
+	this->update_filter_precompilation();
 }
 
 ImageViewerApplication::~ImageViewerApplication(){
@@ -41,6 +63,12 @@ ImageViewerApplication::~ImageViewerApplication(){
 }
 
 void ImageViewerApplication::new_instance(const QStringList &args){
+	TRACE_SCOPE("ImageViewerApplication::new_instance");
+	// Borderless --batch <filter> <input directory> [<output directory>]
+	if (args.size() >= 4 && args[1] == "--batch"){
+		this->run_batch(this->find_filter(args[2]), args[3], args.size() >= 5 ? args[4] : QString());
+		return;
+	}
 	sharedp_t p(new MainWindow(*this, args));
 	if (!p->is_null())
 		this->add_window(p);
@@ -167,6 +195,7 @@ public:
 };
 
 void ImageViewerApplication::save_settings(bool with_state){
+	TRACE_SCOPE("ImageViewerApplication::save_settings");
 	if (this->do_not_save)
 		return;
 	QString path = this->get_config_filename();
@@ -193,8 +222,43 @@ void ImageViewerApplication::restore_current_state(const ApplicationState &windo
 
 void ImageViewerApplication::restore_current_windows(const std::vector<std::shared_ptr<WindowState>> &window_states){
 	this->windows.clear();
-	for (auto &state : window_states)
-		this->add_window(std::make_shared<MainWindow>(*this, state));
+	this->pending_restores.clear();
+	for (auto &state : window_states){
+		auto window = std::make_shared<MainWindow>(*this, state);
+		this->add_window(window);
+		this->pending_restores.push_back(window);
+	}
+	// Every window is up with its saved geometry before any image is opened,
+	// so the first one is usable just as soon no matter how many there are.
+	QTimer::singleShot(0, this, [this](){ this->restore_next_window(); });
+}
+
+// Opens the image of one restored window per pass through the event loop,
+// so the windows already restored stay responsive. The window with focus
+// goes first, then any that can be seen. Decoding itself happens on the
+// thread pool, so the images of several windows are decoded at once.
+void ImageViewerApplication::restore_next_window(){
+	TRACE_SCOPE("ImageViewerApplication::restore_next_window");
+	auto &pending = this->pending_restores;
+	pending.erase(std::remove_if(pending.begin(), pending.end(), [](const std::weak_ptr<MainWindow> &p){ return p.expired(); }), pending.end());
+	if (!pending.size())
+		return;
+	auto get_priority = [](const MainWindow &window){
+		if (window.isActiveWindow())
+			return 0;
+		if (window.isVisible() && !window.isMinimized())
+			return 1;
+		return 2;
+	};
+	auto best = pending.begin();
+	for (auto it = pending.begin(); it != pending.end(); ++it)
+		if (get_priority(*it->lock()) < get_priority(*best->lock()))
+			best = it;
+	auto window = best->lock();
+	pending.erase(best);
+	window->load_restored_image();
+	if (pending.size())
+		QTimer::singleShot(0, this, [this](){ this->restore_next_window(); });
 }
 
 std::shared_ptr<QMenu> ImageViewerApplication::build_context_menu(MainWindow *caller){
@@ -215,6 +279,7 @@ std::shared_ptr<QMenu> ImageViewerApplication::build_context_menu(MainWindow *ca
 void ImageViewerApplication::set_option_values(MainSettings &settings){
 	*this->settings = settings;
 	this->setQuitOnLastWindowClosed(!this->settings->get_keep_application_in_background());
+	this->update_filter_precompilation();
 }
 
 void ImageViewerApplication::show_options(){
@@ -232,6 +297,7 @@ void ImageViewerApplication::quit_and_discard_state(){
 }
 
 bool ImageViewerApplication::restore_settings(){
+	TRACE_SCOPE("ImageViewerApplication::restore_settings");
 	QString path = this->get_config_filename();
 	if (path.isNull())
 		return false;
@@ -259,7 +325,7 @@ bool ImageViewerApplication::restore_settings(){
 	if (settings->shortcuts)
 		this->shortcuts.restore_settings(*settings->shortcuts);
 
-	if (settings->state)
+	if (settings->state && !this->replaying)
 		this->restore_current_state(*settings->state);
 
 	return true;
@@ -356,8 +422,9 @@ QStringList ImageViewerApplication::get_user_filter_list(){
 	return directory.entryList();
 }
 
-QMenu &ImageViewerApplication::get_lua_submenu(MainWindow *){
+QMenu &ImageViewerApplication::get_lua_submenu(MainWindow *caller){
 	this->lua_submenu.clear();
+	this->batch_submenu.clear();
 	this->lua_submenu.setTitle("User filters");
 	auto list = this->get_user_filter_list();
 	if (list.isEmpty()){
@@ -368,10 +435,21 @@ QMenu &ImageViewerApplication::get_lua_submenu(MainWindow *){
 			//this->lua_submenu.addAction("Quit", caller, SLOT(user_script_slot()));
 			this->lua_submenu.addAction(i);
 		}
+	this->batch_input_directory = caller ? caller->get_current_directory() : QString();
+	if (list.size() && this->batch_input_directory.size()){
+		this->batch_submenu.setTitle("Apply to every image in the directory");
+		for (auto &i : list)
+			this->batch_submenu.addAction(i);
+		this->lua_submenu.addSeparator();
+		this->lua_submenu.addMenu(&this->batch_submenu);
+	}
 	return this->lua_submenu;
 }
 
 void ImageViewerApplication::lua_script_activated(QAction *action){
+	// Triggers from the batch submenu also reach this menu.
+	if (action->parent() == &this->batch_submenu)
+		return;
 	try{
 		this->context_menu_last_requester->process_user_script(this->get_user_filters_location() + action->text());
 	}catch (std::exception &e){
@@ -387,16 +465,165 @@ void ImageViewerApplication::lua_script_activated(QAction *action){
 	}
 }
 
+void ImageViewerApplication::batch_script_activated(QAction *action){
+	this->run_batch(this->get_user_filters_location() + action->text(), this->batch_input_directory);
+}
+
+// Filters given on the command line may also be named relative to the user
+// filters directory.
+QString ImageViewerApplication::find_filter(const QString &path){
+	if (QFileInfo(path).exists())
+		return path;
+	auto location = this->get_user_filters_location();
+	if (location.isNull())
+		return path;
+	auto ret = location + QFileInfo(path).fileName();
+	return QFileInfo(ret).exists() ? ret : path;
+}
+
+void ImageViewerApplication::run_batch(const QString &filter, const QString &input_directory, QString output_directory){
+	auto filter_name = QFileInfo(filter).fileName();
+	if (output_directory.isEmpty()){
+		output_directory = QFileDialog::getExistingDirectory(nullptr, "Output directory for " + filter_name, input_directory);
+		if (output_directory.isEmpty())
+			return;
+	}
+	QMessageBox msgbox;
+	msgbox.setWindowTitle("Batch " + filter_name);
+	DirectoryListing listing(input_directory);
+	if (!listing){
+		msgbox.setText("Directory not found: " + input_directory);
+		msgbox.setIcon(QMessageBox::Critical);
+		msgbox.exec();
+		return;
+	}
+	if (QDir(output_directory) == QDir(input_directory)){
+		msgbox.setText("The output directory must be different from the input directory.");
+		msgbox.setIcon(QMessageBox::Critical);
+		msgbox.exec();
+		return;
+	}
+	QProgressDialog progress("Applying " + filter_name + "...", "Cancel", 0, (int)listing.size());
+	progress.setWindowModality(Qt::ApplicationModal);
+	progress.setMinimumDuration(500);
+	auto callback = [&progress](size_t done, size_t){
+		progress.setValue((int)done);
+		QCoreApplication::processEvents();
+		return !progress.wasCanceled();
+	};
+	BatchProcessor processor(this->get_plugin_core_state());
+	auto result = processor.run(filter, listing, output_directory, callback);
+	progress.reset();
+	msgbox.setText(result.to_string());
+	if (result.failed)
+		msgbox.setIcon(QMessageBox::Warning);
+	msgbox.exec();
+}
+
+int ImageViewerApplication::run_replay(){
+	if (!this->replaying)
+		return 1;
+	auto script = this->args[2];
+	auto report = this->args.size() >= 4 ? this->args[3] : QString();
+	NavigationReplay replay;
+	QString error;
+	auto open = [this](const QString &path) -> MainWindow *{
+		sharedp_t p(new MainWindow(*this, QStringList() << QString() << path));
+		if (p->is_null())
+			return nullptr;
+		this->add_window(p);
+		return p.get();
+	};
+	int ret = 0;
+	if (!replay.load(script, error) || !replay.run(open, error)){
+		std::cerr << error.toStdString() << std::endl;
+		ret = 1;
+	}
+	replay.print_summary();
+	if (report.size() && !replay.write_report(report)){
+		std::cerr << "Can't write " << report.toStdString() << std::endl;
+		ret = 1;
+	}
+	return ret;
+}
+
 PluginCoreState &ImageViewerApplication::get_plugin_core_state(){
-	if (!this->plugin_core_state)
+	if (!this->plugin_core_state){
 		this->plugin_core_state.reset(new PluginCoreState);
+		auto config = this->get_config_location();
+		if (!config.isNull())
+			this->plugin_core_state->set_cache_location(config + "cache/");
+	}
 	return *this->plugin_core_state;
 }
 
+MetadataCache *ImageViewerApplication::get_metadata_cache(){
+	if (!this->metadata_cache){
+		auto config = this->get_config_location();
+		if (config.isNull())
+			return nullptr;
+		this->metadata_cache.reset(new MetadataCache(config + "cache/metadata.dat"));
+	}
+	return this->metadata_cache.get();
+}
+
 void ImageViewerApplication::setup_slots(){
 	connect(this->desktop(), SIGNAL(resized(int)), this, SLOT(resolution_change(int)));
 	connect(this->desktop(), SIGNAL(workAreaResized(int)), this, SLOT(work_area_change(int)));
 	connect(&this->lua_submenu, SIGNAL(triggered(QAction *)), this, SLOT(lua_script_activated(QAction *)));
+	connect(&this->batch_submenu, SIGNAL(triggered(QAction *)), this, SLOT(batch_script_activated(QAction *)));
+	// Editors often save by replacing the file, so changes are coalesced
+	// before looking at what needs to be compiled again.
+	this->filters_rescan_timer.setSingleShot(true);
+	this->filters_rescan_timer.setInterval(1000);
+	connect(&this->filters_rescan_timer, &QTimer::timeout, [this](){ this->precompile_changed_filters(); });
+}
+
+void ImageViewerApplication::update_filter_precompilation(){
+	if (!this->settings->get_precompile_cpp_filters()){
+		this->filters_rescan_timer.stop();
+		this->filters_watcher.reset();
+		this->precompiled_filters.clear();
+		if (this->plugin_core_state)
+			this->plugin_core_state->cancel_precompilations();
+		return;
+	}
+	if (this->filters_watcher)
+		return;
+	auto location = this->get_user_filters_location();
+	if (location.isNull())
+		return;
+	this->filters_watcher.reset(new QFileSystemWatcher);
+	this->filters_watcher->addPath(location);
+	auto rescan = [this](){ this->filters_rescan_timer.start(); };
+	connect(this->filters_watcher.get(), &QFileSystemWatcher::directoryChanged, rescan);
+	connect(this->filters_watcher.get(), &QFileSystemWatcher::fileChanged, rescan);
+	// The first scan is also delayed, to stay out of the way of the startup.
+	this->filters_rescan_timer.start();
+}
+
+void ImageViewerApplication::precompile_changed_filters(){
+	if (!this->filters_watcher)
+		return;
+	auto location = this->get_user_filters_location();
+	std::map<QString, QDateTime> current;
+	for (auto &name : this->get_user_filter_list()){
+		auto path = location + name;
+		if (!is_cpp_path(path))
+			continue;
+		auto last_modified = QFileInfo(path).lastModified();
+		current[path] = last_modified;
+		auto it = this->precompiled_filters.find(path);
+		if (it != this->precompiled_filters.end() && it->second == last_modified)
+			continue;
+		this->get_plugin_core_state().precompile_cpp(path);
+	}
+	this->precompiled_filters = current;
+	auto watched = this->filters_watcher->files();
+	if (watched.size())
+		this->filters_watcher->removePaths(watched);
+	for (auto &p : current)
+		this->filters_watcher->addPath(p.first);
 }
 
 void ImageViewerApplication::reset_tray_menu(){
@@ -11,6 +11,7 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include "SingleInstanceApplication.h"
 #include "serialization/settings.generated.h"
 #include "plugin-core/PluginCoreState.h"
+#include "MetadataCache.h"
 #include "Shortcuts.h"
 #include "Streams.h"
 #include "Enums.h"
@@ -18,6 +19,10 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include <memory>
 #include <exception>
 #include <QSystemTrayIcon>
+#include <QTimer>
+#include <QDateTime>
+
+class QFileSystemWatcher;
 
 class QAction;
 struct lua_State;
@@ -32,6 +37,9 @@ class ImageViewerApplication : public SingleInstanceApplication
 	std::map<uintptr_t, sharedp_t> windows;
 	std::vector<std::pair<DirectoryListing *, unsigned> > listings;
 	bool do_not_save;
+	// Set if this process was started to replay a script. Neither the saved
+	// windows nor the settings are touched then.
+	bool replaying;
 	std::vector<std::shared_ptr<QAction> > actions;
 	ApplicationShortcuts shortcuts;
 	MainWindow *context_menu_last_requester;
@@ -42,24 +50,36 @@ class ImageViewerApplication : public SingleInstanceApplication
 	std::shared_ptr<MainSettings> settings;
 
 	QMenu lua_submenu;
+	QMenu batch_submenu;
+	QString batch_input_directory;
 	std::unique_ptr<PluginCoreState> plugin_core_state;
+	std::unique_ptr<MetadataCache> metadata_cache;
 	QSystemTrayIcon tray_icon;
 	std::shared_ptr<QMenu> tray_context_menu,
 		last_tray_context_menu;
+	std::unique_ptr<QFileSystemWatcher> filters_watcher;
+	QTimer filters_rescan_timer;
+	std::map<QString, QDateTime> precompiled_filters;
+	std::vector<std::weak_ptr<MainWindow>> pending_restores;
 
 	void save_current_state(std::shared_ptr<ApplicationState> &);
 	void save_current_windows(std::vector<std::shared_ptr<WindowState>> &);
 	void restore_current_state(const ApplicationState &);
 	void restore_current_windows(const std::vector<std::shared_ptr<WindowState>> &);
+	void restore_next_window();
 	void propagate_shortcuts();
 	QMenu &get_lua_submenu(MainWindow *caller);
 	QString get_config_location();
 	QString get_config_filename();
 	QString get_user_filters_location();
 	QStringList get_user_filter_list();
+	QString find_filter(const QString &path);
+	void run_batch(const QString &filter, const QString &input_directory, QString output_directory = QString());
 	void setup_slots();
 	void reset_tray_menu();
 	void conditional_tray_show();
+	void update_filter_precompilation();
+	void precompile_changed_filters();
 
 protected:
 	void new_instance(const QStringList &args) override;
@@ -68,6 +88,9 @@ protected:
 public:
 	ImageViewerApplication(int &argc, char **argv, const QString &unique_name);
 	~ImageViewerApplication();
+	// Borderless --replay <script> [<report>]
+	// Plays the script given on the command line. Returns the exit code.
+	int run_replay();
 	std::shared_ptr<DirectoryIterator> request_directory(const QString &path);
 	void release_directory(std::shared_ptr<DirectoryIterator>);
 	bool get_clamp_to_edges() const{
@@ -106,6 +129,8 @@ public:
 	}
 	void set_option_values(MainSettings &settings);
 	PluginCoreState &get_plugin_core_state();
+	// Null if there's no config location.
+	MetadataCache *get_metadata_cache();
 
 public slots:
 	void window_closing(MainWindow *);
@@ -113,6 +138,7 @@ public slots:
 	void resolution_change(int screen);
 	void work_area_change(int screen);
 	void lua_script_activated(QAction *action);
+	void batch_script_activated(QAction *action);
 	void quit_slot(){
 		this->quit();
 	}
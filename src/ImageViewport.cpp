@@ -7,12 +7,15 @@ Distributed under a permissive license. See COPYING.txt for details.
 
 #include "ImageViewport.h"
 #include "LoadedImage.h"
+#include "AnimationPlayer.h"
+#include "plugin-core/Trace.h"
 #include <QPaintEvent>
 #include <QPainter>
 
 ImageViewport::ImageViewport(QWidget *parent) :
 		QLabel(parent),
-		zoom(1){
+		zoom(1),
+		pending(nullptr){
 	this->transform.reset();
 	this->setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Fixed);
 }
@@ -39,8 +42,21 @@ QMatrix translate(const QMatrix &m, const QPointF &offset){
 }
 
 void ImageViewport::paintEvent(QPaintEvent *){
-	QPainter painter(this);
-	if (!this->pixmap() && !this->movie()){
+	TRACE_SCOPE("ImageViewport::paintEvent");
+	{
+		QPainter painter(this);
+		this->paint(painter);
+	}
+	if (this->painted)
+		this->painted();
+}
+
+void ImageViewport::paint(QPainter &painter){
+	if (!this->pixmap() && !this->animation){
+		// The window already has the right size, and the background shows
+		// until the pixels are in.
+		if (this->pending)
+			return;
 		painter.setBrush(QBrush(Qt::white));
 		auto font = painter.font();
 		font.setPixelSize(48);
@@ -58,11 +74,20 @@ void ImageViewport::paintEvent(QPaintEvent *){
 	auto src_quad = this->compute_quad();
 	auto offset = src_quad.move_to_origin();
 	transform = translate(transform, offset);
-	painter.setMatrix(transform);
-	if (this->pixmap())
+	if (this->pixmap()){
+		painter.setMatrix(transform);
 		painter.drawPixmap(QRect(QPoint(0, 0), this->image_size), *this->pixmap());
-	else
-		painter.drawPixmap(QRect(QPoint(0, 0), this->image_size), this->movie()->currentPixmap());
+		return;
+	}
+	auto &frame = this->animation->get_current_frame();
+	if (!frame.scaled.isNull() && frame.scale == this->zoom){
+		// Already at the right size, so only the rotation is left.
+		painter.setMatrix(translate(this->transform, offset));
+		painter.drawImage(QRect(QPoint(0, 0), frame.scaled.size()), frame.scaled);
+		return;
+	}
+	painter.setMatrix(transform);
+	painter.drawImage(QRect(QPoint(0, 0), this->image_size), frame.image);
 }
 
 void ImageViewport::save_state(WindowState &state) const{
@@ -84,7 +109,39 @@ void ImageViewport::set_transform(const QMatrix &m){
 	this->transform_changed();
 }
 
+void ImageViewport::set_zoom(double x){
+	this->zoom = x;
+	if (this->animation)
+		this->animation->set_zoom(x);
+}
+
 void ImageViewport::set_image(LoadedGraphics &li){
 	this->image_size = li.get_size();
-	li.assign_to_QLabel(*this);
+	this->pending = nullptr;
+	li.assign_to_viewport(*this);
+}
+
+void ImageViewport::pending_finished(const LoadedGraphics *graphics, const QPixmap &pixmap){
+	if (this->pending != graphics)
+		return;
+	this->pending = nullptr;
+	this->setPixmap(pixmap);
+	emit this->pending_image_ready();
+}
+
+void ImageViewport::pending_failed(const LoadedGraphics *graphics){
+	if (this->pending != graphics)
+		return;
+	this->pending = nullptr;
+	emit this->pending_image_failed();
+}
+
+void ImageViewport::set_animation(const std::shared_ptr<AnimationPlayer> &animation){
+	if (this->animation)
+		this->animation->set_frame_changed_callback(nullptr);
+	this->animation = animation;
+	if (!animation)
+		return;
+	animation->set_zoom(this->zoom);
+	animation->set_frame_changed_callback([this](){ this->update(); });
 }
@@ -12,9 +12,13 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include <QImage>
 #include <QMatrix>
 #include "Quadrangular.h"
+#include <memory>
+#include <functional>
 #include "serialization/settings.generated.h"
 
 class LoadedGraphics;
+class AnimationPlayer;
+class QPainter;
 
 class ImageViewport : public QLabel
 {
@@ -22,6 +26,10 @@ class ImageViewport : public QLabel
 	QMatrix transform;
 	double zoom;
 	QSize image_size;
+	std::shared_ptr<AnimationPlayer> animation;
+	// The image whose pixels are still being decoded, if any.
+	const LoadedGraphics *pending;
+	std::function<void()> painted;
 
 	QMatrix get_final_transform() const{
 		auto ret = this->transform;
@@ -38,14 +46,13 @@ class ImageViewport : public QLabel
 		return this->compute_quad(this->image_size);
 	}
 	void transform_changed();
+	void paint(QPainter &);
 public:
 	explicit ImageViewport(QWidget *parent = 0);
 	void reset_transform(){
 		this->transform.reset();
 	}
-	void set_zoom(double x){
-		this->zoom = x;
-	}
+	void set_zoom(double x);
 	void rotate(double delta_theta);
 	void update_size(){
 		this->resize(this->get_size());
@@ -57,7 +64,7 @@ public:
 		size = this->compute_quad_no_zoom(size).get_bounding_box().size().toSize();
 	}
 	QSize get_size() const{
-		if (!this->pixmap() && !this->movie())
+		if (!this->pixmap() && !this->animation && !this->pending)
 			return QSize(800, 600);
 		auto ret = this->image_size;
 		this->compute_size(ret);
@@ -79,9 +86,26 @@ public:
 
 	void paintEvent(QPaintEvent *) override;
 	void set_image(LoadedGraphics &li);
+	void set_animation(const std::shared_ptr<AnimationPlayer> &);
+	void set_pending(const LoadedGraphics *graphics){
+		this->pending = graphics;
+	}
+	bool is_pending() const{
+		return !!this->pending;
+	}
+	// Ignored if graphics has been replaced in the meantime.
+	void pending_finished(const LoadedGraphics *graphics, const QPixmap &);
+	// Likewise, for graphics that turned out not to decode.
+	void pending_failed(const LoadedGraphics *graphics);
+	// Called at the end of every paint event.
+	void set_paint_callback(const std::function<void()> &f){
+		this->painted = f;
+	}
 
 signals:
 	void transform_updated();
+	void pending_image_ready();
+	void pending_image_failed();
 
 public slots:
 
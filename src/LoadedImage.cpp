@@ -6,97 +6,182 @@ Distributed under a permissive license. See COPYING.txt for details.
 */
 
 #include "LoadedImage.h"
+#include "AnimationPlayer.h"
+#include "BackgroundColor.h"
+#include "ImageViewport.h"
+#include "MetadataCache.h"
+#include "plugin-core/Trace.h"
 #include <QImage>
+#include <QImageReader>
+#include <QPixelFormat>
+#include <QElapsedTimer>
 #include <QtConcurrent/QtConcurrentRun>
-#include <QLabel>
 
-LoadedImage::LoadedImage(const QString &path){
-	QImage img(path);
-	if ((this->null = img.isNull()))
+bool probe_image(const QString &path, ImageProbe &dst){
+	TRACE_SCOPE("probe_image");
+	QImageReader reader(path);
+	if (!reader.canRead())
+		return false;
+	// For JPEG, PNG, GIF, WebP and TIFF, the plugins only parse the header
+	// for these.
+	dst.size = reader.size();
+	if (!dst.size.isValid())
+		return false;
+	dst.transformation = reader.transformation();
+	auto format = reader.imageFormat();
+	// If the plugin won't say, assume there's alpha. That only costs working
+	// out a background color.
+	dst.alpha = format == QImage::Format_Invalid || QImage::toPixelFormat(format).alphaUsage() == QPixelFormat::UsesAlpha;
+	return true;
+}
+
+static DecodedImage decode_image(const QString &path){
+	TRACE_SCOPE("decode_image");
+	QElapsedTimer timer;
+	timer.start();
+	DecodedImage ret;
+	ret.image = QImage(path);
+	ret.decode_ms = timer.elapsed();
+	return ret;
+}
+
+LoadedImage::LoadedImage(const QString &path, MetadataCache *cache): cache(cache), path(path){
+	TRACE_SCOPE("LoadedImage::LoadedImage");
+	ImageMetadata metadata;
+	bool cached = this->cache && this->cache->get(path, metadata);
+	this->decoded = QtConcurrent::run(decode_image, path);
+	ImageProbe probe;
+	if (probe_image(path, probe)){
+		this->size = probe.size;
+		this->alpha = probe.alpha;
+	}else if (cached){
+		this->size = metadata.size;
+		this->alpha = metadata.alpha;
+	}else{
+		// Nothing short of decoding the image will tell.
+		auto image = this->decoded.result().image;
+		this->size = image.size();
+		this->alpha = image.hasAlphaChannel();
+	}
+	if ((this->null = this->size.isEmpty()))
 		return;
-	this->compute_average_color(img);
-	this->image = QtConcurrent::run([](QImage img){ return QPixmap::fromImage(img); }, img);
-	this->size = img.size();
-	this->alpha = img.hasAlphaChannel();
+	if (cached && metadata.size == this->size)
+		this->known_background_color = metadata.background_color;
+	this->start();
 }
 
-LoadedImage::LoadedImage(const QImage &image){
-	this->compute_average_color(image);
-	this->image = QtConcurrent::run([](QImage img){ return QPixmap::fromImage(img); }, image);
+LoadedImage::LoadedImage(const QImage &image): cache(nullptr){
+	this->decoded = QtConcurrent::run([](QImage img){
+		DecodedImage ret;
+		ret.image = img;
+		ret.decode_ms = -1;
+		return ret;
+	}, image);
 	this->size = image.size();
 	this->alpha = image.hasAlphaChannel();
+	this->null = image.isNull();
+	this->start();
 }
 
 LoadedImage::~LoadedImage(){
+	this->store_metadata();
 	this->background_color.cancel();
 }
 
-QColor get_average_color(QImage src){
-	if (src.depth() < 32)
-		src = src.convertToFormat(QImage::Format_ARGB32);
-	quint64 avg[3] = {0};
-	unsigned pixel_count=0;
-	for (auto y = src.height() * 0; y < src.height(); y++){
-		const uchar *p = src.constScanLine(y);
-		for (auto x = src.width() * 0; x < src.width(); x++){
-			avg[0] += quint64(p[2]) * quint64(p[3]) / 255;
-			avg[1] += quint64(p[1]) * quint64(p[3]) / 255;
-			avg[2] += quint64(p[0]) * quint64(p[3]) / 255;
-			p += 4;
-			pixel_count++;
-		}
-	}
-	for (int a = 0; a < 3; a++)
-		avg[a] /= pixel_count;
-	return QColor(avg[0], avg[1], avg[2]);
+void LoadedImage::start(){
+	this->image = QtConcurrent::run([](QFuture<DecodedImage> decoded){
+		auto image = decoded.result().image;
+		TRACE_SCOPE("QPixmap::fromImage");
+		return QPixmap::fromImage(image);
+	}, this->decoded);
+	// The average color is a pass over every pixel, so it's skipped whenever
+	// the cache already has it.
+	if (!this->known_background_color.isValid())
+		this->background_color = QtConcurrent::run([](QFuture<DecodedImage> decoded){ return background_color_parallel_function(decoded.result().image); }, this->decoded);
 }
 
-QColor background_color_parallel_function(QImage img){
-	QColor avg = get_average_color(img),
-		negative = avg,
-		background;
-	negative.setRedF(1 - negative.redF());
-	negative.setGreenF(1 - negative.greenF());
-	negative.setBlueF(1 - negative.blueF());
-	if (negative.saturationF() <= .05 && negative.valueF() >= .45 && negative.valueF() <= .55)
-		background = Qt::white;
-	else
-		background = negative;
-	return background;
+QColor LoadedImage::get_background_color(){
+	if (!this->known_background_color.isValid())
+		this->known_background_color = this->background_color.result();
+	return this->known_background_color;
 }
 
-void LoadedImage::compute_average_color(QImage img){
-	this->background_color = QtConcurrent::run(background_color_parallel_function, img);
+void LoadedImage::store_metadata(){
+	// Whatever hasn't been worked out by now isn't waited for.
+	if (!this->cache || !this->decoded.isFinished())
+		return;
+	auto decoded = this->decoded.result();
+	if (decoded.image.isNull())
+		return;
+	ImageMetadata metadata;
+	metadata.size = decoded.image.size();
+	metadata.alpha = decoded.image.hasAlphaChannel();
+	metadata.background_color = this->known_background_color;
+	if (!metadata.background_color.isValid() && this->background_color.isFinished())
+		metadata.background_color = this->background_color.result();
+	metadata.decode_ms = decoded.decode_ms;
+	this->cache->put(this->path, metadata);
 }
 
-void LoadedImage::assign_to_QLabel(QLabel &label){
-	label.setPixmap(this->image);
+void LoadedImage::assign_to_viewport(ImageViewport &viewport){
+	viewport.set_animation(nullptr);
+	if (this->image.isFinished() && !this->decoded.result().image.isNull()){
+		viewport.setPixmap(this->image.result());
+		return;
+	}
+	// The window is laid out from the header now, and the pixels go in once
+	// they're decoded.
+	viewport.clear();
+	viewport.set_pending(this);
+	this->watcher.reset(new QFutureWatcher<QPixmap>);
+	QObject::connect(this->watcher.get(), &QFutureWatcherBase::finished, &viewport, [this, &viewport](){
+		// The header can be fine while the pixels aren't.
+		if (this->decoded.result().image.isNull()){
+			this->null = true;
+			viewport.pending_failed(this);
+			return;
+		}
+		viewport.pending_finished(this, this->image.result());
+	});
+	this->watcher->setFuture(this->image);
 }
 
 QImage LoadedImage::get_QImage() const{
-	return ((QPixmap)this->image).toImage();
+	return this->decoded.result().image;
 }
 
-LoadedAnimation::LoadedAnimation(const QString &path): animation(path){
-	this->null = !this->animation.isValid();
+LoadedAnimation::LoadedAnimation(const QString &path): animation(std::make_shared<AnimationPlayer>(path)){
+	this->null = !this->animation->is_valid();
 	if (!this->null){
-		(void)this->animation.jumpToNextFrame();
-		this->size = this->animation.currentPixmap().size();
+		this->size = this->animation->get_size();
 		this->alpha = true;
 	}
 }
 
-void LoadedAnimation::assign_to_QLabel(QLabel &label){
-	label.setMovie(&this->animation);
-	this->animation.start();
+LoadedAnimation::LoadedAnimation(const std::vector<AnimationFrame> &frames): animation(std::make_shared<AnimationPlayer>(frames)){
+	this->null = !this->animation->is_valid();
+	if (!this->null){
+		this->size = this->animation->get_size();
+		this->alpha = true;
+	}
+}
+
+void LoadedAnimation::assign_to_viewport(ImageViewport &viewport){
+	viewport.clear();
+	viewport.set_animation(this->animation);
+	this->animation->start();
 }
 
 QImage LoadedAnimation::get_QImage() const{
-	return this->animation.currentImage();
+	return this->animation->get_current_frame().image;
+}
+
+std::unique_ptr<FrameSource> LoadedAnimation::get_frames() const{
+	return this->animation->open_frames();
 }
 
-std::shared_ptr<LoadedGraphics> LoadedGraphics::create(const QString &path){
+std::shared_ptr<LoadedGraphics> LoadedGraphics::create(const QString &path, MetadataCache *cache){
 	if (path.endsWith(".gif", Qt::CaseInsensitive))
 		return std::shared_ptr<LoadedGraphics>(new LoadedAnimation(path));
-	return std::shared_ptr<LoadedGraphics>(new LoadedImage(path));
+	return std::shared_ptr<LoadedGraphics>(new LoadedImage(path, cache));
 }
@@ -10,11 +10,16 @@ Distributed under a permissive license. See COPYING.txt for details.
 
 #include <QString>
 #include <QPixmap>
-#include <QMovie>
 #include <QFuture>
+#include <QFutureWatcher>
+#include <QImageIOHandler>
 #include <memory>
+#include <vector>
+#include "plugin-core/PluginCaller.h"
 
-class QLabel;
+class ImageViewport;
+class AnimationPlayer;
+class MetadataCache;
 
 class LoadedGraphics{
 protected:
@@ -34,43 +39,76 @@ public:
 	bool has_alpha() const{
 		return this->alpha;
 	}
-	virtual void assign_to_QLabel(QLabel &) = 0;
+	virtual void assign_to_viewport(ImageViewport &) = 0;
 	virtual QImage get_QImage() const = 0;
-	static std::shared_ptr<LoadedGraphics> create(const QString &path);
+	// Null for still images.
+	virtual std::unique_ptr<FrameSource> get_frames() const{
+		return nullptr;
+	}
+	// If cache is set, what's learned about the file is remembered there.
+	static std::shared_ptr<LoadedGraphics> create(const QString &path, MetadataCache *cache = nullptr);
+};
+
+struct ImageProbe{
+	QSize size;
+	bool alpha;
+	// The EXIF orientation. The decoder doesn't apply it either, so size is as
+	// stored in the file.
+	QImageIOHandler::Transformations transformation;
 };
 
+// Learns the dimensions, alpha and orientation of an image from its header
+// alone, without decoding any pixels. Returns false if the file can't be read
+// or if its header doesn't give the dimensions.
+bool probe_image(const QString &path, ImageProbe &);
+
+struct DecodedImage{
+	QImage image;
+	qint64 decode_ms;
+};
+
+// Opening a file only reads its header. The pixels are decoded on the thread
+// pool, and shown once they're ready.
 class LoadedImage : public LoadedGraphics{
+	QFuture<DecodedImage> decoded;
 	QFuture<QPixmap> image;
 	QFuture<QColor> background_color;
+	std::unique_ptr<QFutureWatcher<QPixmap>> watcher;
+	// Set once the background color is known, whether from the cache or from
+	// background_color.
+	QColor known_background_color;
+	MetadataCache *cache;
+	QString path;
 
-	void compute_average_color(QImage);
+	void start();
+	void store_metadata();
 public:
-	LoadedImage(const QString &path);
+	LoadedImage(const QString &path, MetadataCache *cache = nullptr);
 	LoadedImage(const QImage &image);
 	~LoadedImage();
-	QColor get_background_color() override{
-		return this->background_color.result();
-	}
+	QColor get_background_color() override;
 	bool is_animation() const override{
 		return false;
 	}
-	void assign_to_QLabel(QLabel &) override;
+	void assign_to_viewport(ImageViewport &) override;
 	QImage get_QImage() const override;
 };
 
 class LoadedAnimation : public LoadedGraphics{
-	QMovie animation;
+	std::shared_ptr<AnimationPlayer> animation;
 
 public:
 	LoadedAnimation(const QString &path);
+	LoadedAnimation(const std::vector<AnimationFrame> &);
 	QColor get_background_color() override{
 		return QColor(0, 0, 0, 0);
 	}
 	bool is_animation() const override{
 		return true;
 	}
-	void assign_to_QLabel(QLabel &) override;
+	void assign_to_viewport(ImageViewport &) override;
 	QImage get_QImage() const override;
+	std::unique_ptr<FrameSource> get_frames() const override;
 };
 
 #endif // LOADEDIMAGE_H
@@ -9,11 +9,15 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include "ui_MainWindow.h"
 #include "Misc.h"
 #include "RotateDialog.h"
+#include "ThumbnailGrid.h"
+#include "plugin-core/Trace.h"
+#include "ClangErrorMessage.hpp"
 #include <algorithm>
 #include <limits>
 #include <QImage>
 #include <QMetaEnum>
 #include <QDir>
+#include <QMessageBox>
 #include <exception>
 #include <cassert>
 #include "plugin-core/PluginCoreState.h"
@@ -23,6 +27,7 @@ MainWindow::MainWindow(ImageViewerApplication &app, const QStringList &arguments
 		QMainWindow(parent),
 		ui(new Ui::MainWindow),
 		app(&app){
+	TRACE_SCOPE("MainWindow::MainWindow");
 	this->init();
 	if (arguments.size() >= 2)
 		this->open_path_and_display_image(arguments[1]);
@@ -32,9 +37,11 @@ MainWindow::MainWindow(ImageViewerApplication &app, const std::shared_ptr<Window
 		QMainWindow(parent),
 		ui(new Ui::MainWindow),
 		app(&app){
+	TRACE_SCOPE("MainWindow::MainWindow");
 	this->init();
 	this->restore_state(state);
 	this->set_background();
+	this->show_placeholder_background();
 }
 
 MainWindow::~MainWindow(){
@@ -49,6 +56,9 @@ void MainWindow::init(){
 	this->window_state->set_zoom(1);
 	this->window_state->set_fullscreen_zoom(1);
 	this->color_calculated = false;
+	this->restore_pending = false;
+	this->background_pending = false;
+	this->skipped_images = 0;
 	this->window_state->set_fullscreen(false);
 	this->ui->setupUi(this);
 	this->setWindowFlags(this->windowFlags() | Qt::FramelessWindowHint);
@@ -61,6 +71,8 @@ void MainWindow::init(){
 	this->setup_shortcuts();
 
 	connect(this->ui->label, SIGNAL(transform_updated()), this, SLOT(label_transform_updated()));
+	connect(this->ui->label, SIGNAL(pending_image_ready()), this, SLOT(label_image_ready()));
+	connect(this->ui->label, SIGNAL(pending_image_failed()), this, SLOT(label_image_failed()));
 }
 
 void MainWindow::set_desktop_size(int screen){
@@ -222,6 +234,7 @@ void MainWindow::set_background_sizes(){
 void MainWindow::show_nothing(){
 	qDebug() << "MainWindow::show_nothing()";
 	this->displayed_image.reset();
+	this->filter_history.clear();
 	this->resize(800, 600);
 	this->ui->label->move(0, 0);
 	this->ui->label->resize(this->size());
@@ -286,6 +299,7 @@ void MainWindow::move_in_direction(bool forward){
 		return;
 	this->set_iterator();
 	this->moving_forward = forward;
+	this->skipped_images = 0;
 	auto old_pos = this->directory_iterator->pos();
 	this->advance();
 	if (this->directory_iterator->pos() == old_pos)
@@ -295,13 +309,14 @@ void MainWindow::move_in_direction(bool forward){
 }
 
 bool MainWindow::open_path_and_display_image(QString path){
+	TRACE_SCOPE("MainWindow::open_path_and_display_image");
 	std::shared_ptr<LoadedGraphics> li;
 	size_t i = 0;
 	auto &label = this->ui->label;
 	if (!!this->directory_iterator)
 		i = this->directory_iterator->pos();
 	while (true){
-		li = LoadedGraphics::create(path);
+		li = LoadedGraphics::create(path, this->app->get_metadata_cache());
 		qDebug() << path;
 		if (!li->is_null())
 			break;
@@ -328,6 +343,7 @@ bool MainWindow::open_path_and_display_image(QString path){
 	label->move(0, 0);
 	this->setWindowTitle(current_filename);
 	this->displayed_image = li;
+	this->filter_history.clear();
 
 	label->reset_transform();
 	this->set_zoom();
@@ -341,7 +357,37 @@ void MainWindow::display_filtered_image(const std::shared_ptr<LoadedGraphics> &g
 	this->display_image_in_label(graphics, false);
 }
 
+void MainWindow::display_filtered_image(const QImage &image){
+	if (this->filter_history.is_empty() && this->displayed_image)
+		this->filter_history.reset(this->displayed_image->get_QImage());
+	this->filter_history.push(image);
+	this->display_filtered_image(std::make_shared<LoadedImage>(image));
+}
+
+void MainWindow::display_filtered_animation(const std::vector<AnimationFrame> &frames){
+	// The history only holds still images.
+	this->filter_history.clear();
+	this->display_filtered_image(std::make_shared<LoadedAnimation>(frames));
+}
+
+void MainWindow::show_message_box(const QString &title, const QString &message, bool is_error){
+	QMessageBox msgbox;
+	if (title.size())
+		msgbox.setWindowTitle(title);
+	msgbox.setText(message);
+	if (is_error)
+		msgbox.setIcon(QMessageBox::Critical);
+	msgbox.exec();
+}
+
+void MainWindow::show_compiler_error(const QString &message){
+	ClangErrorMessage msgbox;
+	msgbox.set_error_message(message);
+	msgbox.exec();
+}
+
 void MainWindow::display_image_in_label(const std::shared_ptr<LoadedGraphics> &graphics, bool first_display){
+	TRACE_SCOPE("MainWindow::display_image_in_label");
 	auto zoom = this->get_current_zoom();
 	auto &label = this->ui->label;
 	label->set_image(*graphics);
@@ -355,7 +401,8 @@ void MainWindow::display_image_in_label(const std::shared_ptr<LoadedGraphics> &g
 	);
 	label->resize(size);
 
-	if (!this->color_calculated && this->displayed_image->has_alpha()){
+	// Until the pixels are in, there's nothing to take the color from.
+	if (!this->color_calculated && this->displayed_image->has_alpha() && !label->is_pending()){
 		this->set_background(true);
 		this->color_calculated = true;
 	}
@@ -376,13 +423,43 @@ void MainWindow::show_rotate_dialog(){
 	dialog.exec();
 }
 
+void MainWindow::show_thumbnails(){
+	auto directory = QString::fromStdWString(this->window_state->get_current_directory());
+	if (directory.isEmpty())
+		return;
+	// As a child, the grid is closed along with the window it opens images in.
+	auto grid = new ThumbnailGrid(directory, this);
+	grid->set_activated_callback([this](const QString &path){ this->open_from_thumbnails(path); });
+	grid->show();
+}
+
+void MainWindow::open_from_thumbnails(const QString &path){
+	this->clear_image_pos();
+	this->moving_forward = true;
+	if (!this->open_path_and_display_image(path))
+		return;
+	if (!!this->directory_iterator)
+		this->directory_iterator->go_to(QString::fromStdWString(this->window_state->get_current_filename()));
+	this->raise();
+	this->activateWindow();
+}
+
 void MainWindow::show_context_menu(QMouseEvent *ev){
 	this->app->postEvent(this, new QContextMenuEvent(QContextMenuEvent::Other, ev->screenPos().toPoint()));
 }
 
 void MainWindow::build_context_menu(QMenu &main_menu, QMenu &lua_submenu){
 	main_menu.addAction("Transform...", this, SLOT(show_rotate_dialog()));
+	if (!!this->directory_iterator)
+		main_menu.addAction("Thumbnails...", this, SLOT(show_thumbnails()));
 	main_menu.addMenu(&lua_submenu);
+	if (this->app->get_plugin_core_state().get_profile().has_run())
+		main_menu.addAction("Last filter timing...", this, SLOT(show_filter_timing()));
+	auto &shortcuts = this->app->get_shortcuts();
+	if (this->filter_history.can_undo())
+		main_menu.addAction("Undo filter", this, SLOT(undo_filter_slot()), shortcuts.get_current_sequence(undo_filter_command));
+	if (this->filter_history.can_redo())
+		main_menu.addAction("Redo filter", this, SLOT(redo_filter_slot()), shortcuts.get_current_sequence(redo_filter_command));
 	main_menu.addAction("Close", this, SLOT(close_slot()), this->app->get_shortcuts().get_current_sequence(close_command));
 }
 
@@ -484,6 +561,42 @@ void MainWindow::label_transform_updated(){
 	this->set_background_sizes();
 }
 
+void MainWindow::label_image_ready(){
+	this->skipped_images = 0;
+	if (this->background_pending){
+		this->background_pending = false;
+		this->window_state->set_using_checkerboard_pattern_updated(true);
+		this->set_background();
+	}
+	if (this->color_calculated || !this->displayed_image || !this->displayed_image->has_alpha())
+		return;
+	this->set_background(true);
+	this->color_calculated = true;
+}
+
+// The image's header was readable, but its pixels weren't. It's skipped the
+// way open_path_and_display_image() skips images it can't open, except that it
+// happens once the window already shows it.
+void MainWindow::label_image_failed(){
+	if (!this->directory_iterator || ++this->skipped_images >= this->directory_iterator->get_listing()->size()){
+		this->show_nothing();
+		return;
+	}
+	this->set_iterator();
+	auto old_pos = this->directory_iterator->pos();
+	this->advance();
+	if (this->directory_iterator->pos() == old_pos){
+		this->show_nothing();
+		return;
+	}
+	this->clear_image_pos();
+	this->open_path_and_display_image(**this->directory_iterator);
+}
+
+ImageViewport *MainWindow::get_viewport() const{
+	return this->ui->label;
+}
+
 QMatrix MainWindow::get_image_transform() const{
 	return this->ui->label->get_transform();
 }
@@ -514,6 +627,27 @@ void MainWindow::process_user_script(const QString &path){
 	plugin_core_state.execute(path);
 }
 
+void MainWindow::undo_filter_slot(){
+	if (!this->filter_history.can_undo())
+		return;
+	this->display_filtered_image(std::make_shared<LoadedImage>(this->filter_history.undo()));
+}
+
+void MainWindow::redo_filter_slot(){
+	if (!this->filter_history.can_redo())
+		return;
+	this->display_filtered_image(std::make_shared<LoadedImage>(this->filter_history.redo()));
+}
+
+void MainWindow::show_filter_timing(){
+	auto &profile = this->app->get_plugin_core_state().get_profile();
+	this->show_message_box("Filter timing", profile.to_string(), false);
+}
+
 QImage MainWindow::get_image() const{
 	return this->displayed_image->get_QImage();
 }
+
+std::unique_ptr<FrameSource> MainWindow::get_frames() const{
+	return this->displayed_image->get_frames();
+}
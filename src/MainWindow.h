@@ -19,12 +19,14 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include <vector>
 #include <memory>
 #include "Misc.h"
+#include "FilterHistory.h"
+#include "plugin-core/PluginCaller.h"
 
 namespace Ui {
 class MainWindow;
 }
 
-class MainWindow : public QMainWindow{
+class MainWindow : public QMainWindow, public PluginCaller{
 	Q_OBJECT
 
 	std::shared_ptr<Ui::MainWindow> ui;
@@ -38,6 +40,7 @@ class MainWindow : public QMainWindow{
 	Optional<QPoint> image_pos;
 	QSize first_window_size;
 	std::shared_ptr<LoadedGraphics> displayed_image;
+	FilterHistory filter_history;
 	std::vector<int> horizontal_clampers,
 		vertical_clampers;
 	//QString current_directory,
@@ -47,6 +50,12 @@ class MainWindow : public QMainWindow{
 	std::vector<std::shared_ptr<QShortcut> > shortcuts;
 	bool not_moved;
 	bool color_calculated;
+	// Set from restore_state() until load_restored_image().
+	bool restore_pending;
+	// Set if the background should be redone once the pixels are in.
+	bool background_pending;
+	// Images skipped in a row because they failed to decode.
+	size_t skipped_images;
 	std::vector<QMetaObject::Connection> connections;
 
 	enum class ResizeMode{
@@ -103,6 +112,9 @@ class MainWindow : public QMainWindow{
 	void clear_image_pos();
 	void rotate(bool right, bool fine = false);
 	void fix_positions_and_zoom();
+	QString get_state_path() const;
+	void show_placeholder_background();
+	void open_from_thumbnails(const QString &path);
 
 protected:
 	void mousePressEvent(QMouseEvent *ev) override;
@@ -123,8 +135,16 @@ public:
 	bool open_path_and_display_image(QString path);
 	void display_image_in_label(const std::shared_ptr<LoadedGraphics> &graphics, bool first_display);
 	void display_filtered_image(const std::shared_ptr<LoadedGraphics> &);
+	void display_filtered_image(const QImage &) override;
+	void display_filtered_animation(const std::vector<AnimationFrame> &) override;
+	void show_message_box(const QString &title, const QString &message, bool is_error) override;
+	void show_compiler_error(const QString &message) override;
 	std::shared_ptr<WindowState> save_state() const;
 	void restore_state(const std::shared_ptr<WindowState> &);
+	void load_restored_image();
+	bool is_restore_pending() const{
+		return this->restore_pending;
+	}
 	bool is_null() const{
 		return !this->displayed_image || this->displayed_image->is_null();
 	}
@@ -143,13 +163,24 @@ public:
 		return check_flag(this->get_current_zoom_mode(), ZoomMode::Automatic);
 	}
 	void process_user_script(const QString &path);
-	QImage get_image() const;
+	QImage get_image() const override;
+	std::unique_ptr<FrameSource> get_frames() const override;
+	QString get_current_directory() const{
+		return QString::fromStdWString(this->window_state->get_current_directory());
+	}
 	ImageViewerApplication &get_app(){
 		return *this->app;
 	}
+	ImageViewport *get_viewport() const;
+	// Does what the shortcut for the command does. command is an internal
+	// name, such as "next" or "zoom_in". Returns false if there's no such
+	// command.
+	bool run_command(const QString &command);
 
 public slots:
 	void label_transform_updated();
+	void label_image_ready();
+	void label_image_failed();
 
 	void quit_slot();
 	void quit2_slot();
@@ -183,7 +214,11 @@ public slots:
 	void flip_h();
 	void flip_v();
 	void show_rotate_dialog();
+	void show_thumbnails();
 	void show_options_dialog();
+	void show_filter_timing();
+	void undo_filter_slot();
+	void redo_filter_slot();
 
 signals:
 	void closing(MainWindow *);
@@ -7,14 +7,50 @@ Distributed under a permissive license. See COPYING.txt for details.
 
 #include "MainWindow.h"
 #include "ui_MainWindow.h"
+#include "MetadataCache.h"
+#include "plugin-core/Trace.h"
 #include <QDir>
 
-void MainWindow::restore_state(const std::shared_ptr<WindowState> &state){
-	this->window_state = state;
-	this->window_state->set_using_checkerboard_pattern_updated(true);
+QString MainWindow::get_state_path() const{
 	auto path = QString::fromStdWString(this->window_state->get_current_directory());
 	path += QDir::separator();
 	path += QString::fromStdWString(this->window_state->get_current_filename());
+	return path;
+}
+
+// Only puts the window where it was. The image is opened later, by
+// load_restored_image(), so that every window can be up before any of them
+// has to wait on a file.
+void MainWindow::restore_state(const std::shared_ptr<WindowState> &state){
+	this->window_state = state;
+	this->window_state->set_using_checkerboard_pattern_updated(true);
+	this->move(this->window_state->get_pos().to_QPoint());
+	this->resize(this->window_state->get_size().to_QSize());
+	this->ui->label->hide();
+	this->restore_pending = true;
+}
+
+// Until the image is opened, the window shows the background it had the last
+// time, if the metadata cache remembers it.
+void MainWindow::show_placeholder_background(){
+	auto cache = this->app->get_metadata_cache();
+	ImageMetadata metadata;
+	if (this->window_state->get_using_checkerboard_pattern() || !cache || !cache->get(this->get_state_path(), metadata))
+		return;
+	if (!metadata.background_color.isValid())
+		return;
+	this->set_solid(metadata.background_color);
+	this->ui->solid->show();
+	this->ui->checkerboard->hide();
+}
+
+void MainWindow::load_restored_image(){
+	TRACE_SCOPE("MainWindow::load_restored_image");
+	if (!this->restore_pending)
+		return;
+	this->restore_pending = false;
+	this->ui->label->show();
+	auto path = this->get_state_path();
 	auto temp_zoom_mode = this->window_state->get_zoom_mode();
 	this->window_state->set_zoom_mode(ZoomMode::Locked);
 	bool success = this->open_path_and_display_image(path);
@@ -27,9 +63,21 @@ void MainWindow::restore_state(const std::shared_ptr<WindowState> &state){
 		return;
 	this->resize(this->window_state->get_size().to_QSize());
 	this->fix_positions_and_zoom();
+
+	// The background so far was only a placeholder. If the color has to be
+	// worked out from the pixels, that waits until they're in.
+	if (this->ui->label->is_pending() && !this->window_state->get_using_checkerboard_pattern())
+		this->background_pending = true;
+	else{
+		this->window_state->set_using_checkerboard_pattern_updated(true);
+		this->set_background();
+	}
 }
 
 std::shared_ptr<WindowState> MainWindow::save_state() const{
+	// Nothing has moved yet, and the label doesn't hold the saved values.
+	if (this->restore_pending)
+		return this->window_state;
 	this->window_state->set_pos(this->pos());
 	this->window_state->set_size(this->size());
 	this->window_state->set_label_pos(this->ui->label->pos());
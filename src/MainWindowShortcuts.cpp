@@ -8,45 +8,47 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include "MainWindow.h"
 #include "ui_MainWindow.h"
 
-void MainWindow::setup_shortcuts(){
-	static struct Pair{
-		const char *command;
-		const char *slot;
-	} pairs[] = {
+static const struct ShortcutSlot{
+	const char *command;
+	const char *slot;
+} shortcut_slots[] = {
 #define SETUP_SHORTCUT(command, slot) { command, SLOT(slot)},
-		SETUP_SHORTCUT(quit_command, quit_slot())
-		SETUP_SHORTCUT(quit2_command, quit2_slot())
-		SETUP_SHORTCUT(next_command, next_slot())
-		SETUP_SHORTCUT(back_command, back_slot())
-		SETUP_SHORTCUT(background_swap_command, background_swap_slot())
-		SETUP_SHORTCUT(close_command, close_slot())
-		SETUP_SHORTCUT(zoom_in_command, zoom_in_slot())
-		SETUP_SHORTCUT(zoom_out_command, zoom_out_slot())
-		SETUP_SHORTCUT(reset_zoom_command, reset_zoom_slot())
-		SETUP_SHORTCUT(up_command, up_slot())
-		SETUP_SHORTCUT(down_command, down_slot())
-		SETUP_SHORTCUT(left_command, left_slot())
-		SETUP_SHORTCUT(right_command, right_slot())
-		SETUP_SHORTCUT(up_big_command, up_big_slot())
-		SETUP_SHORTCUT(down_big_command, down_big_slot())
-		SETUP_SHORTCUT(left_big_command, left_big_slot())
-		SETUP_SHORTCUT(right_big_command, right_big_slot())
-		SETUP_SHORTCUT(cycle_zoom_mode_command, cycle_zoom_mode_slot())
-		SETUP_SHORTCUT(toggle_lock_zoom_command, toggle_lock_zoom_slot())
-		SETUP_SHORTCUT(go_to_start_command, go_to_start())
-		SETUP_SHORTCUT(go_to_end_command, go_to_end())
-		SETUP_SHORTCUT(toggle_fullscreen_command, toggle_fullscreen())
-		SETUP_SHORTCUT(rotate_left_command, rotate_left())
-		SETUP_SHORTCUT(rotate_right_command, rotate_right())
-		SETUP_SHORTCUT(rotate_left_fine_command, rotate_left_fine())
-		SETUP_SHORTCUT(rotate_right_fine_command, rotate_right_fine())
-		SETUP_SHORTCUT(flip_h_command, flip_h())
-		SETUP_SHORTCUT(flip_v_command, flip_v())
-		SETUP_SHORTCUT(minimize_command, minimize_slot())
-		SETUP_SHORTCUT(minimize_all_command, minimize_all_slot())
-		SETUP_SHORTCUT(show_options_command, show_options_dialog())
-	};
+	SETUP_SHORTCUT(quit_command, quit_slot())
+	SETUP_SHORTCUT(quit2_command, quit2_slot())
+	SETUP_SHORTCUT(next_command, next_slot())
+	SETUP_SHORTCUT(back_command, back_slot())
+	SETUP_SHORTCUT(background_swap_command, background_swap_slot())
+	SETUP_SHORTCUT(close_command, close_slot())
+	SETUP_SHORTCUT(zoom_in_command, zoom_in_slot())
+	SETUP_SHORTCUT(zoom_out_command, zoom_out_slot())
+	SETUP_SHORTCUT(reset_zoom_command, reset_zoom_slot())
+	SETUP_SHORTCUT(up_command, up_slot())
+	SETUP_SHORTCUT(down_command, down_slot())
+	SETUP_SHORTCUT(left_command, left_slot())
+	SETUP_SHORTCUT(right_command, right_slot())
+	SETUP_SHORTCUT(up_big_command, up_big_slot())
+	SETUP_SHORTCUT(down_big_command, down_big_slot())
+	SETUP_SHORTCUT(left_big_command, left_big_slot())
+	SETUP_SHORTCUT(right_big_command, right_big_slot())
+	SETUP_SHORTCUT(cycle_zoom_mode_command, cycle_zoom_mode_slot())
+	SETUP_SHORTCUT(toggle_lock_zoom_command, toggle_lock_zoom_slot())
+	SETUP_SHORTCUT(go_to_start_command, go_to_start())
+	SETUP_SHORTCUT(go_to_end_command, go_to_end())
+	SETUP_SHORTCUT(toggle_fullscreen_command, toggle_fullscreen())
+	SETUP_SHORTCUT(rotate_left_command, rotate_left())
+	SETUP_SHORTCUT(rotate_right_command, rotate_right())
+	SETUP_SHORTCUT(rotate_left_fine_command, rotate_left_fine())
+	SETUP_SHORTCUT(rotate_right_fine_command, rotate_right_fine())
+	SETUP_SHORTCUT(flip_h_command, flip_h())
+	SETUP_SHORTCUT(flip_v_command, flip_v())
+	SETUP_SHORTCUT(minimize_command, minimize_slot())
+	SETUP_SHORTCUT(minimize_all_command, minimize_all_slot())
+	SETUP_SHORTCUT(show_options_command, show_options_dialog())
+	SETUP_SHORTCUT(undo_filter_command, undo_filter_slot())
+	SETUP_SHORTCUT(redo_filter_command, redo_filter_slot())
+};
 
+void MainWindow::setup_shortcuts(){
 	for (auto &c : this->connections)
 		this->disconnect(c);
 	
@@ -54,7 +56,7 @@ void MainWindow::setup_shortcuts(){
 	this->shortcuts.clear();
 
 	auto &shortcuts = this->app->get_shortcuts();
-	for (auto &p : pairs){
+	for (auto &p : shortcut_slots){
 		auto setting = shortcuts.get_shortcut_setting(p.command);
 		if (!setting)
 			continue;
@@ -70,6 +72,19 @@ void MainWindow::setup_shortcut(const QKeySequence &sequence, const char *slot){
 	this->connections.push_back(connection);
 }
 
+bool MainWindow::run_command(const QString &command){
+	for (auto &p : shortcut_slots){
+		if (command != p.command)
+			continue;
+		// SLOT() prepends a code to the signature, and invokeMethod() wants
+		// just the name.
+		QByteArray name(p.slot + 1);
+		name.chop(2);
+		return QMetaObject::invokeMethod(this, name.constData(), Qt::DirectConnection);
+	}
+	return false;
+}
+
 void MainWindow::quit_slot(){
 	this->app->quit();
 }
@@ -0,0 +1,154 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "MetadataCache.h"
+#include <QFile>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDataStream>
+#include <QDateTime>
+#include <algorithm>
+#include <vector>
+
+static const quint32 cache_magic = 0x424C4D43;
+static const quint32 cache_version = 1;
+
+static bool stat_file(const QString &path, QString &key, qint64 &size, qint64 &modified){
+	QFileInfo info(path);
+	if (!info.isFile())
+		return false;
+	key = info.absoluteFilePath();
+	size = info.size();
+	modified = info.lastModified().toMSecsSinceEpoch();
+	return true;
+}
+
+MetadataCache::MetadataCache(const QString &path): path(path), loaded(false), dirty(false){}
+
+MetadataCache::~MetadataCache(){
+	this->save();
+}
+
+void MetadataCache::load(){
+	if (this->loaded)
+		return;
+	this->loaded = true;
+	QFile file(this->path);
+	if (!file.open(QFile::ReadOnly))
+		return;
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_0);
+	quint32 magic, version, count;
+	stream >> magic >> version >> count;
+	// A cache written by some other version is simply started over.
+	if (magic != cache_magic || version != cache_version)
+		return;
+	for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++){
+		QString key;
+		Entry entry;
+		bool has_color;
+		QRgb color;
+		stream
+			>> key
+			>> entry.file_size
+			>> entry.modified
+			>> entry.last_used
+			>> entry.metadata.size
+			>> entry.metadata.alpha
+			>> has_color
+			>> color
+			>> entry.metadata.decode_ms;
+		if (stream.status() != QDataStream::Ok)
+			break;
+		if (has_color)
+			entry.metadata.background_color = QColor::fromRgba(color);
+		this->entries[key] = entry;
+	}
+}
+
+void MetadataCache::evict(){
+	if (this->entries.size() <= max_entries)
+		return;
+	// Drop the least recently used eighth, so this doesn't happen on every put.
+	std::vector<qint64> times;
+	times.reserve(this->entries.size());
+	for (auto &e : this->entries)
+		times.push_back(e.last_used);
+	auto nth = times.begin() + times.size() / 8;
+	std::nth_element(times.begin(), nth, times.end());
+	auto cutoff = *nth;
+	for (auto it = this->entries.begin(); it != this->entries.end();){
+		if (it->last_used <= cutoff)
+			it = this->entries.erase(it);
+		else
+			++it;
+	}
+}
+
+bool MetadataCache::get(const QString &path, ImageMetadata &dst){
+	QString key;
+	qint64 size, modified;
+	if (!stat_file(path, key, size, modified))
+		return false;
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->load();
+	auto it = this->entries.find(key);
+	if (it == this->entries.end())
+		return false;
+	if (it->file_size != size || it->modified != modified){
+		this->entries.erase(it);
+		this->dirty = true;
+		return false;
+	}
+	it->last_used = QDateTime::currentMSecsSinceEpoch();
+	dst = it->metadata;
+	return true;
+}
+
+void MetadataCache::put(const QString &path, const ImageMetadata &metadata){
+	Entry entry;
+	QString key;
+	if (!stat_file(path, key, entry.file_size, entry.modified))
+		return;
+	entry.last_used = QDateTime::currentMSecsSinceEpoch();
+	entry.metadata = metadata;
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->load();
+	this->entries[key] = entry;
+	this->dirty = true;
+	this->evict();
+}
+
+void MetadataCache::save(){
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (!this->dirty || this->path.isEmpty())
+		return;
+	QDir().mkpath(QFileInfo(this->path).absolutePath());
+	QSaveFile file(this->path);
+	if (!file.open(QFile::WriteOnly))
+		return;
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_0);
+	stream << cache_magic << cache_version << (quint32)this->entries.size();
+	for (auto it = this->entries.begin(); it != this->entries.end(); ++it){
+		auto &entry = it.value();
+		auto &color = entry.metadata.background_color;
+		stream
+			<< it.key()
+			<< entry.file_size
+			<< entry.modified
+			<< entry.last_used
+			<< entry.metadata.size
+			<< entry.metadata.alpha
+			<< color.isValid()
+			<< (color.isValid() ? color.rgba() : (QRgb)0)
+			<< entry.metadata.decode_ms;
+	}
+	if (file.commit())
+		this->dirty = false;
+}
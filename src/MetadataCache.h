@@ -0,0 +1,56 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef METADATACACHE_H
+#define METADATACACHE_H
+
+#include <QString>
+#include <QSize>
+#include <QColor>
+#include <QHash>
+#include <mutex>
+
+struct ImageMetadata{
+	QSize size;
+	bool alpha;
+	// Invalid if it hasn't been computed yet.
+	QColor background_color;
+	qint64 decode_ms;
+
+	ImageMetadata(): alpha(false), decode_ms(-1){}
+};
+
+// Remembers what was learned about each image the last time it was opened,
+// so it doesn't have to be computed again. Entries are keyed by the absolute
+// path and are only returned while the file's size and modification time
+// still match. The whole cache is kept in a single file, which is read on
+// first use and written back by save(). Thread-safe.
+class MetadataCache{
+	struct Entry{
+		qint64 file_size,
+			modified,
+			last_used;
+		ImageMetadata metadata;
+	};
+	QString path;
+	std::mutex mutex;
+	QHash<QString, Entry> entries;
+	bool loaded,
+		dirty;
+	static const int max_entries = 16384;
+
+	void load();
+	void evict();
+public:
+	MetadataCache(const QString &path);
+	~MetadataCache();
+	bool get(const QString &path, ImageMetadata &);
+	void put(const QString &path, const ImageMetadata &);
+	void save();
+};
+
+#endif
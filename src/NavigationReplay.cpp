@@ -0,0 +1,243 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "NavigationReplay.h"
+#include "MainWindow.h"
+#include "ImageViewport.h"
+#include "DirectoryListing.h"
+#include "bench/BenchUtility.h"
+#include "plugin-core/Trace.h"
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QTimer>
+
+// A command whose result hasn't been painted by then is given up on.
+static const int paint_timeout_ms = 5000;
+
+bool NavigationReplay::load(const QString &path, QString &error){
+	QFile file(path);
+	if (!file.open(QFile::ReadOnly | QFile::Text)){
+		error = "Can't open " + path;
+		return false;
+	}
+	QTextStream stream(&file);
+	int line_number = 0;
+	while (!stream.atEnd()){
+		auto line = stream.readLine().trimmed();
+		line_number++;
+		if (line.isEmpty() || line.startsWith('#'))
+			continue;
+		Step step;
+		step.line = line_number;
+		step.count = 1;
+		auto space = line.indexOf(' ');
+		step.command = line.left(space);
+		if (space >= 0)
+			step.argument = line.mid(space + 1).trimmed();
+		bool ok = true;
+		if (step.command == "open")
+			ok = !step.argument.isEmpty();
+		else if (step.command == "wait")
+			step.count = step.argument.toInt(&ok);
+		else if (!step.argument.isEmpty())
+			step.count = step.argument.toInt(&ok);
+		// The window has to outlive the script.
+		if (step.command == "close" || step.command == "quit" || step.command == "quit2")
+			ok = false;
+		if (!ok || step.count < 0){
+			error = QString("%1:%2: invalid step.").arg(path).arg(line_number);
+			return false;
+		}
+		this->steps.push_back(step);
+	}
+	if (!this->steps.size() || this->steps.front().command != "open"){
+		error = path + ": the script must begin by opening something.";
+		return false;
+	}
+	return true;
+}
+
+static void pump_events(int ms){
+	QElapsedTimer timer;
+	timer.start();
+	do
+		QApplication::processEvents(QEventLoop::AllEvents, 10);
+	while (timer.elapsed() < ms);
+}
+
+// Runs action, which may replace window, and waits for the first paint of
+// window's viewport that shows an image. Returns false if there was none.
+static bool measure(MainWindow *&window, const std::function<void()> &action, double &ms){
+	QEventLoop loop;
+	QElapsedTimer timer;
+	bool painted = false;
+	ImageViewport *viewport = nullptr;
+	auto attach = [&](){
+		viewport = window->get_viewport();
+		viewport->set_paint_callback([&](){
+			// While the pixels are still being decoded, only the background
+			// is shown.
+			if (painted || viewport->is_pending())
+				return;
+			ms = timer.nsecsElapsed() * 1e-6;
+			painted = true;
+			loop.quit();
+		});
+	};
+	auto previous = window;
+	timer.start();
+	// Some commands repaint before returning.
+	if (window)
+		attach();
+	action();
+	if (window != previous){
+		if (viewport)
+			viewport->set_paint_callback(nullptr);
+		viewport = nullptr;
+		if (window)
+			attach();
+	}
+	if (!viewport)
+		return false;
+	if (!painted){
+		QTimer timeout;
+		timeout.setSingleShot(true);
+		QObject::connect(&timeout, &QTimer::timeout, &loop, &QEventLoop::quit);
+		timeout.start(paint_timeout_ms);
+		loop.exec();
+	}
+	viewport->set_paint_callback(nullptr);
+	return painted;
+}
+
+static void close_window(MainWindow *&window){
+	if (!window)
+		return;
+	// The way the close shortcut does it, as the window is destroyed as soon
+	// as it's closed.
+	window->close_slot();
+	QApplication::processEvents();
+	window = nullptr;
+}
+
+void NavigationReplay::record(const QString &command, bool painted, double ms){
+	if (!this->commands.contains(command))
+		this->commands << command;
+	if (painted)
+		this->latencies[command].push_back(ms);
+	else
+		this->timeouts[command]++;
+}
+
+bool NavigationReplay::run(const open_callback &open, QString &error){
+	MainWindow *window = nullptr;
+	bool ret = true;
+	for (auto &step : this->steps){
+		if (step.command == "wait"){
+			pump_events(step.count);
+			continue;
+		}
+		if (step.command == "open"){
+			auto path = QFileInfo(step.argument).absoluteFilePath();
+			if (QFileInfo(path).isDir()){
+				DirectoryListing listing(path);
+				if (!listing || !listing.size()){
+					error = QString("Line %1: no images in %2").arg(step.line).arg(path);
+					ret = false;
+					break;
+				}
+				path = listing[0];
+			}
+			close_window(window);
+			double ms = 0;
+			trace_begin("replay open");
+			bool painted = measure(window, [&](){ window = open(path); }, ms);
+			trace_end();
+			if (!window){
+				error = QString("Line %1: can't open %2").arg(step.line).arg(path);
+				ret = false;
+				break;
+			}
+			this->record(step.command, painted, ms);
+			continue;
+		}
+		bool known = true;
+		auto trace_name = ("replay " + step.command).toStdString();
+		for (int i = 0; i < step.count && known; i++){
+			double ms = 0;
+			trace_begin(trace_name);
+			bool painted = measure(window, [&](){ known = window->run_command(step.command); }, ms);
+			trace_end();
+			if (known)
+				this->record(step.command, painted, ms);
+		}
+		if (!known){
+			error = QString("Line %1: unknown command %2").arg(step.line).arg(step.command);
+			ret = false;
+			break;
+		}
+	}
+	close_window(window);
+	return ret;
+}
+
+static void add_row(BenchReport &report, const QString &command, const std::vector<double> &samples, int timeouts){
+	auto stats = Statistics::compute(samples);
+	report.add_row(QVariantList()
+		<< command
+		<< (qulonglong)stats.samples
+		<< timeouts
+		<< stats.median
+		<< stats.p95
+		<< stats.p99
+		<< stats.mean
+		<< stats.max
+	);
+}
+
+static BenchReport make_report(const QStringList &commands, const std::map<QString, std::vector<double>> &latencies, const std::map<QString, int> &timeouts){
+	BenchReport ret(QStringList()
+		<< "command"
+		<< "samples"
+		<< "timeouts"
+		<< "p50_ms"
+		<< "p95_ms"
+		<< "p99_ms"
+		<< "mean_ms"
+		<< "max_ms"
+	);
+	std::vector<double> all;
+	int all_timeouts = 0;
+	for (auto &command : commands){
+		std::vector<double> samples;
+		auto it = latencies.find(command);
+		if (it != latencies.end())
+			samples = it->second;
+		auto it2 = timeouts.find(command);
+		int count = it2 != timeouts.end() ? it2->second : 0;
+		add_row(ret, command, samples, count);
+		all.insert(all.end(), samples.begin(), samples.end());
+		all_timeouts += count;
+	}
+	add_row(ret, "all", all, all_timeouts);
+	return ret;
+}
+
+void NavigationReplay::print_summary() const{
+	make_report(this->commands, this->latencies, this->timeouts).print();
+}
+
+bool NavigationReplay::write_report(const QString &path) const{
+	auto report = make_report(this->commands, this->latencies, this->timeouts);
+	if (path.endsWith(".csv", Qt::CaseInsensitive))
+		return report.write_csv(path);
+	return report.write_json(path);
+}
@@ -0,0 +1,58 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef NAVIGATIONREPLAY_H
+#define NAVIGATIONREPLAY_H
+
+#include <QString>
+#include <QStringList>
+#include <functional>
+#include <map>
+#include <vector>
+
+class MainWindow;
+
+// Plays a scripted session on a real window, and measures for every command
+// the time from issuing it to the first paint that shows its result. A script
+// has one step per line:
+//
+//     open <file or directory>
+//     <command> [<count>]
+//     wait <milliseconds>
+//
+// where <command> is the internal name of a shortcut command, such as next,
+// back, zoom_in, rotate_right or toggle_fullscreen. Empty lines and lines
+// starting with # are ignored.
+class NavigationReplay{
+public:
+	// Opens a window showing path. Returns null on failure.
+	typedef std::function<MainWindow *(const QString &path)> open_callback;
+private:
+	struct Step{
+		int line;
+		QString command;
+		QString argument;
+		int count;
+	};
+	std::vector<Step> steps;
+	// In milliseconds, by command.
+	std::map<QString, std::vector<double>> latencies;
+	// Commands whose result was never painted.
+	std::map<QString, int> timeouts;
+	// Commands in the order they first appear.
+	QStringList commands;
+
+	void record(const QString &command, bool painted, double ms);
+public:
+	bool load(const QString &path, QString &error);
+	bool run(const open_callback &, QString &error);
+	void print_summary() const;
+	// As CSV if the path ends in .csv, otherwise as JSON.
+	bool write_report(const QString &path) const;
+};
+
+#endif
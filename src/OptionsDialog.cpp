@@ -214,6 +214,7 @@ void OptionsDialog::setup_general_options(){
 	this->ui->clamp_to_edges_cb->setChecked(this->options->get_clamp_to_edges());
 	this->ui->save_state_on_exit_cb->setChecked(this->options->get_save_state_on_exit());
     this->ui->keep_application_running_cb->setChecked(this->options->get_keep_application_in_background());
+	this->ui->precompile_cpp_filters_cb->setChecked(this->options->get_precompile_cpp_filters());
 	this->ui->clamp_strength_spinbox->setValue(this->options->get_clamp_strength());
 	this->ui->zoom_mode_for_new_windows_cb->set_selected_item(this->options->get_zoom_mode_for_new_windows());
 	this->ui->fullscreen_zoom_mode_for_new_windows_cb->set_selected_item(this->options->get_fullscreen_zoom_mode_for_new_windows());
@@ -290,6 +291,7 @@ std::shared_ptr<MainSettings> OptionsDialog::build_options(){
 	ret->set_clamp_to_edges(this->ui->clamp_to_edges_cb->isChecked());
 	ret->set_save_state_on_exit(this->ui->save_state_on_exit_cb->isChecked());
 	ret->set_keep_application_in_background(this->ui->keep_application_running_cb->isChecked());
+	ret->set_precompile_cpp_filters(this->ui->precompile_cpp_filters_cb->isChecked());
 	ret->set_clamp_strength(this->ui->clamp_strength_spinbox->value());
 	ret->set_zoom_mode_for_new_windows(this->ui->zoom_mode_for_new_windows_cb->get_selected_item());
 	ret->set_fullscreen_zoom_mode_for_new_windows(this->ui->fullscreen_zoom_mode_for_new_windows_cb->get_selected_item());
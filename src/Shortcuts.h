@@ -35,6 +35,7 @@ DECLARE_COMMAND_INTERNAL_NAME(minimize_all);
 DECLARE_COMMAND_INTERNAL_NAME(next);
 DECLARE_COMMAND_INTERNAL_NAME(quit);
 DECLARE_COMMAND_INTERNAL_NAME(quit2);
+DECLARE_COMMAND_INTERNAL_NAME(redo_filter);
 DECLARE_COMMAND_INTERNAL_NAME(reset_zoom);
 DECLARE_COMMAND_INTERNAL_NAME(right);
 DECLARE_COMMAND_INTERNAL_NAME(right_big);
@@ -45,6 +46,7 @@ DECLARE_COMMAND_INTERNAL_NAME(rotate_right_fine);
 DECLARE_COMMAND_INTERNAL_NAME(show_options);
 DECLARE_COMMAND_INTERNAL_NAME(toggle_fullscreen);
 DECLARE_COMMAND_INTERNAL_NAME(toggle_lock_zoom);
+DECLARE_COMMAND_INTERNAL_NAME(undo_filter);
 DECLARE_COMMAND_INTERNAL_NAME(up);
 DECLARE_COMMAND_INTERNAL_NAME(up_big);
 DECLARE_COMMAND_INTERNAL_NAME(zoom_in);
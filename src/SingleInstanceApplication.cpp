@@ -7,13 +7,18 @@ Distributed under a permissive license. See COPYING.txt for details.
 
 #include "SingleInstanceApplication.h"
 #include "GenericException.h"
+#include "plugin-core/Trace.h"
 #include <QtNetwork/QLocalSocket>
 #include <QDataStream>
+#include <QDateTime>
+#include <QtEndian>
 #include <exception>
 #include "Misc.h"
 #include "MainWindow.h"
 #include <QProcess>
+#include <QFileInfo>
 #include <fstream>
+#include <cstring>
 
 //#define DISABLE_SINGLE_INSTANCE
 
@@ -29,22 +34,58 @@ void allow_set_foreground_window(qulonglong){
 }
 #endif
 
+// The arguments may be forwarded to an instance running in a different working
+// directory, so relative paths are resolved here.
+static QStringList make_paths_absolute(QStringList args){
+	for (int i = 1; i < args.size(); i++)
+		if (!args[i].startsWith('-'))
+			args[i] = QFileInfo(args[i]).absoluteFilePath();
+	return args;
+}
+
+bool SingleInstanceApplication::forward_to_running_instance(int &argc, char **argv, const QString &unique_name){
+#ifdef DISABLE_SINGLE_INSTANCE
+	return false;
+#else
+	TRACE_SCOPE("SingleInstanceApplication::forward_to_running_instance");
+	auto launch_time = QDateTime::currentMSecsSinceEpoch();
+	qint64 server_pid;
+	{
+		// Much cheaper than a QApplication, and still gets the arguments
+		// right on Windows.
+		QCoreApplication app(argc, argv);
+		auto args = app.arguments();
+		trace_strip_arguments(args);
+		// Fails immediately if no server is listening.
+		if (!send_arguments(unique_name, make_paths_absolute(args), launch_time, server_pid))
+			return false;
+	}
+	allow_set_foreground_window(server_pid);
+	return true;
+#endif
+}
+
 SingleInstanceApplication::SingleInstanceApplication(int &argc, char **argv, const QString &unique_name):
 		QApplication(argc, argv),
 		running(false),
 		unique_name(unique_name){
+	TRACE_SCOPE("SingleInstanceApplication::SingleInstanceApplication");
 #ifndef DISABLE_SINGLE_INSTANCE
-	this->args = this->arguments();
+	auto args = this->arguments();
+	trace_strip_arguments(args);
+	this->args = make_paths_absolute(args);
+	// Standalone instances neither hand their arguments over nor take any.
+	if (unique_name.isEmpty())
+		return;
 	bool success = false;
 	for (int tries = 0; tries < 5 && !success; tries++){
 		this->shared_memory.reset(new QSharedMemory);
 		this->shared_memory->setKey(unique_name);
 		for (; tries < 5 && !success; tries++){
 			if (this->shared_memory->attach()){
-				QLocalSocket socket(this);
 				this->running = true;
 				qint64 server_pid;
-				if (this->communicate_with_server(socket, server_pid, this->arguments()))
+				if (send_arguments(unique_name, this->args, QDateTime::currentMSecsSinceEpoch(), server_pid))
 					allow_set_foreground_window(server_pid);
 				else{
 					this->clear_shared_memory();
@@ -75,53 +116,74 @@ void SingleInstanceApplication::clear_shared_memory(){
 #endif
 }
 
+// Messages are read as they come in, rather than by waiting on the socket, so
+// the GUI thread never blocks on the other process.
 void SingleInstanceApplication::receive_message(){
-	auto socket = this->local_server->nextPendingConnection();
-	if (!socket->waitForReadyRead(this->timeout))
+	while (auto socket = this->local_server->nextPendingConnection()){
+		connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+		connect(socket, &QLocalSocket::readyRead, this, [this, socket](){ this->read_message(*socket); });
+		if (socket->bytesAvailable())
+			this->read_message(*socket);
+	}
+}
+
+void SingleInstanceApplication::read_message(QLocalSocket &socket){
+	// A message is a QByteArray as written by QDataStream, i.e. a big endian
+	// 32-bit size followed by the data.
+	if (socket.bytesAvailable() < 4)
+		return;
+	auto header = socket.peek(4);
+	auto size = qFromBigEndian<quint32>((const uchar *)header.constData());
+	if (socket.bytesAvailable() < 4 + (qint64)size)
 		return;
+	QByteArray payload;
+	QDataStream(&socket) >> payload;
+	auto received = QDateTime::currentMSecsSinceEpoch();
 
-	auto byte_msg = socket->readAll();
+	qint64 launch_time;
+	QStringList args;
+	QDataStream stream(payload);
+	stream >> launch_time >> args;
 	{
 		qint64 pid = this->applicationPid();
-		socket->write(QByteArray((const char *)&pid, sizeof(pid)));
-		socket->waitForBytesWritten(this->timeout);
+		socket.write(QByteArray((const char *)&pid, sizeof(pid)));
+		socket.flush();
 	}
-	socket->waitForDisconnected(this->timeout);
-	this->new_instance(to_QStringList(byte_msg));
-}
-
-bool SingleInstanceApplication::communicate_with_server(QLocalSocket &socket, qint64 &server_pid, const QStringList &list){
-	QByteArray response;
-	if (!this->communicate_with_server(socket, response, to_QByteArray(list)))
-		return false;
-	server_pid = 0;
-	union{
-		unsigned char buf[sizeof(qint64)];
-		qint64 pid;
-	} u;
-	for (int i = 0; i < response.size(); i++)
-		u.buf[i] = response[i];
-	server_pid = u.pid;
-	return true;
+	{
+		TRACE_SCOPE("SingleInstanceApplication::new_instance");
+		this->new_instance(args);
+	}
+	qDebug() << "SingleInstanceApplication: arguments arrived" << received - launch_time << "ms after launch, handled" << QDateTime::currentMSecsSinceEpoch() - launch_time << "ms after launch.";
 }
 
-bool SingleInstanceApplication::communicate_with_server(QLocalSocket &socket, QByteArray &response, const QByteArray &msg){
-	if (!this->running)
-		return false;
-	socket.connectToServer(this->unique_name, QIODevice::ReadWrite);
-	if (!socket.waitForConnected(this->timeout)){
+bool SingleInstanceApplication::send_arguments(const QString &unique_name, const QStringList &args, qint64 launch_time, qint64 &server_pid){
+	QLocalSocket socket;
+	socket.connectToServer(unique_name, QIODevice::ReadWrite);
+	if (!socket.waitForConnected(timeout)){
 		qDebug() << socket.errorString().toLatin1();
 		return false;
 	}
-	socket.write(msg);
-	if (!socket.waitForBytesWritten(this->timeout)){
-		qDebug() << socket.errorString().toLatin1();
-		return false;
+	QByteArray payload;
+	{
+		QDataStream stream(&payload, QIODevice::WriteOnly);
+		stream << launch_time << args;
 	}
-	if (!socket.waitForReadyRead(this->timeout)){
+	{
+		QDataStream stream(&socket);
+		stream << payload;
+	}
+	if (!socket.waitForBytesWritten(timeout)){
 		qDebug() << socket.errorString().toLatin1();
 		return false;
 	}
-	response = socket.readAll();
+	while (socket.bytesAvailable() < (qint64)sizeof(server_pid)){
+		if (!socket.waitForReadyRead(timeout)){
+			qDebug() << socket.errorString().toLatin1();
+			return false;
+		}
+	}
+	auto response = socket.read(sizeof(server_pid));
+	memcpy(&server_pid, response.constData(), sizeof(server_pid));
+	socket.disconnectFromServer();
 	return true;
 }
@@ -21,6 +21,7 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include <exception>
 
 class MainWindow;
+class QLocalSocket;
 
 class ApplicationAlreadyRunningException : public std::exception{};
 
@@ -37,8 +38,8 @@ class SingleInstanceApplication : public QApplication{
 	bool send_message(const QString &s){
 		return this->send_message(s.toUtf8());
 	}
-	bool communicate_with_server(QLocalSocket &socket, qint64 &server_pid, const QStringList &list);
-	bool communicate_with_server(QLocalSocket &socket, QByteArray &response, const QByteArray &msg);
+	static bool send_arguments(const QString &unique_name, const QStringList &args, qint64 launch_time, qint64 &server_pid);
+	void read_message(QLocalSocket &);
 	void clear_shared_memory();
 
 protected:
@@ -47,7 +48,13 @@ protected:
 
 public:
 	//May throw ApplicationAlreadyRunningException.
+	// If unique_name is empty, the application runs on its own, whether or
+	// not another instance is running.
 	explicit SingleInstanceApplication(int &argc, char **argv, const QString &unique_name);
+	// Meant to be called first thing in main(). If an instance is already
+	// running, hands it the arguments and returns true, without ever
+	// constructing a QApplication.
+	static bool forward_to_running_instance(int &argc, char **argv, const QString &unique_name);
 	bool is_running() const{
 		return this->running;
 	}
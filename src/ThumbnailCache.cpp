@@ -0,0 +1,100 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "ThumbnailCache.h"
+#include "plugin-core/Trace.h"
+#include <QStandardPaths>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDateTime>
+#include <QImageReader>
+#include <QCryptographicHash>
+#include <QUrl>
+
+static const QFile::Permissions private_directory = QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner;
+static const QFile::Permissions private_file = QFile::ReadOwner | QFile::WriteOwner;
+
+ThumbnailCache::ThumbnailCache(){
+	auto base = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+	if (base.isEmpty())
+		return;
+	this->root = QDir::cleanPath(base + "/thumbnails") + "/";
+	auto location = this->root + "normal/";
+	if (!QDir().mkpath(location))
+		return;
+	// The standard requires that nobody else can see what's been viewed.
+	QFile::setPermissions(this->root, private_directory);
+	QFile::setPermissions(location, private_directory);
+	this->location = location;
+}
+
+QString ThumbnailCache::get_path(const QByteArray &uri) const{
+	return this->location + QString::fromLatin1(QCryptographicHash::hash(uri, QCryptographicHash::Md5).toHex()) + ".png";
+}
+
+QImage ThumbnailCache::generate(const QString &path, QSize *original_size){
+	QImageReader reader(path);
+	auto size = reader.size();
+	if (original_size)
+		*original_size = size;
+	bool too_large = size.width() > thumbnail_size || size.height() > thumbnail_size;
+	// Lets the JPEG plugin decode at 1/2, 1/4 or 1/8 of the size, and SVGs be
+	// rendered at the size directly.
+	if (size.isValid() && too_large)
+		reader.setScaledSize(size.scaled(thumbnail_size, thumbnail_size, Qt::KeepAspectRatio));
+	auto ret = reader.read();
+	if (ret.isNull())
+		return ret;
+	if (ret.width() > thumbnail_size || ret.height() > thumbnail_size)
+		ret = ret.scaled(thumbnail_size, thumbnail_size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+	if (original_size && !original_size->isValid())
+		*original_size = ret.size();
+	return ret;
+}
+
+QImage ThumbnailCache::get(const QString &path) const{
+	TRACE_SCOPE("ThumbnailCache::get");
+	QFileInfo info(path);
+	if (!info.isFile())
+		return QImage();
+	auto absolute = info.absoluteFilePath();
+	// Thumbnails of thumbnails aren't stored.
+	bool cacheable = !this->location.isEmpty() && !absolute.startsWith(this->root);
+	auto uri = QUrl::fromLocalFile(absolute).toEncoded();
+	auto mtime = QString::number(info.lastModified().toMSecsSinceEpoch() / 1000);
+	QString cached;
+	if (cacheable){
+		cached = this->get_path(uri);
+		QImageReader reader(cached, "png");
+		// The text chunks come before the pixels, so stale entries are
+		// rejected without being decoded.
+		if (reader.text("Thumb::MTime") == mtime && reader.text("Thumb::URI") == QString::fromLatin1(uri)){
+			auto ret = reader.read();
+			if (!ret.isNull())
+				return ret;
+		}
+	}
+
+	QSize original_size;
+	auto ret = generate(path, &original_size);
+	if (ret.isNull() || !cacheable)
+		return ret;
+	ret.setText("Thumb::URI", QString::fromLatin1(uri));
+	ret.setText("Thumb::MTime", mtime);
+	ret.setText("Thumb::Size", QString::number(info.size()));
+	ret.setText("Thumb::Image::Width", QString::number(original_size.width()));
+	ret.setText("Thumb::Image::Height", QString::number(original_size.height()));
+	ret.setText("Software", "Borderless");
+	// QSaveFile writes to a temporary file and renames it, as the standard
+	// asks, so other readers never see a partial thumbnail.
+	QSaveFile file(cached);
+	if (file.open(QFile::WriteOnly) && ret.save(&file, "PNG") && file.commit())
+		QFile::setPermissions(cached, private_file);
+	return ret;
+}
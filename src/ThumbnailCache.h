@@ -0,0 +1,35 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QString>
+#include <QImage>
+
+// The largest side of a thumbnail, i.e. the "normal" size of the standard.
+const int thumbnail_size = 128;
+
+// Reads and writes thumbnails in the cache described by the freedesktop.org
+// Thumbnail Managing Standard, so they're shared with file managers and other
+// viewers. get() may be called from any thread.
+class ThumbnailCache{
+	QString location,
+		root;
+
+	QString get_path(const QByteArray &uri) const;
+public:
+	ThumbnailCache();
+	// Returns the thumbnail from the cache if it's up to date, otherwise
+	// generates it and stores it. Null if the image can't be read.
+	QImage get(const QString &path) const;
+	// Generates a thumbnail without touching the cache. Only as much of the
+	// image is decoded as the format allows for the size.
+	static QImage generate(const QString &path, QSize *original_size = nullptr);
+};
+
+#endif
@@ -0,0 +1,230 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "ThumbnailGrid.h"
+#include "plugin-core/Trace.h"
+#include <QPainter>
+#include <QPaintEvent>
+#include <QMouseEvent>
+#include <QScrollBar>
+#include <QThread>
+#include <QDir>
+#include <algorithm>
+#include <limits>
+
+static const int cell_padding = 6;
+// Past this, the least recently drawn thumbnails are dropped from memory.
+static const int max_thumbnail_kib = 64 << 10;
+static const int collect_interval_ms = 15;
+
+ThumbnailGrid::ThumbnailGrid(const QString &directory, QWidget *parent):
+		QAbstractScrollArea(parent),
+		listing(directory),
+		count(0),
+		thumbnails(max_thumbnail_kib),
+		stop(false){
+	if (this->listing)
+		this->count = this->listing.size();
+	this->setWindowFlags(Qt::Window);
+	this->setAttribute(Qt::WA_DeleteOnClose);
+	this->setWindowTitle(directory);
+	this->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+	this->viewport()->setAutoFillBackground(false);
+	this->resize(this->get_cell_width() * 6 + this->verticalScrollBar()->sizeHint().width(), this->get_cell_height() * 4);
+
+	this->collect_timer.setInterval(collect_interval_ms);
+	QObject::connect(&this->collect_timer, &QTimer::timeout, [this](){ this->collect(); });
+
+	// The GUI thread only draws, so it's left a core of its own.
+	auto n = std::max(QThread::idealThreadCount() - 1, 1);
+	for (int i = 0; i < n; i++)
+		this->workers.emplace_back([this](){ this->worker_loop(); });
+}
+
+ThumbnailGrid::~ThumbnailGrid(){
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stop = true;
+		this->queue.clear();
+	}
+	this->cv.notify_all();
+	for (auto &t : this->workers)
+		t.join();
+}
+
+int ThumbnailGrid::get_cell_width() const{
+	return thumbnail_size + cell_padding * 2;
+}
+
+int ThumbnailGrid::get_cell_height() const{
+	return thumbnail_size + cell_padding * 3 + this->fontMetrics().height();
+}
+
+int ThumbnailGrid::get_columns() const{
+	return std::max(this->viewport()->width() / this->get_cell_width(), 1);
+}
+
+void ThumbnailGrid::update_scrollbar(){
+	auto columns = this->get_columns();
+	auto rows = (qint64)((this->count + columns - 1) / columns);
+	auto height = this->viewport()->height();
+	auto content = std::min<qint64>(rows * this->get_cell_height(), std::numeric_limits<int>::max());
+	auto bar = this->verticalScrollBar();
+	bar->setRange(0, (int)std::max<qint64>(content - height, 0));
+	bar->setPageStep(height);
+	bar->setSingleStep(this->get_cell_height() / 2);
+}
+
+QString ThumbnailGrid::get_filename(size_t i) const{
+	auto path = this->listing[i];
+	return path.mid(path.lastIndexOf(QDir::separator()) + 1);
+}
+
+void ThumbnailGrid::request_visible(){
+	if (!this->count)
+		return;
+	auto columns = (size_t)this->get_columns();
+	auto cell_height = this->get_cell_height();
+	auto top = this->verticalScrollBar()->value();
+	auto height = this->viewport()->height();
+	auto first_row = (size_t)(top / cell_height);
+	auto last_row = (size_t)((top + height) / cell_height);
+	auto page_rows = last_row - first_row + 1;
+	// What's on screen, then the page below, then the page above.
+	std::vector<size_t> wanted;
+	auto add_rows = [&](size_t begin, size_t end){
+		for (auto i = begin * columns; i < std::min(end * columns, this->count); i++)
+			if (!this->thumbnails.contains(i) && !this->failed.contains(i))
+				wanted.push_back(i);
+	};
+	add_rows(first_row, last_row + 1);
+	add_rows(last_row + 1, last_row + 1 + page_rows);
+	add_rows(first_row - std::min(first_row, page_rows), first_row);
+
+	std::deque<std::pair<size_t, QString>> queue;
+	for (auto i : wanted)
+		queue.emplace_back(i, this->listing[i]);
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		// Whatever was queued for a part of the directory that's no longer
+		// near the screen is dropped.
+		this->queue.clear();
+		for (auto &item : queue)
+			if (!this->in_flight.count(item.first))
+				this->queue.push_back(item);
+		if (!this->queue.size() && !this->in_flight.size())
+			return;
+	}
+	this->cv.notify_all();
+	if (!this->collect_timer.isActive())
+		this->collect_timer.start();
+}
+
+void ThumbnailGrid::worker_loop(){
+	trace_set_thread_name("Thumbnail worker");
+	while (true){
+		std::pair<size_t, QString> item;
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->cv.wait(lock, [this](){ return this->stop || this->queue.size(); });
+			if (this->stop)
+				return;
+			item = this->queue.front();
+			this->queue.pop_front();
+			this->in_flight.insert(item.first);
+		}
+		auto image = this->cache.get(item.second);
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->finished.emplace_back(item.first, image);
+	}
+}
+
+void ThumbnailGrid::collect(){
+	std::vector<std::pair<size_t, QImage>> finished;
+	bool idle;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		finished.swap(this->finished);
+		for (auto &item : finished)
+			this->in_flight.erase(item.first);
+		idle = !this->queue.size() && !this->in_flight.size();
+	}
+	if (idle)
+		this->collect_timer.stop();
+	if (!finished.size())
+		return;
+	for (auto &item : finished){
+		if (item.second.isNull()){
+			this->failed.insert(item.first);
+			continue;
+		}
+		auto cost = std::max(item.second.width() * item.second.height() * 4 / 1024, 1);
+		this->thumbnails.insert(item.first, new QPixmap(QPixmap::fromImage(item.second)), cost);
+	}
+	this->viewport()->update();
+}
+
+void ThumbnailGrid::paintEvent(QPaintEvent *ev){
+	TRACE_SCOPE("ThumbnailGrid::paintEvent");
+	QPainter painter(this->viewport());
+	painter.fillRect(ev->rect(), Qt::black);
+	if (!this->count)
+		return;
+	auto columns = (size_t)this->get_columns();
+	auto cell_width = this->get_cell_width();
+	auto cell_height = this->get_cell_height();
+	auto top = this->verticalScrollBar()->value();
+	auto height = this->viewport()->height();
+	auto first_row = (size_t)(top / cell_height);
+	auto last_row = (size_t)((top + height) / cell_height);
+	auto metrics = this->fontMetrics();
+	painter.setPen(Qt::white);
+	for (auto row = first_row; row <= last_row; row++){
+		for (size_t column = 0; column < columns; column++){
+			auto i = row * columns + column;
+			if (i >= this->count)
+				return;
+			QRect cell((int)column * cell_width, (int)(row * cell_height) - top, cell_width, cell_height);
+			if (!cell.intersects(ev->rect()))
+				continue;
+			QRect box(cell.x() + cell_padding, cell.y() + cell_padding, thumbnail_size, thumbnail_size);
+			auto pixmap = this->thumbnails.object(i);
+			if (pixmap){
+				auto size = pixmap->size();
+				QPoint position(
+					box.x() + (thumbnail_size - size.width()) / 2,
+					box.y() + (thumbnail_size - size.height()) / 2
+				);
+				painter.drawPixmap(position, *pixmap);
+			}else if (!this->failed.contains(i))
+				painter.fillRect(box, QColor(48, 48, 48));
+			QRect text(cell.x() + cell_padding, box.bottom() + cell_padding, thumbnail_size, metrics.height());
+			painter.drawText(text, Qt::AlignHCenter, metrics.elidedText(this->get_filename(i), Qt::ElideMiddle, thumbnail_size));
+		}
+	}
+}
+
+void ThumbnailGrid::resizeEvent(QResizeEvent *){
+	this->update_scrollbar();
+	this->request_visible();
+}
+
+void ThumbnailGrid::scrollContentsBy(int, int){
+	this->viewport()->update();
+	this->request_visible();
+}
+
+void ThumbnailGrid::mouseDoubleClickEvent(QMouseEvent *ev){
+	auto column = ev->pos().x() / this->get_cell_width();
+	if (column >= this->get_columns())
+		return;
+	auto row = (ev->pos().y() + this->verticalScrollBar()->value()) / this->get_cell_height();
+	auto i = (size_t)row * this->get_columns() + column;
+	if (i >= this->count || !this->activated)
+		return;
+	this->activated(this->listing[i]);
+}
@@ -0,0 +1,73 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef THUMBNAILGRID_H
+#define THUMBNAILGRID_H
+
+#include "DirectoryListing.h"
+#include "ThumbnailCache.h"
+#include <QAbstractScrollArea>
+#include <QCache>
+#include <QPixmap>
+#include <QSet>
+#include <QTimer>
+#include <deque>
+#include <set>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+
+// Shows every image in a directory as a grid of thumbnails. Thumbnails are
+// made on worker threads of the grid's own, which always take the ones
+// currently on screen first, followed by those a page away. Painting only
+// ever draws what's already been made, so scrolling doesn't wait on them.
+class ThumbnailGrid : public QAbstractScrollArea{
+	DirectoryListing listing;
+	size_t count;
+	ThumbnailCache cache;
+	// Keyed by index into listing. Costs are in KiB.
+	QCache<size_t, QPixmap> thumbnails;
+	QSet<size_t> failed;
+	std::function<void(const QString &)> activated;
+	QTimer collect_timer;
+
+	// Shared with the workers.
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<std::pair<size_t, QString>> queue;
+	std::set<size_t> in_flight;
+	std::vector<std::pair<size_t, QImage>> finished;
+	bool stop;
+	std::vector<std::thread> workers;
+
+	int get_cell_width() const;
+	int get_cell_height() const;
+	int get_columns() const;
+	void update_scrollbar();
+	void request_visible();
+	void worker_loop();
+	void collect();
+	QString get_filename(size_t) const;
+
+protected:
+	void paintEvent(QPaintEvent *) override;
+	void resizeEvent(QResizeEvent *) override;
+	void scrollContentsBy(int dx, int dy) override;
+	void mouseDoubleClickEvent(QMouseEvent *) override;
+
+public:
+	ThumbnailGrid(const QString &directory, QWidget *parent = nullptr);
+	~ThumbnailGrid();
+	// Called with the path of an image when it's double-clicked.
+	void set_activated_callback(const std::function<void(const QString &)> &f){
+		this->activated = f;
+	}
+};
+
+#endif
@@ -0,0 +1,59 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef BENCHCALLER_H
+#define BENCHCALLER_H
+
+#include "plugin-core/PluginCaller.h"
+#include <QImage>
+#include <iostream>
+
+// Feeds a fixed image to filters and keeps whatever they display, printing
+// their messages to the console.
+class BenchCaller : public PluginCaller{
+	QImage input;
+	QImage output;
+	bool displayed;
+	bool failed;
+public:
+	BenchCaller(): displayed(false), failed(false){}
+	void set_input(const QImage &image){
+		this->input = image;
+	}
+	void reset(){
+		this->output = QImage();
+		this->displayed = false;
+		this->failed = false;
+	}
+	bool get_displayed() const{
+		return this->displayed;
+	}
+	bool get_failed() const{
+		return this->failed;
+	}
+	QImage get_image() const override{
+		return this->input;
+	}
+	void display_filtered_image(const QImage &image) override{
+		this->output = image;
+		this->displayed = true;
+	}
+	void show_message_box(const QString &title, const QString &message, bool is_error) override{
+		if (is_error)
+			this->failed = true;
+		auto &stream = is_error ? std::cerr : std::cout;
+		if (title.size())
+			stream << title.toStdString() << ": ";
+		stream << message.toStdString() << std::endl;
+	}
+	void show_compiler_error(const QString &message) override{
+		this->failed = true;
+		std::cerr << message.toStdString() << std::endl;
+	}
+};
+
+#endif
@@ -0,0 +1,75 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "BenchFixtures.h"
+#include <QDir>
+#include <QFile>
+#include <cstdint>
+
+static std::uint32_t xorshift(std::uint32_t &state){
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+QImage make_synthetic_image(const QSize &size, QImage::Format format){
+	QImage ret(size, QImage::Format_ARGB32);
+	if (ret.isNull())
+		return ret;
+	std::uint32_t state = 0x9E3779B9;
+	auto w = size.width();
+	auto h = size.height();
+	for (int y = 0; y < h; y++){
+		auto line = (QRgb *)ret.scanLine(y);
+		for (int x = 0; x < w; x++){
+			auto noise = xorshift(state);
+			int r = x * 255 / w;
+			int g = y * 255 / h;
+			int b = (x + y) * 127 / (w + h) + (noise & 0x7F);
+			int a = 0xC0 | (noise >> 8 & 0x3F);
+			line[x] = qRgba(r, g, b, a);
+		}
+	}
+	if (format != ret.format())
+		ret = ret.convertToFormat(format);
+	return ret;
+}
+
+SyntheticDirectory::SyntheticDirectory(size_t count){
+	if (!this->directory.isValid())
+		return;
+	static const char *prefixes[] = {
+		"IMG_",
+		"img_",
+		"DSC",
+		"Photo ",
+		"scan-",
+	};
+	static const char *extensions[] = {
+		".jpg",
+		".JPG",
+		".png",
+		".webp",
+	};
+	const size_t prefix_count = sizeof(prefixes) / sizeof(*prefixes);
+	const size_t extension_count = sizeof(extensions) / sizeof(*extensions);
+	QDir dir(this->directory.path());
+	for (size_t i = 0; i < count; i++){
+		auto name = QString("%1%2").arg(prefixes[i % prefix_count]).arg(i, 6, 10, QChar('0'));
+		// One in ten isn't an image, to make the name filters do some work.
+		bool image = i % 10 != 9;
+		name += image ? extensions[i / prefix_count % extension_count] : ".txt";
+		QFile file(dir.filePath(name));
+		if (!file.open(QFile::WriteOnly)){
+			this->image_names.clear();
+			return;
+		}
+		if (image)
+			this->image_names << name;
+	}
+}
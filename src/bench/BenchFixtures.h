@@ -0,0 +1,40 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef BENCHFIXTURES_H
+#define BENCHFIXTURES_H
+
+#include <QImage>
+#include <QSize>
+#include <QStringList>
+#include <QTemporaryDir>
+
+// Deterministic noisy gradient, so that results don't depend on whatever
+// images happen to be at hand.
+QImage make_synthetic_image(const QSize &, QImage::Format);
+
+// A temporary directory filled with empty files. Most of them have names a
+// listing accepts, in mixed case; the rest have extensions it skips. The
+// directory is deleted along with the object.
+class SyntheticDirectory{
+	QTemporaryDir directory;
+	QStringList image_names;
+public:
+	SyntheticDirectory(size_t count);
+	bool is_valid() const{
+		return this->directory.isValid() && this->image_names.size();
+	}
+	QString get_path() const{
+		return this->directory.path();
+	}
+	// Names of the files a listing should include, in no particular order.
+	const QStringList &get_image_names() const{
+		return this->image_names;
+	}
+};
+
+#endif
@@ -0,0 +1,160 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "BenchUtility.h"
+#include <QFile>
+#include <QTextStream>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#ifdef WIN32
+#include <Windows.h>
+#include <Psapi.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "psapi.lib")
+#endif
+#else
+#include <sys/resource.h>
+#endif
+
+static double percentile(const std::vector<double> &sorted, double p){
+	if (!sorted.size())
+		return 0;
+	auto index = p * (sorted.size() - 1);
+	auto lo = (size_t)index;
+	auto hi = std::min(lo + 1, sorted.size() - 1);
+	auto frac = index - lo;
+	return sorted[lo] * (1 - frac) + sorted[hi] * frac;
+}
+
+Statistics Statistics::compute(std::vector<double> values){
+	Statistics ret;
+	ret.samples = values.size();
+	if (!ret.samples)
+		return ret;
+	std::sort(values.begin(), values.end());
+	ret.min = values.front();
+	ret.max = values.back();
+	double sum = 0;
+	for (auto x : values)
+		sum += x;
+	ret.mean = sum / values.size();
+	double variance = 0;
+	for (auto x : values)
+		variance += (x - ret.mean) * (x - ret.mean);
+	ret.stddev = values.size() > 1 ? sqrt(variance / (values.size() - 1)) : 0;
+	ret.median = percentile(values, 0.5);
+	ret.p95 = percentile(values, 0.95);
+	ret.p99 = percentile(values, 0.99);
+	return ret;
+}
+
+std::uint64_t get_peak_memory_usage(){
+#ifdef WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+	return pmc.PeakWorkingSetSize;
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+#ifdef __APPLE__
+	return usage.ru_maxrss;
+#else
+	return (std::uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+void BenchReport::add_row(const QVariantList &values){
+	QJsonObject row;
+	for (int i = 0; i < this->columns.size() && i < values.size(); i++)
+		row[this->columns[i]] = QJsonValue::fromVariant(values[i]);
+	this->rows.append(row);
+}
+
+static QString csv_escape(QString s){
+	if (s.contains(',') || s.contains('"') || s.contains('\n'))
+		s = '"' + s.replace("\"", "\"\"") + '"';
+	return s;
+}
+
+bool BenchReport::write_csv(const QString &path) const{
+	QFile file(path);
+	if (!file.open(QFile::WriteOnly | QFile::Truncate | QFile::Text))
+		return false;
+	QTextStream stream(&file);
+	stream << this->columns.join(',') << endl;
+	for (auto row : this->rows){
+		auto object = row.toObject();
+		QStringList cells;
+		for (auto &column : this->columns)
+			cells << csv_escape(object[column].toVariant().toString());
+		stream << cells.join(',') << endl;
+	}
+	return true;
+}
+
+bool BenchReport::write_json(const QString &path) const{
+	QFile file(path);
+	if (!file.open(QFile::WriteOnly | QFile::Truncate))
+		return false;
+	file.write(QJsonDocument(this->rows).toJson());
+	return true;
+}
+
+bool BenchReport::read_json(const QString &path, QJsonArray &rows){
+	QFile file(path);
+	if (!file.open(QFile::ReadOnly))
+		return false;
+	auto document = QJsonDocument::fromJson(file.readAll());
+	if (!document.isArray())
+		return false;
+	rows = document.array();
+	return true;
+}
+
+QString BenchBaseline::make_key(const QStringList &values){
+	return values.join(QChar(0x1F));
+}
+
+bool BenchBaseline::load(const QString &path){
+	QJsonArray rows;
+	if (!BenchReport::read_json(path, rows))
+		return false;
+	for (auto row : rows){
+		auto object = row.toObject();
+		QStringList key;
+		for (auto &column : this->key_columns)
+			key << object[column].toVariant().toString();
+		this->values[make_key(key)] = object[this->value_column].toDouble();
+	}
+	return true;
+}
+
+bool BenchBaseline::find(const QVariantList &key, double &dst) const{
+	QStringList strings;
+	for (auto &value : key)
+		strings << value.toString();
+	auto it = this->values.find(make_key(strings));
+	if (it == this->values.end())
+		return false;
+	dst = it->second;
+	return true;
+}
+
+void BenchReport::print() const{
+	for (auto row : this->rows){
+		auto object = row.toObject();
+		for (auto &column : this->columns)
+			std::cout << column.toStdString() << ": " << object[column].toVariant().toString().toStdString() << std::endl;
+		std::cout << std::endl;
+	}
+}
@@ -0,0 +1,66 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef BENCHUTILITY_H
+#define BENCHUTILITY_H
+
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <QString>
+#include <QStringList>
+#include <QJsonArray>
+#include <QVariant>
+
+struct Statistics{
+	size_t samples;
+	double min,
+		max,
+		mean,
+		median,
+		stddev,
+		p95,
+		p99;
+	Statistics(): samples(0), min(0), max(0), mean(0), median(0), stddev(0), p95(0), p99(0){}
+	static Statistics compute(std::vector<double> values);
+};
+
+std::uint64_t get_peak_memory_usage();
+
+class BenchReport{
+	QStringList columns;
+	QJsonArray rows;
+public:
+	BenchReport(const QStringList &columns): columns(columns){}
+	// Values must be given in the same order as the columns.
+	void add_row(const QVariantList &values);
+	bool write_csv(const QString &path) const;
+	bool write_json(const QString &path) const;
+	// Reads back the rows of a report saved with write_json().
+	static bool read_json(const QString &path, QJsonArray &rows);
+	void print() const;
+	const QJsonArray &get_rows() const{
+		return this->rows;
+	}
+};
+
+// One value per row of a report saved earlier, looked up by the values of the
+// columns that identify the row.
+class BenchBaseline{
+	QStringList key_columns;
+	QString value_column;
+	std::map<QString, double> values;
+
+	static QString make_key(const QStringList &);
+public:
+	BenchBaseline(const QStringList &key_columns, const QString &value_column): key_columns(key_columns), value_column(value_column){}
+	bool load(const QString &path);
+	// Returns false if no row had these key values.
+	bool find(const QVariantList &key, double &dst) const;
+};
+
+#endif
@@ -0,0 +1,163 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "BenchUtility.h"
+#include "BenchCaller.h"
+#include "plugin-core/PluginCoreState.h"
+#include "GenericException.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <iostream>
+#include <exception>
+#include <algorithm>
+
+static double run_once(PluginCoreState &state, BenchCaller &caller, const QString &filter){
+	state.get_store().clear();
+	caller.reset();
+	QElapsedTimer timer;
+	timer.start();
+	state.execute(filter);
+	auto ret = timer.nsecsElapsed() * 1e-6;
+	if (caller.get_failed())
+		throw GenericException("The filter reported an error.");
+	return ret;
+}
+
+int main(int argc, char **argv){
+	QCoreApplication app(argc, argv);
+	app.setApplicationName("borderless-bench");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Runs a Borderless filter repeatedly over a set of images and reports timings.");
+	parser.addHelpOption();
+	QCommandLineOption iterations_option(QStringList() << "n" << "iterations", "Number of steady-state runs per image.", "count", "10");
+	QCommandLineOption csv_option("csv", "Write results as CSV to <path>.", "path");
+	QCommandLineOption json_option("json", "Write results as JSON to <path>.", "path");
+	parser.addOption(iterations_option);
+	parser.addOption(csv_option);
+	parser.addOption(json_option);
+	parser.addPositionalArgument("filter", "Lua or C++ filter to run.");
+	parser.addPositionalArgument("images", "Input images.", "<image>...");
+	parser.process(app);
+
+	auto positional = parser.positionalArguments();
+	if (positional.size() < 2)
+		parser.showHelp(1);
+	auto filter = QFileInfo(positional.front()).absoluteFilePath();
+	positional.pop_front();
+	bool ok;
+	int iterations = parser.value(iterations_option).toInt(&ok);
+	if (!ok || iterations < 1){
+		std::cerr << "Invalid iteration count.\n";
+		return 1;
+	}
+
+	BenchReport report(QStringList()
+		<< "filter"
+		<< "image"
+		<< "width"
+		<< "height"
+		<< "iterations"
+		<< "interpreter_load_ms"
+		<< "compile_ms"
+		<< "first_run_ms"
+		<< "median_ms"
+		<< "mean_ms"
+		<< "min_ms"
+		<< "stddev_ms"
+		<< "megapixels_per_second"
+		<< "peak_memory_bytes"
+	);
+
+	PluginCoreState state;
+	BenchCaller caller;
+	state.set_current_caller(&caller);
+	int ret = 0;
+
+	// Both are timed once per filter, before it first runs, and reported in
+	// the first row only.
+	QElapsedTimer timer;
+	timer.start();
+	if (!state.load_interpreter(filter)){
+		std::cerr << "Can't load the interpreter for " << QFileInfo(filter).fileName().toStdString() << std::endl;
+		return 1;
+	}
+	QVariant load_ms = timer.nsecsElapsed() * 1e-6;
+	timer.restart();
+	QString error;
+	if (!state.compile(filter, error)){
+		std::cerr << QFileInfo(filter).fileName().toStdString() << " doesn't compile.";
+		if (error.size())
+			std::cerr << "\n" << error.toStdString();
+		std::cerr << std::endl;
+		return 1;
+	}
+	QVariant compile_ms = timer.nsecsElapsed() * 1e-6;
+
+	for (auto &path : positional){
+		QImage image(path);
+		if (image.isNull()){
+			std::cerr << "Can't load " << path.toStdString() << std::endl;
+			ret = 1;
+			continue;
+		}
+		caller.set_input(image);
+		try{
+			// The filter is already compiled, so the first run only shows
+			// warm-up costs, such as JIT traces.
+			auto first_run = run_once(state, caller, filter);
+			std::vector<double> times;
+			times.reserve(iterations);
+			for (int i = 0; i < iterations; i++)
+				times.push_back(run_once(state, caller, filter));
+			state.get_store().clear();
+
+			auto stats = Statistics::compute(times);
+			double megapixels = (double)image.width() * image.height() * 1e-6;
+			report.add_row(QVariantList()
+				<< QFileInfo(filter).fileName()
+				<< path
+				<< image.width()
+				<< image.height()
+				<< iterations
+				<< load_ms
+				<< compile_ms
+				<< first_run
+				<< stats.median
+				<< stats.mean
+				<< stats.min
+				<< stats.stddev
+				<< (stats.median > 0 ? megapixels / (stats.median * 1e-3) : 0.0)
+				<< (qulonglong)get_peak_memory_usage()
+			);
+			load_ms = compile_ms = QVariant();
+			if (state.get_profile().get_phases().size())
+				std::cout << state.get_profile().to_string().toStdString() << std::endl;
+			if (!caller.get_displayed())
+				std::cerr << "Warning: " << QFileInfo(filter).fileName().toStdString() << " didn't produce an image.\n";
+		}catch (std::exception &e){
+			std::cerr << path.toStdString() << ": " << e.what() << std::endl;
+			ret = 1;
+		}
+	}
+
+	// Nothing ran, so there's nothing to report.
+	if (!report.get_rows().size())
+		return 1;
+	report.print();
+	if (parser.isSet(csv_option) && !report.write_csv(parser.value(csv_option))){
+		std::cerr << "Can't write " << parser.value(csv_option).toStdString() << std::endl;
+		ret = 1;
+	}
+	if (parser.isSet(json_option) && !report.write_json(parser.value(json_option))){
+		std::cerr << "Can't write " << parser.value(json_option).toStdString() << std::endl;
+		ret = 1;
+	}
+	return ret;
+}
@@ -0,0 +1,411 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "BenchUtility.h"
+#include "BenchCaller.h"
+#include "BenchFixtures.h"
+#include "BackgroundColor.h"
+#include "DirectoryListing.h"
+#include "Quadrangular.h"
+#include "plugin-core/ImageStore.h"
+#include "plugin-core/PluginCoreState.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMatrix>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+
+struct MicroBenchmark{
+	QString name;
+	QString parameters;
+	// Work done by one run: pixels if per_pixel is set, operations otherwise.
+	double units;
+	bool per_pixel;
+	// Runs untimed before every timed run. Optional.
+	std::function<void()> setup;
+	std::function<void()> run;
+};
+
+// Keeps the results of the benchmarked code alive, so that the compiler
+// can't discard it.
+static volatile double sink;
+
+static const QSize image_sizes[] = {
+	QSize(256, 256),
+	QSize(1024, 1024),
+	QSize(4096, 4096),
+};
+
+struct FormatName{
+	QImage::Format format;
+	const char *name;
+};
+
+static const FormatName image_formats[] = {
+	{ QImage::Format_ARGB32, "ARGB32" },
+	{ QImage::Format_RGB32, "RGB32" },
+	{ QImage::Format_RGB888, "RGB888" },
+	{ QImage::Format_Grayscale8, "Grayscale8" },
+};
+
+static const QSize filter_image_size(1024, 1024);
+static const int quadrangular_batch = 100000;
+static const int find_batch = 10000;
+
+static QString describe(const QSize &size, const char *format = nullptr){
+	auto ret = QString("%1x%2").arg(size.width()).arg(size.height());
+	if (format)
+		ret += QString(" ") + format;
+	return ret;
+}
+
+static void add_color_benchmarks(std::vector<MicroBenchmark> &dst){
+	for (auto &size : image_sizes){
+		for (auto &format : image_formats){
+			auto image = std::make_shared<QImage>();
+			auto qsize = size;
+			auto qformat = format.format;
+			MicroBenchmark b;
+			b.name = "get_average_color";
+			b.parameters = describe(size, format.name);
+			b.units = (double)size.width() * size.height();
+			b.per_pixel = true;
+			b.setup = [image, qsize, qformat](){
+				if (image->isNull())
+					*image = make_synthetic_image(qsize, qformat);
+			};
+			b.run = [image](){
+				sink = get_average_color(*image).redF();
+			};
+			dst.push_back(b);
+		}
+	}
+}
+
+static void add_image_store_benchmarks(std::vector<MicroBenchmark> &dst){
+	for (auto &size : image_sizes){
+		auto qsize = size;
+		auto store = std::make_shared<ImageStore>();
+		auto source = std::make_shared<QImage>();
+		auto image = std::make_shared<std::shared_ptr<Image>>();
+
+		// Image::to_alpha() is private; converting to the format an image is
+		// already in is the public path to it, and the one filters take on
+		// first access.
+		MicroBenchmark b;
+		b.name = "Image::to_alpha";
+		b.parameters = describe(size, "ARGB32");
+		b.units = (double)size.width() * size.height();
+		b.per_pixel = true;
+		b.setup = [store, source, image, qsize](){
+			if (source->isNull())
+				*source = make_synthetic_image(qsize, QImage::Format_ARGB32);
+			image->reset();
+			store->clear();
+			*image = store->get_image(store->store(*source));
+		};
+		b.run = [image](){
+			(*image)->convert_format(PIXEL_FORMAT_RGBA8);
+		};
+		dst.push_back(b);
+
+		b.name = "Image::traverse";
+		b.parameters = describe(size, "RGBA8");
+		// Keeps whatever image the previous benchmark left, already converted.
+		b.setup = [store, source, image, qsize](){
+			if (!*image){
+				if (source->isNull())
+					*source = make_synthetic_image(qsize, QImage::Format_ARGB32);
+				*image = store->get_image(store->store(*source));
+			}
+			(*image)->convert_format(PIXEL_FORMAT_RGBA8);
+		};
+		b.run = [image](){
+			std::uint64_t sum = 0;
+			(*image)->traverse([&sum](int r, int g, int b, int a, int, int){
+				sum += r + g + b + a;
+			});
+			sink = (double)sum;
+		};
+		dst.push_back(b);
+	}
+}
+
+static void add_directory_benchmarks(std::vector<MicroBenchmark> &dst, size_t entries){
+	auto directory = std::make_shared<SyntheticDirectory>(entries);
+	if (!directory->is_valid()){
+		std::cerr << "Can't create the synthetic directory, skipping DirectoryListing.\n";
+		return;
+	}
+	auto count = directory->get_image_names().size();
+	auto parameters = QString("%1 entries").arg(count);
+
+	MicroBenchmark b;
+	b.name = "DirectoryListing listing";
+	b.parameters = parameters;
+	b.units = count;
+	b.per_pixel = false;
+	b.run = [directory](){
+		DirectoryListing listing(directory->get_path());
+		sink = (double)listing.size();
+	};
+	dst.push_back(b);
+
+	auto unsorted = std::make_shared<QStringList>();
+	b.name = "sort_entries";
+	b.setup = [directory, unsorted](){
+		*unsorted = directory->get_image_names();
+		std::shuffle(unsorted->begin(), unsorted->end(), std::mt19937(1));
+	};
+	b.run = [unsorted](){
+		sort_entries(*unsorted);
+		sink = (double)unsorted->size();
+	};
+	dst.push_back(b);
+
+	auto listing = std::make_shared<DirectoryListing>(directory->get_path());
+	auto queries = std::make_shared<QStringList>();
+	b.name = "DirectoryListing::find";
+	b.units = find_batch;
+	b.setup = [directory, queries](){
+		if (queries->size())
+			return;
+		std::mt19937 rng(2);
+		auto &names = directory->get_image_names();
+		std::uniform_int_distribution<int> dist(0, names.size() - 1);
+		for (int i = 0; i < find_batch; i++)
+			*queries << names[dist(rng)].toUpper();
+	};
+	b.run = [listing, queries](){
+		size_t found = 0;
+		for (auto &name : *queries){
+			size_t position;
+			found += listing->find(position, name);
+		}
+		sink = (double)found;
+	};
+	dst.push_back(b);
+}
+
+static void add_quadrangular_benchmarks(std::vector<MicroBenchmark> &dst){
+	auto transforms = std::make_shared<std::vector<QMatrix>>();
+	for (int angle = 0; angle < 360; angle++){
+		QMatrix m;
+		m.rotate(angle);
+		m.scale(1 + angle / 360.0, 1 + angle / 360.0);
+		transforms->push_back(m);
+	}
+	MicroBenchmark b;
+	b.name = "Quadrangular transform";
+	b.parameters = "rotate+scale, bounding box";
+	b.units = quadrangular_batch;
+	b.per_pixel = false;
+	b.run = [transforms](){
+		Quadrangular quad(QRect(0, 0, 4000, 3000));
+		double total = 0;
+		for (int i = 0; i < quadrangular_batch; i++){
+			auto transformed = quad * (*transforms)[i % transforms->size()];
+			transformed.move_to_origin();
+			total += transformed.get_bounding_box().width();
+		}
+		sink = total;
+	};
+	dst.push_back(b);
+}
+
+static void add_filter_benchmarks(std::vector<MicroBenchmark> &dst, PluginCoreState &state, BenchCaller &caller, const QStringList &filters){
+	auto image = make_synthetic_image(filter_image_size, QImage::Format_ARGB32);
+	for (auto &path : filters){
+		auto filter = QFileInfo(path).absoluteFilePath();
+		auto language = QFileInfo(path).suffix().toLower() == "lua" ? "Lua" : "C++";
+		MicroBenchmark b;
+		b.name = QString("filter %1").arg(language);
+		b.parameters = QFileInfo(path).fileName() + " " + describe(filter_image_size);
+		b.units = (double)filter_image_size.width() * filter_image_size.height();
+		b.per_pixel = true;
+		b.setup = [&state, &caller, image](){
+			state.get_store().clear();
+			caller.set_input(image);
+			caller.reset();
+		};
+		b.run = [&state, filter](){
+			state.execute(filter);
+		};
+		dst.push_back(b);
+	}
+}
+
+static std::vector<double> measure(MicroBenchmark &b, int repetitions){
+	std::vector<double> ret;
+	ret.reserve(repetitions);
+	// Warm up caches, lazy initialization and the fixtures themselves.
+	if (b.setup)
+		b.setup();
+	b.run();
+	for (int i = 0; i < repetitions; i++){
+		if (b.setup)
+			b.setup();
+		QElapsedTimer timer;
+		timer.start();
+		b.run();
+		ret.push_back((double)timer.nsecsElapsed());
+	}
+	return ret;
+}
+
+int main(int argc, char **argv){
+	QCoreApplication app(argc, argv);
+	app.setApplicationName("borderless-microbench");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Times the viewer's hot paths in isolation over synthetic inputs.");
+	parser.addHelpOption();
+	QCommandLineOption repetitions_option(QStringList() << "n" << "repetitions", "Number of timed runs per benchmark.", "count", "15");
+	QCommandLineOption entries_option("entries", "Number of files in the synthetic directory.", "count", "100000");
+	QCommandLineOption filter_option("filter", "Lua or C++ filter to time. May be given more than once.", "path");
+	QCommandLineOption baseline_option("baseline", "Compare against a report saved earlier with --json.", "path");
+	QCommandLineOption threshold_option("threshold", "Slowdown relative to the baseline, in percent, that counts as a regression.", "percent", "10");
+	QCommandLineOption csv_option("csv", "Write results as CSV to <path>.", "path");
+	QCommandLineOption json_option("json", "Write results as JSON to <path>.", "path");
+	parser.addOption(repetitions_option);
+	parser.addOption(entries_option);
+	parser.addOption(filter_option);
+	parser.addOption(baseline_option);
+	parser.addOption(threshold_option);
+	parser.addOption(csv_option);
+	parser.addOption(json_option);
+	parser.addPositionalArgument("suites", "Any of color, image, directory, quadrangular, filter. All by default.", "[<suite>...]");
+	parser.process(app);
+
+	bool ok;
+	int repetitions = parser.value(repetitions_option).toInt(&ok);
+	if (!ok || repetitions < 1){
+		std::cerr << "Invalid repetition count.\n";
+		return 1;
+	}
+	auto entries = parser.value(entries_option).toUInt(&ok);
+	if (!ok || !entries){
+		std::cerr << "Invalid entry count.\n";
+		return 1;
+	}
+	auto threshold = parser.value(threshold_option).toDouble(&ok);
+	if (!ok){
+		std::cerr << "Invalid threshold.\n";
+		return 1;
+	}
+
+	BenchBaseline baseline(QStringList() << "benchmark" << "parameters", "median_ns");
+	if (parser.isSet(baseline_option) && !baseline.load(parser.value(baseline_option))){
+		std::cerr << "Can't read " << parser.value(baseline_option).toStdString() << std::endl;
+		return 1;
+	}
+
+	auto suites = parser.positionalArguments();
+	auto enabled = [&suites](const char *suite){
+		return !suites.size() || suites.contains(suite);
+	};
+
+	PluginCoreState state;
+	BenchCaller caller;
+	state.set_current_caller(&caller);
+
+	std::vector<MicroBenchmark> benchmarks;
+	if (enabled("color"))
+		add_color_benchmarks(benchmarks);
+	if (enabled("image"))
+		add_image_store_benchmarks(benchmarks);
+	if (enabled("directory"))
+		add_directory_benchmarks(benchmarks, entries);
+	if (enabled("quadrangular"))
+		add_quadrangular_benchmarks(benchmarks);
+	if (enabled("filter"))
+		add_filter_benchmarks(benchmarks, state, caller, parser.values(filter_option));
+
+	BenchReport report(QStringList()
+		<< "benchmark"
+		<< "parameters"
+		<< "repetitions"
+		<< "median_ns"
+		<< "mean_ns"
+		<< "min_ns"
+		<< "p95_ns"
+		<< "stddev_ns"
+		<< "ns_per_pixel"
+		<< "ops_per_second"
+		<< "baseline_median_ns"
+		<< "change_percent"
+	);
+
+	int ret = 0;
+	int regressions = 0;
+	for (auto &b : benchmarks){
+		std::cout << b.name.toStdString() << " (" << b.parameters.toStdString() << ")..." << std::endl;
+		caller.reset();
+		auto stats = Statistics::compute(measure(b, repetitions));
+		// Release the fixtures as soon as they're no longer needed.
+		b.setup = nullptr;
+		b.run = nullptr;
+		if (caller.get_failed()){
+			std::cerr << b.parameters.toStdString() << ": the filter reported an error.\n";
+			ret = 1;
+			continue;
+		}
+		QVariant ns_per_pixel,
+			ops_per_second,
+			baseline_median,
+			change;
+		if (b.per_pixel)
+			ns_per_pixel = stats.median / b.units;
+		else if (stats.median > 0)
+			ops_per_second = b.units / (stats.median * 1e-9);
+		double previous;
+		if (baseline.find(QVariantList() << b.name << b.parameters, previous) && previous > 0){
+			auto percent = (stats.median - previous) / previous * 100;
+			baseline_median = previous;
+			change = percent;
+			if (percent > threshold){
+				std::cerr << "Regression: " << b.name.toStdString() << " (" << b.parameters.toStdString() << ") is " << percent << "% slower than the baseline.\n";
+				regressions++;
+			}
+		}
+		report.add_row(QVariantList()
+			<< b.name
+			<< b.parameters
+			<< repetitions
+			<< stats.median
+			<< stats.mean
+			<< stats.min
+			<< stats.p95
+			<< stats.stddev
+			<< ns_per_pixel
+			<< ops_per_second
+			<< baseline_median
+			<< change
+		);
+	}
+
+	report.print();
+	if (parser.isSet(csv_option) && !report.write_csv(parser.value(csv_option))){
+		std::cerr << "Can't write " << parser.value(csv_option).toStdString() << std::endl;
+		ret = 1;
+	}
+	if (parser.isSet(json_option) && !report.write_json(parser.value(json_option))){
+		std::cerr << "Can't write " << parser.value(json_option).toStdString() << std::endl;
+		ret = 1;
+	}
+	if (regressions){
+		std::cerr << regressions << " benchmark(s) regressed by more than " << threshold << "%.\n";
+		if (!ret)
+			ret = 2;
+	}
+	return ret;
+}
@@ -0,0 +1,259 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "BenchUtility.h"
+#include "BenchFixtures.h"
+#include "ImageViewport.h"
+#include "LoadedImage.h"
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <iostream>
+#include <memory>
+
+struct ViewportTransform{
+	const char *name;
+	double rotation;
+	bool flip;
+};
+
+static const ViewportTransform transforms[] = {
+	{ "none", 0, false },
+	{ "rotate 90", 90, false },
+	{ "rotate 45", 45, false },
+	{ "flip", 0, true },
+};
+
+static const double zooms[] = {
+	0.25,
+	0.5,
+	1,
+	2,
+};
+
+static const QSize image_sizes[] = {
+	QSize(640, 480),
+	QSize(1920, 1080),
+	QSize(4096, 3072),
+};
+
+static const int animation_frame_count = 3;
+static const int animation_frame_delay = 40;
+
+static void pump_events(int ms){
+	QElapsedTimer timer;
+	timer.start();
+	do
+		QApplication::processEvents(QEventLoop::AllEvents, 10);
+	while (timer.elapsed() < ms);
+}
+
+static std::shared_ptr<LoadedGraphics> make_graphics(bool animation, const QSize &size){
+	auto image = make_synthetic_image(size, QImage::Format_ARGB32);
+	if (!animation)
+		return std::make_shared<LoadedImage>(image);
+	std::vector<AnimationFrame> frames;
+	for (int i = 0; i < animation_frame_count; i++){
+		AnimationFrame frame;
+		frame.image = i % 2 ? image.mirrored(true, false) : image;
+		frame.delay = animation_frame_delay;
+		frames.push_back(frame);
+	}
+	return std::make_shared<LoadedAnimation>(frames);
+}
+
+// Shows graphics in viewport and waits until there's something to draw.
+static void load_graphics(ImageViewport &viewport, LoadedGraphics &graphics){
+	viewport.set_image(graphics);
+	if (viewport.is_pending()){
+		QEventLoop loop;
+		QObject::connect(&viewport, &ImageViewport::pending_image_ready, &loop, &QEventLoop::quit);
+		loop.exec();
+	}
+}
+
+static void set_view(ImageViewport &viewport, const ViewportTransform &transform, double zoom){
+	viewport.set_transform(QMatrix());
+	if (transform.rotation)
+		viewport.rotate(transform.rotation);
+	if (transform.flip)
+		viewport.flip(true);
+	viewport.set_zoom(zoom);
+	viewport.update_size();
+}
+
+// Renders the part of the viewport a screen of the given size would show,
+// the same way a paint event from the window system would.
+static std::vector<double> render_frames(ImageViewport &viewport, QImage &screen, int count, bool animation){
+	std::vector<double> ret;
+	ret.reserve(count);
+	QRegion visible(QRect(QPoint(0, 0), screen.size()).intersected(viewport.rect()));
+	for (int i = 0; i < count; i++){
+		// Lets the animation move on to its next frame.
+		if (animation)
+			QApplication::processEvents();
+		screen.fill(Qt::black);
+		QElapsedTimer timer;
+		timer.start();
+		viewport.render(&screen, QPoint(), visible, QWidget::DrawChildren);
+		ret.push_back(timer.nsecsElapsed() * 1e-6);
+	}
+	return ret;
+}
+
+static bool parse_size(const QString &s, QSize &dst){
+	auto parts = s.split('x');
+	if (parts.size() != 2)
+		return false;
+	bool ok1, ok2;
+	dst = QSize(parts[0].toInt(&ok1), parts[1].toInt(&ok2));
+	return ok1 && ok2 && !dst.isEmpty();
+}
+
+int main(int argc, char **argv){
+	// Nothing is ever shown, so there's no need for a display.
+	if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	QApplication app(argc, argv);
+	app.setApplicationName("borderless-renderbench");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Times ImageViewport painting over a matrix of image sizes, zooms and rotations.");
+	parser.addHelpOption();
+	QCommandLineOption frames_option(QStringList() << "n" << "frames", "Number of timed frames per case.", "count", "60");
+	QCommandLineOption screen_option("screen", "Size of the area painted, as <width>x<height>.", "size", "1920x1080");
+	QCommandLineOption kind_option("kind", "Only time still images (pixmap) or animations (animation).", "kind");
+	QCommandLineOption baseline_option("baseline", "Compare against a report saved earlier with --json.", "path");
+	QCommandLineOption threshold_option("threshold", "Slowdown of the median frame time relative to the baseline, in percent, that counts as a regression.", "percent", "10");
+	QCommandLineOption csv_option("csv", "Write results as CSV to <path>.", "path");
+	QCommandLineOption json_option("json", "Write results as JSON to <path>.", "path");
+	parser.addOption(frames_option);
+	parser.addOption(screen_option);
+	parser.addOption(kind_option);
+	parser.addOption(baseline_option);
+	parser.addOption(threshold_option);
+	parser.addOption(csv_option);
+	parser.addOption(json_option);
+	parser.process(app);
+
+	bool ok;
+	int frames = parser.value(frames_option).toInt(&ok);
+	if (!ok || frames < 1){
+		std::cerr << "Invalid frame count.\n";
+		return 1;
+	}
+	QSize screen_size;
+	if (!parse_size(parser.value(screen_option), screen_size)){
+		std::cerr << "Invalid screen size.\n";
+		return 1;
+	}
+	auto threshold = parser.value(threshold_option).toDouble(&ok);
+	if (!ok){
+		std::cerr << "Invalid threshold.\n";
+		return 1;
+	}
+	auto kind = parser.value(kind_option);
+	if (kind.size() && kind != "pixmap" && kind != "animation"){
+		std::cerr << "Invalid kind.\n";
+		return 1;
+	}
+
+	BenchBaseline baseline(QStringList() << "kind" << "image" << "zoom" << "transform", "median_ms");
+	if (parser.isSet(baseline_option) && !baseline.load(parser.value(baseline_option))){
+		std::cerr << "Can't read " << parser.value(baseline_option).toStdString() << std::endl;
+		return 1;
+	}
+
+	BenchReport report(QStringList()
+		<< "kind"
+		<< "image"
+		<< "zoom"
+		<< "transform"
+		<< "frames"
+		<< "median_ms"
+		<< "mean_ms"
+		<< "p95_ms"
+		<< "p99_ms"
+		<< "max_ms"
+		<< "frames_per_second"
+		<< "baseline_median_ms"
+		<< "change_percent"
+	);
+
+	QImage screen(screen_size, QImage::Format_ARGB32_Premultiplied);
+	int regressions = 0;
+	for (int animation = 0; animation < 2; animation++){
+		const char *kind_name = animation ? "animation" : "pixmap";
+		if (kind.size() && kind != kind_name)
+			continue;
+		for (auto &size : image_sizes){
+			auto image_name = QString("%1x%2").arg(size.width()).arg(size.height());
+			// A fresh viewport for every image, like a fresh window.
+			ImageViewport viewport;
+			auto graphics = make_graphics(!!animation, size);
+			load_graphics(viewport, *graphics);
+			for (auto zoom : zooms){
+				for (auto &transform : transforms){
+					set_view(viewport, transform, zoom);
+					// Gives the animation's decoder thread time to rescale
+					// frames to the new zoom.
+					if (animation)
+						pump_events(animation_frame_count * animation_frame_delay * 2);
+					// Warm up.
+					render_frames(viewport, screen, 1, !!animation);
+					auto stats = Statistics::compute(render_frames(viewport, screen, frames, !!animation));
+
+					QVariant baseline_median,
+						change;
+					double previous;
+					if (baseline.find(QVariantList() << kind_name << image_name << zoom << transform.name, previous) && previous > 0){
+						auto percent = (stats.median - previous) / previous * 100;
+						baseline_median = previous;
+						change = percent;
+						if (percent > threshold){
+							std::cerr << "Regression: " << kind_name << " " << image_name.toStdString() << " at " << zoom << "x, " << transform.name << ", is " << percent << "% slower than the baseline.\n";
+							regressions++;
+						}
+					}
+					report.add_row(QVariantList()
+						<< kind_name
+						<< image_name
+						<< zoom
+						<< transform.name
+						<< frames
+						<< stats.median
+						<< stats.mean
+						<< stats.p95
+						<< stats.p99
+						<< stats.max
+						<< (stats.mean > 0 ? 1000 / stats.mean : 0.0)
+						<< baseline_median
+						<< change
+					);
+				}
+			}
+		}
+	}
+
+	int ret = 0;
+	report.print();
+	if (parser.isSet(csv_option) && !report.write_csv(parser.value(csv_option))){
+		std::cerr << "Can't write " << parser.value(csv_option).toStdString() << std::endl;
+		ret = 1;
+	}
+	if (parser.isSet(json_option) && !report.write_json(parser.value(json_option))){
+		std::cerr << "Can't write " << parser.value(json_option).toStdString() << std::endl;
+		ret = 1;
+	}
+	if (regressions){
+		std::cerr << regressions << " case(s) regressed by more than " << threshold << "%.\n";
+		if (!ret)
+			ret = 2;
+	}
+	return ret;
+}
@@ -6,14 +6,48 @@ Distributed under a permissive license. See COPYING.txt for details.
 */
 
 #include "ImageViewerApplication.h"
+#include "plugin-core/Trace.h"
+
+static bool is_replay(int argc, char **argv){
+	QStringList args;
+	for (int i = 0; i < argc; i++)
+		args << QString::fromLocal8Bit(argv[i]);
+	trace_strip_arguments(args);
+	return args.size() >= 3 && args[1] == "--replay";
+}
+
+// A replay measures a session of its own, so it never goes to an instance
+// that's already running, and it doesn't need a display.
+static int replay(int argc, char **argv){
+	if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	int ret;
+	{
+		ImageViewerApplication app(argc, argv, QString());
+		ret = app.run_replay();
+	}
+	trace_write();
+	return ret;
+}
 
 int main(int argc, char **argv){
+	trace_initialize(argc, argv);
+	if (is_replay(argc, argv))
+		return replay(argc, argv);
+	// Opening a file with an instance already running should cost no more than
+	// handing over the path.
+	if (SingleInstanceApplication::forward_to_running_instance(argc, argv, "BorderlessViewer")){
+		trace_write();
+		return 0;
+	}
+	int ret = 0;
 	try{
 		ImageViewerApplication app(argc, argv, "BorderlessViewer");
-		return app.exec();
+		ret = app.exec();
 	}catch (ApplicationAlreadyRunningException &){
-		return 0;
 	}catch (NoWindowsException &){
-		return 0;
 	}
+	// After the application is gone, so its destructor is in the trace.
+	trace_write();
+	return ret;
 }
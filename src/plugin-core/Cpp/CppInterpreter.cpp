@@ -8,7 +8,6 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include "stdafx.h"
 #include "CppInterpreter.h"
 #include "../CallResultImpl.h"
-#include "../../StreamRedirector.h"
 #ifndef USING_PRECOMPILED_HEADERS
 #include "llvm_headers.h"
 #include <sstream>
@@ -72,7 +71,6 @@ bool execute(llvm::Module &mod, llvm::ExecutionEngine &execution_engine, CppInte
 	}
 		
 	ArrayRef<llvm::GenericValue> args;
-	execution_engine.finalizeObject();
 
 	global_store_tls_f(nullptr, &cpp);
 	execution_engine.runFunction(EntryFn, args);
@@ -87,22 +85,84 @@ void CppInterpreter::display_return_value_in_current_window(){
 
 }
 
-CallResult CppInterpreter::execute_path(const char *filename){
+static CallResult make_error(const std::string &message){
+	CallResult ret;
+	ret.impl = new CallResultImpl(message);
+	ret.success = false;
+	ret.error_message = ret.impl->message.c_str();
+	return ret;
+}
+
+// A foreground run mustn't wait for a background compilation of some other
+// filter, so the lock is only held to look up and update the maps.
+std::shared_ptr<CachedProgram> CppInterpreter::get_program(const char *filename, CallResult &result){
+	std::string path = filename;
+	std::promise<CompileResult> promise;
+	std::shared_future<CompileResult> future;
+	bool compile_here = false;
 	{
-		CallResult ret;
-		if (this->attempt_cache_reuse(ret, filename))
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto ret = this->find_in_cache(filename);
+		if (ret)
 			return ret;
+		auto it = this->compilations.find(path);
+		if (it != this->compilations.end())
+			future = it->second;
+		else{
+			future = promise.get_future().share();
+			this->compilations[path] = future;
+			compile_here = true;
+		}
+	}
+	if (compile_here){
+		CompileResult compilation;
+		try{
+			compilation.program = this->compile(filename, compilation.error_message);
+		}catch (...){
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->compilations.erase(path);
+			}
+			promise.set_exception(std::current_exception());
+			throw;
+		}
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			if (compilation.program)
+				this->cached_programs[path] = compilation.program;
+			this->compilations.erase(path);
+		}
+		promise.set_value(compilation);
 	}
+	auto &compilation = future.get();
+	if (!compilation.program)
+		result = make_error(compilation.error_message);
+	return compilation.program;
+}
+
+CallResult CppInterpreter::execute_path(const char *filename){
+	CallResult ret;
+	auto program = this->get_program(filename, ret);
+	if (!program)
+		return ret;
+	return program->execute();
+}
 
+CallResult CppInterpreter::compile_path(const char *filename){
+	CallResult ret;
+	this->get_program(filename, ret);
+	return ret;
+}
+
+std::shared_ptr<CachedProgram> CppInterpreter::compile(const char *filename, std::string &final_error_message){
 	std::string error_message;
-	std::string redirection;
+	// Not by redirecting stdout and stderr: compilations may run on a
+	// background thread, and that would capture other threads' output too.
+	std::string diagnostics;
+	llvm::raw_string_ostream diagnostics_stream(diagnostics);
 	while (true){
-#if defined(WIN32) && defined(_CONSOLE) || !defined(WIN32)
-		StdStreamRedirectionGuard guard(redirection);
-#endif
-
 		IntrusiveRefCntPtr<DiagnosticOptions> diagnostic_options = new DiagnosticOptions();
-		TextDiagnosticPrinter *text_diagnostic_printer = new TextDiagnosticPrinter(llvm::errs(), &*diagnostic_options);
+		TextDiagnosticPrinter *text_diagnostic_printer = new TextDiagnosticPrinter(diagnostics_stream, &*diagnostic_options);
 
 		IntrusiveRefCntPtr<DiagnosticIDs> diagnostic_ids(new DiagnosticIDs());
 		DiagnosticsEngine diagnostics_engine(diagnostic_ids, &*diagnostic_options, text_diagnostic_printer);
@@ -171,7 +231,7 @@ CallResult CppInterpreter::execute_path(const char *filename){
 		clang.setInvocation(invocation.release());
 
 		// Create the compilers actual diagnostics engine.
-		clang.createDiagnostics();
+		clang.createDiagnostics(new TextDiagnosticPrinter(diagnostics_stream, &clang.getDiagnosticOpts()));
 		if (!clang.hasDiagnostics()){
 			error_message = "No diagnostics.";
 			break;
@@ -193,8 +253,11 @@ CallResult CppInterpreter::execute_path(const char *filename){
 
 		auto mod = module.get();
 
-		llvm::InitializeNativeTarget();
-		llvm::InitializeNativeTargetAsmPrinter();
+		static std::once_flag target_initialized;
+		std::call_once(target_initialized, [](){
+			llvm::InitializeNativeTarget();
+			llvm::InitializeNativeTargetAsmPrinter();
+		});
 
 		std::shared_ptr<llvm::ExecutionEngine> execution_engine(create_execution_engine(std::move(module), &error_message));
 
@@ -203,19 +266,18 @@ CallResult CppInterpreter::execute_path(const char *filename){
 			break;
 		}
 
-		if (!execute(*mod, *execution_engine, *this, error_message))
+		if (!mod->getFunction("__borderless_main")){
+			error_message = "'__borderless_main' function not found in module.";
 			break;
+		}
 
-		this->save_in_cache(filename, context, execution_engine, mod);
-
-		return CallResult();
+		std::shared_ptr<CachedProgram> ret(new CachedProgram(this, filename, context, execution_engine, mod));
+		ret->finalize();
+		return ret;
 	}
 
-	CallResult ret;
-	ret.impl = new CallResultImpl(redirection + "\n\n" + error_message);
-	ret.success = false;
-	ret.error_message = ret.impl->message.c_str();
-	return ret;
+	final_error_message = diagnostics_stream.str() + "\n\n" + error_message;
+	return nullptr;
 }
 
 void CppInterpreter::pass_main_arguments(void *&state, void *&image) const{
@@ -223,23 +285,17 @@ void CppInterpreter::pass_main_arguments(void *&state, void *&image) const{
 	image = this->parameters.caller_image;
 }
 
-bool CppInterpreter::attempt_cache_reuse(CallResult &result, const char *path){
+std::shared_ptr<CachedProgram> CppInterpreter::find_in_cache(const char *path){
 	std::string spath = path;
 	auto it = this->cached_programs.find(spath);
 	if (it == this->cached_programs.end())
-		return false;
-	auto &program = *it->second;
-	if (!program.equals(path)){
+		return nullptr;
+	auto ret = it->second;
+	if (!ret->equals(path)){
 		this->cached_programs.erase(it);
-		return false;
+		return nullptr;
 	}
-	result = program.execute();
-	return true;
-}
-
-void CppInterpreter::save_in_cache(const char *path, const std::shared_ptr<llvm::LLVMContext> &context, const std::shared_ptr<llvm::ExecutionEngine> &execution_engine, llvm::Module *module){
-	std::string spath = path;
-	this->cached_programs[spath].reset(new CachedProgram(this, spath, context, execution_engine, module));
+	return ret;
 }
 
 CachedProgram::CachedProgram(
@@ -257,6 +313,12 @@ CachedProgram::CachedProgram(
 	this->hash = (*this->interpreter->get_hash_function())(this->path);
 }
 
+void CachedProgram::finalize(){
+	// Generates the machine code. Done right after compilation so that
+	// background compilations leave nothing to do for the first run.
+	this->execution_engine->finalizeObject();
+}
+
 CallResult CachedProgram::execute(){
 	std::string error_message;
 	CallResult ret;
@@ -11,6 +11,8 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include "main.h"
 #include <string>
 #include <map>
+#include <mutex>
+#include <future>
 
 struct Sha1Sum{
 	unsigned char data[20];
@@ -37,6 +39,7 @@ public:
 		llvm::Module *module
 	);
 	bool equals(const std::string &path);
+	void finalize();
 	CallResult execute();
 };
 
@@ -45,12 +48,24 @@ class CppInterpreter{
 	hash_function hf;
 	void *return_value;
 	std::map<std::string, std::shared_ptr<CachedProgram>> cached_programs;
-	bool attempt_cache_reuse(CallResult &, const char *);
-	void save_in_cache(const char *, const std::shared_ptr<llvm::LLVMContext> &, const std::shared_ptr<llvm::ExecutionEngine> &, llvm::Module *);
+	struct CompileResult{
+		std::shared_ptr<CachedProgram> program;
+		std::string error_message;
+	};
+	// Compilations in progress, by path. Whoever asks for a program that's
+	// being compiled waits for that same compilation.
+	std::map<std::string, std::shared_future<CompileResult>> compilations;
+	// Guards cached_programs and compilations, since programs may be
+	// compiled from a background thread. Not held while compiling.
+	std::mutex mutex;
+	std::shared_ptr<CachedProgram> find_in_cache(const char *);
+	std::shared_ptr<CachedProgram> compile(const char *filename, std::string &error_message);
+	std::shared_ptr<CachedProgram> get_program(const char *filename, CallResult &result);
 public:
 	CppInterpreter(const CppInterpreterParameters &);
 	~CppInterpreter();
 	CallResult execute_path(const char *filename);
+	CallResult compile_path(const char *filename);
 	void pass_main_arguments(void *&, void *&) const;
 	void set_return_value(void *rv){
 		this->return_value = rv;
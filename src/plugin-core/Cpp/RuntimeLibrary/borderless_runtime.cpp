@@ -13,6 +13,18 @@ void Application::display_in_current_window(const Image &img){
 		::display_in_current_window(this->state, img.get_handle());
 }
 
+int Application::get_frame_index(){
+	int ret;
+	get_frame_info(this->state, &ret, nullptr);
+	return ret;
+}
+
+int Application::get_frame_count(){
+	int ret;
+	get_frame_info(this->state, nullptr, &ret);
+	return ret;
+}
+
 void Application::debug_print(const std::string &s){
 	::debug_print(s.c_str());
 }
@@ -21,14 +33,34 @@ void Application::show_message_box(const std::string &s){
 	::show_message_box(s.c_str());
 }
 
+void Application::begin_phase(const char *name){
+	borderless_begin_phase(this->state, name);
+}
+
+void Application::end_phase(){
+	borderless_end_phase(this->state);
+}
+
+SaveStatus Application::poll_save(int ticket){
+	return (SaveStatus)poll_saved_image(this->state, ticket);
+}
+
+bool Application::wait_for_save(int ticket){
+	return wait_for_saved_image(this->state, ticket) == SAVE_SUCCEEDED;
+}
+
+bool Application::wait_for_saves(){
+	return !!wait_for_saved_images(this->state);
+}
+
 Image::Image(const char *path){
 	auto p = load_image(g_application->get_state(), path);
 	if (p)
 		this->handle.reset(p);
 }
 
-Image::Image(int w, int h){
-	auto p = allocate_image(g_application->get_state(), w, h);
+Image::Image(int w, int h, PixelFormat format){
+	auto p = allocate_image_with_format(g_application->get_state(), w, h, (pixel_format)format);
 	if (p)
 		this->handle.reset(p);
 }
@@ -66,23 +98,73 @@ void Image::get_pixel_data(int &w, int &h, int &stride, int &pitch, unsigned cha
 	pixels = this->pixels;
 }
 
+PixelFormat Image::get_format() const{
+	return (PixelFormat)get_image_format(this->get_handle());
+}
+
+bool Image::convert(PixelFormat format){
+	if (!convert_image_format(this->get_handle(), (pixel_format)format))
+		return false;
+	this->props_initialized = false;
+	return true;
+}
+
+Plane Image::get_plane(Channel channel, bool writable){
+	Plane ret;
+	this->get_dimensions(ret.w, ret.h);
+	ret.data = get_image_plane(this->get_handle(), (image_channel)channel, writable, &ret.pitch);
+	this->props_initialized = false;
+	return ret;
+}
+
+void Image::commit_planes(){
+	commit_image_planes(this->get_handle());
+}
+
+void Image::release_planes(){
+	release_image_planes(this->get_handle());
+}
+
+bool Image::dither(const DitherOptions &options){
+	return !!dither_image(this->get_handle(), &options);
+}
+
 bool Image::save(const char *path){
 	return !!save_image(this->get_handle(), path);
 }
 
-ImageIterator::ImageIterator(Image &image): image(image){
+int Image::save_async(const char *path){
+	return save_image_async(this->get_handle(), path);
+}
+
+ImageIterator::ImageIterator(Image &image, TraversalOrder order):
+		image(image),
+		order(order),
+		generator(0, 0){
 	this->image.get_pixel_data(this->w, this->h, this->stride, this->pitch, this->pixels);
+	this->generator = ::TraversalGenerator(this->w, this->h, (traversal_order)order);
 	this->reset();
 }
 
 bool ImageIterator::next(u8 *&pi){
-	if (this->i >= this->n)
+	if (this->order == TraversalOrder::Raster){
+		if (this->i >= this->n)
+			return false;
+		pi = this->pixels + this->i++ * this->stride;
+		return true;
+	}
+	if (!this->generator.next(this->x, this->y))
 		return false;
-	pi = this->pixels + this->i++ * 4;
+	pi = this->pixels + this->y * this->pitch + this->x * this->stride;
 	return true;
 }
 
 void ImageIterator::position(int &x, int &y) const{
+	if (this->order != TraversalOrder::Raster){
+		x = this->x;
+		y = this->y;
+		return;
+	}
 	auto i = this->i - 1;
 	x = i % this->w;
 	y = i / this->w;
@@ -91,4 +173,6 @@ void ImageIterator::position(int &x, int &y) const{
 void ImageIterator::reset(){
 	this->i = 0;
 	this->n = this->w * this->h;
+	this->x = this->y = 0;
+	this->generator.reset();
 }
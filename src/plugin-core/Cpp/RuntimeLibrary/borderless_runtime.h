@@ -2,16 +2,85 @@
 #define BORDERLESS_RUNTIME_H
 
 #include "capi.h"
+#include "traversal.h"
 //#include <memory>
 #include <string>
 #include <unordered_map>
 #include <cstdint>
+#include <initializer_list>
+#include <type_traits>
 
 namespace B{
 	typedef ::Image *handle_t;
 	typedef ::PluginCoreState *state_t;
 	class Image;
 	
+	enum class PixelFormat{
+		RGBA8 = PIXEL_FORMAT_RGBA8,
+		RGBA16 = PIXEL_FORMAT_RGBA16,
+		RGBA32F = PIXEL_FORMAT_RGBA32F,
+	};
+	
+	enum class TraversalOrder{
+		Raster = TRAVERSAL_RASTER,
+		Serpentine = TRAVERSAL_SERPENTINE,
+		ZigZag = TRAVERSAL_ZIGZAG,
+		Hilbert = TRAVERSAL_HILBERT,
+		Morton = TRAVERSAL_MORTON,
+	};
+	
+	enum class Channel{
+		Red = IMAGE_CHANNEL_RED,
+		Green = IMAGE_CHANNEL_GREEN,
+		Blue = IMAGE_CHANNEL_BLUE,
+		Alpha = IMAGE_CHANNEL_ALPHA,
+		Luma = IMAGE_CHANNEL_LUMA,
+	};
+	
+	enum class SaveStatus{
+		Pending = SAVE_PENDING,
+		Failed = SAVE_FAILED,
+		Succeeded = SAVE_SUCCEEDED,
+	};
+	
+	enum class DitherAlgorithm{
+		FloydSteinberg = DITHER_FLOYD_STEINBERG,
+		Jarvis = DITHER_JARVIS,
+		Stucki = DITHER_STUCKI,
+		Atkinson = DITHER_ATKINSON,
+		Bayer = DITHER_BAYER,
+	};
+	
+	// See dither_options in capi.h. The palette must outlive the call to
+	// Image::dither().
+	struct DitherOptions : public ::dither_options{
+		DitherOptions(){
+			::get_default_dither_options(this);
+		}
+		DitherOptions(DitherAlgorithm algorithm, int levels = 2): DitherOptions(){
+			this->algorithm = (dither_algorithm)algorithm;
+			this->levels = levels;
+		}
+	};
+	
+	// A single channel of an image, as floats in the range [0; 1]. See
+	// get_image_plane().
+	struct Plane{
+		float *data = nullptr;
+		int w = 0,
+			h = 0,
+			pitch = 0;
+		operator bool() const{
+			return !!this->data;
+		}
+		float *row(int y) const{
+			return this->data + this->pitch * y;
+		}
+		float &operator()(int x, int y) const{
+			return this->data[x + this->pitch * y];
+		}
+	};
+	
 	class shared_ptr{
 		handle_t p;
 		unsigned *refcount;
@@ -68,12 +137,43 @@ namespace B{
 		Application(state_t state): state(state){}
 		B::Image get_displayed_image();
 		void display_in_current_window(const Image &);
+		// The frame of the displayed image being filtered, if it's animated.
+		int get_frame_index();
+		int get_frame_count();
 		void debug_print(const std::string &);
 		void show_message_box(const std::string &);
+		void begin_phase(const char *name);
+		void end_phase();
+		// Tickets come from Image::save_async().
+		SaveStatus poll_save(int ticket);
+		bool wait_for_save(int ticket);
+		// Returns false if any save not yet waited on failed.
+		bool wait_for_saves();
 	};
 	
 	Application *g_application;
 	
+	inline double clock(){
+		return borderless_clock();
+	}
+	
+	inline unsigned long long clock_ns(){
+		return borderless_clock_ns();
+	}
+	
+	// Reports the time spent in its scope as a named phase of the run.
+	class Phase{
+		Phase(const Phase &);
+		void operator=(const Phase &);
+	public:
+		Phase(const char *name){
+			g_application->begin_phase(name);
+		}
+		~Phase(){
+			g_application->end_phase();
+		}
+	};
+	
 	class Image{
 		friend class Application;
 		shared_ptr handle;
@@ -91,7 +191,7 @@ namespace B{
 		Image(handle_t handle): handle(handle){}
 		Image(const char *path);
 		Image(const std::string &path): Image(path.c_str()){}
-		Image(int w, int h);
+		Image(int w, int h, PixelFormat format = PixelFormat::RGBA8);
 		~Image();
 		Image clone() const;
 		Image clone_without_data() const;
@@ -103,23 +203,60 @@ namespace B{
 		}
 		void get_dimensions(int &w, int &h);
 		void get_pixel_data(int &w, int &h, int &stride, int &pitch, unsigned char *&pixels);
+		PixelFormat get_format() const;
+		// Converts the image in place. Invalidates pixel pointers and iterators.
+		bool convert(PixelFormat);
+		// Pixel pointers obtained before this call shouldn't be written to
+		// while planes are in use; get_pixel_data() commits the planes. Plane
+		// data stays valid until release_planes() or the image is unloaded,
+		// but must be requested again after get_pixel_data() or convert().
+		Plane get_plane(Channel, bool writable = true);
+		void commit_planes();
+		void release_planes();
+		// Dithers the image in place. Pixel pointers remain valid.
+		bool dither(const DitherOptions & = DitherOptions());
 		bool save(const char *path);
 		bool save(const std::string &path){
 			return this->save(path.c_str());
 		}
+		// Returns a ticket right away, or zero on failure. The image may be
+		// modified as soon as this returns.
+		int save_async(const char *path);
+		int save_async(const std::string &path){
+			return this->save_async(path.c_str());
+		}
 		handle_t get_handle() const{
 			return this->handle ? this->handle.get() : nullptr;
 		}
 	};
 	
+	// Calls f(x0, y0, x1, y1) for every tile of a w x h area, on every core,
+	// in an order that respects the dependencies of the stencil. For example,
+	// for error diffusion:
+	//   B::parallel_wavefront(w, h, { { -1, 0 }, { 1, -1 } }, [&](int x0, int y0, int x1, int y1){ ... });
+	// See run_wavefront() in capi.h.
+	template <typename F>
+	bool parallel_wavefront(int w, int h, std::initializer_list<wavefront_dependency> stencil, F &&f, int tile_w = 0, int tile_h = 0){
+		typedef typename std::remove_reference<F>::type function_t;
+		auto trampoline = [](void *ud, int x0, int y0, int x1, int y1){
+			(*(function_t *)ud)(x0, y0, x1, y1);
+		};
+		return !!run_wavefront(w, h, tile_w, tile_h, stencil.begin(), (int)stencil.size(), trampoline, (void *)&f);
+	}
+	
 	class ImageIterator{
 		Image &image;
 		u8 *pixels;
 		int w, h, stride, pitch, i, n;
 		unsigned state;
+		TraversalOrder order;
+		::TraversalGenerator generator;
+		int x, y;
 	public:
-		ImageIterator(Image &);
+		ImageIterator(Image &, TraversalOrder = TraversalOrder::Raster);
 		// Behaves like iterator++ != end for while and for predicate.
+		// For wide formats, the pointer should be cast according to
+		// Image::get_format().
 		bool next(u8 *&pi);
 		void position(int &x, int &y) const;
 		void reset();
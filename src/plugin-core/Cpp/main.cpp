@@ -45,6 +45,18 @@ CPP_PLUGIN_EXPORT_C void CppInterpreter_execute(CallResult *result, CppInterpret
 	}
 }
 
+CPP_PLUGIN_EXPORT_C void CppInterpreter_compile(CallResult *result, CppInterpreter *interpreter, const char *filename){
+	try{
+		auto r = interpreter->compile_path(filename);
+		if (result)
+			*result = r;
+	}catch (std::exception &e){
+		result->impl = new CallResultImpl((std::string)"Exception thrown: " + e.what());
+		result->error_message = result->impl->message.c_str();
+		result->success = false;
+	}
+}
+
 CPP_PLUGIN_EXPORT_C void CppInterpreter_reset_imag(CppInterpreter *interpreter, external_state image){
 	interpreter->reset_image(image);
 }
@@ -49,6 +49,9 @@ struct CppInterpreterParameters{
 Cpp_DECLARE_EXPORTED_FUNCTION(CppInterpreter *, new_CppInterpreter, CppInterpreterParameters *parameters);
 Cpp_DECLARE_EXPORTED_FUNCTION(void, delete_CppInterpreter, CppInterpreter *);
 Cpp_DECLARE_EXPORTED_FUNCTION(void, CppInterpreter_execute, CallResult *result, CppInterpreter *, const char *filename);
+// Compiles the program and keeps it in the cache without running it. May be
+// called from a thread other than the one that calls CppInterpreter_execute().
+Cpp_DECLARE_EXPORTED_FUNCTION(void, CppInterpreter_compile, CallResult *result, CppInterpreter *, const char *filename);
 Cpp_DECLARE_EXPORTED_FUNCTION(void, CppInterpreter_reset_imag, CppInterpreter *, external_state);
 Cpp_DECLARE_EXPORTED_FUNCTION(void, delete_CppCallResult, CallResult *);
 
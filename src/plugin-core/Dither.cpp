@@ -0,0 +1,548 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "Dither.h"
+#include "ImageStore.h"
+#include "PixelFormat.h"
+#include "ParallelFor.h"
+#include <QThreadPool>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DITHER_USE_SSE
+#endif
+
+namespace{
+
+// Where the quantization error of a pixel goes, relative to the pixel and to
+// the direction of the row.
+struct Tap{
+	int dx, dy;
+	float weight;
+};
+
+const Tap floyd_steinberg_taps[] = {
+	{  1, 0, 7 / 16.f },
+	{ -1, 1, 3 / 16.f },
+	{  0, 1, 5 / 16.f },
+	{  1, 1, 1 / 16.f },
+};
+
+const Tap jarvis_taps[] = {
+	{  1, 0, 7 / 48.f },
+	{  2, 0, 5 / 48.f },
+	{ -2, 1, 3 / 48.f },
+	{ -1, 1, 5 / 48.f },
+	{  0, 1, 7 / 48.f },
+	{  1, 1, 5 / 48.f },
+	{  2, 1, 3 / 48.f },
+	{ -2, 2, 1 / 48.f },
+	{ -1, 2, 3 / 48.f },
+	{  0, 2, 5 / 48.f },
+	{  1, 2, 3 / 48.f },
+	{  2, 2, 1 / 48.f },
+};
+
+const Tap stucki_taps[] = {
+	{  1, 0, 8 / 42.f },
+	{  2, 0, 4 / 42.f },
+	{ -2, 1, 2 / 42.f },
+	{ -1, 1, 4 / 42.f },
+	{  0, 1, 8 / 42.f },
+	{  1, 1, 4 / 42.f },
+	{  2, 1, 2 / 42.f },
+	{ -2, 2, 1 / 42.f },
+	{ -1, 2, 2 / 42.f },
+	{  0, 2, 4 / 42.f },
+	{  1, 2, 2 / 42.f },
+	{  2, 2, 1 / 42.f },
+};
+
+// Only diffuses 6/8 of the error, by design.
+const Tap atkinson_taps[] = {
+	{  1, 0, 1 / 8.f },
+	{  2, 0, 1 / 8.f },
+	{ -1, 1, 1 / 8.f },
+	{  0, 1, 1 / 8.f },
+	{  1, 1, 1 / 8.f },
+	{  0, 2, 1 / 8.f },
+};
+
+const unsigned char bayer_matrix[8][8] = {
+	{  0, 32,  8, 40,  2, 34, 10, 42 },
+	{ 48, 16, 56, 24, 50, 18, 58, 26 },
+	{ 12, 44,  4, 36, 14, 46,  6, 38 },
+	{ 60, 28, 52, 20, 62, 30, 54, 22 },
+	{  3, 35, 11, 43,  1, 33,  9, 41 },
+	{ 51, 19, 59, 27, 49, 17, 57, 25 },
+	{ 15, 47,  7, 39, 13, 45,  5, 37 },
+	{ 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+const float luma_weights[] = { 0.2126f, 0.7152f, 0.0722f };
+
+// Kernels span at most three rows, the current one included.
+const int max_kernel_rows = 3;
+
+#define TAPS(x) x, sizeof(x) / sizeof(*x)
+
+// Every kernel diffuses within the current row only forwards, and at most two
+// pixels. Those errors are carried in registers from pixel to pixel; only
+// the taps below go through memory.
+struct Kernel{
+	int count;
+	// Largest horizontal reach of a tap.
+	int radius;
+	float ahead[2];
+	Tap below[16];
+	int below_count;
+	Kernel(const Tap *taps = nullptr, int count = 0): count(count), radius(0), below_count(0){
+		this->ahead[0] = this->ahead[1] = 0;
+		for (int i = 0; i < count; i++){
+			auto &tap = taps[i];
+			this->radius = std::max(this->radius, std::abs(tap.dx));
+			if (!tap.dy)
+				this->ahead[tap.dx - 1] = tap.weight;
+			else
+				this->below[this->below_count++] = tap;
+		}
+	}
+};
+
+Kernel get_kernel(dither_algorithm algorithm){
+	switch (algorithm){
+		case DITHER_FLOYD_STEINBERG:
+			return Kernel(TAPS(floyd_steinberg_taps));
+		case DITHER_JARVIS:
+			return Kernel(TAPS(jarvis_taps));
+		case DITHER_STUCKI:
+			return Kernel(TAPS(stucki_taps));
+		case DITHER_ATKINSON:
+			return Kernel(TAPS(atkinson_taps));
+		default:
+			return Kernel();
+	}
+}
+
+// Samples are worked on as single floats (the luma) in grayscale mode and as
+// groups of four floats (red, green, blue, and an unused lane) otherwise, so
+// that a whole pixel fits in a vector register. When dithering to levels they
+// are scaled so that the levels fall on integers, which keeps the chain of
+// dependencies from one pixel to the next as short as possible.
+// Adding and subtracting this rounds to the nearest integer, in fewer cycles
+// than a round trip through an integer register.
+const float rounding_constant = 12582912.f;
+
+template <int Lanes>
+struct Sample{
+	float v[Lanes];
+
+	static Sample load(const float *p){
+		Sample ret;
+		for (int i = 0; i < Lanes; i++)
+			ret.v[i] = p[i];
+		return ret;
+	}
+	void store(float *p) const{
+		for (int i = 0; i < Lanes; i++)
+			p[i] = this->v[i];
+	}
+	Sample clamp(float max) const{
+		Sample ret;
+		for (int i = 0; i < Lanes; i++)
+			ret.v[i] = std::min(std::max(this->v[i], 0.f), max);
+		return ret;
+	}
+	Sample operator+(const Sample &o) const{
+		Sample ret;
+		for (int i = 0; i < Lanes; i++)
+			ret.v[i] = this->v[i] + o.v[i];
+		return ret;
+	}
+	Sample operator-(const Sample &o) const{
+		Sample ret;
+		for (int i = 0; i < Lanes; i++)
+			ret.v[i] = this->v[i] - o.v[i];
+		return ret;
+	}
+	Sample operator+(float x) const{
+		Sample ret;
+		for (int i = 0; i < Lanes; i++)
+			ret.v[i] = this->v[i] + x;
+		return ret;
+	}
+	Sample operator*(float x) const{
+		Sample ret;
+		for (int i = 0; i < Lanes; i++)
+			ret.v[i] = this->v[i] * x;
+		return ret;
+	}
+	Sample round() const{
+		Sample ret;
+		for (int i = 0; i < Lanes; i++){
+			float t = this->v[i] + rounding_constant;
+			ret.v[i] = t - rounding_constant;
+		}
+		return ret;
+	}
+	static void add_scaled(float *dst, const Sample &s, float weight){
+		for (int i = 0; i < Lanes; i++)
+			dst[i] += s.v[i] * weight;
+	}
+};
+
+#ifdef DITHER_USE_SSE
+template <>
+struct Sample<4>{
+	__m128 v;
+
+	static Sample load(const float *p){
+		Sample ret;
+		ret.v = _mm_loadu_ps(p);
+		return ret;
+	}
+	void store(float *p) const{
+		_mm_storeu_ps(p, this->v);
+	}
+	Sample clamp(float max) const{
+		Sample ret;
+		ret.v = _mm_min_ps(_mm_max_ps(this->v, _mm_setzero_ps()), _mm_set1_ps(max));
+		return ret;
+	}
+	Sample operator+(const Sample &o) const{
+		Sample ret;
+		ret.v = _mm_add_ps(this->v, o.v);
+		return ret;
+	}
+	Sample operator-(const Sample &o) const{
+		Sample ret;
+		ret.v = _mm_sub_ps(this->v, o.v);
+		return ret;
+	}
+	Sample operator+(float x) const{
+		Sample ret;
+		ret.v = _mm_add_ps(this->v, _mm_set1_ps(x));
+		return ret;
+	}
+	Sample operator*(float x) const{
+		Sample ret;
+		ret.v = _mm_mul_ps(this->v, _mm_set1_ps(x));
+		return ret;
+	}
+	Sample round() const{
+		auto k = _mm_set1_ps(rounding_constant);
+		Sample ret;
+		ret.v = _mm_sub_ps(_mm_add_ps(this->v, k), k);
+		return ret;
+	}
+	static void add_scaled(float *dst, const Sample &s, float weight){
+		_mm_storeu_ps(dst, _mm_add_ps(_mm_loadu_ps(dst), _mm_mul_ps(s.v, _mm_set1_ps(weight))));
+	}
+};
+#endif
+
+class DitherJob{
+	const dither_options &options;
+	Kernel kernel;
+	bool diffuse;
+	int w, h;
+	std::uint8_t *pixels;
+	unsigned pitch;
+	pixel_format format;
+	// Rows of the error buffer are padded by the radius of the kernel on
+	// both sides, so that errors can be diffused without checking bounds.
+	// Whatever lands on the padding is never read. Row y of the image uses
+	// row y % error_rows of the buffer, which has room for every row being
+	// dithered plus the rows they diffuse into; a row is zeroed as it's
+	// read, so it can be reused.
+	int padded_w;
+	int error_rows;
+	std::vector<float> errors;
+	int threads;
+	// Samples are multiplied by scale while they're dithered. With a palette
+	// it's 1.
+	float scale,
+		inverse_scale;
+	// Amplitude of the ordered dither, in scaled units.
+	float spread;
+	// Four floats per color. In grayscale mode, the first one is the luma.
+	std::vector<float> palette,
+		palette_rgb;
+	// Number of pixels of each row already dithered, in the direction of
+	// the row.
+	std::unique_ptr<std::atomic<int>[]> progress;
+
+	struct RowBuffers{
+		// The pixels of the row, as RGBA32F.
+		std::vector<float> pixels;
+		// The samples being dithered.
+		std::vector<float> samples;
+		// The chosen color of every pixel, when using a palette.
+		std::vector<int> colors;
+	};
+
+	int get_direction(int y) const{
+		return this->options.serpentine && y % 2 ? -1 : 1;
+	}
+	float *get_error_row(int y, int lanes){
+		return &this->errors[((size_t)(y % this->error_rows) * this->padded_w + this->kernel.radius) * lanes];
+	}
+	void wait_for_progress(int y, int needed, int &cached);
+	template <int Lanes>
+	int find_nearest_color(const Sample<Lanes> &) const;
+	template <int Lanes, bool Diffuse, bool UsePalette>
+	void process_row(int y, RowBuffers &);
+public:
+	DitherJob(Image &, const dither_options &);
+	void run();
+};
+
+DitherJob::DitherJob(Image &image, const dither_options &options): options(options){
+	this->kernel = get_kernel(options.algorithm);
+	this->diffuse = !!this->kernel.count;
+	image.get_dimensions(this->w, this->h);
+	unsigned stride;
+	this->pixels = (std::uint8_t *)image.get_pixels_pointer(stride, this->pitch);
+	this->format = image.get_format();
+	int lanes = options.grayscale ? 1 : 4;
+	this->padded_w = this->w + 2 * this->kernel.radius;
+	this->threads = parallel_for_threads(this->h, options.threads);
+	this->error_rows = std::min(this->threads + max_kernel_rows, this->h + max_kernel_rows - 1);
+	if (this->diffuse)
+		this->errors.resize((size_t)this->padded_w * this->error_rows * lanes);
+	this->scale = options.palette ? 1 : (float)(std::max(options.levels, 2) - 1);
+	this->inverse_scale = 1 / this->scale;
+	this->spread = 1;
+	if (options.palette){
+		for (int i = 0; i < options.palette_size; i++){
+			float rgb[4];
+			for (int j = 0; j < 3; j++)
+				rgb[j] = options.palette[i].data[j] * (1.f / 255.f);
+			rgb[3] = 0;
+			this->palette_rgb.insert(this->palette_rgb.end(), rgb, rgb + 4);
+			if (options.grayscale)
+				rgb[0] = rgb[0] * luma_weights[0] + rgb[1] * luma_weights[1] + rgb[2] * luma_weights[2];
+			this->palette.insert(this->palette.end(), rgb, rgb + 4);
+		}
+		// For ordered dithering, approximate the spacing between colors.
+		this->spread = 1.f / std::max(options.palette_size - 1, 1);
+	}
+	this->progress.reset(new std::atomic<int>[this->h]);
+	for (int i = 0; i < this->h; i++)
+		this->progress[i] = 0;
+}
+
+void DitherJob::wait_for_progress(int y, int needed, int &cached){
+	while (true){
+		cached = this->progress[y].load(std::memory_order_acquire);
+		if (cached >= needed)
+			break;
+		std::this_thread::yield();
+	}
+}
+
+template <int Lanes>
+int DitherJob::find_nearest_color(const Sample<Lanes> &sample) const{
+	float v[4];
+	sample.store(v);
+	int ret = 0;
+	float best = -1;
+	int n = (int)this->palette.size() / 4;
+	for (int i = 0; i < n; i++){
+		auto color = &this->palette[i * 4];
+		float distance = 0;
+		for (int j = 0; j < Lanes && j < 3; j++)
+			distance += (v[j] - color[j]) * (v[j] - color[j]);
+		if (best < 0 || distance < best){
+			ret = i;
+			best = distance;
+		}
+	}
+	return ret;
+}
+
+template <int Lanes, bool Diffuse, bool UsePalette>
+void DitherJob::process_row(int y, RowBuffers &buffers){
+	auto scanline = this->pixels + (size_t)this->pitch * y;
+	auto pixels = &buffers.pixels[0];
+	auto samples = &buffers.samples[0];
+	auto colors = &buffers.colors[0];
+	// 8-bit images, by far the most common, are read and written directly.
+	bool direct = this->format == PIXEL_FORMAT_RGBA8;
+	if (!direct)
+		convert_pixels(pixels, PIXEL_FORMAT_RGBA32F, scanline, this->format, this->w);
+	float input_scale = direct ? this->scale * (1.f / 255.f) : this->scale;
+	for (int x = 0; x < this->w; x++){
+		float rgb[3];
+		for (int j = 0; j < 3; j++)
+			rgb[j] = (direct ? scanline[x * 4 + j] : pixels[x * 4 + j]) * input_scale;
+		if (Lanes == 1)
+			samples[x] = rgb[0] * luma_weights[0] + rgb[1] * luma_weights[1] + rgb[2] * luma_weights[2];
+		else{
+			std::copy(rgb, rgb + 3, samples + x * Lanes);
+			samples[x * Lanes + 3] = 0;
+		}
+	}
+
+	int direction = this->get_direction(y);
+	auto error_row = Diffuse ? this->get_error_row(y, Lanes) : nullptr;
+	// Offsets of the taps below, in floats, for this direction.
+	ptrdiff_t offsets[16];
+	float weights[16];
+	int below_count = this->kernel.below_count;
+	for (int i = 0; i < below_count; i++){
+		auto &tap = this->kernel.below[i];
+		offsets[i] = Diffuse ? this->get_error_row(y + tap.dy, Lanes) - error_row + tap.dx * direction * Lanes : 0;
+		weights[i] = tap.weight;
+	}
+	if (Diffuse){
+		// The rows this one diffuses into must have been read by the rows
+		// that used them before.
+		int previous = y + max_kernel_rows - 1 - this->error_rows;
+		int cached;
+		if (previous >= 0)
+			this->wait_for_progress(previous, this->w, cached);
+	}
+	float ahead0 = this->kernel.ahead[0],
+		ahead1 = this->kernel.ahead[1];
+	Sample<Lanes> carry0,
+		carry1;
+	if (Diffuse){
+		float zero[4] = {};
+		carry0 = carry1 = Sample<Lanes>::load(zero);
+	}
+	// Kept in locals, since the stores below could otherwise alias them.
+	int w = this->w;
+	// The previous row must be done with every pixel that diffuses into this
+	// one, and far enough away that the errors the two rows diffuse never
+	// land on the same samples. Rows further up are transitively further
+	// ahead.
+	int reach = 2 * this->kernel.radius;
+	bool previous_forwards = y && this->get_direction(y - 1) > 0;
+	float scale = this->scale,
+		spread = this->spread;
+	auto progress = &this->progress[y];
+	int cached_progress = 0;
+	for (int i = 0; i < w; i++){
+		int x = direction > 0 ? i : w - 1 - i;
+		auto sample = Sample<Lanes>::load(samples + x * Lanes);
+		Sample<Lanes> quantized;
+		if (Diffuse){
+			if (y){
+				int needed = previous_forwards ? std::min(x + reach + 1, w) : w - std::max(x - reach, 0);
+				if (cached_progress < needed)
+					this->wait_for_progress(y - 1, needed, cached_progress);
+			}
+			auto error = error_row + x * Lanes;
+			sample = (sample + Sample<Lanes>::load(error) + carry0).clamp(scale);
+			std::fill(error, error + Lanes, 0.f);
+			if (UsePalette){
+				colors[x] = this->find_nearest_color(sample);
+				quantized = Sample<Lanes>::load(&this->palette[colors[x] * 4]);
+			}else
+				quantized = sample.round();
+			auto e = sample - quantized;
+			carry0 = carry1 + e * ahead0;
+			carry1 = e * ahead1;
+			for (int j = 0; j < below_count; j++)
+				Sample<Lanes>::add_scaled(error + offsets[j], e, weights[j]);
+			progress->store(i + 1, std::memory_order_release);
+		}else{
+			float bias = ((bayer_matrix[y % 8][x % 8] + 0.5f) / 64.f - 0.5f) * spread;
+			sample = sample + bias;
+			if (UsePalette)
+				colors[x] = this->find_nearest_color(sample);
+			else
+				quantized = sample.clamp(scale).round();
+		}
+		if (!UsePalette)
+			quantized.store(samples + x * Lanes);
+	}
+
+	float output_scale = UsePalette ? 1 : this->inverse_scale;
+	for (int x = 0; x < this->w; x++){
+		const float *rgb = UsePalette ? &this->palette_rgb[colors[x] * 4] : samples + x * Lanes;
+		// Palette entries are always full colors; grayscale samples are a
+		// single luma.
+		int gray = !UsePalette && Lanes == 1;
+		for (int j = 0; j < 3; j++){
+			float c = rgb[gray ? 0 : j] * output_scale;
+			if (direct)
+				scanline[x * 4 + j] = (std::uint8_t)(c * 255.f + 0.5f);
+			else
+				pixels[x * 4 + j] = c;
+		}
+	}
+	if (!direct)
+		convert_pixels(scanline, this->format, pixels, PIXEL_FORMAT_RGBA32F, this->w);
+}
+
+void DitherJob::run(){
+	void (DitherJob::*process)(int, RowBuffers &);
+	bool palette = !!this->palette.size();
+#define DitherJob_SELECT_PROCESS(lanes) \
+	if (this->diffuse) \
+		process = palette ? &DitherJob::process_row<lanes, true, true> : &DitherJob::process_row<lanes, true, false>; \
+	else \
+		process = palette ? &DitherJob::process_row<lanes, false, true> : &DitherJob::process_row<lanes, false, false>
+	if (this->options.grayscale){
+		DitherJob_SELECT_PROCESS(1);
+	}else{
+		DitherJob_SELECT_PROCESS(4);
+	}
+
+	int lanes = this->options.grayscale ? 1 : 4;
+	int threads = this->threads;
+	std::vector<RowBuffers> buffers(threads);
+	for (auto &b : buffers){
+		b.pixels.resize((size_t)this->w * 4);
+		// Room for a full vector load on the last sample.
+		b.samples.resize((size_t)this->w * lanes + 4);
+		b.colors.resize(this->w);
+	}
+	// Rows are handed out in order, and a row only ever waits on rows
+	// already being worked on, so the helpers may start late without risk of
+	// deadlock.
+	parallel_for(this->h, [this, process, &buffers](int y, int thread){ (this->*process)(y, buffers[thread]); }, threads);
+}
+
+}
+
+void get_default_dither_options(dither_options &options){
+	options.algorithm = DITHER_FLOYD_STEINBERG;
+	options.levels = 2;
+	options.palette = nullptr;
+	options.palette_size = 0;
+	options.grayscale = 1;
+	options.serpentine = 0;
+	options.threads = 0;
+}
+
+const char *check_dither_options(const dither_options &options){
+	if (options.algorithm < DITHER_FLOYD_STEINBERG || options.algorithm > DITHER_BAYER)
+		return "Unknown dithering algorithm.";
+	if (options.palette){
+		if (options.palette_size < 1 || options.palette_size > DITHER_MAX_PALETTE_SIZE)
+			return "Invalid palette size.";
+	}else if (options.levels < 2 || options.levels > 65536)
+		return "The number of levels should be between 2 and 65536.";
+	return nullptr;
+}
+
+const char *dither(Image &image, const dither_options &options){
+	auto error = check_dither_options(options);
+	if (error)
+		return error;
+	DitherJob job(image, options);
+	job.run();
+	return nullptr;
+}
@@ -0,0 +1,21 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef DITHER_H
+#define DITHER_H
+
+#include "capi.h"
+
+void get_default_dither_options(dither_options &);
+// Returns nullptr if the options are usable, otherwise a message with static
+// storage duration.
+const char *check_dither_options(const dither_options &);
+// Dithers the image in place. Returns nullptr on success, otherwise a message
+// with static storage duration.
+const char *dither(Image &, const dither_options &);
+
+#endif
@@ -0,0 +1,122 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "FilterProfile.h"
+
+void FilterProfile::start_run(const QString &filter_name){
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->filter_name = filter_name;
+	this->phases.clear();
+	this->open_phases.clear();
+	this->running = true;
+	this->run_start = this->run_end = get_monotonic_clock_ns();
+}
+
+void FilterProfile::finish_run(){
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (!this->running)
+		return;
+	this->run_end = get_monotonic_clock_ns();
+	for (auto &p : this->open_phases)
+		for (auto &open : p.second)
+			this->close_phase(open, this->run_end);
+	this->open_phases.clear();
+	this->running = false;
+}
+
+size_t FilterProfile::find_phase(const std::string &path, unsigned depth){
+	for (size_t i = 0; i < this->phases.size(); i++)
+		if (this->phases[i].path == path)
+			return i;
+	Phase phase;
+	phase.path = path;
+	phase.depth = depth;
+	phase.count = 0;
+	phase.total_ns = 0;
+	this->phases.push_back(phase);
+	return this->phases.size() - 1;
+}
+
+void FilterProfile::close_phase(const OpenPhase &open, std::uint64_t now){
+	auto &phase = this->phases[open.index];
+	phase.count++;
+	phase.total_ns += now - open.start;
+}
+
+void FilterProfile::begin_phase(const char *name){
+	auto now = get_monotonic_clock_ns();
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (!this->running)
+		return;
+	auto &stack = this->open_phases[std::this_thread::get_id()];
+	std::string path;
+	if (stack.size()){
+		path = this->phases[stack.back().index].path;
+		path += '/';
+	}
+	path += name ? name : "(unnamed)";
+	OpenPhase open;
+	open.index = this->find_phase(path, (unsigned)stack.size());
+	open.start = now;
+	stack.push_back(open);
+	trace_begin(name ? name : "(unnamed)");
+}
+
+void FilterProfile::end_phase(){
+	auto now = get_monotonic_clock_ns();
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (!this->running)
+		return;
+	auto it = this->open_phases.find(std::this_thread::get_id());
+	if (it == this->open_phases.end() || !it->second.size())
+		return;
+	this->close_phase(it->second.back(), now);
+	it->second.pop_back();
+	trace_end();
+}
+
+bool FilterProfile::has_run() const{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return !this->filter_name.isEmpty();
+}
+
+std::uint64_t FilterProfile::get_total_ns() const{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->run_end - this->run_start;
+}
+
+std::vector<FilterProfile::Phase> FilterProfile::get_phases() const{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->phases;
+}
+
+static QString format_ms(std::uint64_t ns){
+	return QString::number(ns * 1e-6, 'f', 3) + " ms";
+}
+
+QString FilterProfile::to_string() const{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto total = this->run_end - this->run_start;
+	QString ret = this->filter_name + ": " + format_ms(total) + " total\n";
+	std::uint64_t top_level = 0;
+	for (auto &phase : this->phases){
+		auto slash = phase.path.rfind('/');
+		auto name = QString::fromUtf8(phase.path.c_str() + (slash == phase.path.npos ? 0 : slash + 1));
+		ret += QString(2 * (phase.depth + 1), ' ');
+		ret += name + ": " + format_ms(phase.total_ns);
+		if (phase.count != 1)
+			ret += QString(" (%1 times)").arg(phase.count);
+		if (total)
+			ret += QString(", %1%").arg(phase.total_ns * 100.0 / total, 0, 'f', 1);
+		ret += '\n';
+		if (!phase.depth)
+			top_level += phase.total_ns;
+	}
+	if (this->phases.size() && top_level < total)
+		ret += "  (outside phases): " + format_ms(total - top_level) + '\n';
+	return ret;
+}
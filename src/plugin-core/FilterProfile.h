@@ -0,0 +1,58 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef FILTERPROFILE_H
+#define FILTERPROFILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <QString>
+#include "Trace.h"
+
+// Collects the named phases a filter reports during a single run. Phases may
+// be nested, and may be reported from more than one thread; each thread keeps
+// its own nesting.
+class FilterProfile{
+public:
+	struct Phase{
+		std::string path;
+		unsigned depth;
+		unsigned count;
+		std::uint64_t total_ns;
+	};
+private:
+	struct OpenPhase{
+		size_t index;
+		std::uint64_t start;
+	};
+	mutable std::mutex mutex;
+	QString filter_name;
+	std::vector<Phase> phases;
+	std::map<std::thread::id, std::vector<OpenPhase>> open_phases;
+	std::uint64_t run_start,
+		run_end;
+	bool running;
+
+	size_t find_phase(const std::string &path, unsigned depth);
+	void close_phase(const OpenPhase &, std::uint64_t now);
+public:
+	FilterProfile(): run_start(0), run_end(0), running(false){}
+	void start_run(const QString &filter_name);
+	void finish_run();
+	void begin_phase(const char *name);
+	void end_phase();
+	bool has_run() const;
+	std::uint64_t get_total_ns() const;
+	std::vector<Phase> get_phases() const;
+	QString to_string() const;
+};
+
+#endif
@@ -6,13 +6,22 @@ Distributed under a permissive license. See COPYING.txt for details.
 */
 
 #include "ImageStore.h"
+#include "PixelFormat.h"
+#include "ParallelEncoder.h"
 #include <QImage>
 #include <QFile>
+#include <QFileInfo>
+#include <QThreadStorage>
 
 Image::Image(const QString &path, ImageStore &owner, int handle):
 		owner(&owner),
 		own_handle(handle),
-		alphaed(false){
+		format(PIXEL_FORMAT_RGBA8),
+		writable_planes(0),
+		stale_planes(0),
+		planes_dirty(false),
+		alphaed(false),
+		stride(4){
 	if (!QFile::exists(path))
 		throw ImageOperationResult("File not found.");
 	this->bitmap = QImage(path);
@@ -22,10 +31,30 @@ Image::Image(const QString &path, ImageStore &owner, int handle):
 	this->h = this->bitmap.height();
 }
 
-Image::Image(int w, int h, ImageStore &owner, int handle):
+Image::Image(int w, int h, ImageStore &owner, int handle, pixel_format format):
 		owner(&owner),
 		own_handle(handle),
-		alphaed(false){
+		format(format),
+		writable_planes(0),
+		stale_planes(0),
+		planes_dirty(false),
+		alphaed(false),
+		stride(4){
+	if (!is_valid_pixel_format(format))
+		throw ImageOperationResult("Invalid pixel format.");
+	if (format != PIXEL_FORMAT_RGBA8){
+		this->w = w;
+		this->h = h;
+		this->stride = get_bytes_per_pixel(format);
+		this->pitch = w * this->stride;
+		this->alphaed = true;
+		try{
+			this->wide_pixels.resize((size_t)this->pitch * h);
+		}catch (std::bad_alloc &){
+			throw ImageOperationResult("Not enough memory.");
+		}
+		return;
+	}
 	this->bitmap = QImage(w, h, QImage::Format_RGBA8888);
 	if (this->bitmap.isNull())
 		throw ImageOperationResult("Unknown error.");
@@ -36,7 +65,12 @@ Image::Image(int w, int h, ImageStore &owner, int handle):
 Image::Image(const QImage &image, ImageStore &owner, int handle):
 		owner(&owner),
 		own_handle(handle),
-		alphaed(false){
+		format(PIXEL_FORMAT_RGBA8),
+		writable_planes(0),
+		stale_planes(0),
+		planes_dirty(false),
+		alphaed(false),
+		stride(4){
 	this->bitmap = image;
 	if (this->bitmap.isNull())
 		throw ImageOperationResult("Unknown error.");
@@ -44,27 +78,38 @@ Image::Image(const QImage &image, ImageStore &owner, int handle):
 	this->h = this->bitmap.height();
 }
 
-void Image::traverse(traversal_callback cb){
-	this->to_alpha();
+// Wide pixels are converted one at a time, and the image stays in its format.
+static void read_pixel8(std::uint8_t (&dst)[4], const std::uint8_t *pixel, pixel_format format){
+	if (format == PIXEL_FORMAT_RGBA8){
+		for (int i = 0; i < 4; i++)
+			dst[i] = pixel[i];
+		return;
+	}
+	convert_pixels(dst, PIXEL_FORMAT_RGBA8, pixel, format, 1);
+}
 
-	auto pixels = this->bitmap.bits();
-	for (int y = 0; y < this->h; y++){
-		//auto scanline = pixels + this->pitch * (this->h - 1 - y);
-		auto scanline = pixels + this->pitch * y;
-		for (int x = 0; x < this->w; x++){
-			auto pixel = scanline + x * this->stride;
-			int r = pixel[0];
-			int g = pixel[1];
-			int b = pixel[2];
-			int a = pixel[3];
-			auto prev = this->owner->get_current_traversal_image();
-			auto prev_pixel = this->current_pixel;
-			this->owner->set_current_traversal_image(this);
-			this->current_pixel = pixel;
-			cb(r, g, b, a, x, y);
-			this->owner->set_current_traversal_image(prev);
-			this->current_pixel = prev_pixel;
-		}
+void Image::traverse(traversal_callback cb, traversal_order order){
+	// The callback may write to the pixels.
+	unsigned stride, pitch;
+	auto pixels = (std::uint8_t *)this->get_pixels_pointer(stride, pitch);
+
+	TraversalGenerator generator(this->w, this->h, order);
+	int x, y;
+	while (generator.next(x, y)){
+		auto pixel = pixels + (size_t)pitch * y + x * stride;
+		std::uint8_t rgba[4];
+		read_pixel8(rgba, pixel, this->format);
+		int r = rgba[0];
+		int g = rgba[1];
+		int b = rgba[2];
+		int a = rgba[3];
+		auto prev = this->owner->get_current_traversal_image();
+		auto prev_pixel = this->current_pixel;
+		this->owner->set_current_traversal_image(this);
+		this->current_pixel = pixel;
+		cb(r, g, b, a, x, y);
+		this->owner->set_current_traversal_image(prev);
+		this->current_pixel = prev_pixel;
 	}
 }
 
@@ -77,29 +122,152 @@ void Image::to_alpha(){
 	this->alphaed = true;
 }
 
+bool Image::decode_wide(pixel_format format){
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+	// Older versions of Qt always decode to 8 bits per channel.
+	if (this->bitmap.depth() < 64)
+		return false;
+	auto source = this->bitmap.convertToFormat(QImage::Format_RGBA64);
+	if (source.isNull())
+		return false;
+	auto pitch = (size_t)this->w * get_bytes_per_pixel(format);
+	std::vector<std::uint8_t> pixels(pitch * this->h);
+	for (int y = 0; y < this->h; y++)
+		convert_pixels(&pixels[pitch * y], format, source.constScanLine(y), PIXEL_FORMAT_RGBA16, this->w);
+	this->wide_pixels.swap(pixels);
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool Image::convert_format(pixel_format format){
+	if (!is_valid_pixel_format(format))
+		return false;
+	// Planes are stored in a format-independent way, but they must not be
+	// committed later on top of the converted pixels.
+	this->invalidate_planes();
+	if (format == this->format){
+		if (format == PIXEL_FORMAT_RGBA8)
+			this->to_alpha();
+		return true;
+	}
+	auto new_stride = get_bytes_per_pixel(format);
+	auto new_pitch = (size_t)this->w * new_stride;
+	try{
+		if (this->format == PIXEL_FORMAT_RGBA8){
+			if (this->alphaed || !this->decode_wide(format)){
+				this->to_alpha();
+				std::vector<std::uint8_t> pixels(new_pitch * this->h);
+				for (int y = 0; y < this->h; y++)
+					convert_pixels(&pixels[new_pitch * y], format, this->bitmap.constScanLine(y), PIXEL_FORMAT_RGBA8, this->w);
+				this->wide_pixels.swap(pixels);
+			}
+			this->bitmap = QImage();
+		}else if (format == PIXEL_FORMAT_RGBA8){
+			QImage bitmap(this->w, this->h, QImage::Format_RGBA8888);
+			if (bitmap.isNull())
+				return false;
+			for (int y = 0; y < this->h; y++)
+				convert_pixels(bitmap.scanLine(y), format, &this->wide_pixels[(size_t)this->pitch * y], this->format, this->w);
+			this->bitmap = bitmap;
+			std::vector<std::uint8_t>().swap(this->wide_pixels);
+			new_pitch = bitmap.bytesPerLine();
+		}else{
+			std::vector<std::uint8_t> pixels(new_pitch * this->h);
+			convert_pixels(pixels.data(), format, this->wide_pixels.data(), this->format, (size_t)this->w * this->h);
+			this->wide_pixels.swap(pixels);
+		}
+	}catch (std::bad_alloc &){
+		return false;
+	}
+	this->format = format;
+	this->stride = new_stride;
+	this->pitch = (unsigned)new_pitch;
+	this->alphaed = true;
+	return true;
+}
+
+QImage Image::to_QImage() const{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+	const auto qformat = QImage::Format_RGBA64;
+	const auto dst_format = PIXEL_FORMAT_RGBA16;
+#else
+	const auto qformat = QImage::Format_RGBA8888;
+	const auto dst_format = PIXEL_FORMAT_RGBA8;
+#endif
+	QImage ret(this->w, this->h, qformat);
+	if (ret.isNull())
+		return ret;
+	for (int y = 0; y < this->h; y++)
+		convert_pixels(ret.scanLine(y), dst_format, &this->wide_pixels[(size_t)this->pitch * y], this->format, this->w);
+	return ret;
+}
+
 void Image::set_current_pixel(const pixel_t &rgba){
+	if (this->format != PIXEL_FORMAT_RGBA8){
+		convert_pixels(this->current_pixel, this->format, rgba.data(), PIXEL_FORMAT_RGBA8, 1);
+		return;
+	}
 	for (int i = 0; i < 4; i++)
 		this->current_pixel[i] = rgba[i];
 }
 
+static const char *save_bitmap(const QImage &bitmap, const QString &path, const SaveOptions &opt){
+	auto format = opt.format;
+	if (!format.size())
+		format = QFileInfo(path).suffix().toLower().toStdString();
+	bool parallel = opt.parallel == Trinary::True;
+	if (opt.parallel == Trinary::Undefined)
+		parallel = (long long)bitmap.width() * bitmap.height() >= parallel_encoder_threshold;
+	if (parallel && is_parallel_format(format))
+		return save_parallel(bitmap, path, format, opt.compression, opt.fast);
+	auto compression = opt.compression;
+	// Qt's PNG writer at deflate level 1.
+	if (opt.fast && format == "png")
+		compression = 89;
+	if (!bitmap.save(path, opt.format.size() ? opt.format.c_str() : nullptr, compression))
+		return "Unknown error.";
+	return nullptr;
+}
+
 ImageOperationResult Image::save(const QString &path, SaveOptions opt){
+	return save_bitmap(this->get_bitmap(), path, opt);
+}
+
+QImage Image::get_snapshot(){
+	auto ret = this->get_bitmap();
+	// Wide images are converted into a new QImage anyway. Pixels that have
+	// been handed out may be written to without QImage knowing, so those have
+	// to be copied; otherwise, copy-on-write takes care of it.
+	if (this->format == PIXEL_FORMAT_RGBA8 && this->alphaed)
+		ret = ret.copy();
+	return ret;
+}
+
+ImageOperationResult Image::save_async(const QString &path, SaveOptions opt){
+	auto snapshot = this->get_snapshot();
+	if (snapshot.isNull())
+		return "Not enough memory.";
 	ImageOperationResult ret;
-	ret.success = this->bitmap.save(path, opt.format.size() ? opt.format.c_str() : nullptr, opt.compression);
-	if (!ret.success)
-		ret.message = "Unknown error.";
+	ret.results[0] = this->owner->get_save_queue().enqueue([snapshot, path, opt](){
+		return save_bitmap(snapshot, path, opt);
+	});
 	return ret;
 }
 
 ImageOperationResult Image::get_pixel(unsigned x, unsigned y){
 	if (x >= (unsigned)this->w || y >= (unsigned)this->h)
 		return "Invalid coordinates.";
-	this->to_alpha();
-	auto pixels = this->bitmap.bits();
-	auto pixel = pixels + this->pitch * y + this->stride * x;
+	this->commit_planes();
+	unsigned stride, pitch;
+	auto pixels = (const std::uint8_t *)this->get_storage(stride, pitch);
+	std::uint8_t rgba[4];
+	read_pixel8(rgba, pixels + (size_t)pitch * y + stride * x, this->format);
 	ImageOperationResult ret;
 	ret.success = 1;
 	for (int i = 0; i < 4; i++)
-		ret.results[i] = pixel[i];
+		ret.results[i] = rgba[i];
 	return ret;
 }
 
@@ -115,88 +283,121 @@ ImageOperationResult ImageStore::load(const char *path){
 	return this->load(QString::fromUtf8(path));
 }
 
+// Images are created outside the lock, since that may mean decoding a file.
+int ImageStore::reserve_handle(){
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->next_index++;
+}
+
+static QThreadStorage<uintptr_t> handle_log;
+
+void ImageStore::set_handle_log(std::vector<int> *log){
+	handle_log.setLocalData((uintptr_t)log);
+}
+
+void ImageStore::add_image(const std::shared_ptr<Image> &image){
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->images[image->get_handle()] = image;
+	}
+	auto log = (std::vector<int> *)handle_log.localData();
+	if (log)
+		log->push_back(image->get_handle());
+}
+
 Image *ImageStore::load_image(const char *path){
-	auto qpath = QString::fromUtf8(path);
 	decltype(this->images)::mapped_type ret;
 	try{
-		ret.reset(new Image(path, *this, this->next_index));
+		ret.reset(new Image(path, *this, this->reserve_handle()));
 	}catch (ImageOperationResult &ior){
 		return nullptr;
 	}
-	this->images[this->next_index++] = ret;
+	this->add_image(ret);
 	return ret.get();
 }
 
 ImageOperationResult ImageStore::load(const QString &path){
 	decltype(this->images)::mapped_type img;
 	try{
-		img.reset(new Image(path, *this, this->next_index));
+		img.reset(new Image(path, *this, this->reserve_handle()));
 	}catch (ImageOperationResult &ior){
 		return ior;
 	}
+	this->add_image(img);
 	ImageOperationResult ret;
-	ret.results[0] = this->next_index++;
-	this->images[ret.results[0]] = img;
+	ret.results[0] = img->get_handle();
 	return ret;
 }
 
 ImageOperationResult ImageStore::unload(int handle){
-	auto it = this->images.find(handle);
-	if (it == this->images.end())
-		return HANDLE_NOT_FOUND_MSG;
-	this->images.erase(it);
+	std::shared_ptr<Image> image;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto it = this->images.find(handle);
+		if (it == this->images.end())
+			return HANDLE_NOT_FOUND_MSG;
+		image = it->second;
+		this->images.erase(it);
+	}
+	// The image is freed here, outside the lock.
 	return ImageOperationResult();
 }
 
 ImageOperationResult ImageStore::save(int handle, const QString &path, SaveOptions opt){
-	auto it = this->images.find(handle);
-	if (it == this->images.end())
+	auto image = this->get_image(handle);
+	if (!image)
+		return HANDLE_NOT_FOUND_MSG;
+	return image->save(path, opt);
+}
+
+ImageOperationResult ImageStore::save_async(int handle, const QString &path, SaveOptions opt){
+	auto image = this->get_image(handle);
+	if (!image)
 		return HANDLE_NOT_FOUND_MSG;
-	return it->second->save(path, opt);
+	return image->save_async(path, opt);
 }
 
-ImageOperationResult ImageStore::traverse(int handle, traversal_callback cb){
-	auto it = this->images.find(handle);
-	if (it == this->images.end())
+ImageOperationResult ImageStore::traverse(int handle, traversal_callback cb, traversal_order order){
+	auto img = this->get_image(handle);
+	if (!img)
 		return HANDLE_NOT_FOUND_MSG;
-	auto img = it->second;
-	img->traverse(cb);
+	img->traverse(cb, order);
 	return ImageOperationResult();
 }
 
-Image *ImageStore::allocate_image(int w, int h){
+Image *ImageStore::allocate_image(int w, int h, pixel_format format){
 	if (w < 1 || h < 1)
 		return nullptr;
 	decltype(this->images)::mapped_type ret;
 	try{
-		ret.reset(new Image(w, h, *this, this->next_index));
+		ret.reset(new Image(w, h, *this, this->reserve_handle(), format));
 	}catch (ImageOperationResult &ior){
 		return nullptr;
 	}
-	this->images[this->next_index++] = ret;
+	this->add_image(ret);
 	return ret.get();
 }
 
-ImageOperationResult ImageStore::allocate(int w, int h){
+ImageOperationResult ImageStore::allocate(int w, int h, pixel_format format){
 	if (w < 1  || h < 1 )
 		return "both width and height must be at least 1.";
 	decltype(this->images)::mapped_type img;
 	try{
-		img.reset(new Image(w, h, *this, this->next_index));
+		img.reset(new Image(w, h, *this, this->reserve_handle(), format));
 	}catch (ImageOperationResult &ior){
 		return ior;
 	}
+	this->add_image(img);
 	ImageOperationResult ior;
-	ior.results[0] = this->next_index++;
-	this->images[ior.results[0]] = img;
+	ior.results[0] = img->get_handle();
 	return ior;
 }
 
 ImageOperationResult ImageStore::get_pixel(int handle, unsigned x, unsigned y){
-	auto it = this->images.find(handle);
-	if (it == this->images.end())
+	auto image = this->get_image(handle);
+	if (!image)
 		return HANDLE_NOT_FOUND_MSG;
-	return it->second->get_pixel(x, y);
+	return image->get_pixel(x, y);
 }
 
 void ImageStore::set_current_pixel(const pixel_t &rgba){
@@ -206,27 +407,102 @@ void ImageStore::set_current_pixel(const pixel_t &rgba){
 }
 
 ImageOperationResult ImageStore::get_dimensions(int handle){
-	auto it = this->images.find(handle);
-	if (it == this->images.end())
+	auto image = this->get_image(handle);
+	if (!image)
 		return HANDLE_NOT_FOUND_MSG;
-	return it->second->get_dimensions();
+	return image->get_dimensions();
 }
 
 int ImageStore::store(const QImage &image){
-	int ret = this->next_index;
+	std::shared_ptr<Image> img;
 	try{
-		this->images[ret] = std::make_shared<Image>(image, *this, ret);
+		img = std::make_shared<Image>(image, *this, this->reserve_handle());
 	}catch (std::exception &){
 		return -1;
 	}
-	this->next_index++;
-	return ret;
+	this->add_image(img);
+	return img->get_handle();
 }
 
 void *Image::get_pixels_pointer(unsigned &stride, unsigned &pitch){
-	this->to_alpha();
+	// The caller may write through the pointer, so planes can't be trusted
+	// after this point.
+	this->invalidate_planes();
+	return this->get_storage(stride, pitch);
+}
+
+void *Image::get_storage(unsigned &stride, unsigned &pitch){
+	if (this->format == PIXEL_FORMAT_RGBA8)
+		this->to_alpha();
 
 	stride = this->stride;
 	pitch = this->pitch;
+	if (this->format != PIXEL_FORMAT_RGBA8)
+		return this->wide_pixels.data();
 	return this->bitmap.bits();
 }
+
+float *Image::get_plane(image_channel channel, bool writable, unsigned &pitch){
+	if (channel < 0 || channel >= plane_count)
+		return nullptr;
+	pitch = this->w;
+	auto &plane = this->planes[channel];
+	unsigned bit = 1 << channel;
+	if (!plane.size() || this->stale_planes & bit){
+		// The other writable planes may still hold changes the pixels don't.
+		this->commit_planes();
+		unsigned stride, storage_pitch;
+		auto pixels = (const std::uint8_t *)this->get_storage(stride, storage_pitch);
+		try{
+			// Dimensions never change, so a stale plane is refilled in place.
+			plane.resize((size_t)this->w * this->h);
+		}catch (std::bad_alloc &){
+			return nullptr;
+		}
+		for (int y = 0; y < this->h; y++)
+			extract_channel(&plane[(size_t)this->w * y], pixels + (size_t)storage_pitch * y, this->format, this->w, channel);
+		this->stale_planes &= ~bit;
+	}
+	if (writable){
+		this->writable_planes |= bit;
+		this->planes_dirty = true;
+	}
+	return plane.data();
+}
+
+void Image::commit_planes(){
+	if (!this->planes_dirty)
+		return;
+	this->planes_dirty = false;
+	unsigned stride, pitch;
+	auto pixels = (std::uint8_t *)this->get_storage(stride, pitch);
+	for (int y = 0; y < this->h; y++){
+		auto row = pixels + (size_t)pitch * y;
+		// Luma goes first, so that planes of individual channels have
+		// precedence over it.
+		if (this->writable_planes & (1 << IMAGE_CHANNEL_LUMA))
+			insert_channel(row, this->format, &this->planes[IMAGE_CHANNEL_LUMA][(size_t)this->w * y], this->w, IMAGE_CHANNEL_LUMA);
+		for (int i = IMAGE_CHANNEL_RED; i <= IMAGE_CHANNEL_ALPHA; i++){
+			auto &plane = this->planes[i];
+			if (this->writable_planes & (1 << i))
+				insert_channel(row, this->format, &plane[(size_t)this->w * y], this->w, (image_channel)i);
+		}
+	}
+}
+
+// Used before the pixels are accessed some other way. The plane storage stays
+// where it is, since filters may still hold pointers to it; get_plane()
+// refreshes it.
+void Image::invalidate_planes(){
+	this->commit_planes();
+	this->writable_planes = 0;
+	this->stale_planes = ~0U;
+}
+
+void Image::release_planes(){
+	this->commit_planes();
+	for (auto &plane : this->planes)
+		std::vector<float>().swap(plane);
+	this->writable_planes = 0;
+	this->stale_planes = 0;
+}
@@ -15,6 +15,10 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include <array>
 #include <QImage>
 #include "capi.h"
+#include "traversal.h"
+#include "SaveQueue.h"
+#include <vector>
+#include <mutex>
 
 class Image;
 class QString;
@@ -22,8 +26,10 @@ class QString;
 struct ImageOperationResult{
 	bool success;
 	int results[4];
-	std::string message;
-	ImageOperationResult(const char *msg = nullptr): success(!msg), message(msg ? msg : ""){}
+	// Always a string with static storage duration, so results can be
+	// returned and copied without allocating.
+	const char *message;
+	ImageOperationResult(const char *msg = nullptr): success(!msg), message(msg){}
 };
 
 enum class Trinary{
@@ -35,7 +41,12 @@ enum class Trinary{
 struct SaveOptions{
 	int compression;
 	std::string format;
-	SaveOptions(): compression(-1){}
+	// Whether to use the parallel PNG/TIFF encoder. If undefined, it's used for
+	// images of at least parallel_encoder_threshold pixels.
+	Trinary parallel;
+	// Trade size for speed.
+	bool fast;
+	SaveOptions(): compression(-1), parallel(Trinary::Undefined), fast(false){}
 };
 
 typedef std::function<void(int, int, int, int, int, int)> traversal_callback;
@@ -46,30 +57,65 @@ class ImageStore;
 class Image{
 	ImageStore *owner;
 	int own_handle;
+	// Storage for PIXEL_FORMAT_RGBA8. Until the pixels are first accessed,
+	// this is the image as it was decoded, in whatever format and depth.
 	QImage bitmap;
+	// Storage for the other formats.
+	std::vector<std::uint8_t> wide_pixels;
+	pixel_format format;
+	// Planar copies of single channels, indexed by image_channel. Empty until
+	// requested, and then kept until release_planes(), because filters hold
+	// pointers into them.
+	static const int plane_count = IMAGE_CHANNEL_LUMA + 1;
+	std::vector<float> planes[plane_count];
+	// Masks of planes that commit_planes() writes back, and of planes that
+	// must be extracted again before they're handed out.
+	unsigned writable_planes;
+	unsigned stale_planes;
+	// Set when a writable plane is handed out, cleared by commit_planes().
+	bool planes_dirty;
 	bool alphaed;
 	int w, h;
-	static const unsigned stride = 4;
+	unsigned stride;
 	unsigned pitch;
 	std::uint8_t *current_pixel;
 
 	void to_alpha();
+	bool decode_wide(pixel_format);
+	QImage to_QImage() const;
+	void *get_storage(unsigned &stride, unsigned &pitch);
+	void invalidate_planes();
 public:
 	Image(const QString &path, ImageStore &owner, int handle);
-	Image(int w, int h, ImageStore &owner, int handle);
+	Image(int w, int h, ImageStore &owner, int handle, pixel_format = PIXEL_FORMAT_RGBA8);
 	Image(const QImage &, ImageStore &owner, int handle);
-	void traverse(traversal_callback cb);
+	// The 8-bit accessors below (traverse(), set_current_pixel(), get_pixel())
+	// convert each pixel of a wide image to and from PIXEL_FORMAT_RGBA8 as
+	// it's accessed. The image itself keeps its format.
+	void traverse(traversal_callback cb, traversal_order = TRAVERSAL_RASTER);
 	void set_current_pixel(const pixel_t &rgba);
 	ImageOperationResult save(const QString &path, SaveOptions opt);
+	// On success, results[0] is the ticket of the save. See SaveQueue.
+	ImageOperationResult save_async(const QString &path, SaveOptions opt);
+	// Returns the pixels as they are now, in a form that's safe to read from
+	// another thread while this image keeps changing.
+	QImage get_snapshot();
 	ImageOperationResult get_pixel(unsigned x, unsigned y);
 	ImageOperationResult get_dimensions();
 	void get_dimensions(int &w, int &h){
 		w = this->w;
 		h = this->h;
 	}
-	QImage get_bitmap() const{
-		return this->bitmap;
+	QImage get_bitmap(){
+		this->commit_planes();
+		if (this->format == PIXEL_FORMAT_RGBA8)
+			return this->bitmap;
+		return this->to_QImage();
 	}
+	pixel_format get_format() const{
+		return this->format;
+	}
+	bool convert_format(pixel_format);
 	ImageStore *get_owner() const{
 		return this->owner;
 	}
@@ -77,14 +123,24 @@ public:
 		return this->own_handle;
 	}
 	void *get_pixels_pointer(unsigned &stride, unsigned &pitch);
+	float *get_plane(image_channel, bool writable, unsigned &pitch);
+	void commit_planes();
+	void release_planes();
 };
 
+// Safe to use from several threads at once, as long as each image is only
+// operated on by one of them.
 class ImageStore{
+	mutable std::mutex mutex;
 	std::unordered_map<int, std::shared_ptr<Image>> images;
 	Image *current_traversal_image;
 	int next_index;
+	SaveQueue save_queue;
+
+	int reserve_handle();
+	void add_image(const std::shared_ptr<Image> &);
 public:
-	ImageStore(): current_traversal_image(nullptr){}
+	ImageStore(): current_traversal_image(nullptr), next_index(0){}
 	ImageOperationResult load(const char *path);
 	ImageOperationResult load(const QString &path);
 	Image *load_image(const char *path);
@@ -94,9 +150,13 @@ public:
 		this->unload(img->get_handle());
 	}
 	ImageOperationResult save(int handle, const QString &path, SaveOptions opt);
-	ImageOperationResult traverse(int handle, traversal_callback cb);
-	ImageOperationResult allocate(int w, int h);
-	Image *allocate_image(int w, int h);
+	ImageOperationResult save_async(int handle, const QString &path, SaveOptions opt);
+	SaveQueue &get_save_queue(){
+		return this->save_queue;
+	}
+	ImageOperationResult traverse(int handle, traversal_callback cb, traversal_order = TRAVERSAL_RASTER);
+	ImageOperationResult allocate(int w, int h, pixel_format = PIXEL_FORMAT_RGBA8);
+	Image *allocate_image(int w, int h, pixel_format = PIXEL_FORMAT_RGBA8);
 	ImageOperationResult get_pixel(int handle, unsigned x, unsigned y);
 	void set_current_pixel(const pixel_t &rgba);
 	ImageOperationResult get_dimensions(int handle);
@@ -107,13 +167,18 @@ public:
 	void set_current_traversal_image(Image *image){
 		this->current_traversal_image = image;
 	}
+	// Handles of images created by this thread from then on are appended to
+	// log. Pass null to stop.
+	static void set_handle_log(std::vector<int> *log);
 	std::shared_ptr<Image> get_image(int img) const{
+		std::lock_guard<std::mutex> lock(this->mutex);
 		auto i = this->images.find(img);
 		if (i == this->images.end())
 			return std::shared_ptr<Image>();
 		return i->second;
 	}
 	void clear(){
+		std::lock_guard<std::mutex> lock(this->mutex);
 		this->images.clear();
 		this->next_index = 0;
 	}
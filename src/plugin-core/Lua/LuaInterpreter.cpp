@@ -9,12 +9,12 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include "lua.h"
 #include "../CallResultImpl.h"
 #include <cassert>
+#include <cstdint>
+#include <cmath>
 #include <sstream>
 
 LuaInterpreter::LuaInterpreter(const LuaInterpreterParameters &params): parameters(params){
-	auto state = this->parameters.state;
-	auto f = this->parameters.release_returned_string;
-	this->release_function = [=](char *s){ f(state, s); };
+	this->invalidate_image_info();
 	this->lua_state = init_lua_state(this);
 }
 
@@ -24,15 +24,34 @@ CallResult LuaInterpreter::execute_buffer(const char *filename, const void *buff
 	CallResult ret;
 	auto state = this->lua_state.get();
 	try{
-		luaL_loadbuffer(state, (const char *)buffer, size, filename);
+		// Whatever an earlier run that failed left behind.
+		lua_settop(state, 0);
+		// Handles are reused by the core between runs.
+		this->invalidate_image_info();
+		if (luaL_loadbuffer(state, (const char *)buffer, size, filename)){
+			std::string message = "Lua threw an error: ";
+			message += lua_tostring(state, -1);
+			lua_pop(state, 1);
+			this->message_box(nullptr, message.c_str(), true);
+			ret.success = false;
+			return ret;
+		}
+		// The same state may be reused for this or any other filter, so every
+		// run gets globals of its own.
+		push_run_environment(state);
+		lua_pushvalue(state, -1);
+		lua_setfenv(state, -3);
+		lua_insert(state, -2);
 		lua_call(state, 0, 0);
-		lua_getglobal(state, "is_pure_filter");
+		lua_getfield(state, -1, "is_pure_filter");
 		bool pure_filter = false;
 		if (lua_isboolean(state, -1))
 			pure_filter = !!lua_toboolean(state, -1);
 		lua_pop(state, 1);
 		if (pure_filter){
-			lua_getglobal(state, "main");
+			// Lets the core run the filter on several frames at once.
+			this->parameters.report_pure_filter(this->parameters.state);
+			lua_getfield(state, -1, "main");
 			if (!lua_isfunction(state, -1))
 				throw std::exception("Pure filter doesn't contain a main function.");
 
@@ -43,7 +62,11 @@ CallResult LuaInterpreter::execute_buffer(const char *filename, const void *buff
 				imgno = (int)lua_tointeger(state, -1);
 			auto image = this->display_in_current_window(imgno);
 		}
+		lua_settop(state, 0);
 	}catch (LuaStackUnwind &){
+		// The error has already been reported, but the state is no longer
+		// usable.
+		ret.success = false;
 	}catch (std::exception &e){
 		ret.impl = new CallResultImpl(e.what());
 		ret.success = false;
@@ -60,44 +83,149 @@ CallResult LuaInterpreter::execute_buffer(const char *filename, const void *buff
 	return ret;
 }
 
+bool LuaInterpreter::compile_buffer(const char *filename, const void *buffer, size_t size, bytecode_writer_t writer, void *ud){
+	auto state = this->lua_state.get();
+	if (luaL_loadbuffer(state, (const char *)buffer, size, filename)){
+		lua_pop(state, 1);
+		return false;
+	}
+	struct Sink{
+		bytecode_writer_t writer;
+		void *ud;
+	} sink = { writer, ud };
+	auto error = lua_dump(
+		state,
+		[](lua_State *, const void *data, size_t size, void *ud){
+			auto sink = (Sink *)ud;
+			sink->writer(sink->ud, data, size);
+			return 0;
+		},
+		&sink
+	);
+	lua_pop(state, 1);
+	return !error;
+}
+
 void LuaInterpreter::message_box(const char *title, const char *message, bool is_error){
 	this->parameters.show_message_box(this->parameters.state, title, message, is_error);
 }
 
-ImageOperationResult to_ImageOperationResult(const ImageOperationResultExternal &src, std::function<void(char *)> &release){
+static ImageOperationResult to_ImageOperationResult(const ImageOperationResultExternal &src){
 	ImageOperationResult ret;
 	ret.success = src.success;
-	if (src.message)
-		ret.message = src.message;
+	ret.message = src.message;
 	static_assert(sizeof(ret.results) == sizeof(src.results), "Inconsistent struct definitions!");
 	memcpy(ret.results, src.results, sizeof(ret.results));
-	release(src.message);
 	return ret;
 }
 
+const image_info *LuaInterpreter::get_image_info(int handle, ImageOperationResult &error){
+	if (this->cached_info.pixels && this->cached_info.handle == handle)
+		return &this->cached_info;
+	auto result = this->parameters.get_image_info(this->parameters.state, handle, &this->cached_info);
+	if (!result.success){
+		this->invalidate_image_info();
+		error = to_ImageOperationResult(result);
+		return nullptr;
+	}
+	return &this->cached_info;
+}
+
 ImageOperationResult LuaInterpreter::load_image(const char *path){
-	return to_ImageOperationResult(this->parameters.load_image(this->parameters.state, path), this->release_function);
+	return to_ImageOperationResult(this->parameters.load_image(this->parameters.state, path));
 }
 
 ImageOperationResult LuaInterpreter::unload_image(int handle){
-	return to_ImageOperationResult(this->parameters.unload_image(this->parameters.state, handle), this->release_function);
+	this->invalidate_image_info();
+	return to_ImageOperationResult(this->parameters.unload_image(this->parameters.state, handle));
+}
+
+ImageOperationResult LuaInterpreter::allocate_image(int w, int h, pixel_format format){
+	return to_ImageOperationResult(this->parameters.allocate_image(this->parameters.state, w, h, format));
 }
 
-ImageOperationResult LuaInterpreter::allocate_image(int w, int h){
-	return to_ImageOperationResult(this->parameters.allocate_image(this->parameters.state, w, h), this->release_function);
+ImageOperationResult LuaInterpreter::convert_image_format(int handle, pixel_format format){
+	this->invalidate_image_info();
+	return to_ImageOperationResult(this->parameters.convert_image_format(this->parameters.state, handle, format));
+}
+
+ImageOperationResult LuaInterpreter::dither_image(int handle, const dither_options &options){
+	return to_ImageOperationResult(this->parameters.dither_image(this->parameters.state, handle, &options));
+}
+
+ImageOperationResult LuaInterpreter::get_image_format(int handle){
+	ImageOperationResult ret;
+	auto info = this->get_image_info(handle, ret);
+	if (!info)
+		return ret;
+	ret.results[0] = info->format;
+	return ret;
+}
+
+static void read_pixel(pixel_t &rgba, const unsigned char *pixel, pixel_format format){
+	switch (format){
+		case PIXEL_FORMAT_RGBA8:
+			for (int i = 0; i < 4; i++)
+				rgba[i] = pixel[i];
+			break;
+		case PIXEL_FORMAT_RGBA16:
+			for (int i = 0; i < 4; i++)
+				rgba[i] = ((const std::uint16_t *)pixel)[i];
+			break;
+		case PIXEL_FORMAT_RGBA32F:
+			for (int i = 0; i < 4; i++)
+				rgba[i] = ((const float *)pixel)[i];
+			break;
+	}
+}
+
+static bool write_pixel(unsigned char *pixel, pixel_format format, const pixel_t &rgba){
+	// NaN compares false with everything, so it has to be ruled out on its
+	// own before converting to an integer.
+	switch (format){
+		case PIXEL_FORMAT_RGBA8:
+			for (int i = 0; i < 4; i++)
+				if (std::isnan(rgba[i]) || rgba[i] < 0 || rgba[i] > 255)
+					return false;
+			for (int i = 0; i < 4; i++)
+				pixel[i] = (std::uint8_t)rgba[i];
+			break;
+		case PIXEL_FORMAT_RGBA16:
+			for (int i = 0; i < 4; i++)
+				if (std::isnan(rgba[i]) || rgba[i] < 0 || rgba[i] > 65535)
+					return false;
+			for (int i = 0; i < 4; i++)
+				((std::uint16_t *)pixel)[i] = (std::uint16_t)rgba[i];
+			break;
+		case PIXEL_FORMAT_RGBA32F:
+			for (int i = 0; i < 4; i++)
+				((float *)pixel)[i] = (float)rgba[i];
+			break;
+	}
+	return true;
 }
 
 ImageOperationResult LuaInterpreter::save_image(int handle, const char *path, const SaveOptions &options){
-	auto ret = this->parameters.save_image(this->parameters.state, handle, path, options.compression, options.format.c_str());
-	return to_ImageOperationResult(ret, this->release_function);
+	auto ret = this->parameters.save_image(this->parameters.state, handle, path, options.compression, options.format.c_str(), options.parallel, options.fast);
+	return to_ImageOperationResult(ret);
+}
+
+ImageOperationResult LuaInterpreter::save_image_async(int handle, const char *path, const SaveOptions &options){
+	auto ret = this->parameters.save_image_async(this->parameters.state, handle, path, options.compression, options.format.c_str(), options.parallel, options.fast);
+	return to_ImageOperationResult(ret);
+}
+
+ImageOperationResult LuaInterpreter::get_save_status(int ticket, bool wait){
+	return to_ImageOperationResult(this->parameters.get_save_status(this->parameters.state, ticket, wait));
 }
 
-ImageOperationResult LuaInterpreter::traverse(int handle, traverse_callback_t cb, void *ud){
-	image_info info;
-	auto ret = this->parameters.get_image_info(this->parameters.state, handle, &info);
-	if (!ret.results)
-		return to_ImageOperationResult(ret, this->release_function);
-	this->release_function(ret.message);
+ImageOperationResult LuaInterpreter::traverse(int handle, traverse_callback_t cb, void *ud, traversal_order order){
+	ImageOperationResult error;
+	auto cached = this->get_image_info(handle, error);
+	if (!cached)
+		return error;
+	// Copied, since the callback may replace the cached entry.
+	auto info = *cached;
 
 	auto pixels = (unsigned char *)info.pixels;
 	traversal_stack_frame current_frame = {
@@ -105,62 +233,51 @@ ImageOperationResult LuaInterpreter::traverse(int handle, traverse_callback_t cb
 		info,
 		nullptr,
 	};
-	for (int y = 0; y < info.h; y++){
-		//auto scanline = pixels + this->pitch * (this->h - 1 - y);
-		auto scanline = pixels + info.pitch * y;
-		for (int x = 0; x < info.w; x++){
-			auto pixel = scanline + x * info.stride;
-			int r = pixel[0];
-			int g = pixel[1];
-			int b = pixel[2];
-			int a = pixel[3];
-
-			current_frame.current_pixel = pixel;
-
-			this->frame = &current_frame;
-			cb(ud, r, g, b, a, x, y);
-			this->frame = this->frame->prev;
-		}
+	TraversalGenerator generator(info.w, info.h, order);
+	int x, y;
+	while (generator.next(x, y)){
+		auto pixel = pixels + info.pitch * y + x * info.stride;
+		pixel_t rgba;
+		read_pixel(rgba, pixel, info.format);
+
+		current_frame.current_pixel = pixel;
+
+		this->frame = &current_frame;
+		cb(ud, rgba, x, y);
+		this->frame = this->frame->prev;
 	}
 
 	return ImageOperationResult();
 }
 
-void LuaInterpreter::set_current_pixel(const pixel_t &rgba){
+bool LuaInterpreter::set_current_pixel(const pixel_t &rgba){
 	if (!this->frame)
-		return;
-	auto pixel = this->frame->current_pixel;
-	for (int i = 0; i < 4; i++)
-		pixel[i] = rgba[i];
+		return true;
+	return write_pixel(this->frame->current_pixel, this->frame->info.format, rgba);
 }
 
-ImageOperationResult LuaInterpreter::get_pixel(int handle, int x, int y){
-	image_info info;
-	auto result = this->parameters.get_image_info(this->parameters.state, handle, &info);
-	if (!result.results)
-		return to_ImageOperationResult(result, this->release_function);
-	this->release_function(result.message);
+ImageOperationResult LuaInterpreter::get_pixel(int handle, int x, int y, pixel_t &rgba){
+	ImageOperationResult ret;
+	auto info = this->get_image_info(handle, ret);
+	if (!info)
+		return ret;
 
-	if (x >= info.w || y >= info.h)
+	if ((unsigned)x >= (unsigned)info->w || (unsigned)y >= (unsigned)info->h)
 		return "Invalid coordinates.";
-	auto pixels = (unsigned char *)info.pixels;
-	auto pixel = pixels + info.pitch * y + info.stride * x;
-	ImageOperationResult ret;
-	for (int i = 0; i < 4; i++)
-		ret.results[i] = pixel[i];
+	auto pixels = (unsigned char *)info->pixels;
+	auto pixel = pixels + info->pitch * y + info->stride * x;
+	read_pixel(rgba, pixel, info->format);
 	return ret;
 }
 
 ImageOperationResult LuaInterpreter::get_image_dimensions(int handle){
-	image_info info;
-	auto result = this->parameters.get_image_info(this->parameters.state, handle, &info);
-	if (!result.results)
-		return to_ImageOperationResult(result, this->release_function);
-	this->release_function(result.message);
-
 	ImageOperationResult ret;
-	ret.results[0] = info.w;
-	ret.results[1] = info.h;
+	auto info = this->get_image_info(handle, ret);
+	if (!info)
+		return ret;
+
+	ret.results[0] = info->w;
+	ret.results[1] = info->h;
 	return ret;
 }
 
@@ -168,7 +285,14 @@ int LuaInterpreter::get_caller_image(){
 	return this->parameters.get_caller_image(this->parameters.state);
 }
 
+ImageOperationResult LuaInterpreter::get_frame_info(){
+	return to_ImageOperationResult(this->parameters.get_frame_info(this->parameters.state));
+}
+
 ImageOperationResult LuaInterpreter::display_in_current_window(int handle){
+	// Displaying shares the pixel buffer with the viewer, so the next write
+	// must go through the core to detach it.
+	this->invalidate_image_info();
 	this->parameters.display_in_current_window(this->parameters.state, handle);
 	return ImageOperationResult();
 }
@@ -176,3 +300,11 @@ ImageOperationResult LuaInterpreter::display_in_current_window(int handle){
 void LuaInterpreter::debug_print(const char *string){
 	this->parameters.debug_print(this->parameters.state, string);
 }
+
+void LuaInterpreter::begin_phase(const char *name){
+	this->parameters.begin_phase(this->parameters.state, name);
+}
+
+void LuaInterpreter::end_phase(){
+	this->parameters.end_phase(this->parameters.state);
+}
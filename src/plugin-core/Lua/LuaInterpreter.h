@@ -9,25 +9,32 @@ Distributed under a permissive license. See COPYING.txt for details.
 #define LUAINTERPRETER_H
 
 #include "main.h"
+#include "../traversal.h"
 #include <string>
 #include <array>
 #include <memory>
 #include <lua.hpp>
-#include <functional>
 
 struct ImageOperationResult{
 	bool success;
 	int results[4];
-	std::string message;
-	ImageOperationResult(const char *msg = nullptr): success(!msg), message(msg ? msg : ""){}
+	// Always a string with static storage duration, so results can be
+	// returned and copied without allocating.
+	const char *message;
+	ImageOperationResult(const char *msg = nullptr): success(!msg), message(msg){}
 };
 
-typedef std::array<std::uint8_t, 4> pixel_t;
+// Channel values in the natural range of the format of the image: [0; 255],
+// [0; 65535], or [0; 1] for floating point images.
+typedef std::array<double, 4> pixel_t;
 
 struct SaveOptions{
 	int compression;
 	std::string format;
-	SaveOptions(): compression(-1){}
+	// -1 to leave it to the image size, 0 or 1 to force it off or on.
+	int parallel;
+	bool fast;
+	SaveOptions(): compression(-1), parallel(-1), fast(false){}
 };
 
 struct traversal_stack_frame{
@@ -38,26 +45,43 @@ struct traversal_stack_frame{
 
 class LuaInterpreter{
 	LuaInterpreterParameters parameters;
-	std::function<void(char *)> release_function;
 	std::shared_ptr<lua_State> lua_state;
 	traversal_stack_frame *frame = nullptr;
+	// The last image_info returned by the core. Per-pixel calls usually refer
+	// to the same image, so this saves a call across the DLL boundary.
+	image_info cached_info;
+
+	const image_info *get_image_info(int handle, ImageOperationResult &error);
+	void invalidate_image_info(){
+		this->cached_info.pixels = nullptr;
+	}
 public:
 	LuaInterpreter(const LuaInterpreterParameters &params);
 	~LuaInterpreter();
 	CallResult execute_buffer(const char *filename, const void *buffer, size_t size);
+	bool compile_buffer(const char *filename, const void *buffer, size_t size, bytecode_writer_t writer, void *ud);
 	void message_box(const char *title, const char *message, bool is_error);
 	ImageOperationResult load_image(const char *path);
 	ImageOperationResult unload_image(int handle);
-	ImageOperationResult allocate_image(int w, int h);
+	ImageOperationResult allocate_image(int w, int h, pixel_format format);
+	ImageOperationResult convert_image_format(int handle, pixel_format format);
+	ImageOperationResult dither_image(int handle, const dither_options &);
+	ImageOperationResult get_image_format(int handle);
 	ImageOperationResult save_image(int handle, const char *path, const SaveOptions &);
-	typedef void (*traverse_callback_t)(void *, int r, int g, int b, int a, int x, int y);
-	ImageOperationResult traverse(int handle, traverse_callback_t cb, void *ud);
-	void set_current_pixel(const pixel_t &);
-	ImageOperationResult get_pixel(int handle, int x, int y);
+	ImageOperationResult save_image_async(int handle, const char *path, const SaveOptions &);
+	ImageOperationResult get_save_status(int ticket, bool wait);
+	typedef void (*traverse_callback_t)(void *, const pixel_t &rgba, int x, int y);
+	ImageOperationResult traverse(int handle, traverse_callback_t cb, void *ud, traversal_order = TRAVERSAL_RASTER);
+	// Returns false if the values are out of range for the format.
+	bool set_current_pixel(const pixel_t &);
+	ImageOperationResult get_pixel(int handle, int x, int y, pixel_t &rgba);
 	ImageOperationResult get_image_dimensions(int handle);
 	int get_caller_image();
+	ImageOperationResult get_frame_info();
 	ImageOperationResult display_in_current_window(int handle);
 	void debug_print(const char *string);
+	void begin_phase(const char *name);
+	void end_phase();
 };
 
 #endif
@@ -8,10 +8,14 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include "lua.h"
 #include "LuaInterpreter.h"
 #include "../CallResultImpl.h"
+#include "../Wavefront.h"
 #include <cmath>
 #include <cassert>
 #include <sstream>
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cctype>
 
 #ifdef WIN32
 #include <Windows.h>
@@ -21,11 +25,21 @@ Distributed under a permissive license. See COPYING.txt for details.
 
 #define MINIMIZE_CHECKING
 
-const char * const plugin_core_state_global_name = "__plugincorestate";
 const char * const current_image_global_name = "__current_image";
+// Only the addresses are used, as registry keys.
+static const char interpreter_registry_key = 0;
+static const char environment_metatable_key = 0;
 
+// Every exposed function is a closure whose only upvalue is the interpreter,
+// so this is a plain stack read. Only valid inside those functions.
 static LuaInterpreter *get_interpreter(lua_State *state){
-	lua_getglobal(state, plugin_core_state_global_name);
+	return (LuaInterpreter *)lua_touserdata(state, lua_upvalueindex(1));
+}
+
+// For the contexts that aren't one of the exposed functions.
+static LuaInterpreter *get_interpreter_from_registry(lua_State *state){
+	lua_pushlightuserdata(state, (void *)&interpreter_registry_key);
+	lua_rawget(state, LUA_REGISTRYINDEX);
 	auto ret = (LuaInterpreter *)lua_touserdata(state, -1);
 	lua_pop(state, 1);
 	return ret;
@@ -54,22 +68,58 @@ void handle_call_to_c_error(lua_State *state, const char *function, const char *
 	lua_getinfo(state, "nSl", &debug);
 	int line = debug.currentline;
 	std::stringstream stream;
-	stream << "ERROR at line " << line << " calling function " << function << "(): " << msg;
-	auto interpreter = get_interpreter(state);
+	stream << "ERROR at line " << line << " calling function " << function << "(): " << (msg ? msg : "Unknown error.");
+	auto interpreter = get_interpreter_from_registry(state);
 	interpreter->message_box("Error executing Lua script.", stream.str().c_str(), true);
 }
 
 #define DECLARE_LUA_FUNCTION(x) static int x(lua_State *state)
 
+static const char * const pixel_format_names[] = {
+	"rgba8",
+	"rgba16",
+	"rgba32f",
+};
+
+// Returns -1 if the value at the given index isn't the name of a format.
+static int to_pixel_format(lua_State *state, int index){
+	if (!lua_isstring(state, index))
+		return -1;
+	std::string name = lua_tostring(state, index);
+	for (int i = 0; i < (int)(sizeof(pixel_format_names) / sizeof(*pixel_format_names)); i++)
+		if (name == pixel_format_names[i])
+			return i;
+	return -1;
+}
+
+static const char * const traversal_order_names[] = {
+	"raster",
+	"serpentine",
+	"zigzag",
+	"hilbert",
+	"morton",
+};
+
+// Returns -1 if the value at the given index isn't the name of an order.
+static int to_traversal_order(lua_State *state, int index){
+	if (!lua_isstring(state, index))
+		return -1;
+	auto name = lua_tostring(state, index);
+	for (int i = 0; i < (int)(sizeof(traversal_order_names) / sizeof(*traversal_order_names)); i++)
+		if (!strcmp(name, traversal_order_names[i]))
+			return i;
+	return -1;
+}
+
 DECLARE_LUA_FUNCTION(load_image){
-	std::string msg;
+	const char *msg = nullptr;
 #ifndef MINIMIZE_CHECKING
 	if (lua_gettop(state) < 1)
 		msg = "Not enough parameters.";
 	else if (!lua_isstring(state, 1))
 		msg = "The parameter should be a string.";
 #endif
-	if (!msg.size()){
+	if (!msg){
 		auto interpreter = get_interpreter(state);
 		auto res = interpreter->load_image(lua_tostring(state, 1));
 		if (res.success){
@@ -79,14 +129,14 @@ DECLARE_LUA_FUNCTION(load_image){
 		msg = res.message;
 	}
 
-	handle_call_to_c_error(state, __FUNCTION__, msg.c_str());
+	handle_call_to_c_error(state, __FUNCTION__, msg);
 	lua_pushnil(state);
-	lua_pushstring(state, msg.c_str());
+	lua_pushstring(state, msg);
 	return 2;
 }
 
 DECLARE_LUA_FUNCTION(allocate_image){
-	std::string msg;
+	const char *msg = nullptr;
 #ifndef MINIMIZE_CHECKING
 	if (lua_gettop(state) < 2){
 		msg = "Not enough parameters.";
@@ -94,14 +144,19 @@ DECLARE_LUA_FUNCTION(allocate_image){
 		msg = "Both parameters must be integers.";
 	}
 #endif
-	if (!msg.size()){
+	if (!msg){
 		int w = (int)lua_tointeger(state, 1);
 		int h = (int)lua_tointeger(state, 2);
+		int format = PIXEL_FORMAT_RGBA8;
+		if (lua_gettop(state) >= 3)
+			format = to_pixel_format(state, 3);
 		if (w <= 0 || h <= 0)
 			msg = "Both parameters must be greater than zero.";
+		else if (format < 0)
+			msg = "Unknown pixel format.";
 		else{
 			auto interpreter = get_interpreter(state);
-			auto res = interpreter->allocate_image(w, h);
+			auto res = interpreter->allocate_image(w, h, (pixel_format)format);
 			if (res.success){
 				lua_pushinteger(state, res.results[0]);
 				return 1;
@@ -109,9 +164,9 @@ DECLARE_LUA_FUNCTION(allocate_image){
 			msg = res.message;
 		}
 	}
-	handle_call_to_c_error(state, __FUNCTION__, msg.c_str());
+	handle_call_to_c_error(state, __FUNCTION__, msg);
 	lua_pushnil(state);
-	lua_pushstring(state, msg.c_str());
+	lua_pushstring(state, msg);
 	return 2;
 }
 
@@ -126,23 +181,30 @@ DECLARE_LUA_FUNCTION(traverse_image){
 		return 0;
 	}
 #endif
+	int order = TRAVERSAL_RASTER;
+	if (lua_gettop(state) >= 3 && !lua_isnil(state, 3)){
+		order = to_traversal_order(state, 3);
+		if (order < 0){
+			handle_call_to_c_error(state, __FUNCTION__, "Unknown traversal order.");
+			return 0;
+		}
+	}
 	int imgno = (int)lua_tointeger(state, 1);
 	auto interpreter = get_interpreter(state);
 
 	interpreter->traverse(
 		imgno,
-		[](void *State, int r, int g, int b, int a, int x, int y){
+		[](void *State, const pixel_t &rgba, int x, int y){
 			auto state = (lua_State *)State;
 			lua_pushvalue(state, 2);
-			lua_pushinteger(state, r);
-			lua_pushinteger(state, g);
-			lua_pushinteger(state, b);
-			lua_pushinteger(state, a);
+			for (int i = 0; i < 4; i++)
+				lua_pushnumber(state, rgba[i]);
 			lua_pushinteger(state, x);
 			lua_pushinteger(state, y);
 			lua_call(state, 6, 0);
 		},
-		state
+		state,
+		(traversal_order)order
 	);
 
 	return 0;
@@ -262,23 +324,18 @@ DECLARE_LUA_FUNCTION(set_current_pixel){
 	}
 #endif
 	pixel_t rgba;
-	memset(rgba.data(), 0, rgba.size() * sizeof(rgba[0]));
 	for (int i = 0; i < 4; i++){
 #ifndef MINIMIZE_CHECKING
 		if (!lua_isnumber(state, i + 1)){
-			handle_call_to_c_error(state, __FUNCTION__, "All parameters should be integers.");
+			handle_call_to_c_error(state, __FUNCTION__, "All parameters should be numbers.");
 			return 0;
 		}
 #endif
-		int c = (int)lua_tointeger(state, i + 1);
-		if (c < 0 || c > 255){
-			handle_call_to_c_error(state, __FUNCTION__, "All parameters should be in the range [0; 255].");
-			return 0;
-		}
-		rgba[i] = (std::uint8_t)c;
+		rgba[i] = lua_tonumber(state, i + 1);
 	}
 	auto interpreter = get_interpreter(state);
-	interpreter->set_current_pixel(rgba);
+	if (!interpreter->set_current_pixel(rgba))
+		handle_call_to_c_error(state, __FUNCTION__, "Values are out of range for the pixel format of the image.");
 	return 0;
 }
 
@@ -287,7 +344,7 @@ void to_lower(std::string &s){
 }
 
 DECLARE_LUA_FUNCTION(save_image){
-	std::string msg;
+	const char *msg = nullptr;
 #ifndef MINIMIZE_CHECKING
 	if (lua_gettop(state) < 2)
 		msg = "Not enough parameters.";
@@ -296,7 +353,7 @@ DECLARE_LUA_FUNCTION(save_image){
 	else if (!lua_isstring(state, 2))
 		msg = "The second parameter should be a string.";
 #endif
-	if (!msg.size()){
+	if (!msg){
 		int handle = (int)lua_tointeger(state, 1);
 		SaveOptions opt;
 		if (lua_gettop(state) >= 3 && lua_istable(state, 3)){
@@ -315,11 +372,40 @@ DECLARE_LUA_FUNCTION(save_image){
 				lua_gettable(state, 3);
 				if (lua_isnumber(state, -1))
 					opt.compression = (int)lua_tointeger(state, -1);
+				else if (lua_isstring(state, -1)){
+					std::string s = lua_tostring(state, -1);
+					to_lower(s);
+					opt.fast = s == "fast";
+				}
 				lua_pop(state, 1);
 			}
+			{
+				lua_pushstring(state, "parallel");
+				lua_gettable(state, 3);
+				if (lua_isboolean(state, -1))
+					opt.parallel = lua_toboolean(state, -1);
+				lua_pop(state, 1);
+			}
+		}
+		bool async = false;
+		if (lua_gettop(state) >= 3 && lua_istable(state, 3)){
+			lua_getfield(state, 3, "async");
+			async = !!lua_toboolean(state, -1);
+			lua_pop(state, 1);
 		}
 		auto path = lua_tostring(state, 2);
 		auto interpreter = get_interpreter(state);
+		if (async){
+			auto res = interpreter->save_image_async(handle, path, opt);
+			if (res.success){
+				lua_pushinteger(state, res.results[0]);
+				return 1;
+			}
+			msg = res.message;
+			handle_call_to_c_error(state, __FUNCTION__, msg);
+			lua_pushnil(state);
+			return 1;
+		}
 		auto res = interpreter->save_image(handle, path, opt);
 		if (res.success){
 			lua_pushboolean(state, true);
@@ -327,7 +413,7 @@ DECLARE_LUA_FUNCTION(save_image){
 		}
 		msg = res.message;
 	}
-	handle_call_to_c_error(state, __FUNCTION__, msg.c_str());
+	handle_call_to_c_error(state, __FUNCTION__, msg);
 	lua_pushboolean(state, false);
 	return 1;
 }
@@ -377,7 +463,7 @@ DECLARE_LUA_FUNCTION(unload_image){
 	auto core_state = get_interpreter(state);
 	auto res = core_state->unload_image((int)lua_tointeger(state, 1));
 	if (!res.success)
-		handle_call_to_c_error(state, __FUNCTION__, res.message.c_str());
+		handle_call_to_c_error(state, __FUNCTION__, res.message);
 	return 0;
 }
 
@@ -404,13 +490,14 @@ DECLARE_LUA_FUNCTION(get_pixel){
 	}
 
 	auto interpreter = get_interpreter(state);
-	auto res = interpreter->get_pixel(params[0], params[1], params[2]);
+	pixel_t rgba;
+	auto res = interpreter->get_pixel(params[0], params[1], params[2], rgba);
 	if (!res.success){
-		handle_call_to_c_error(state, __FUNCTION__, res.message.c_str());
+		handle_call_to_c_error(state, __FUNCTION__, res.message);
 		return 0;
 	}
 	for (int i = 0; i < 4; i++)
-		lua_pushinteger(state, res.results[i]);
+		lua_pushnumber(state, rgba[i]);
 	return 4;
 }
 
@@ -428,7 +515,7 @@ DECLARE_LUA_FUNCTION(get_image_dimensions){
 	auto res = interpreter->get_image_dimensions(img);
 
 	if (!res.success){
-		handle_call_to_c_error(state, __FUNCTION__, res.message.c_str());
+		handle_call_to_c_error(state, __FUNCTION__, res.message);
 		return 0;
 	}
 	for (int i = 0; i < 2; i++)
@@ -436,6 +523,290 @@ DECLARE_LUA_FUNCTION(get_image_dimensions){
 	return 2;
 }
 
+DECLARE_LUA_FUNCTION(convert_image){
+#ifndef MINIMIZE_CHECKING
+	if (lua_gettop(state) < 2 || !lua_isnumber(state, 1)){
+		handle_call_to_c_error(state, __FUNCTION__, "Parameters are of incorrect types.");
+		return 0;
+	}
+#endif
+	auto format = to_pixel_format(state, 2);
+	if (format < 0){
+		handle_call_to_c_error(state, __FUNCTION__, "Unknown pixel format.");
+		lua_pushboolean(state, false);
+		return 1;
+	}
+	auto interpreter = get_interpreter(state);
+	auto res = interpreter->convert_image_format((int)lua_tointeger(state, 1), (pixel_format)format);
+	if (!res.success)
+		handle_call_to_c_error(state, __FUNCTION__, res.message);
+	lua_pushboolean(state, res.success);
+	return 1;
+}
+
+DECLARE_LUA_FUNCTION(get_image_format){
+#ifndef MINIMIZE_CHECKING
+	if (lua_gettop(state) < 1 || !lua_isnumber(state, 1)){
+		handle_call_to_c_error(state, __FUNCTION__, "The parameter should be an integer.");
+		return 0;
+	}
+#endif
+	auto interpreter = get_interpreter(state);
+	auto res = interpreter->get_image_format((int)lua_tointeger(state, 1));
+	if (!res.success){
+		handle_call_to_c_error(state, __FUNCTION__, res.message);
+		return 0;
+	}
+	lua_pushstring(state, pixel_format_names[res.results[0]]);
+	return 1;
+}
+
+static const char * const dither_algorithm_names[] = {
+	"floyd-steinberg",
+	"jarvis",
+	"stucki",
+	"atkinson",
+	"bayer",
+};
+
+// Reads the optional fields of the options table at the given index. The
+// palette is copied to the given buffer. Returns an error message, or nullptr.
+static const char *to_dither_options(lua_State *state, int index, dither_options &options, u8_quad *palette){
+	// Same defaults as get_default_dither_options(), which lives in the core.
+	options.algorithm = DITHER_FLOYD_STEINBERG;
+	options.levels = 2;
+	options.palette = nullptr;
+	options.palette_size = 0;
+	options.grayscale = 1;
+	options.serpentine = 0;
+	options.threads = 0;
+	if (lua_isnoneornil(state, index))
+		return nullptr;
+	if (!lua_istable(state, index))
+		return "The options should be a table.";
+	const char *ret = nullptr;
+
+	lua_getfield(state, index, "algorithm");
+	if (!lua_isnil(state, -1)){
+		ret = "Unknown dithering algorithm.";
+		if (lua_isstring(state, -1)){
+			auto name = lua_tostring(state, -1);
+			for (int i = 0; i < (int)(sizeof(dither_algorithm_names) / sizeof(*dither_algorithm_names)); i++){
+				if (!strcmp(name, dither_algorithm_names[i])){
+					options.algorithm = (dither_algorithm)i;
+					ret = nullptr;
+					break;
+				}
+			}
+		}
+	}
+	lua_pop(state, 1);
+
+	lua_getfield(state, index, "levels");
+	if (lua_isnumber(state, -1))
+		options.levels = (int)lua_tointeger(state, -1);
+	lua_pop(state, 1);
+
+	lua_getfield(state, index, "threads");
+	if (lua_isnumber(state, -1))
+		options.threads = (int)lua_tointeger(state, -1);
+	lua_pop(state, 1);
+
+	lua_getfield(state, index, "grayscale");
+	if (!lua_isnil(state, -1))
+		options.grayscale = lua_toboolean(state, -1);
+	lua_pop(state, 1);
+
+	lua_getfield(state, index, "serpentine");
+	if (!lua_isnil(state, -1))
+		options.serpentine = lua_toboolean(state, -1);
+	lua_pop(state, 1);
+
+	lua_getfield(state, index, "palette");
+	if (lua_istable(state, -1)){
+		int n = (int)lua_objlen(state, -1);
+		if (n < 1 || n > DITHER_MAX_PALETTE_SIZE)
+			ret = "Invalid palette size.";
+		for (int i = 0; i < n && !ret; i++){
+			lua_rawgeti(state, -1, i + 1);
+			if (!lua_istable(state, -1))
+				ret = "Palette colors should be tables of the form {r, g, b}.";
+			for (int j = 0; j < 3 && !ret; j++){
+				lua_rawgeti(state, -1, j + 1);
+				palette[i].data[j] = (u8)std::min(std::max((int)lua_tointeger(state, -1), 0), 255);
+				lua_pop(state, 1);
+			}
+			palette[i].data[3] = 255;
+			lua_pop(state, 1);
+		}
+		options.palette = palette;
+		options.palette_size = n;
+	}
+	lua_pop(state, 1);
+
+	return ret;
+}
+
+// Pushes nil while the save is pending, and otherwise true, or false and the
+// error message.
+static int push_save_status(lua_State *state, const ImageOperationResult &res){
+	if (res.results[0] == SAVE_PENDING){
+		lua_pushnil(state);
+		return 1;
+	}
+	lua_pushboolean(state, res.results[0] == SAVE_SUCCEEDED);
+	if (res.results[0] == SAVE_SUCCEEDED || !res.message)
+		return 1;
+	lua_pushstring(state, res.message);
+	return 2;
+}
+
+DECLARE_LUA_FUNCTION(poll_saved_image){
+#ifndef MINIMIZE_CHECKING
+	if (lua_gettop(state) < 1 || !lua_isnumber(state, 1)){
+		handle_call_to_c_error(state, __FUNCTION__, "Parameters are of incorrect types.");
+		return 0;
+	}
+#endif
+	auto interpreter = get_interpreter(state);
+	return push_save_status(state, interpreter->get_save_status((int)lua_tointeger(state, 1), false));
+}
+
+DECLARE_LUA_FUNCTION(wait_for_saved_image){
+	int ticket = lua_isnumber(state, 1) ? (int)lua_tointeger(state, 1) : 0;
+	auto interpreter = get_interpreter(state);
+	return push_save_status(state, interpreter->get_save_status(ticket, true));
+}
+
+DECLARE_LUA_FUNCTION(dither_image){
+#ifndef MINIMIZE_CHECKING
+	if (lua_gettop(state) < 1 || !lua_isnumber(state, 1)){
+		handle_call_to_c_error(state, __FUNCTION__, "Parameters are of incorrect types.");
+		return 0;
+	}
+#endif
+	dither_options options;
+	u8_quad palette[DITHER_MAX_PALETTE_SIZE];
+	auto msg = to_dither_options(state, 2, options, palette);
+	if (!msg){
+		auto interpreter = get_interpreter(state);
+		auto res = interpreter->dither_image((int)lua_tointeger(state, 1), options);
+		msg = res.message;
+	}
+	if (msg)
+		handle_call_to_c_error(state, __FUNCTION__, msg);
+	lua_pushboolean(state, !msg);
+	return 1;
+}
+
+// Parses a stencil of the form "(x-1, y), (x+1, y-1)".
+static bool parse_stencil(std::vector<wavefront_dependency> &dst, const char *s){
+	auto skip_spaces = [&s](){
+		while (isspace((unsigned char)*s))
+			s++;
+	};
+	auto parse_coordinate = [&](char name, int &offset){
+		skip_spaces();
+		if (*s++ != name)
+			return false;
+		skip_spaces();
+		offset = 0;
+		if (*s != '+' && *s != '-')
+			return true;
+		int sign = *s++ == '-' ? -1 : 1;
+		skip_spaces();
+		if (!isdigit((unsigned char)*s))
+			return false;
+		while (isdigit((unsigned char)*s))
+			offset = offset * 10 + (*s++ - '0');
+		offset *= sign;
+		skip_spaces();
+		return true;
+	};
+	dst.clear();
+	while (true){
+		skip_spaces();
+		if (!*s)
+			return true;
+		wavefront_dependency d;
+		if (*s++ != '(' || !parse_coordinate('x', d.dx) || *s++ != ',' || !parse_coordinate('y', d.dy) || *s++ != ')')
+			return false;
+		dst.push_back(d);
+		skip_spaces();
+		if (*s == ',')
+			s++;
+	}
+}
+
+// Reads a stencil given either as a string or as a list of {dx, dy} pairs.
+static bool to_stencil(std::vector<wavefront_dependency> &dst, lua_State *state, int index){
+	if (lua_type(state, index) == LUA_TSTRING)
+		return parse_stencil(dst, lua_tostring(state, index));
+	if (!lua_istable(state, index))
+		return false;
+	dst.clear();
+	int n = (int)lua_objlen(state, index);
+	for (int i = 0; i < n; i++){
+		lua_rawgeti(state, index, i + 1);
+		bool valid = lua_istable(state, -1);
+		wavefront_dependency d = { 0, 0 };
+		if (valid){
+			lua_rawgeti(state, -1, 1);
+			lua_rawgeti(state, -2, 2);
+			valid = lua_isnumber(state, -2) && lua_isnumber(state, -1);
+			d.dx = (int)lua_tointeger(state, -2);
+			d.dy = (int)lua_tointeger(state, -1);
+			lua_pop(state, 2);
+		}
+		lua_pop(state, 1);
+		if (!valid)
+			return false;
+		dst.push_back(d);
+	}
+	return true;
+}
+
+// Lua states can't be shared between threads, so the tiles run one after
+// another on the calling thread, in raster order, which satisfies any stencil
+// the scheduler accepts. Filters written this way can later be ported to C++
+// as they are.
+DECLARE_LUA_FUNCTION(run_wavefront){
+#ifndef MINIMIZE_CHECKING
+	if (lua_gettop(state) < 4 || !lua_isnumber(state, 1) || !lua_isnumber(state, 2) || !lua_isfunction(state, 4)){
+		handle_call_to_c_error(state, __FUNCTION__, "Parameters are of incorrect types.");
+		return 0;
+	}
+#endif
+	int w = (int)lua_tointeger(state, 1),
+		h = (int)lua_tointeger(state, 2);
+	int tile_w = lua_isnumber(state, 5) ? (int)lua_tointeger(state, 5) : 0,
+		tile_h = lua_isnumber(state, 6) ? (int)lua_tointeger(state, 6) : 0;
+	if (tile_w <= 0)
+		tile_w = default_wavefront_tile_w;
+	if (tile_h <= 0)
+		tile_h = default_wavefront_tile_h;
+	std::vector<wavefront_dependency> stencil, dependencies;
+	if (!to_stencil(stencil, state, 3)){
+		handle_call_to_c_error(state, __FUNCTION__, "Invalid stencil.");
+		return 0;
+	}
+	if (!get_tile_dependencies(dependencies, stencil.data(), (int)stencil.size(), tile_w, tile_h)){
+		handle_call_to_c_error(state, __FUNCTION__, "The stencil can't be scheduled with the given tile size.");
+		return 0;
+	}
+	for (int y = 0; y < h; y += tile_h){
+		for (int x = 0; x < w; x += tile_w){
+			lua_pushvalue(state, 4);
+			lua_pushinteger(state, x);
+			lua_pushinteger(state, y);
+			lua_pushinteger(state, std::min(x + tile_w, w));
+			lua_pushinteger(state, std::min(y + tile_h, h));
+			lua_call(state, 4, 0);
+		}
+	}
+	return 0;
+}
+
 enum class ZigZagState{
 	Initial = 0,
 	RightwardsOnTop,
@@ -559,6 +930,14 @@ DECLARE_LUA_FUNCTION(zig_zag_order){
 	return 3;
 }
 
+DECLARE_LUA_FUNCTION(get_frame_info){
+	auto interpreter = get_interpreter(state);
+	auto res = interpreter->get_frame_info();
+	lua_pushinteger(state, res.results[0]);
+	lua_pushinteger(state, res.results[1]);
+	return 2;
+}
+
 DECLARE_LUA_FUNCTION(get_displayed_image){
 	lua_getglobal(state, current_image_global_name);
 	if (!lua_isnil(state, -1))
@@ -574,14 +953,14 @@ DECLARE_LUA_FUNCTION(get_displayed_image){
 }
 
 DECLARE_LUA_FUNCTION(display_in_current_window){
-	std::string msg;
+	const char *msg = nullptr;
 #ifndef MINIMIZE_CHECKING
 	if (lua_gettop(state) < 1)
 		msg = "Not enough parameters.";
 	else if (!lua_isnumber(state, 1))
 		msg = "The first parameter should be a number.";
 #endif
-	if (!msg.size()){
+	if (!msg){
 		int handle = (int)lua_tointeger(state, 1);
 		auto interpreter = get_interpreter(state);
 		auto result = interpreter->display_in_current_window(handle);
@@ -591,7 +970,7 @@ DECLARE_LUA_FUNCTION(display_in_current_window){
 		}
 		msg = result.message;
 	}
-	handle_call_to_c_error(state, __FUNCTION__, msg.c_str());
+	handle_call_to_c_error(state, __FUNCTION__, msg);
 	lua_pushboolean(state, false);
 	return 1;
 }
@@ -607,33 +986,84 @@ DECLARE_LUA_FUNCTION(debug_print){
 }
 
 DECLARE_LUA_FUNCTION(show_message_box){
-	std::string msg;
+	const char *msg = nullptr;
 #ifndef MINIMIZE_CHECKING
 	if (lua_gettop(state) < 1)
 		msg = "Not enough parameters.";
 	else if (!lua_isstring(state, 1))
 		msg = "The first parameter should be a string.";
 #endif
-	if (!msg.size()){
+	if (!msg){
 		auto interpreter = get_interpreter(state);
 		interpreter->message_box(nullptr, lua_tostring(state, 1), false);
 		lua_pushboolean(state, true);
 		return 1;
 	}
-	handle_call_to_c_error(state, __FUNCTION__, msg.c_str());
+	handle_call_to_c_error(state, __FUNCTION__, msg);
 	lua_pushboolean(state, false);
 	return 1;
 }
 
+DECLARE_LUA_FUNCTION(begin_phase){
+#ifndef MINIMIZE_CHECKING
+	if (lua_gettop(state) < 1 || !lua_isstring(state, 1)){
+		handle_call_to_c_error(state, __FUNCTION__, "The parameter should be a string.");
+		return 0;
+	}
+#endif
+	auto interpreter = get_interpreter(state);
+	interpreter->begin_phase(lua_tostring(state, 1));
+	return 0;
+}
+
+DECLARE_LUA_FUNCTION(end_phase){
+	auto interpreter = get_interpreter(state);
+	interpreter->end_phase();
+	return 0;
+}
+
+DECLARE_LUA_FUNCTION(clock_ns){
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	lua_pushnumber(state, (lua_Number)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+	return 1;
+}
+
 int lua_panic_function(lua_State *state){
 	std::stringstream stream;
 	stream << "Lua threw an error: " << lua_tostring(state, -1);
-	auto interpreter = get_interpreter(state);
+	auto interpreter = get_interpreter_from_registry(state);
 	interpreter->message_box(nullptr, stream.str().c_str(), true);
 	throw LuaStackUnwind();
 	return 0;
 }
 
+void push_run_environment(lua_State *state){
+	lua_pushnil(state);
+	lua_setglobal(state, current_image_global_name);
+	lua_newtable(state);
+	lua_pushlightuserdata(state, (void *)&environment_metatable_key);
+	lua_rawget(state, LUA_REGISTRYINDEX);
+	lua_setmetatable(state, -2);
+	lua_pushvalue(state, -1);
+	lua_setfield(state, -2, "_G");
+}
+
+// Copies the globals as they are right after initialization, and makes a
+// metatable that looks names up in the copy, for push_run_environment().
+static void snapshot_globals(lua_State *state){
+	lua_pushlightuserdata(state, (void *)&environment_metatable_key);
+	lua_newtable(state);
+	lua_newtable(state);
+	lua_pushnil(state);
+	while (lua_next(state, LUA_GLOBALSINDEX)){
+		lua_pushvalue(state, -2);
+		lua_insert(state, -2);
+		lua_rawset(state, -4);
+	}
+	lua_setfield(state, -2, "__index");
+	lua_rawset(state, LUA_REGISTRYINDEX);
+}
+
 #define EXPOSE_LUA_FUNCTION(x) { #x, x }
 
 std::shared_ptr<lua_State> init_lua_state(LuaInterpreter *interpreter){
@@ -650,27 +1080,40 @@ std::shared_ptr<lua_State> init_lua_state(LuaInterpreter *interpreter){
 		EXPOSE_LUA_FUNCTION(hsv_to_rgb),
 		EXPOSE_LUA_FUNCTION(set_current_pixel),
 		EXPOSE_LUA_FUNCTION(save_image),
+		EXPOSE_LUA_FUNCTION(poll_saved_image),
+		EXPOSE_LUA_FUNCTION(wait_for_saved_image),
 		EXPOSE_LUA_FUNCTION(bitwise_and),
 		EXPOSE_LUA_FUNCTION(bitwise_or),
 		EXPOSE_LUA_FUNCTION(bitwise_xor),
 		EXPOSE_LUA_FUNCTION(bitwise_not),
 		EXPOSE_LUA_FUNCTION(get_pixel),
 		EXPOSE_LUA_FUNCTION(get_image_dimensions),
+		EXPOSE_LUA_FUNCTION(convert_image),
+		EXPOSE_LUA_FUNCTION(get_image_format),
+		EXPOSE_LUA_FUNCTION(dither_image),
+		EXPOSE_LUA_FUNCTION(run_wavefront),
 		EXPOSE_LUA_FUNCTION(zig_zag_order),
 		EXPOSE_LUA_FUNCTION(display_in_current_window),
 		EXPOSE_LUA_FUNCTION(get_displayed_image),
+		EXPOSE_LUA_FUNCTION(get_frame_info),
 		EXPOSE_LUA_FUNCTION(debug_print),
 		EXPOSE_LUA_FUNCTION(show_message_box),
+		EXPOSE_LUA_FUNCTION(begin_phase),
+		EXPOSE_LUA_FUNCTION(end_phase),
+		EXPOSE_LUA_FUNCTION(clock_ns),
 	};
 	for (auto &r : c_functions){
-		lua_pushcfunction(state, r.func);
+		lua_pushlightuserdata(state, interpreter);
+		lua_pushcclosure(state, r.func, 1);
 		lua_setglobal(state, r.name);
 	}
 
+	lua_pushlightuserdata(state, (void *)&interpreter_registry_key);
 	lua_pushlightuserdata(state, interpreter);
-	lua_setglobal(state, plugin_core_state_global_name);
+	lua_rawset(state, LUA_REGISTRYINDEX);
 
 	lua_atpanic(state, lua_panic_function);
+	snapshot_globals(state);
 
 	return ret;
 }
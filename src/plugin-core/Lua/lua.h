@@ -17,6 +17,10 @@ bool get_lua_global_function(lua_State *state, const char *name);
 void handle_call_to_c_error(lua_State *state, const char *function, const char *msg);
 std::shared_ptr<lua_State> init_lua_state(LuaInterpreter *core_state);
 int lua_panic_function(lua_State *state);
+// Pushes a fresh table of globals for a run, which falls back on the globals
+// the state was initialized with. Writes go to the new table, so nothing one
+// run sets or overrides is seen by the next.
+void push_run_environment(lua_State *state);
 
 class LuaStackUnwind : public std::exception{
 public:
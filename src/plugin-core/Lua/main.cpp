@@ -41,3 +41,11 @@ LUA_PLUGIN_EXPORT_C void LuaInterpreter_execute(CallResult *result, LuaInterpret
 LUA_PLUGIN_EXPORT_C void delete_LuaCallResult(CallResult *result){
 	delete result->impl;
 }
+
+LUA_PLUGIN_EXPORT_C bool LuaInterpreter_compile(LuaInterpreter *interpreter, const char *filename, const void *buffer, size_t size, bytecode_writer_t writer, void *ud){
+	return interpreter->compile_buffer(filename, buffer, size, writer, ud);
+}
+
+LUA_PLUGIN_EXPORT_C const char *LuaInterpreter_get_version(){
+	return LUAJIT_VERSION;
+}
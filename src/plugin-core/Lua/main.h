@@ -13,6 +13,7 @@ Distributed under a permissive license. See COPYING.txt for details.
 #endif
 
 #include "../CallResult.h"
+#include "../capi.h"
 
 #define LUA_PLUGIN_EXTERN_C extern "C"
 
@@ -28,12 +29,14 @@ typedef void *external_state;
 struct ImageOperationResultExternal{
 	bool success = true;
 	int results[4];
-	char *message = nullptr;
+	// Points to static storage in the core. Never needs to be freed.
+	const char *message = nullptr;
 };
 
 struct image_info{
 	int handle;
 	int w, h, stride, pitch;
+	pixel_format format;
 	void *pixels;
 };
 
@@ -46,18 +49,30 @@ struct LuaInterpreterParameters{
 #define LuaInterpreterParameters_DECLARE_FUNCTION0(rt, x) \
 	typedef rt (*x##_f)(external_state); \
 	x##_f x
-	LuaInterpreterParameters_DECLARE_FUNCTION(void, release_returned_string, char *);
 	LuaInterpreterParameters_DECLARE_FUNCTION(void, show_message_box, const char *title, const char *message, bool is_error);
 	LuaInterpreterParameters_DECLARE_FUNCTION(ImageOperationResultExternal, get_image_info, int handle, image_info *);
 	LuaInterpreterParameters_DECLARE_FUNCTION(ImageOperationResultExternal, load_image, const char *path);
 	LuaInterpreterParameters_DECLARE_FUNCTION(ImageOperationResultExternal, unload_image, int handle);
-	LuaInterpreterParameters_DECLARE_FUNCTION(ImageOperationResultExternal, allocate_image, int w, int h);
-	LuaInterpreterParameters_DECLARE_FUNCTION(ImageOperationResultExternal, save_image, int handle, const char *path, int compression, const char *format);
+	LuaInterpreterParameters_DECLARE_FUNCTION(ImageOperationResultExternal, allocate_image, int w, int h, pixel_format format);
+	LuaInterpreterParameters_DECLARE_FUNCTION(ImageOperationResultExternal, convert_image_format, int handle, pixel_format format);
+	LuaInterpreterParameters_DECLARE_FUNCTION(ImageOperationResultExternal, dither_image, int handle, const dither_options *options);
+	LuaInterpreterParameters_DECLARE_FUNCTION(ImageOperationResultExternal, save_image, int handle, const char *path, int compression, const char *format, int parallel, bool fast);
+	LuaInterpreterParameters_DECLARE_FUNCTION(ImageOperationResultExternal, save_image_async, int handle, const char *path, int compression, const char *format, int parallel, bool fast);
+	// results[0] receives a save_status. A ticket of zero waits for every save.
+	LuaInterpreterParameters_DECLARE_FUNCTION(ImageOperationResultExternal, get_save_status, int ticket, bool wait);
 	LuaInterpreterParameters_DECLARE_FUNCTION0(int, get_caller_image);
 	LuaInterpreterParameters_DECLARE_FUNCTION(void, display_in_current_window, int handle);
+	// results[0] and results[1] receive the index of the frame being filtered
+	// and the number of frames.
+	LuaInterpreterParameters_DECLARE_FUNCTION0(ImageOperationResultExternal, get_frame_info);
+	LuaInterpreterParameters_DECLARE_FUNCTION0(void, report_pure_filter);
 	LuaInterpreterParameters_DECLARE_FUNCTION(void, debug_print, const char *string);
+	LuaInterpreterParameters_DECLARE_FUNCTION(void, begin_phase, const char *name);
+	LuaInterpreterParameters_DECLARE_FUNCTION0(void, end_phase);
 };
 
+typedef void (*bytecode_writer_t)(void *ud, const void *data, size_t size);
+
 #define Lua_DECLARE_EXPORTED_FUNCTION(rt, x, ...) \
 	typedef rt (*x##_f)(__VA_ARGS__); \
 	LUA_PLUGIN_EXPORT_C rt x(__VA_ARGS__)
@@ -66,5 +81,11 @@ Lua_DECLARE_EXPORTED_FUNCTION(LuaInterpreter *, new_LuaInterpreter, LuaInterpret
 Lua_DECLARE_EXPORTED_FUNCTION(void, delete_LuaInterpreter, LuaInterpreter *);
 Lua_DECLARE_EXPORTED_FUNCTION(void, LuaInterpreter_execute, CallResult *result, LuaInterpreter *, const char *filename, const void *buffer, size_t size);
 Lua_DECLARE_EXPORTED_FUNCTION(void, delete_LuaCallResult, CallResult *);
+// Loads the script without running it and passes its bytecode to writer.
+// The bytecode may later be passed to LuaInterpreter_execute() in place of the
+// source. Returns false if the script doesn't compile.
+Lua_DECLARE_EXPORTED_FUNCTION(bool, LuaInterpreter_compile, LuaInterpreter *, const char *filename, const void *buffer, size_t size, bytecode_writer_t writer, void *ud);
+// Bytecode is only valid for the same version of the interpreter.
+Lua_DECLARE_EXPORTED_FUNCTION(const char *, LuaInterpreter_get_version, void);
 
 #endif
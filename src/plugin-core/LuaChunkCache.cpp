@@ -0,0 +1,94 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "LuaChunkCache.h"
+#include <QCryptographicHash>
+#include <QFile>
+#include <QSaveFile>
+#include <QDir>
+
+void LuaChunkCache::set_location(const QString &location){
+	this->location = location;
+	if (!this->location.isEmpty() && !QDir().mkpath(this->location))
+		this->location.clear();
+	this->prune();
+}
+
+// Deletes the least recently written chunks until the directory is well
+// under max_disk_usage, so that it doesn't need pruning again right away.
+void LuaChunkCache::prune(){
+	this->disk_usage = 0;
+	if (this->location.isEmpty())
+		return;
+	auto files = QDir(this->location).entryInfoList(QStringList() << "*.ljbc", QDir::Files, QDir::Time);
+	const qint64 target = max_disk_usage / 4 * 3;
+	for (auto &file : files){
+		if (this->disk_usage + file.size() > target){
+			QFile::remove(file.absoluteFilePath());
+			continue;
+		}
+		this->disk_usage += file.size();
+	}
+}
+
+QByteArray LuaChunkCache::compute_key(const QString &filename, const QByteArray &source) const{
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData(this->flavor);
+	hash.addData("\0", 1);
+	// The file name is part of the key because it's stored in the bytecode
+	// and shows up in error messages.
+	hash.addData(filename.toUtf8());
+	hash.addData("\0", 1);
+	hash.addData(source);
+	return hash.result().toHex();
+}
+
+QString LuaChunkCache::get_path(const QByteArray &key) const{
+	if (this->location.isEmpty())
+		return QString();
+	return this->location + QString::fromLatin1(key) + ".ljbc";
+}
+
+QByteArray LuaChunkCache::get(const QByteArray &key, const verifier &verify){
+	auto it = this->chunks.find(key);
+	if (it != this->chunks.end())
+		return it.value();
+	auto path = this->get_path(key);
+	if (path.isEmpty())
+		return QByteArray();
+	QFile file(path);
+	if (!file.open(QFile::ReadOnly))
+		return QByteArray();
+	auto ret = file.readAll();
+	file.close();
+	// Truncated or otherwise damaged.
+	if (!ret.size() || (verify && !verify(ret))){
+		QFile::remove(path);
+		return QByteArray();
+	}
+	this->put(key, ret);
+	return ret;
+}
+
+void LuaChunkCache::put(const QByteArray &key, const QByteArray &bytecode){
+	if (this->chunks.size() >= max_chunks_in_memory)
+		this->chunks.clear();
+	bool new_chunk = !this->chunks.contains(key);
+	this->chunks[key] = bytecode;
+	auto path = this->get_path(key);
+	if (!new_chunk || path.isEmpty() || QFile::exists(path))
+		return;
+	QSaveFile file(path);
+	if (!file.open(QFile::WriteOnly))
+		return;
+	file.write(bytecode);
+	if (!file.commit())
+		return;
+	this->disk_usage += bytecode.size();
+	if (this->disk_usage > max_disk_usage)
+		this->prune();
+}
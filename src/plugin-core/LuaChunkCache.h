@@ -0,0 +1,47 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef LUACHUNKCACHE_H
+#define LUACHUNKCACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <functional>
+
+// Keeps the bytecode of Lua filters in memory and, if a location has been
+// set, on disk, keyed by a hash of the interpreter flavor, the file name and
+// the source.
+class LuaChunkCache{
+	QString location;
+	QByteArray flavor;
+	QHash<QByteArray, QByteArray> chunks;
+	qint64 disk_usage = 0;
+	static const int max_chunks_in_memory = 64;
+	static const qint64 max_disk_usage = 32 << 20;
+
+	QString get_path(const QByteArray &key) const;
+	void prune();
+public:
+	// Returns false if the bytecode can't be loaded.
+	typedef std::function<bool(const QByteArray &)> verifier;
+
+	void set_location(const QString &location);
+	// Bytecode is only valid for the interpreter build that produced it, so
+	// this must identify the version and bitness of the interpreter. Must be
+	// set before any key is computed.
+	void set_flavor(const QByteArray &flavor){
+		this->flavor = flavor;
+	}
+	QByteArray compute_key(const QString &filename, const QByteArray &source) const;
+	// Chunks read from disk are passed to verify, if given, and discarded if
+	// it fails.
+	QByteArray get(const QByteArray &key, const verifier &verify = verifier());
+	void put(const QByteArray &key, const QByteArray &bytecode);
+};
+
+#endif
@@ -0,0 +1,534 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "ParallelEncoder.h"
+#include "ParallelFor.h"
+#include <QImage>
+#include <QSaveFile>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#ifdef WIN32
+// Qt bundles zlib and exports it from QtCore.
+#include <QtZlib/zlib.h>
+#else
+#include <zlib.h>
+#endif
+
+namespace{
+
+typedef std::vector<std::uint8_t> buffer_t;
+
+struct SourceImage{
+	const std::uint8_t *pixels;
+	int w, h;
+	size_t pitch;
+	int channels;
+	// Bytes per sample: 1 or 2. Two-byte samples are in native byte order.
+	int sample_size;
+
+	size_t get_row_size() const{
+		return (size_t)this->w * this->channels * this->sample_size;
+	}
+	const std::uint8_t *get_row(int y) const{
+		return this->pixels + this->pitch * y;
+	}
+};
+
+bool is_little_endian(){
+	const std::uint16_t x = 1;
+	return *(const std::uint8_t *)&x == 1;
+}
+
+// Bands are at least this large, so that deflate has room to find matches and
+// the cost of the flushes between bands is negligible.
+const size_t min_band_size = 1 << 20;
+
+int get_band_rows(const SourceImage &image){
+	return (int)std::max<size_t>(min_band_size / std::max<size_t>(image.get_row_size(), 1), 1);
+}
+
+int quality_to_level(int quality, bool fast){
+	if (fast)
+		return 1;
+	if (quality < 0)
+		return Z_DEFAULT_COMPRESSION;
+	// Same mapping as Qt's PNG writer.
+	return (100 - std::min(quality, 100)) * 9 / 91;
+}
+
+void put_u32_be(buffer_t &dst, std::uint32_t x){
+	for (int i = 4; i--;)
+		dst.push_back((std::uint8_t)(x >> (i * 8)));
+}
+
+// PNG.
+
+enum PngFilter{
+	PNG_FILTER_NONE = 0,
+	PNG_FILTER_SUB = 1,
+	PNG_FILTER_UP = 2,
+	PNG_FILTER_AVERAGE = 3,
+	PNG_FILTER_PAETH = 4,
+	PNG_FILTER_COUNT,
+};
+
+inline std::uint8_t paeth(int a, int b, int c){
+	int p = a + b - c;
+	int pa = std::abs(p - a),
+		pb = std::abs(p - b),
+		pc = std::abs(p - c);
+	if (pa <= pb && pa <= pc)
+		return (std::uint8_t)a;
+	return (std::uint8_t)(pb <= pc ? b : c);
+}
+
+void apply_png_filter(std::uint8_t *dst, const std::uint8_t *row, const std::uint8_t *prev, size_t n, size_t bpp, int filter){
+	switch (filter){
+		case PNG_FILTER_NONE:
+			memcpy(dst, row, n);
+			break;
+		case PNG_FILTER_SUB:
+			for (size_t i = 0; i < n; i++)
+				dst[i] = row[i] - (i >= bpp ? row[i - bpp] : 0);
+			break;
+		case PNG_FILTER_UP:
+			for (size_t i = 0; i < n; i++)
+				dst[i] = row[i] - prev[i];
+			break;
+		case PNG_FILTER_AVERAGE:
+			for (size_t i = 0; i < n; i++)
+				dst[i] = row[i] - (std::uint8_t)(((i >= bpp ? row[i - bpp] : 0) + prev[i]) / 2);
+			break;
+		case PNG_FILTER_PAETH:
+			for (size_t i = 0; i < n; i++)
+				dst[i] = row[i] - (i >= bpp ? paeth(row[i - bpp], prev[i], prev[i - bpp]) : paeth(0, prev[i], 0));
+			break;
+	}
+}
+
+// The usual heuristic: the filter whose output, taken as signed bytes, has
+// the smallest sum of absolute values.
+std::uint64_t get_filter_cost(const std::uint8_t *data, size_t n){
+	std::uint64_t ret = 0;
+	for (size_t i = 0; i < n; i++)
+		ret += std::abs((int)(std::int8_t)data[i]);
+	return ret;
+}
+
+class PngEncoder{
+	const SourceImage &image;
+	int level;
+	bool fast;
+	size_t row_size,
+		filtered_row_size;
+	int band_rows,
+		bands;
+	// Filter type byte followed by the filtered row, for every row.
+	buffer_t filtered;
+	std::vector<buffer_t> compressed;
+	std::vector<std::uint32_t> adlers;
+	std::atomic<bool> failed;
+
+	void get_png_row(std::uint8_t *dst, int y) const;
+	void filter_band(int band);
+	void compress_band(int band);
+public:
+	PngEncoder(const SourceImage &image, int level, bool fast);
+	const char *encode(buffer_t &header, std::vector<buffer_t> *&chunks, buffer_t &trailer);
+};
+
+PngEncoder::PngEncoder(const SourceImage &image, int level, bool fast):
+		image(image),
+		level(level),
+		fast(fast),
+		failed(false){
+	this->row_size = image.get_row_size();
+	this->filtered_row_size = this->row_size + 1;
+	this->band_rows = get_band_rows(image);
+	this->bands = (image.h + this->band_rows - 1) / this->band_rows;
+}
+
+// PNG wants two-byte samples in big endian order.
+void PngEncoder::get_png_row(std::uint8_t *dst, int y) const{
+	auto src = this->image.get_row(y);
+	if (this->image.sample_size == 1 || !is_little_endian()){
+		memcpy(dst, src, this->row_size);
+		return;
+	}
+	for (size_t i = 0; i < this->row_size; i += 2){
+		dst[i] = src[i + 1];
+		dst[i + 1] = src[i];
+	}
+}
+
+void PngEncoder::filter_band(int band){
+	int y0 = band * this->band_rows,
+		y1 = std::min(y0 + this->band_rows, this->image.h);
+	size_t bpp = this->image.channels * this->image.sample_size;
+	buffer_t row(this->row_size),
+		prev(this->row_size, 0),
+		candidate(this->row_size);
+	if (y0)
+		this->get_png_row(prev.data(), y0 - 1);
+	for (int y = y0; y < y1; y++){
+		this->get_png_row(row.data(), y);
+		auto dst = &this->filtered[y * this->filtered_row_size];
+		if (this->fast){
+			// Paeth alone does nearly as well as trying every filter, for a
+			// fraction of the time.
+			dst[0] = PNG_FILTER_PAETH;
+			apply_png_filter(dst + 1, row.data(), prev.data(), this->row_size, bpp, PNG_FILTER_PAETH);
+		}else{
+			std::uint64_t best_cost = 0;
+			for (int filter = PNG_FILTER_NONE; filter < PNG_FILTER_COUNT; filter++){
+				apply_png_filter(candidate.data(), row.data(), prev.data(), this->row_size, bpp, filter);
+				auto cost = get_filter_cost(candidate.data(), this->row_size);
+				if (filter != PNG_FILTER_NONE && cost >= best_cost)
+					continue;
+				best_cost = cost;
+				dst[0] = (std::uint8_t)filter;
+				memcpy(dst + 1, candidate.data(), this->row_size);
+			}
+		}
+		row.swap(prev);
+	}
+}
+
+// Every band is a run of raw deflate blocks that ends on a byte boundary (with
+// a sync flush, or the final block for the last band), so the bands can simply
+// be concatenated. Each band is primed with the end of the previous one, so
+// little is lost to the split.
+void PngEncoder::compress_band(int band){
+	size_t begin = (size_t)band * this->band_rows * this->filtered_row_size,
+		end = std::min((size_t)(band + 1) * this->band_rows, (size_t)this->image.h) * this->filtered_row_size;
+	auto data = this->filtered.data();
+	this->adlers[band] = (std::uint32_t)adler32(adler32(0, nullptr, 0), data + begin, (uInt)(end - begin));
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, this->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+		this->failed = true;
+		return;
+	}
+	const size_t window_size = 1 << 15;
+	if (begin){
+		size_t dictionary = std::min(begin, window_size);
+		deflateSetDictionary(&stream, data + begin - dictionary, (uInt)dictionary);
+	}
+	bool last = band == this->bands - 1;
+	auto &dst = this->compressed[band];
+	dst.resize(deflateBound(&stream, (uLong)(end - begin)) + 16);
+	stream.next_in = data + begin;
+	stream.avail_in = (uInt)(end - begin);
+	stream.next_out = dst.data();
+	stream.avail_out = (uInt)dst.size();
+	if (deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH) != (last ? Z_STREAM_END : Z_OK) || stream.avail_in)
+		this->failed = true;
+	dst.resize(dst.size() - stream.avail_out);
+	deflateEnd(&stream);
+}
+
+const char *PngEncoder::encode(buffer_t &header, std::vector<buffer_t> *&chunks, buffer_t &trailer){
+	try{
+		this->filtered.resize(this->filtered_row_size * this->image.h);
+		this->compressed.resize(this->bands);
+		this->adlers.resize(this->bands);
+	}catch (std::bad_alloc &){
+		return "Not enough memory.";
+	}
+	parallel_for(this->bands, [this](int band, int){ this->filter_band(band); });
+	parallel_for(this->bands, [this](int band, int){ this->compress_band(band); });
+	if (this->failed)
+		return "Compression failed.";
+
+	static const std::uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	header.assign(signature, signature + sizeof(signature));
+	static const std::uint8_t color_types[] = { 0, 0, 4, 2, 6 };
+	buffer_t ihdr;
+	put_u32_be(ihdr, this->image.w);
+	put_u32_be(ihdr, this->image.h);
+	ihdr.push_back((std::uint8_t)(this->image.sample_size * 8));
+	ihdr.push_back(color_types[this->image.channels]);
+	// Compression, filter method, and no interlacing.
+	ihdr.push_back(0);
+	ihdr.push_back(0);
+	ihdr.push_back(0);
+	auto put_chunk = [](buffer_t &dst, const char *type, const std::uint8_t *data, size_t size){
+		put_u32_be(dst, (std::uint32_t)size);
+		auto crc = crc32(0, nullptr, 0);
+		crc = crc32(crc, (const Bytef *)type, 4);
+		// crc32() returns the initial value when passed a null buffer.
+		if (size)
+			crc = crc32(crc, data, (uInt)size);
+		dst.insert(dst.end(), type, type + 4);
+		dst.insert(dst.end(), data, data + size);
+		put_u32_be(dst, (std::uint32_t)crc);
+	};
+	put_chunk(header, "IHDR", ihdr.data(), ihdr.size());
+
+	// The zlib header goes in an IDAT of its own, and so does the checksum,
+	// which is only known after every band is done. Each band gets its own
+	// IDAT, whose CRC is computed in parallel.
+	int flevel = this->level == Z_DEFAULT_COMPRESSION ? 2 : this->level < 2 ? 0 : this->level < 6 ? 1 : this->level == 6 ? 2 : 3;
+	std::uint8_t zlib_header[] = { 0x78, (std::uint8_t)(flevel << 6) };
+	zlib_header[1] += 31 - ((zlib_header[0] << 8) + zlib_header[1]) % 31;
+	put_chunk(header, "IDAT", zlib_header, sizeof(zlib_header));
+
+	auto &compressed = this->compressed;
+	parallel_for(this->bands, [&compressed, &put_chunk](int band, int){
+		buffer_t chunk;
+		chunk.reserve(compressed[band].size() + 12);
+		put_chunk(chunk, "IDAT", compressed[band].data(), compressed[band].size());
+		compressed[band].swap(chunk);
+	});
+	chunks = &this->compressed;
+
+	auto adler = this->adlers[0];
+	for (int i = 1; i < this->bands; i++){
+		int y0 = i * this->band_rows,
+			y1 = std::min(y0 + this->band_rows, this->image.h);
+		adler = (std::uint32_t)adler32_combine(adler, this->adlers[i], (z_off_t)((y1 - y0) * this->filtered_row_size));
+	}
+	buffer_t checksum;
+	put_u32_be(checksum, adler);
+	put_chunk(trailer, "IDAT", checksum.data(), checksum.size());
+	put_chunk(trailer, "IEND", nullptr, 0);
+	return nullptr;
+}
+
+// TIFF. Every strip is an independent zlib stream, with horizontal
+// differencing, so strips are compressed in parallel with no extra work.
+
+class TiffEncoder{
+	const SourceImage &image;
+	int level;
+	int strip_rows,
+		strips;
+	std::vector<buffer_t> compressed;
+	std::atomic<bool> failed;
+
+	void compress_strip(int strip);
+public:
+	TiffEncoder(const SourceImage &image, int level):
+			image(image),
+			level(level),
+			failed(false){
+		this->strip_rows = get_band_rows(image);
+		this->strips = (image.h + this->strip_rows - 1) / this->strip_rows;
+	}
+	const char *encode(buffer_t &header, std::vector<buffer_t> *&strips, buffer_t &trailer);
+};
+
+template <typename T>
+void difference_row(T *row, int w, int channels){
+	for (int x = w; --x > 0;)
+		for (int c = 0; c < channels; c++)
+			row[x * channels + c] -= row[(x - 1) * channels + c];
+}
+
+void TiffEncoder::compress_strip(int strip){
+	int y0 = strip * this->strip_rows,
+		y1 = std::min(y0 + this->strip_rows, this->image.h);
+	auto row_size = this->image.get_row_size();
+	buffer_t data(row_size * (y1 - y0));
+	for (int y = y0; y < y1; y++){
+		auto row = &data[(y - y0) * row_size];
+		memcpy(row, this->image.get_row(y), row_size);
+		if (this->image.sample_size == 1)
+			difference_row(row, this->image.w, this->image.channels);
+		else
+			difference_row((std::uint16_t *)row, this->image.w, this->image.channels);
+	}
+	auto &dst = this->compressed[strip];
+	uLongf size = compressBound((uLong)data.size());
+	dst.resize(size);
+	if (compress2(dst.data(), &size, data.data(), (uLong)data.size(), this->level) != Z_OK)
+		this->failed = true;
+	dst.resize(size);
+}
+
+const char *TiffEncoder::encode(buffer_t &header, std::vector<buffer_t> *&strips, buffer_t &trailer){
+	try{
+		this->compressed.resize(this->strips);
+	}catch (std::bad_alloc &){
+		return "Not enough memory.";
+	}
+	parallel_for(this->strips, [this](int strip, int){ this->compress_strip(strip); });
+	if (this->failed)
+		return "Compression failed.";
+
+	// Everything is written in the native byte order, which TIFF allows, so
+	// that two-byte samples can be written as they are.
+	auto put16 = [](buffer_t &dst, std::uint16_t x){
+		dst.insert(dst.end(), (const std::uint8_t *)&x, (const std::uint8_t *)&x + 2);
+	};
+	auto put32 = [](buffer_t &dst, std::uint32_t x){
+		dst.insert(dst.end(), (const std::uint8_t *)&x, (const std::uint8_t *)&x + 4);
+	};
+	header.clear();
+	header.push_back(is_little_endian() ? 'I' : 'M');
+	header.push_back(header[0]);
+	put16(header, 42);
+	std::uint64_t offset = 8;
+	for (auto &strip : this->compressed)
+		offset += strip.size();
+	if (offset > 0xFFFF0000ULL)
+		return "Image too large for TIFF.";
+	// Word-aligned IFD.
+	bool pad = offset & 1;
+	offset += pad;
+	put32(header, (std::uint32_t)offset);
+
+	struct Entry{
+		std::uint16_t tag, type;
+		std::uint32_t count;
+		// Either the value itself, or the offset of the values into extra
+		// (until the IFD is written).
+		std::uint32_t value;
+		bool in_extra;
+	};
+	const std::uint16_t SHORT = 3,
+		LONG = 4;
+	std::vector<Entry> entries;
+	buffer_t extra;
+	auto add = [&](std::uint16_t tag, std::uint16_t type, std::uint32_t value){
+		Entry e = { tag, type, 1, 0, false };
+		if (type == SHORT){
+			auto short_value = (std::uint16_t)value;
+			memcpy(&e.value, &short_value, 2);
+		}else
+			e.value = value;
+		entries.push_back(e);
+	};
+	auto add_array = [&](std::uint16_t tag, std::uint16_t type, const buffer_t &values, std::uint32_t count){
+		Entry e = { tag, type, count, 0, values.size() > 4 };
+		if (!e.in_extra)
+			memcpy(&e.value, values.data(), values.size());
+		else{
+			e.value = (std::uint32_t)extra.size();
+			extra.insert(extra.end(), values.begin(), values.end());
+		}
+		entries.push_back(e);
+	};
+	buffer_t bits_per_sample,
+		strip_offsets,
+		strip_byte_counts;
+	for (int i = 0; i < this->image.channels; i++)
+		put16(bits_per_sample, (std::uint16_t)(this->image.sample_size * 8));
+	std::uint32_t strip_offset = 8;
+	for (auto &strip : this->compressed){
+		put32(strip_offsets, strip_offset);
+		put32(strip_byte_counts, (std::uint32_t)strip.size());
+		strip_offset += (std::uint32_t)strip.size();
+	}
+	add(256, LONG, this->image.w);
+	add(257, LONG, this->image.h);
+	add_array(258, SHORT, bits_per_sample, this->image.channels);
+	// Adobe deflate.
+	add(259, SHORT, 8);
+	// BlackIsZero for grayscale images, RGB otherwise.
+	add(262, SHORT, this->image.channels == 1 ? 1 : 2);
+	add_array(273, LONG, strip_offsets, this->strips);
+	add(277, SHORT, this->image.channels);
+	add(278, LONG, this->strip_rows);
+	add_array(279, LONG, strip_byte_counts, this->strips);
+	// Chunky.
+	add(284, SHORT, 1);
+	// Horizontal differencing.
+	add(317, SHORT, 2);
+	// Unassociated alpha.
+	if (this->image.channels == 4)
+		add(338, SHORT, 2);
+	// Samples are unsigned integers.
+	add(339, SHORT, 1);
+
+	trailer.clear();
+	if (pad)
+		trailer.push_back(0);
+	put16(trailer, (std::uint16_t)entries.size());
+	auto extra_offset = (std::uint32_t)offset + 2 + (std::uint32_t)entries.size() * 12 + 4;
+	for (auto &e : entries){
+		if (e.in_extra)
+			e.value += extra_offset;
+		put16(trailer, e.tag);
+		put16(trailer, e.type);
+		put32(trailer, e.count);
+		trailer.insert(trailer.end(), (const std::uint8_t *)&e.value, (const std::uint8_t *)&e.value + 4);
+	}
+	put32(trailer, 0);
+	trailer.insert(trailer.end(), extra.begin(), extra.end());
+	strips = &this->compressed;
+	return nullptr;
+}
+
+}
+
+bool is_parallel_format(const std::string &format){
+	return format == "png" || format == "tif" || format == "tiff";
+}
+
+const char *save_parallel(const QImage &image, const QString &path, const std::string &format, int quality, bool fast){
+	QImage converted;
+	SourceImage source;
+	source.sample_size = 1;
+	if (image.format() == QImage::Format_Grayscale8){
+		converted = image;
+		source.channels = 1;
+	}else
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+	if (image.depth() > 32){
+		converted = image.convertToFormat(QImage::Format_RGBA64);
+		source.channels = 4;
+		source.sample_size = 2;
+	}else
+#endif
+	if (image.hasAlphaChannel()){
+		converted = image.convertToFormat(QImage::Format_RGBA8888);
+		source.channels = 4;
+	}else{
+		converted = image.convertToFormat(QImage::Format_RGB888);
+		source.channels = 3;
+	}
+	if (converted.isNull())
+		return "Not enough memory.";
+	source.pixels = converted.constBits();
+	source.w = converted.width();
+	source.h = converted.height();
+	source.pitch = converted.bytesPerLine();
+
+	buffer_t header,
+		trailer;
+	std::vector<buffer_t> *body = nullptr;
+	const char *ret;
+	int level = quality_to_level(quality, fast);
+	// The encoders are kept alive until the body has been written.
+	PngEncoder png(source, level, fast);
+	TiffEncoder tiff(source, level);
+	if (format == "png")
+		ret = png.encode(header, body, trailer);
+	else if (format == "tif" || format == "tiff")
+		ret = tiff.encode(header, body, trailer);
+	else
+		return "Unsupported format.";
+	if (ret)
+		return ret;
+
+	QSaveFile file(path);
+	if (!file.open(QSaveFile::WriteOnly))
+		return "Can't open the file for writing.";
+	bool ok = file.write((const char *)header.data(), header.size()) == (qint64)header.size();
+	for (auto &part : *body)
+		ok = ok && file.write((const char *)part.data(), part.size()) == (qint64)part.size();
+	ok = ok && file.write((const char *)trailer.data(), trailer.size()) == (qint64)trailer.size();
+	if (!ok || !file.commit())
+		return "Error writing the file.";
+	return nullptr;
+}
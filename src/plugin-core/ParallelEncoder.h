@@ -0,0 +1,30 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef PARALLELENCODER_H
+#define PARALLELENCODER_H
+
+#include <string>
+
+class QImage;
+class QString;
+
+// Images at least this large are saved with the parallel encoder when the
+// caller leaves the choice to us.
+const long long parallel_encoder_threshold = 4 << 20;
+
+// Returns true if the format (e.g. "png", "tif") can be written by
+// save_parallel().
+bool is_parallel_format(const std::string &format);
+// Writes a PNG or a TIFF, compressing bands of rows on every core. quality
+// follows QImage::save(): -1 for the default, otherwise 0 (smallest) to 100
+// (largest). If fast is set, quality is ignored and the settings are picked
+// for throughput. Returns nullptr on success, otherwise a message with static
+// storage duration.
+const char *save_parallel(const QImage &, const QString &path, const std::string &format, int quality, bool fast);
+
+#endif
@@ -0,0 +1,47 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+// Returns the number of threads parallel_for(n, f, max_threads) will use.
+inline int parallel_for_threads(int n, int max_threads = 0){
+	int threads = max_threads > 0 ? max_threads : QThread::idealThreadCount();
+	return std::max(std::min(threads, n), 1);
+}
+
+// Calls f(i, thread) for every i in [0; n), in increasing order of i, on up
+// to max_threads threads (one per core if max_threads <= 0). thread is in
+// [0; threads) and identifies the thread the call is made on, so that f can
+// keep per-thread state. The calling thread is thread 0 and takes part, so
+// the loop finishes even if the helpers never get a thread from the pool, and
+// f(i) may wait on an earlier f(j) that is already running.
+template <typename F>
+void parallel_for(int n, const F &f, int max_threads = 0){
+	if (n < 1)
+		return;
+	int threads = parallel_for_threads(n, max_threads);
+	std::atomic<int> next(0);
+	auto work = [&](int thread){
+		for (int i; (i = next++) < n;)
+			f(i, thread);
+	};
+	std::vector<QFuture<void>> helpers;
+	for (int i = 1; i < threads; i++)
+		helpers.push_back(QtConcurrent::run([&work, i](){ work(i); }));
+	work(0);
+	for (auto &helper : helpers)
+		helper.waitForFinished();
+}
+
+#endif
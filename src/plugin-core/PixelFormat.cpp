@@ -0,0 +1,168 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "PixelFormat.h"
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+bool is_valid_pixel_format(int format){
+	switch (format){
+		case PIXEL_FORMAT_RGBA8:
+		case PIXEL_FORMAT_RGBA16:
+		case PIXEL_FORMAT_RGBA32F:
+			return true;
+	}
+	return false;
+}
+
+unsigned get_bytes_per_pixel(pixel_format format){
+	switch (format){
+		case PIXEL_FORMAT_RGBA8:
+			return 4;
+		case PIXEL_FORMAT_RGBA16:
+			return 8;
+		case PIXEL_FORMAT_RGBA32F:
+			return 16;
+	}
+	return 0;
+}
+
+static void u8_to_u16(std::uint16_t *dst, const std::uint8_t *src, size_t n){
+	for (size_t i = 0; i < n; i++)
+		dst[i] = (std::uint16_t)(src[i] * 257);
+}
+
+static void u16_to_u8(std::uint8_t *dst, const std::uint16_t *src, size_t n){
+	// Rounds to nearest; exact inverse of u8_to_u16().
+	for (size_t i = 0; i < n; i++)
+		dst[i] = (std::uint8_t)((src[i] * 255u + 32895u) >> 16);
+}
+
+static void to_float(float *dst, const std::uint8_t *src, size_t n){
+	const float k = 1.f / 255.f;
+	for (size_t i = 0; i < n; i++)
+		dst[i] = src[i] * k;
+}
+
+static void to_float(float *dst, const std::uint16_t *src, size_t n){
+	const float k = 1.f / 65535.f;
+	for (size_t i = 0; i < n; i++)
+		dst[i] = src[i] * k;
+}
+
+// Clamps to [0; 1]. The order of the operands makes NaN come out as 0, which
+// keeps the conversions to integers that follow defined.
+static inline float saturate(float x){
+	return std::min(1.f, std::max(0.f, x));
+}
+
+static void from_float(std::uint8_t *dst, const float *src, size_t n){
+	for (size_t i = 0; i < n; i++)
+		dst[i] = (std::uint8_t)(saturate(src[i]) * 255.f + 0.5f);
+}
+
+static void from_float(std::uint16_t *dst, const float *src, size_t n){
+	for (size_t i = 0; i < n; i++)
+		dst[i] = (std::uint16_t)(saturate(src[i]) * 65535.f + 0.5f);
+}
+
+template <typename T>
+static void extract_channel(float *dst, const T *src, size_t count, unsigned channel, float scale){
+	for (size_t i = 0; i < count; i++)
+		dst[i] = src[i * 4 + channel] * scale;
+}
+
+template <typename T>
+static void extract_luma(float *dst, const T *src, size_t count, float scale){
+	const float r = 0.2126f * scale,
+		g = 0.7152f * scale,
+		b = 0.0722f * scale;
+	for (size_t i = 0; i < count; i++)
+		dst[i] = src[i * 4 + 0] * r + src[i * 4 + 1] * g + src[i * 4 + 2] * b;
+}
+
+template <typename T>
+static void insert_channel(T *dst, const float *src, size_t count, unsigned channel, float scale){
+	for (size_t i = 0; i < count; i++)
+		dst[i * 4 + channel] = (T)(saturate(src[i]) * scale + 0.5f);
+}
+
+static void insert_channel(float *dst, const float *src, size_t count, unsigned channel, float){
+	for (size_t i = 0; i < count; i++)
+		dst[i * 4 + channel] = src[i];
+}
+
+void extract_channel(float *dst, const void *src, pixel_format format, size_t count, image_channel channel){
+	switch (format){
+		case PIXEL_FORMAT_RGBA8:
+			if (channel == IMAGE_CHANNEL_LUMA)
+				extract_luma(dst, (const std::uint8_t *)src, count, 1.f / 255.f);
+			else
+				extract_channel(dst, (const std::uint8_t *)src, count, channel, 1.f / 255.f);
+			break;
+		case PIXEL_FORMAT_RGBA16:
+			if (channel == IMAGE_CHANNEL_LUMA)
+				extract_luma(dst, (const std::uint16_t *)src, count, 1.f / 65535.f);
+			else
+				extract_channel(dst, (const std::uint16_t *)src, count, channel, 1.f / 65535.f);
+			break;
+		case PIXEL_FORMAT_RGBA32F:
+			if (channel == IMAGE_CHANNEL_LUMA)
+				extract_luma(dst, (const float *)src, count, 1.f);
+			else
+				extract_channel(dst, (const float *)src, count, channel, 1.f);
+			break;
+	}
+}
+
+void insert_channel(void *dst, pixel_format format, const float *src, size_t count, image_channel channel){
+	if (channel == IMAGE_CHANNEL_LUMA){
+		for (int i = IMAGE_CHANNEL_RED; i <= IMAGE_CHANNEL_BLUE; i++)
+			insert_channel(dst, format, src, count, (image_channel)i);
+		return;
+	}
+	switch (format){
+		case PIXEL_FORMAT_RGBA8:
+			insert_channel((std::uint8_t *)dst, src, count, channel, 255.f);
+			break;
+		case PIXEL_FORMAT_RGBA16:
+			insert_channel((std::uint16_t *)dst, src, count, channel, 65535.f);
+			break;
+		case PIXEL_FORMAT_RGBA32F:
+			insert_channel((float *)dst, src, count, channel, 1.f);
+			break;
+	}
+}
+
+void convert_pixels(void *dst, pixel_format dst_format, const void *src, pixel_format src_format, size_t count){
+	auto n = count * 4;
+	if (dst_format == src_format){
+		memmove(dst, src, count * get_bytes_per_pixel(dst_format));
+		return;
+	}
+	switch (dst_format){
+		case PIXEL_FORMAT_RGBA8:
+			if (src_format == PIXEL_FORMAT_RGBA16)
+				u16_to_u8((std::uint8_t *)dst, (const std::uint16_t *)src, n);
+			else
+				from_float((std::uint8_t *)dst, (const float *)src, n);
+			break;
+		case PIXEL_FORMAT_RGBA16:
+			if (src_format == PIXEL_FORMAT_RGBA8)
+				u8_to_u16((std::uint16_t *)dst, (const std::uint8_t *)src, n);
+			else
+				from_float((std::uint16_t *)dst, (const float *)src, n);
+			break;
+		case PIXEL_FORMAT_RGBA32F:
+			if (src_format == PIXEL_FORMAT_RGBA8)
+				to_float((float *)dst, (const std::uint8_t *)src, n);
+			else
+				to_float((float *)dst, (const std::uint16_t *)src, n);
+			break;
+	}
+}
@@ -0,0 +1,26 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef PIXELFORMAT_H
+#define PIXELFORMAT_H
+
+#include "capi.h"
+#include <cstddef>
+
+bool is_valid_pixel_format(int format);
+unsigned get_bytes_per_pixel(pixel_format format);
+// Converts count pixels between two formats. The loops are kept free of
+// branches so that the compiler can vectorize them; this is the only place
+// where pixels change representation.
+void convert_pixels(void *dst, pixel_format dst_format, const void *src, pixel_format src_format, size_t count);
+// Gathers one channel of count pixels into floats in the range [0; 1].
+void extract_channel(float *dst, const void *src, pixel_format format, size_t count, image_channel channel);
+// Scatters floats in the range [0; 1] into one channel of count pixels. A luma
+// channel is written to red, green, and blue.
+void insert_channel(void *dst, pixel_format format, const float *src, size_t count, image_channel channel);
+
+#endif
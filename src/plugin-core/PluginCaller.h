@@ -0,0 +1,50 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef PLUGINCALLER_H
+#define PLUGINCALLER_H
+
+#include <QImage>
+#include <QString>
+#include <memory>
+#include <vector>
+
+struct AnimationFrame{
+	QImage image;
+	// In milliseconds.
+	int delay;
+};
+
+// Hands out the frames of an animation one at a time, so that they needn't
+// all be in memory at once.
+class FrameSource{
+public:
+	virtual ~FrameSource(){}
+	// The number of frames read() will return.
+	virtual int get_count() const = 0;
+	// Returns false once there are no more frames.
+	virtual bool read(AnimationFrame &) = 0;
+};
+
+// Whatever invokes a filter: a viewer window, or a headless host such as the
+// benchmark runner.
+class PluginCaller{
+public:
+	virtual ~PluginCaller(){}
+	virtual QImage get_image() const = 0;
+	virtual void display_filtered_image(const QImage &) = 0;
+	// The frames of the image, if it's animated. Otherwise, null, and the
+	// filter only gets get_image().
+	virtual std::unique_ptr<FrameSource> get_frames() const{
+		return nullptr;
+	}
+	virtual void display_filtered_animation(const std::vector<AnimationFrame> &){}
+	virtual void show_message_box(const QString &title, const QString &message, bool is_error) = 0;
+	virtual void show_compiler_error(const QString &message) = 0;
+};
+
+#endif
@@ -6,15 +6,17 @@ Distributed under a permissive license. See COPYING.txt for details.
 */
 
 #include "PluginCoreState.h"
-#include "../LoadedImage.h"
-#include "../MainWindow.h"
-#include "../ClangErrorMessage.hpp"
 #include "../GenericException.h"
+#include "Dither.h"
+#include "ParallelFor.h"
 #include <QFile>
 #include <QFileInfo>
-#include <QMessageBox>
 #include <QDir>
 #include <QCryptographicHash>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+#include <mutex>
 #ifdef WIN32
 #include <Windows.h>
 #undef min
@@ -42,28 +44,337 @@ bool is_lua_path(const QString &path){
 	return file_extension == "lua";
 }
 
-PluginCoreState::PluginCoreState(){
+static QThreadStorage<uintptr_t> current_frame;
+
+static PluginCoreState::FrameRun *get_current_frame(){
+	return (PluginCoreState::FrameRun *)current_frame.localData();
+}
+
+PluginCoreState::PluginCoreState(): lua_filter_is_pure(false){
+	this->precompilation_pool.setMaxThreadCount(1);
+}
+
+PluginCoreState::~PluginCoreState(){
+	this->cancel_precompilations();
+	this->precompilation_pool.waitForDone();
 }
 
 void PluginCoreState::execute(const QString &path){
+	TRACE_SCOPE("PluginCoreState::execute");
 	if (!QFile::exists(path))
 		throw GenericException("File not found.");
+	auto frames = this->get_caller()->get_frames();
+	this->profile.start_run(QFileInfo(path).fileName());
+	try{
+		if (frames && frames->get_count() > 1)
+			this->execute_frames(path, *frames);
+		else
+			this->execute_once(path);
+	}catch (...){
+		this->profile.finish_run();
+		throw;
+	}
+	this->finish_saves();
+	this->profile.finish_run();
+}
+
+// Background saves the filter never asked about would otherwise fail
+// silently, and their results would pile up from run to run.
+void PluginCoreState::finish_saves(){
+	const char *message;
+	if (!this->image_store.get_save_queue().wait_all(&message))
+		this->show_message_box(QString(), QString("An image couldn't be saved: ") + message, true);
+}
+
+void PluginCoreState::execute_once(const QString &path){
 	if (is_cpp_path(path))
 		this->execute_cpp(path);
 	if (is_lua_path(path))
 		this->execute_lua(path);
 }
 
+// Reads the next frame into run, as frame index, and its delay into dst.
+// Returns false if there are no more.
+static bool read_frame(FrameSource &frames, PluginCoreState::FrameRun &run, int index, AnimationFrame &dst){
+	AnimationFrame frame;
+	if (index >= frames.get_count() || !frames.read(frame))
+		return false;
+	run.index = index;
+	run.count = frames.get_count();
+	run.input = frame.image;
+	run.input_handle = -1;
+	run.failed = false;
+	dst.delay = frame.delay;
+	return true;
+}
+
+// Frames are read as they're needed and let go of as soon as they're done, so
+// besides the output, only the frames being filtered are in memory.
+void PluginCoreState::execute_frames(const QString &path, FrameSource &frames){
+	std::vector<AnimationFrame> output(frames.get_count());
+	auto complete = this->run_frames(path, frames, false, [&output](FrameRun &run, AnimationFrame &frame){
+		output[run.index] = frame;
+		// If a frame fails or displays nothing, the rest aren't run.
+		return !run.failed && !frame.image.isNull();
+	});
+	if (!complete)
+		return;
+	// In case the source had fewer frames than it said.
+	while (output.size() && output.back().image.isNull())
+		output.pop_back();
+	this->get_caller()->display_filtered_animation(output);
+}
+
+void PluginCoreState::execute_batch(const QString &path, FrameSource &images, const frame_sink &sink){
+	TRACE_SCOPE("PluginCoreState::execute_batch");
+	if (!QFile::exists(path))
+		throw GenericException("File not found.");
+	this->profile.start_run(QFileInfo(path).fileName());
+	try{
+		this->run_frames(path, images, true, sink);
+	}catch (...){
+		this->profile.finish_run();
+		throw;
+	}
+	this->finish_saves();
+	this->profile.finish_run();
+}
+
+// Returns false if the sink stopped the run.
+bool PluginCoreState::run_frames(const QString &path, FrameSource &frames, bool defer_messages, const frame_sink &sink){
+	FrameRun run;
+	run.defer_messages = defer_messages;
+	AnimationFrame frame;
+	// The first frame runs on its own. That's when the filter gets compiled,
+	// and when a Lua filter shows whether it's pure.
+	this->lua_filter_is_pure = false;
+	if (!read_frame(frames, run, 0, frame))
+		return true;
+	this->run_frame(path, run, frame);
+	if (!sink(run, frame))
+		return false;
+	if (is_lua_path(path) && this->lua_filter_is_pure)
+		return this->execute_lua_frames(path, frames, sink);
+	// Anything else may depend on the frames before, so they go in order.
+	for (int i = 1; read_frame(frames, run, i, frame); i++){
+		this->run_frame(path, run, frame);
+		if (!sink(run, frame))
+			return false;
+	}
+	return true;
+}
+
+// Returns false if the frame didn't display anything.
+bool PluginCoreState::run_frame(const QString &path, FrameRun &run, AnimationFrame &dst){
+	current_frame.setLocalData((uintptr_t)&run);
+	ImageStore::set_handle_log(&run.handles);
+	try{
+		this->execute_once(path);
+	}catch (...){
+		ImageStore::set_handle_log(nullptr);
+		current_frame.setLocalData(0);
+		this->finish_frame(run, dst);
+		throw;
+	}
+	ImageStore::set_handle_log(nullptr);
+	current_frame.setLocalData(0);
+	return this->finish_frame(run, dst);
+}
+
+// Moves the output of run into dst and lets go of everything else the frame
+// used. Returns false if there was no output.
+bool PluginCoreState::finish_frame(FrameRun &run, AnimationFrame &dst){
+	for (auto handle : run.handles)
+		this->image_store.unload(handle);
+	run.handles.clear();
+	run.input_handle = -1;
+	run.input = QImage();
+	dst.image = run.output;
+	run.output = QImage();
+	return !dst.image.isNull();
+}
+
+// Runs frames 1 and up of a pure Lua filter, each on whatever thread is free,
+// and each thread with a Lua state of its own. Returns false if the sink
+// stopped the run.
+bool PluginCoreState::execute_lua_frames(const QString &path, FrameSource &frames, const frame_sink &sink){
+	QFile file(path);
+	file.open(QFile::ReadOnly);
+	if (!file.isOpen())
+		throw GenericException("Unknown error while reading file.");
+	auto data = file.readAll();
+	auto filename = QFileInfo(path).fileName();
+	auto utf8_filename = filename.toUtf8();
+	auto key = this->lua_chunk_cache.compute_key(filename, data);
+	// Compiled when the first frame ran.
+	auto bytecode = this->lua_chunk_cache.get(key);
+	auto &chunk = bytecode.size() ? bytecode : data;
+
+	int remaining = frames.get_count() - 1;
+	int threads = parallel_for_threads(remaining);
+	std::vector<std::shared_ptr<LuaInterpreter>> interpreters;
+	interpreters.push_back(this->acquire_lua_interpreter(key));
+	while ((int)interpreters.size() < threads)
+		interpreters.push_back(this->acquire_lua_interpreter(QByteArray()));
+
+	std::vector<FrameRun> runs(threads);
+	// Guards frames, next and message.
+	std::mutex mutex;
+	int next = 1;
+	// The first message, by frame.
+	int message_frame = -1;
+	QString message;
+	std::atomic<bool> stopped(false);
+	auto execute = this->LuaInterpreter_execute;
+	auto delete_result = this->delete_LuaCallResult;
+	parallel_for(remaining, [&](int, int thread){
+		if (stopped)
+			return;
+		auto &run = runs[thread];
+		AnimationFrame frame;
+		{
+			// Frames are decoded in order, so they're read and numbered
+			// together.
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!read_frame(frames, run, next, frame))
+				return;
+			next++;
+		}
+		run.defer_messages = true;
+		current_frame.setLocalData((uintptr_t)&run);
+		ImageStore::set_handle_log(&run.handles);
+		CallResult result;
+		{
+			TRACE_SCOPE("LuaInterpreter_execute");
+			execute(&result, interpreters[thread].get(), utf8_filename.constData(), chunk.constData(), chunk.size());
+		}
+		if (!result.success)
+			run.failed = true;
+		delete_result(&result);
+		ImageStore::set_handle_log(nullptr);
+		current_frame.setLocalData(0);
+		this->finish_frame(run, frame);
+		if (!sink(run, frame))
+			stopped = true;
+		if (run.messages.size()){
+			std::lock_guard<std::mutex> lock(mutex);
+			if (message_frame < 0 || run.index < message_frame){
+				message_frame = run.index;
+				message = run.messages.front();
+			}
+			run.messages.clear();
+		}
+	}, threads);
+
+	if (message_frame >= 0)
+		this->show_message_box(QString(), message, true);
+	if (stopped)
+		return false;
+	this->release_lua_interpreter(key, interpreters[0]);
+	// Enough are kept for the next run to have one per core.
+	for (size_t i = 1; i < interpreters.size(); i++)
+		if ((int)this->idle_lua_interpreters.size() < QThread::idealThreadCount())
+			this->idle_lua_interpreters.push_back(interpreters[i]);
+	return true;
+}
+
 #define RESOLVE_FUNCTION(lib, x) auto x = (x##_f)lib.resolve(#x)
 #define RESOLVE_FUNCTION2(lib, x) this->x = (x##_f)lib.resolve(#x)
 
-void PluginCoreState::execute_lua(const QString &path){
-	if (!this->lua_library.isLoaded()){
-		this->lua_library.setFileName("LuaInterpreter");
-		this->lua_library.load();
-	}
+bool PluginCoreState::initialize_lua(){
+	TRACE_SCOPE("PluginCoreState::initialize_lua");
+	if (this->lua_library.isLoaded())
+		return true;
+	this->lua_library.setFileName("LuaInterpreter");
+	this->lua_library.load();
 	if (!this->lua_library.isLoaded())
+		return false;
+
+	RESOLVE_FUNCTION2(this->lua_library, new_LuaInterpreter);
+	RESOLVE_FUNCTION2(this->lua_library, delete_LuaInterpreter);
+	RESOLVE_FUNCTION2(this->lua_library, LuaInterpreter_execute);
+	RESOLVE_FUNCTION2(this->lua_library, delete_LuaCallResult);
+	RESOLVE_FUNCTION2(this->lua_library, LuaInterpreter_compile);
+	RESOLVE_FUNCTION(this->lua_library, LuaInterpreter_get_version);
+
+	// Without a version, there's no telling whether bytecode saved earlier
+	// came from this same interpreter.
+	if (!LuaInterpreter_get_version)
+		return true;
+	auto flavor = QByteArray(LuaInterpreter_get_version()) + " " + QByteArray::number((int)sizeof(void *) * 8) + "-bit";
+	this->lua_chunk_cache.set_flavor(flavor);
+	if (!this->cache_location.isEmpty())
+		this->lua_chunk_cache.set_location(this->cache_location + "lua/");
+	return true;
+}
+
+std::shared_ptr<LuaInterpreter> PluginCoreState::create_lua_interpreter(){
+	auto params = this->construct_LuaInterpreterParameters();
+	auto f = this->delete_LuaInterpreter;
+	return std::shared_ptr<LuaInterpreter>(this->new_LuaInterpreter(&params), [=](LuaInterpreter *i){ f(i); });
+}
+
+std::shared_ptr<LuaInterpreter> PluginCoreState::acquire_lua_interpreter(const QByteArray &key){
+	// Prefer the state that last ran this same script, since it keeps
+	// whatever traces LuaJIT compiled for it.
+	auto it = this->warm_lua_interpreters.find(key);
+	if (it != this->warm_lua_interpreters.end()){
+		auto ret = it->second.interpreter;
+		this->warm_lua_interpreters.erase(it);
+		return ret;
+	}
+	if (this->idle_lua_interpreters.size()){
+		auto ret = this->idle_lua_interpreters.back();
+		this->idle_lua_interpreters.pop_back();
+		return ret;
+	}
+	return this->create_lua_interpreter();
+}
+
+void PluginCoreState::release_lua_interpreter(const QByteArray &key, const std::shared_ptr<LuaInterpreter> &interpreter){
+	if (this->warm_lua_interpreters.size() >= max_warm_lua_interpreters){
+		auto oldest = this->warm_lua_interpreters.begin();
+		for (auto i = oldest; i != this->warm_lua_interpreters.end(); ++i)
+			if (i->second.last_use < oldest->second.last_use)
+				oldest = i;
+		this->warm_lua_interpreters.erase(oldest);
+	}
+	WarmLuaInterpreter warm;
+	warm.interpreter = interpreter;
+	warm.last_use = this->lua_use_counter++;
+	this->warm_lua_interpreters[key] = warm;
+}
+
+static void append_to_byte_array(void *ud, const void *data, size_t size){
+	((QByteArray *)ud)->append((const char *)data, (int)size);
+}
+
+static void discard_bytecode(void *, const void *, size_t){}
+
+QByteArray PluginCoreState::get_lua_bytecode(const QByteArray &key, LuaInterpreter *interpreter, const QString &filename, const QByteArray &source){
+	if (!this->LuaInterpreter_compile)
+		return QByteArray();
+	auto utf8 = filename.toUtf8();
+	// Compiling bytecode only loads it, so this checks that a chunk saved by
+	// an earlier run is still usable. If it isn't, it's dropped and the
+	// source is compiled again.
+	auto compile = this->LuaInterpreter_compile;
+	auto ret = this->lua_chunk_cache.get(key, [=, &utf8](const QByteArray &bytecode){
+		return compile(interpreter, utf8.constData(), bytecode.constData(), bytecode.size(), discard_bytecode, nullptr);
+	});
+	if (ret.size())
+		return ret;
+	if (!this->LuaInterpreter_compile(interpreter, utf8.constData(), source.constData(), source.size(), append_to_byte_array, &ret))
+		return QByteArray();
+	this->lua_chunk_cache.put(key, ret);
+	return ret;
+}
+
+void PluginCoreState::execute_lua(const QString &path){
+	if (!this->initialize_lua()){
+		this->show_message_box(QString(), "The Lua interpreter could not be loaded.", true);
 		return;
+	}
 	this->caller_image_handle = -1;
 	QFile file(path);
 	file.open(QFile::ReadOnly);
@@ -72,21 +383,35 @@ void PluginCoreState::execute_lua(const QString &path){
 	auto data = file.readAll();
 	
 	auto filename = QFileInfo(path).fileName();
+	auto key = this->lua_chunk_cache.compute_key(filename, data);
 
-	RESOLVE_FUNCTION(this->lua_library, new_LuaInterpreter);
-	RESOLVE_FUNCTION(this->lua_library, delete_LuaInterpreter);
-	RESOLVE_FUNCTION(this->lua_library, LuaInterpreter_execute);
-	RESOLVE_FUNCTION(this->lua_library, delete_LuaCallResult);
-
-	auto params = this->construct_LuaInterpreterParameters();
-	std::shared_ptr<LuaInterpreter> interpreter(new_LuaInterpreter(&params), [=](LuaInterpreter *i){ delete_LuaInterpreter(i); });
+	auto interpreter = this->acquire_lua_interpreter(key);
+	auto bytecode = this->get_lua_bytecode(key, interpreter.get(), filename, data);
+	// If the script doesn't compile, run the source anyway to get the error
+	// reported.
+	auto &chunk = bytecode.size() ? bytecode : data;
 
 	CallResult result;
-	LuaInterpreter_execute(&result, interpreter.get(), filename.toUtf8().toStdString().c_str(), data.data(), data.size());
-	delete_LuaCallResult(&result);
+	{
+		TRACE_SCOPE("LuaInterpreter_execute");
+		this->LuaInterpreter_execute(&result, interpreter.get(), filename.toUtf8().constData(), chunk.constData(), chunk.size());
+	}
+	if (result.success)
+		this->release_lua_interpreter(key, interpreter);
+	this->delete_LuaCallResult(&result);
+
+	// Prepare a state for the next script that isn't already warm.
+	if (!this->idle_lua_interpreters.size())
+		this->idle_lua_interpreters.push_back(this->create_lua_interpreter());
 }
 
 int PluginCoreState::get_caller_image_handle(){
+	auto run = get_current_frame();
+	if (run){
+		if (run->input_handle < 0)
+			run->input_handle = this->image_store.store(run->input);
+		return run->input_handle;
+	}
 	if (this->caller_image_handle >= 0)
 		return this->caller_image_handle;
 	return this->caller_image_handle = this->image_store.store(this->latest_caller->get_image());
@@ -97,28 +422,31 @@ void PluginCoreState::display_in_caller(int handle){
 }
 
 void PluginCoreState::display_in_caller(Image *image){
-	if (image)
-		this->latest_caller->display_filtered_image(std::make_shared<LoadedImage>(image->get_bitmap()));
+	if (!image)
+		return;
+	auto run = get_current_frame();
+	if (run){
+		run->output = image->get_snapshot();
+		return;
+	}
+	this->latest_caller->display_filtered_image(image->get_bitmap());
 }
 
-char *clone_string(const char *s){
-	if (!s)
-		return nullptr;
-	auto n = strlen(s);
-	auto ret = new char[n + 1];
-	memcpy(ret, s, n);
-	ret[n] = 0;
-	return ret;
+void PluginCoreState::get_frame_info(int &index, int &count){
+	auto run = get_current_frame();
+	index = run ? run->index : 0;
+	count = run ? run->count : 1;
 }
 
-char *clone_string(const std::string &s){
-	auto n = s.size();
-	if (!n)
-		return nullptr;
-	auto ret = new char[n + 1];
-	memcpy(ret, &s[0], n);
-	ret[n] = 0;
-	return ret;
+void PluginCoreState::show_message_box(const QString &title, const QString &message, bool is_error){
+	auto run = get_current_frame();
+	if (run && is_error)
+		run->failed = true;
+	if (run && run->defer_messages){
+		run->messages.push_back(message);
+		return;
+	}
+	this->get_caller()->show_message_box(title, message, is_error);
 }
 
 ImageOperationResultExternal to_ImageOperationResultExternal(const ImageOperationResult &src){
@@ -126,7 +454,7 @@ ImageOperationResultExternal to_ImageOperationResultExternal(const ImageOperatio
 	ret.success = src.success;
 	static_assert(sizeof(ret.results) == sizeof(src.results), "Inconsistent struct definitions!");
 	memcpy(ret.results, src.results, sizeof(ret.results));
-	ret.message = clone_string(src.message);
+	ret.message = src.message;
 	return ret;
 }
 
@@ -134,18 +462,9 @@ namespace lua_implementations{
 #define LUA_FUNCTION_SIGNATURE(rt, x, ...) rt x(external_state state, __VA_ARGS__)
 #define LUA_FUNCTION_SIGNATURE0(rt, x) rt x(external_state state)
 
-LUA_FUNCTION_SIGNATURE(void, release_returned_string, char *s){
-	delete[] s;
-}
-
 LUA_FUNCTION_SIGNATURE(void, show_message_box, const char *title, const char *message, bool is_error){
-	QMessageBox msgbox;
-	if (title)
-		msgbox.setWindowTitle(QString::fromUtf8(title));
-	msgbox.setText(QString::fromUtf8(message));
-	if (is_error)
-		msgbox.setIcon(QMessageBox::Critical);
-	msgbox.exec();
+	auto This = (PluginCoreState *)state;
+	This->show_message_box(title ? QString::fromUtf8(title) : QString(), QString::fromUtf8(message), is_error);
 }
 
 LUA_FUNCTION_SIGNATURE(ImageOperationResultExternal, get_image_info, int handle, image_info *info){
@@ -154,7 +473,7 @@ LUA_FUNCTION_SIGNATURE(ImageOperationResultExternal, get_image_info, int handle,
 	auto image = This->get_store().get_image(handle);
 	if (!image){
 		ret.success = false;
-		ret.message = clone_string(HANDLE_NOT_FOUND_MSG);
+		ret.message = HANDLE_NOT_FOUND_MSG;
 		return ret;
 	}
 	info->handle = handle;
@@ -162,6 +481,7 @@ LUA_FUNCTION_SIGNATURE(ImageOperationResultExternal, get_image_info, int handle,
 	info->pixels = image->get_pixels_pointer(stride, pitch);
 	info->stride = stride;
 	info->pitch = pitch;
+	info->format = image->get_format();
 	auto temp = image->get_dimensions();
 	info->w = temp.results[0];
 	info->h = temp.results[1];
@@ -179,20 +499,75 @@ LUA_FUNCTION_SIGNATURE(ImageOperationResultExternal, unload_image, int handle){
 	return to_ImageOperationResultExternal(This->get_store().unload(handle));
 }
 
-LUA_FUNCTION_SIGNATURE(ImageOperationResultExternal, allocate_image, int w, int h){
+LUA_FUNCTION_SIGNATURE(ImageOperationResultExternal, allocate_image, int w, int h, pixel_format format){
+	auto This = (PluginCoreState *)state;
+	return to_ImageOperationResultExternal(This->get_store().allocate(w, h, format));
+}
+
+LUA_FUNCTION_SIGNATURE(ImageOperationResultExternal, convert_image_format, int handle, pixel_format format){
+	ImageOperationResultExternal ret;
 	auto This = (PluginCoreState *)state;
-	return to_ImageOperationResultExternal(This->get_store().allocate(w, h));
+	auto image = This->get_store().get_image(handle);
+	if (!image){
+		ret.success = false;
+		ret.message = HANDLE_NOT_FOUND_MSG;
+	}else if (!image->convert_format(format)){
+		ret.success = false;
+		ret.message = "Image could not be converted.";
+	}
+	return ret;
 }
 
-LUA_FUNCTION_SIGNATURE(ImageOperationResultExternal, save_image, int handle, const char *path, int compression, const char *format){
+LUA_FUNCTION_SIGNATURE(ImageOperationResultExternal, dither_image, int handle, const dither_options *options){
+	ImageOperationResultExternal ret;
 	auto This = (PluginCoreState *)state;
-	SaveOptions opt;
-	opt.compression = compression;
+	auto image = This->get_store().get_image(handle);
+	if (!image){
+		ret.success = false;
+		ret.message = HANDLE_NOT_FOUND_MSG;
+		return ret;
+	}
+	ret.message = dither(*image, *options);
+	ret.success = !ret.message;
+	return ret;
+}
+
+static SaveOptions to_SaveOptions(int compression, const char *format, int parallel, bool fast){
+	SaveOptions ret;
+	ret.compression = compression;
 	if (format)
-		opt.format = format;
+		ret.format = format;
+	if (parallel >= 0)
+		ret.parallel = parallel ? Trinary::True : Trinary::False;
+	ret.fast = fast;
+	return ret;
+}
+
+LUA_FUNCTION_SIGNATURE(ImageOperationResultExternal, save_image, int handle, const char *path, int compression, const char *format, int parallel, bool fast){
+	auto This = (PluginCoreState *)state;
+	auto opt = to_SaveOptions(compression, format, parallel, fast);
 	return to_ImageOperationResultExternal(This->get_store().save(handle, QString::fromUtf8(path), opt));
 }
 
+LUA_FUNCTION_SIGNATURE(ImageOperationResultExternal, save_image_async, int handle, const char *path, int compression, const char *format, int parallel, bool fast){
+	auto This = (PluginCoreState *)state;
+	auto opt = to_SaveOptions(compression, format, parallel, fast);
+	return to_ImageOperationResultExternal(This->get_store().save_async(handle, QString::fromUtf8(path), opt));
+}
+
+LUA_FUNCTION_SIGNATURE(ImageOperationResultExternal, get_save_status, int ticket, bool wait){
+	auto This = (PluginCoreState *)state;
+	auto &queue = This->get_store().get_save_queue();
+	ImageOperationResult ret;
+	if (ticket <= 0)
+		ret.results[0] = queue.wait_all() ? SAVE_SUCCEEDED : SAVE_FAILED;
+	else if (wait)
+		ret.results[0] = queue.wait(ticket, &ret.message);
+	else
+		ret.results[0] = queue.poll(ticket, &ret.message);
+	return to_ImageOperationResultExternal(ret);
+}
+
 LUA_FUNCTION_SIGNATURE0(int, get_caller_image){
 	auto This = (PluginCoreState *)state;
 	return This->get_caller_image_handle();
@@ -203,6 +578,28 @@ LUA_FUNCTION_SIGNATURE(void, display_in_current_window, int handle){
 	This->display_in_caller(handle);
 }
 
+LUA_FUNCTION_SIGNATURE0(ImageOperationResultExternal, get_frame_info){
+	auto This = (PluginCoreState *)state;
+	ImageOperationResult ret;
+	This->get_frame_info(ret.results[0], ret.results[1]);
+	return to_ImageOperationResultExternal(ret);
+}
+
+LUA_FUNCTION_SIGNATURE0(void, report_pure_filter){
+	auto This = (PluginCoreState *)state;
+	This->report_pure_filter();
+}
+
+LUA_FUNCTION_SIGNATURE(void, begin_phase, const char *name){
+	auto This = (PluginCoreState *)state;
+	This->get_profile().begin_phase(name);
+}
+
+LUA_FUNCTION_SIGNATURE0(void, end_phase){
+	auto This = (PluginCoreState *)state;
+	This->get_profile().end_phase();
+}
+
 LUA_FUNCTION_SIGNATURE(void, debug_print, const char *string){
 #ifdef WIN32
 	auto temp = QString::fromUtf8(string);
@@ -216,16 +613,23 @@ LuaInterpreterParameters PluginCoreState::construct_LuaInterpreterParameters(){
 	LuaInterpreterParameters ret;
 	ret.state = this;
 #define PASS_FUNCTION_TO_LUA(x) ret.x = lua_implementations::x
-	PASS_FUNCTION_TO_LUA(release_returned_string);
 	PASS_FUNCTION_TO_LUA(show_message_box);
 	PASS_FUNCTION_TO_LUA(get_image_info);
 	PASS_FUNCTION_TO_LUA(load_image);
 	PASS_FUNCTION_TO_LUA(unload_image);
 	PASS_FUNCTION_TO_LUA(allocate_image);
+	PASS_FUNCTION_TO_LUA(convert_image_format);
+	PASS_FUNCTION_TO_LUA(dither_image);
 	PASS_FUNCTION_TO_LUA(save_image);
+	PASS_FUNCTION_TO_LUA(save_image_async);
+	PASS_FUNCTION_TO_LUA(get_save_status);
 	PASS_FUNCTION_TO_LUA(get_caller_image);
 	PASS_FUNCTION_TO_LUA(display_in_current_window);
+	PASS_FUNCTION_TO_LUA(get_frame_info);
+	PASS_FUNCTION_TO_LUA(report_pure_filter);
 	PASS_FUNCTION_TO_LUA(debug_print);
+	PASS_FUNCTION_TO_LUA(begin_phase);
+	PASS_FUNCTION_TO_LUA(end_phase);
 
 	return ret;
 }
@@ -273,6 +677,10 @@ CPP_FUNCTION_SIGNATURE(bool, get_file_sha1, const char *path, unsigned char *buf
 
 }
 
+PluginCoreState *get_current_cpp_state(){
+	return (PluginCoreState *)cpp_implementations::tls.localData();
+}
+
 void *PluginCoreState::get_image_pointer(){
 	return this->image_store.get_image(this->get_caller_image_handle()).get();
 }
@@ -280,7 +688,8 @@ void *PluginCoreState::get_image_pointer(){
 CppInterpreterParameters PluginCoreState::construct_CppInterpreterParameters(){
 	CppInterpreterParameters ret;
 	ret.state = this;
-	ret.caller_image = this->get_image_pointer();
+	// The image is passed with CppInterpreter_reset_imag() before every run.
+	ret.caller_image = nullptr;
 #define PASS_FUNCTION_TO_CPP(x) ret.x = cpp_implementations::x
 	PASS_FUNCTION_TO_CPP(release_returned_string);
 	PASS_FUNCTION_TO_CPP(store_tls);
@@ -299,27 +708,105 @@ void PluginCoreState::execute_cpp(const QString &path){
 		if (!file.isOpen())
 			throw GenericException("Unknown error while reading file.");
 	}
-	if (this->cpp_interpreter){
-		this->execute_cpp_ready(path);
+	if (!this->initialize_cpp()){
+		this->show_message_box(QString(), "The C++ interpreter could not be loaded.", true);
 		return;
 	}
+	this->execute_cpp_ready(path);
+}
+
+bool PluginCoreState::initialize_cpp(){
+	TRACE_SCOPE("PluginCoreState::initialize_cpp");
+	if (this->cpp_interpreter)
+		return true;
 	if (!this->cpp_library.isLoaded()){
 		this->cpp_library.setFileName("CppInterpreter");
 		this->cpp_library.load();
 	}
 	if (!this->cpp_library.isLoaded())
-		return;
+		return false;
 
 	RESOLVE_FUNCTION(this->cpp_library, new_CppInterpreter);
 	RESOLVE_FUNCTION(this->cpp_library, delete_CppInterpreter);
 	RESOLVE_FUNCTION2(this->cpp_library, CppInterpreter_execute);
 	RESOLVE_FUNCTION2(this->cpp_library, delete_CppCallResult);
 	RESOLVE_FUNCTION2(this->cpp_library, CppInterpreter_reset_imag);
+	RESOLVE_FUNCTION2(this->cpp_library, CppInterpreter_compile);
 
 	auto params = this->construct_CppInterpreterParameters();
 	this->cpp_interpreter.reset(new_CppInterpreter(&params), [=](CppInterpreter *i){ delete_CppInterpreter(i); });
+	return true;
+}
 
-	this->execute_cpp_ready(path);
+void PluginCoreState::precompile_cpp(const QString &path){
+	if (!is_cpp_path(path) || !this->initialize_cpp() || !this->CppInterpreter_compile)
+		return;
+	auto interpreter = this->cpp_interpreter;
+	auto compile = this->CppInterpreter_compile;
+	auto delete_result = this->delete_CppCallResult;
+	auto parameter = QDir::toNativeSeparators(path).toUtf8().toStdString();
+	QtConcurrent::run(&this->precompilation_pool, [=](){
+		QThread::currentThread()->setPriority(QThread::LowestPriority);
+		TRACE_SCOPE("CppInterpreter_compile");
+		CallResult result;
+		compile(&result, interpreter.get(), parameter.c_str());
+		delete_result(&result);
+	});
+}
+
+void PluginCoreState::cancel_precompilations(){
+	this->precompilation_pool.clear();
+}
+
+bool PluginCoreState::load_interpreter(const QString &path){
+	if (is_cpp_path(path))
+		return this->initialize_cpp();
+	if (!is_lua_path(path) || !this->initialize_lua())
+		return false;
+	// Creating a state is part of loading, not of compiling.
+	if (!this->idle_lua_interpreters.size())
+		this->idle_lua_interpreters.push_back(this->create_lua_interpreter());
+	return true;
+}
+
+bool PluginCoreState::compile(const QString &path, QString &error_message){
+	if (!this->load_interpreter(path)){
+		error_message = "The interpreter could not be loaded.";
+		return false;
+	}
+	if (is_cpp_path(path)){
+		if (!this->CppInterpreter_compile)
+			return true;
+		CallResult result;
+		auto parameter = QDir::toNativeSeparators(path).toUtf8().toStdString();
+		this->CppInterpreter_compile(&result, this->cpp_interpreter.get(), parameter.c_str());
+		bool ret = result.success;
+		if (!ret)
+			error_message = QString::fromUtf8(result.error_message);
+		this->delete_CppCallResult(&result);
+		return ret;
+	}
+	QFile file(path);
+	file.open(QFile::ReadOnly);
+	if (!file.isOpen()){
+		error_message = "Unknown error while reading file.";
+		return false;
+	}
+	auto data = file.readAll();
+	auto filename = QFileInfo(path).fileName();
+	auto key = this->lua_chunk_cache.compute_key(filename, data);
+	if (!this->LuaInterpreter_compile)
+		return true;
+	// Always from source, since a chunk cached by an earlier run would
+	// only measure the cache.
+	auto interpreter = this->acquire_lua_interpreter(key);
+	auto utf8 = filename.toUtf8();
+	QByteArray bytecode;
+	bool ret = this->LuaInterpreter_compile(interpreter.get(), utf8.constData(), data.constData(), data.size(), append_to_byte_array, &bytecode);
+	if (ret)
+		this->lua_chunk_cache.put(key, bytecode);
+	this->release_lua_interpreter(key, interpreter);
+	return ret;
 }
 
 void PluginCoreState::execute_cpp_ready(const QString &path){
@@ -331,12 +818,12 @@ void PluginCoreState::execute_cpp_ready(const QString &path){
 
 	CallResult result;
 	auto parameter = QDir::toNativeSeparators(path).toUtf8().toStdString();
-	this->CppInterpreter_execute(&result, this->cpp_interpreter.get(), parameter.c_str());
-	if (!result.success){
-		ClangErrorMessage msgbox;
-		msgbox.set_error_message(QString::fromUtf8(result.error_message));
-		msgbox.exec();
+	{
+		TRACE_SCOPE("CppInterpreter_execute");
+		this->CppInterpreter_execute(&result, this->cpp_interpreter.get(), parameter.c_str());
 	}
+	if (!result.success)
+		this->get_caller()->show_compiler_error(QString::fromUtf8(result.error_message));
 	this->delete_CppCallResult(&result);
 
 	this->cpp_tls.resize(this->cpp_tls_size);
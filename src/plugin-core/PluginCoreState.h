@@ -12,37 +12,132 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include <memory>
 #include <cassert>
 #include <QLibrary>
+#include <QString>
 #include <QThreadStorage>
+#include <QThreadPool>
 #include "Lua/main.h"
 #include "Cpp/main.h"
-
-class QString;
-class MainWindow;
+#include "PluginCaller.h"
+#include "FilterProfile.h"
+#include "LuaChunkCache.h"
+#include <map>
+#include <atomic>
+#include <functional>
 
 class PluginCoreState{
-	MainWindow *latest_caller = nullptr;
+public:
+	// One frame of an animation going through a filter. While a frame runs,
+	// the caller's image is the frame, and whatever the filter displays is
+	// kept as the frame's output. Every thread reuses a single one from
+	// frame to frame.
+	struct FrameRun{
+		int index;
+		int count;
+		QImage input;
+		int input_handle;
+		QImage output;
+		// Images created while the frame ran. They're unloaded once it's
+		// done.
+		std::vector<int> handles;
+		// Frames running off the GUI thread can't show message boxes; their
+		// messages are kept until all frames are done.
+		bool defer_messages;
+		std::vector<QString> messages;
+		// Set if the filter failed or showed an error while the frame ran.
+		bool failed;
+		FrameRun(): index(0), count(1), input_handle(-1), defer_messages(false), failed(false){}
+	};
+	// Gets every frame as soon as it's done, with what the filter displayed
+	// (if anything) in frame. May be called from several threads at once.
+	// Returning false stops the filter from running on the rest.
+	typedef std::function<bool(FrameRun &, AnimationFrame &frame)> frame_sink;
+private:
+	PluginCaller *latest_caller = nullptr;
 	ImageStore image_store;
+	FilterProfile profile;
 	QLibrary lua_library;
 	QLibrary cpp_library;
+	QString cache_location;
+	LuaChunkCache lua_chunk_cache;
+	std::vector<std::shared_ptr<LuaInterpreter>> idle_lua_interpreters;
+	struct WarmLuaInterpreter{
+		std::shared_ptr<LuaInterpreter> interpreter;
+		unsigned long long last_use;
+	};
+	std::map<QByteArray, WarmLuaInterpreter> warm_lua_interpreters;
+	unsigned long long lua_use_counter = 0;
+	static const size_t max_warm_lua_interpreters = 4;
+	new_LuaInterpreter_f new_LuaInterpreter = nullptr;
+	delete_LuaInterpreter_f delete_LuaInterpreter = nullptr;
+	LuaInterpreter_execute_f LuaInterpreter_execute = nullptr;
+	delete_LuaCallResult_f delete_LuaCallResult = nullptr;
+	LuaInterpreter_compile_f LuaInterpreter_compile = nullptr;
 	std::vector<void *> cpp_tls;
 	size_t cpp_tls_size;
 	int caller_image_handle = -1;
+	std::atomic<bool> lua_filter_is_pure;
 	std::shared_ptr<CppInterpreter> cpp_interpreter;
 	void (*CppInterpreter_execute)(CallResult *, CppInterpreter *, const char *);
 	void (*delete_CppCallResult)(CallResult *);
 	void (*CppInterpreter_reset_imag)(CppInterpreter *, external_state);
+	CppInterpreter_compile_f CppInterpreter_compile = nullptr;
+	// Runs background compilations. Declared after cpp_interpreter so that it
+	// is destroyed (and waited on) first.
+	QThreadPool precompilation_pool;
 
+	bool initialize_lua();
+	bool initialize_cpp();
+	std::shared_ptr<LuaInterpreter> create_lua_interpreter();
+	std::shared_ptr<LuaInterpreter> acquire_lua_interpreter(const QByteArray &key);
+	void release_lua_interpreter(const QByteArray &key, const std::shared_ptr<LuaInterpreter> &);
+	QByteArray get_lua_bytecode(const QByteArray &key, LuaInterpreter *, const QString &filename, const QByteArray &source);
+	void execute_once(const QString &);
+	void execute_frames(const QString &, FrameSource &);
+	bool run_frames(const QString &, FrameSource &, bool defer_messages, const frame_sink &);
+	bool run_frame(const QString &, FrameRun &, AnimationFrame &dst);
+	bool execute_lua_frames(const QString &, FrameSource &, const frame_sink &);
+	bool finish_frame(FrameRun &, AnimationFrame &dst);
 	void execute_lua(const QString &);
 	void execute_cpp(const QString &);
 	void execute_cpp_ready(const QString &);
+	void finish_saves();
 	void *get_image_pointer();
 public:
 	PluginCoreState();
-	void set_current_caller(MainWindow *mw){
-		this->latest_caller = mw;
+	~PluginCoreState();
+	// Location for persistent caches. May be left empty.
+	void set_cache_location(const QString &path){
+		this->cache_location = path;
+	}
+	// Returns the previous caller.
+	PluginCaller *set_current_caller(PluginCaller *caller){
+		auto ret = this->latest_caller;
+		this->latest_caller = caller;
+		return ret;
 	}
 	void execute(const QString &path);
-	MainWindow *get_caller() const{
+	// Runs a filter on a sequence of unrelated images, like the frames of an
+	// animation, except that the output goes to sink instead of the caller,
+	// and messages are always kept in the FrameRun for the sink to show.
+	void execute_batch(const QString &path, FrameSource &images, const frame_sink &sink);
+	// Queues a C++ filter for compilation on a low priority thread, so that
+	// a later execute() finds it already compiled. Errors are ignored here
+	// and reported when the filter is actually run.
+	void precompile_cpp(const QString &path);
+	// Discards queued compilations that haven't started yet.
+	void cancel_precompilations();
+	// For benchmarks, so that loading and compiling can be timed apart from
+	// running. Loads the interpreter a filter needs; returns false if it
+	// can't be loaded.
+	bool load_interpreter(const QString &path);
+	// Compiles a filter on the calling thread, without running it, so that
+	// the next execute() finds it compiled. Returns false if it doesn't
+	// compile; the error, if there's one to give, goes in error_message.
+	bool compile(const QString &path, QString &error_message);
+	FilterProfile &get_profile(){
+		return this->profile;
+	}
+	PluginCaller *get_caller() const{
 		assert(!!this->latest_caller);
 		return this->latest_caller;
 	}
@@ -52,13 +147,20 @@ public:
 	LuaInterpreterParameters construct_LuaInterpreterParameters();
 	CppInterpreterParameters construct_CppInterpreterParameters();
 	int get_caller_image_handle();
+	// For still images, the index is 0 and the count is 1.
+	void get_frame_info(int &index, int &count);
+	void report_pure_filter(){
+		this->lua_filter_is_pure = true;
+	}
 	void display_in_caller(int handle);
 	void display_in_caller(Image *img);
+	void show_message_box(const QString &title, const QString &message, bool is_error);
 	void store_tls(void *);
 	void *retrieve_tls();
 };
 
 bool is_cpp_path(const QString &);
+PluginCoreState *get_current_cpp_state();
 extern const char * const accepted_cpp_extensions[];
 extern const size_t accepted_cpp_extensions_size;
 
@@ -0,0 +1,121 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "SaveQueue.h"
+#include "capi.h"
+#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+
+static const char * const unknown_ticket_message = "Unknown ticket.";
+
+SaveQueue::SaveQueue(): dropped_failure(nullptr), next_ticket(1){
+	auto threads = std::max(QThread::idealThreadCount(), 1);
+	this->pool.setMaxThreadCount(threads);
+	this->max_pending = threads * 2;
+}
+
+SaveQueue::~SaveQueue(){
+	this->pool.waitForDone();
+}
+
+// Moves the results of finished saves out of pending. Called with the mutex
+// held.
+void SaveQueue::collect_finished(){
+	for (auto it = this->pending.begin(); it != this->pending.end();){
+		if (!it->second.isFinished()){
+			++it;
+			continue;
+		}
+		this->finished[it->first] = it->second.result();
+		it = this->pending.erase(it);
+	}
+	while (this->finished.size() > max_finished){
+		auto oldest = this->finished.begin();
+		if (!this->dropped_failure)
+			this->dropped_failure = oldest->second;
+		this->finished.erase(oldest);
+	}
+}
+
+int SaveQueue::enqueue(const job_t &job){
+	std::unique_lock<std::mutex> lock(this->mutex);
+	while (true){
+		this->collect_finished();
+		if ((int)this->pending.size() < this->max_pending)
+			break;
+		auto oldest = this->pending.begin()->second;
+		lock.unlock();
+		oldest.waitForFinished();
+		lock.lock();
+	}
+	int ret = this->next_ticket++;
+	// Wrap around before the ticket overflows.
+	if (this->next_ticket <= 0)
+		this->next_ticket = 1;
+	this->pending[ret] = QtConcurrent::run(&this->pool, job);
+	return ret;
+}
+
+int SaveQueue::poll(int ticket, const char **message){
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto it = this->pending.find(ticket);
+		if (it != this->pending.end() && !it->second.isFinished())
+			return SAVE_PENDING;
+	}
+	return this->wait(ticket, message);
+}
+
+int SaveQueue::wait(int ticket, const char **message){
+	const char *result = unknown_ticket_message;
+	QFuture<const char *> future;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto it = this->pending.find(ticket);
+		if (it != this->pending.end()){
+			future = it->second;
+			this->pending.erase(it);
+		}else{
+			auto it2 = this->finished.find(ticket);
+			if (it2 != this->finished.end()){
+				result = it2->second;
+				this->finished.erase(it2);
+			}
+		}
+	}
+	// Default-constructed futures are canceled, and hold no result.
+	if (!future.isCanceled())
+		result = future.result();
+	if (message)
+		*message = result;
+	return result ? SAVE_FAILED : SAVE_SUCCEEDED;
+}
+
+bool SaveQueue::wait_all(const char **message){
+	std::map<int, QFuture<const char *>> pending;
+	std::map<int, const char *> finished;
+	const char *failure;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		pending.swap(this->pending);
+		finished.swap(this->finished);
+		failure = this->dropped_failure;
+		this->dropped_failure = nullptr;
+	}
+	for (auto &p : finished)
+		if (!failure)
+			failure = p.second;
+	for (auto &p : pending){
+		auto result = p.second.result();
+		if (!failure)
+			failure = result;
+	}
+	if (message)
+		*message = failure;
+	return !failure;
+}
@@ -0,0 +1,53 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef SAVEQUEUE_H
+#define SAVEQUEUE_H
+
+#include <QFuture>
+#include <QThreadPool>
+#include <map>
+#include <mutex>
+#include <functional>
+
+// Runs saves on a pool of its own, so that filters that write
+// many outputs don't wait on the encoder. Every save gets a ticket that can
+// be polled or waited on for the result. The number of saves in progress is
+// bounded; past it, enqueue() waits for the oldest one. So is the number of
+// results kept for tickets nobody has asked about; past it, the oldest are
+// dropped, and only whether any of them failed is remembered.
+class SaveQueue{
+	QThreadPool pool;
+	std::mutex mutex;
+	// Results are messages with static storage duration, or null on success.
+	std::map<int, QFuture<const char *>> pending;
+	std::map<int, const char *> finished;
+	// The first failure among the results dropped from finished.
+	const char *dropped_failure;
+	int next_ticket;
+	int max_pending;
+	static const size_t max_finished = 1024;
+
+	void collect_finished();
+public:
+	// Returns null on success, otherwise a message with static storage duration.
+	typedef std::function<const char *()> job_t;
+
+	SaveQueue();
+	~SaveQueue();
+	// Whatever the job writes from must not be written to by anyone else; see
+	// Image::get_snapshot(). Returns a positive ticket.
+	int enqueue(const job_t &job);
+	// Return a save_status. A ticket is forgotten once its result is returned.
+	int poll(int ticket, const char **message = nullptr);
+	int wait(int ticket, const char **message = nullptr);
+	// Waits for every save in progress. Returns false if any of the saves not
+	// yet waited on failed, and the first such failure in message.
+	bool wait_all(const char **message = nullptr);
+};
+
+#endif
@@ -0,0 +1,174 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "Trace.h"
+#include <QCoreApplication>
+#include <QThread>
+#include <QStringList>
+#include <QFile>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstring>
+
+bool trace_enabled = false;
+
+std::uint64_t get_monotonic_clock_ns(){
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+static const char trace_flag[] = "--trace=";
+
+namespace{
+
+struct TraceEvent{
+	std::string name;
+	// 'X' (complete), 'B' or 'E'.
+	char phase;
+	int tid;
+	std::uint64_t start,
+		duration;
+};
+
+std::mutex trace_mutex;
+std::vector<TraceEvent> trace_events;
+std::map<std::thread::id, int> trace_threads;
+std::vector<std::string> trace_thread_names;
+QString trace_path;
+std::uint64_t trace_origin;
+
+// trace_mutex must be held.
+int get_trace_tid(){
+	auto id = std::this_thread::get_id();
+	auto it = trace_threads.find(id);
+	if (it != trace_threads.end())
+		return it->second;
+	int ret = (int)trace_threads.size() + 1;
+	trace_threads[id] = ret;
+	auto app = QCoreApplication::instance();
+	auto thread = QThread::currentThread();
+	std::string name;
+	if (app && thread == app->thread())
+		name = "GUI";
+	else if (thread && !thread->objectName().isEmpty())
+		name = thread->objectName().toStdString();
+	else
+		name = "Thread " + std::to_string(ret);
+	trace_thread_names.push_back(name);
+	return ret;
+}
+
+void add_trace_event(const std::string &name, char phase, std::uint64_t start, std::uint64_t end){
+	std::lock_guard<std::mutex> lock(trace_mutex);
+	TraceEvent event;
+	event.name = name;
+	event.phase = phase;
+	event.tid = get_trace_tid();
+	event.start = start;
+	event.duration = end - start;
+	trace_events.push_back(event);
+}
+
+QByteArray to_json_string(const std::string &s){
+	QByteArray ret = "\"";
+	for (unsigned char c : s){
+		if (c == '"' || c == '\\'){
+			ret += '\\';
+			ret += (char)c;
+		}else if (c < 0x20)
+			ret += QByteArray("\\u00") + QByteArray::number(c, 16).rightJustified(2, '0');
+		else
+			ret += (char)c;
+	}
+	ret += '"';
+	return ret;
+}
+
+QByteArray to_microseconds(std::uint64_t ns){
+	return QByteArray::number(ns / 1000.0, 'f', 3);
+}
+
+}
+
+void trace_initialize(int argc, char **argv){
+	QString path;
+	for (int i = 1; i < argc && path.isEmpty(); i++)
+		if (!strncmp(argv[i], trace_flag, sizeof(trace_flag) - 1))
+			path = QString::fromLocal8Bit(argv[i] + sizeof(trace_flag) - 1);
+	if (path.isEmpty())
+		path = QString::fromLocal8Bit(qgetenv("BORDERLESS_TRACE"));
+	if (path.isEmpty())
+		return;
+	trace_path = path;
+	trace_origin = get_monotonic_clock_ns();
+	trace_enabled = true;
+	trace_set_thread_name("GUI");
+}
+
+void trace_strip_arguments(QStringList &args){
+	for (int i = args.size(); i--;)
+		if (args[i].startsWith(trace_flag))
+			args.removeAt(i);
+}
+
+void trace_set_thread_name(const char *name){
+	if (!trace_enabled)
+		return;
+	std::lock_guard<std::mutex> lock(trace_mutex);
+	trace_thread_names[get_trace_tid() - 1] = name;
+}
+
+void trace_complete(const char *name, std::uint64_t start_ns, std::uint64_t end_ns){
+	add_trace_event(name, 'X', start_ns, end_ns);
+}
+
+void trace_begin(const std::string &name){
+	if (!trace_enabled)
+		return;
+	auto now = get_monotonic_clock_ns();
+	add_trace_event(name, 'B', now, now);
+}
+
+void trace_end(){
+	if (!trace_enabled)
+		return;
+	auto now = get_monotonic_clock_ns();
+	add_trace_event(std::string(), 'E', now, now);
+}
+
+void trace_write(){
+	if (!trace_enabled)
+		return;
+	std::lock_guard<std::mutex> lock(trace_mutex);
+	QFile file(trace_path);
+	if (!file.open(QFile::WriteOnly | QFile::Truncate))
+		return;
+	auto pid = QByteArray::number(QCoreApplication::applicationPid());
+	QByteArray json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	json += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":0,\"args\":{\"name\":\"Borderless\"}}";
+	for (size_t i = 0; i < trace_thread_names.size(); i++){
+		json += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":" + QByteArray::number((int)i + 1);
+		json += ",\"args\":{\"name\":" + to_json_string(trace_thread_names[i]) + "}}";
+	}
+	file.write(json);
+	for (auto &event : trace_events){
+		json = ",\n{\"ph\":\"";
+		json += event.phase;
+		json += "\",\"pid\":" + pid + ",\"tid\":" + QByteArray::number(event.tid);
+		json += ",\"ts\":" + to_microseconds(event.start - trace_origin);
+		if (event.phase != 'E')
+			json += ",\"name\":" + to_json_string(event.name);
+		if (event.phase == 'X')
+			json += ",\"dur\":" + to_microseconds(event.duration);
+		json += "}";
+		file.write(json);
+	}
+	file.write("\n]}\n");
+}
@@ -0,0 +1,53 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <string>
+
+class QStringList;
+
+std::uint64_t get_monotonic_clock_ns();
+
+// Tracing is off unless it's turned on with --trace=<file> on the command line
+// or with the BORDERLESS_TRACE environment variable. While it's off, a
+// TRACE_SCOPE costs a test of trace_enabled on the way in and on the way out.
+// The trace is written on exit as Chrome trace JSON, which chrome://tracing
+// and Perfetto can open.
+extern bool trace_enabled;
+
+// Must be called before any other thread is started.
+void trace_initialize(int argc, char **argv);
+// Removes --trace=<file> from a list of arguments.
+void trace_strip_arguments(QStringList &);
+void trace_set_thread_name(const char *name);
+// name must have static storage duration.
+void trace_complete(const char *name, std::uint64_t start_ns, std::uint64_t end_ns);
+// For zones whose names are only known at run time. Must be balanced on each
+// thread.
+void trace_begin(const std::string &name);
+void trace_end();
+void trace_write();
+
+class TraceScope{
+	const char *name;
+	std::uint64_t start;
+public:
+	TraceScope(const char *name): name(name), start(trace_enabled ? get_monotonic_clock_ns() : 0){}
+	~TraceScope(){
+		if (trace_enabled)
+			trace_complete(this->name, this->start, get_monotonic_clock_ns());
+	}
+};
+
+#define TRACE_CONCATENATE2(x, y) x##y
+#define TRACE_CONCATENATE(x, y) TRACE_CONCATENATE2(x, y)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCATENATE(trace_scope_, __LINE__)(name)
+
+#endif
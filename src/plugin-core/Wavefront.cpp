@@ -0,0 +1,128 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "Wavefront.h"
+#include "ParallelFor.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+namespace{
+
+class WavefrontJob{
+	int w, h, tile_w, tile_h,
+		tiles_x, tiles_y;
+	std::vector<wavefront_dependency> dependencies;
+	wavefront_callback callback;
+	void *user_data;
+	// Number of unfinished tiles each tile is waiting on.
+	std::unique_ptr<std::atomic<int>[]> pending;
+	std::mutex mutex;
+	std::condition_variable ready_cv;
+	std::deque<int> ready;
+
+	int count_dependencies(int tx, int ty) const;
+	void push_ready(int tile);
+public:
+	WavefrontJob(int w, int h, int tile_w, int tile_h, const std::vector<wavefront_dependency> &dependencies, wavefront_callback callback, void *user_data);
+	void process_next();
+	void run();
+};
+
+WavefrontJob::WavefrontJob(int w, int h, int tile_w, int tile_h, const std::vector<wavefront_dependency> &dependencies, wavefront_callback callback, void *user_data):
+		w(w),
+		h(h),
+		tile_w(tile_w),
+		tile_h(tile_h),
+		dependencies(dependencies),
+		callback(callback),
+		user_data(user_data){
+	this->tiles_x = (w + tile_w - 1) / tile_w;
+	this->tiles_y = (h + tile_h - 1) / tile_h;
+	int n = this->tiles_x * this->tiles_y;
+	this->pending.reset(new std::atomic<int>[n]);
+	for (int i = 0; i < n; i++){
+		int count = this->count_dependencies(i % this->tiles_x, i / this->tiles_x);
+		this->pending[i] = count;
+		if (!count)
+			this->ready.push_back(i);
+	}
+}
+
+int WavefrontJob::count_dependencies(int tx, int ty) const{
+	int ret = 0;
+	for (auto &d : this->dependencies){
+		int x = tx + d.dx,
+			y = ty + d.dy;
+		ret += x >= 0 && x < this->tiles_x && y >= 0 && y < this->tiles_y;
+	}
+	return ret;
+}
+
+void WavefrontJob::push_ready(int tile){
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->ready.push_back(tile);
+	}
+	this->ready_cv.notify_one();
+}
+
+// Waits for a tile to become ready and processes it.
+void WavefrontJob::process_next(){
+	int tile;
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		while (!this->ready.size())
+			this->ready_cv.wait(lock);
+		tile = this->ready.front();
+		this->ready.pop_front();
+	}
+
+	int tx = tile % this->tiles_x,
+		ty = tile / this->tiles_x;
+	int x0 = tx * this->tile_w,
+		y0 = ty * this->tile_h;
+	this->callback(this->user_data, x0, y0, std::min(x0 + this->tile_w, this->w), std::min(y0 + this->tile_h, this->h));
+
+	// The dependents of a tile are at the opposite offsets.
+	for (auto &d : this->dependencies){
+		int x = tx - d.dx,
+			y = ty - d.dy;
+		if (x < 0 || x >= this->tiles_x || y < 0 || y >= this->tiles_y)
+			continue;
+		int dependent = x + y * this->tiles_x;
+		if (!--this->pending[dependent])
+			this->push_ready(dependent);
+	}
+}
+
+void WavefrontJob::run(){
+	// One call per tile, so every call gets one. A call only waits while
+	// another one is still processing a tile, which will make more ready.
+	parallel_for(this->tiles_x * this->tiles_y, [this](int, int){ this->process_next(); });
+}
+
+}
+
+const char *schedule_wavefront(int w, int h, int tile_w, int tile_h, const wavefront_dependency *stencil, int stencil_size, wavefront_callback callback, void *user_data){
+	if (!callback)
+		return "No callback given.";
+	if (w < 1 || h < 1)
+		return nullptr;
+	if (tile_w <= 0)
+		tile_w = default_wavefront_tile_w;
+	if (tile_h <= 0)
+		tile_h = default_wavefront_tile_h;
+	std::vector<wavefront_dependency> dependencies;
+	if (!get_tile_dependencies(dependencies, stencil, stencil_size, tile_w, tile_h))
+		return "The stencil can't be scheduled with the given tile size.";
+	WavefrontJob job(w, h, tile_w, tile_h, dependencies, callback, user_data);
+	job.run();
+	return nullptr;
+}
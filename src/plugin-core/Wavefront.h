@@ -0,0 +1,57 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "capi.h"
+#include <vector>
+#include <algorithm>
+
+static const int default_wavefront_tile_w = 64;
+static const int default_wavefront_tile_h = 1;
+
+// Translates a stencil of pixel dependencies into the offsets of the tiles a
+// tile depends on. Returns false if some dependency isn't causal, or if two
+// tiles would depend on each other (e.g. (x + 1, y - 1) with tiles more than
+// one pixel tall). Free of Qt, so that the interpreters can share it.
+inline bool get_tile_dependencies(std::vector<wavefront_dependency> &dst, const wavefront_dependency *stencil, int stencil_size, int tile_w, int tile_h){
+	dst.clear();
+	if (tile_w < 1 || tile_h < 1 || stencil_size < 0)
+		return false;
+	// Rounds towards negative infinity.
+	auto div = [](int a, int b){
+		return a >= 0 ? a / b : -((-a + b - 1) / b);
+	};
+	for (int i = 0; i < stencil_size; i++){
+		auto d = stencil[i];
+		if (d.dy > 0 || (!d.dy && d.dx >= 0))
+			return false;
+		for (int ty = div(d.dy, tile_h); ty <= div(tile_h - 1 + d.dy, tile_h); ty++){
+			for (int tx = div(d.dx, tile_w); tx <= div(tile_w - 1 + d.dx, tile_w); tx++){
+				if (!tx && !ty)
+					continue;
+				if (ty > 0 || (!ty && tx > 0))
+					return false;
+				bool found = false;
+				for (auto &e : dst)
+					found |= e.dx == tx && e.dy == ty;
+				if (!found){
+					wavefront_dependency dep = { tx, ty };
+					dst.push_back(dep);
+				}
+			}
+		}
+	}
+	return true;
+}
+
+// See run_wavefront() in capi.h. Returns nullptr on success, otherwise a
+// message with static storage duration.
+const char *schedule_wavefront(int w, int h, int tile_w, int tile_h, const wavefront_dependency *stencil, int stencil_size, wavefront_callback callback, void *user_data);
+
+#endif
@@ -8,9 +8,10 @@ Distributed under a permissive license. See COPYING.txt for details.
 #include "capi.h"
 #include "ImageStore.h"
 #include "PluginCoreState.h"
-#include <QtWidgets/QMessageBox>
-#include <ctime>
+#include "Dither.h"
+#include "Wavefront.h"
 #include <sstream>
+#include <iostream>
 #ifdef WIN32
 #include <Windows.h>
 #endif
@@ -23,6 +24,10 @@ EXPORT_C Image *allocate_image(PluginCoreState *state, int w, int h){
 	return state->get_store().allocate_image(w, h);
 }
 
+EXPORT_C Image *allocate_image_with_format(PluginCoreState *state, int w, int h, pixel_format format){
+	return state->get_store().allocate_image(w, h, format);
+}
+
 EXPORT_C Image *clone_image(Image *){
 	return nullptr;
 }
@@ -48,6 +53,41 @@ EXPORT_C u8 *get_image_pixel_data(Image *image, int *stride, int *pitch){
 	return ret;
 }
 
+EXPORT_C pixel_format get_image_format(Image *image){
+	return image->get_format();
+}
+
+EXPORT_C int convert_image_format(Image *image, pixel_format format){
+	return image->convert_format(format);
+}
+
+EXPORT_C float *get_image_plane(Image *image, image_channel channel, int writable, int *pitch){
+	unsigned temp;
+	auto ret = image->get_plane(channel, !!writable, temp);
+	*pitch = temp;
+	return ret;
+}
+
+EXPORT_C void commit_image_planes(Image *image){
+	image->commit_planes();
+}
+
+EXPORT_C void release_image_planes(Image *image){
+	image->release_planes();
+}
+
+EXPORT_C void get_default_dither_options(dither_options *options){
+	get_default_dither_options(*options);
+}
+
+EXPORT_C int dither_image(Image *image, const dither_options *options){
+	return !dither(*image, *options);
+}
+
+EXPORT_C int run_wavefront(int w, int h, int tile_w, int tile_h, const wavefront_dependency *stencil, int stencil_size, wavefront_callback callback, void *user_data){
+	return !schedule_wavefront(w, h, tile_w, tile_h, stencil, stencil_size, callback, user_data);
+}
+
 
 EXPORT_C Image *get_displayed_image(PluginCoreState *state){
 	auto handle = state->get_caller_image_handle();
@@ -58,6 +98,15 @@ EXPORT_C void display_in_current_window(PluginCoreState *state, Image *image){
 	state->display_in_caller(image);
 }
 
+EXPORT_C void get_frame_info(PluginCoreState *state, int *index, int *count){
+	int i, n;
+	state->get_frame_info(i, n);
+	if (index)
+		*index = i;
+	if (count)
+		*count = n;
+}
+
 EXPORT_C void rgb_to_hsv(u8_quad *, u8_quad){
 }
 
@@ -75,18 +124,42 @@ EXPORT_C void debug_print(const char *){
 }
 
 EXPORT_C void show_message_box(const char *string){
-	QMessageBox msgbox;
-	msgbox.setText(QString::fromUtf8(string));
-	msgbox.exec();
+	auto state = get_current_cpp_state();
+	// Only the thread running the filter knows which state it belongs to.
+	if (!state){
+		std::cerr << "show_message_box() called outside of a filter run: " << string << std::endl;
+		return;
+	}
+	state->show_message_box(QString(), QString::fromUtf8(string), false);
 }
 
 EXPORT_C int save_image(Image *image, const char *path){
-	image->save(QString::fromUtf8(path), SaveOptions());
-	return false;
+	return image->save(QString::fromUtf8(path), SaveOptions()).success;
+}
+
+EXPORT_C int save_image_async(Image *image, const char *path){
+	auto result = image->save_async(QString::fromUtf8(path), SaveOptions());
+	return result.success ? result.results[0] : 0;
+}
+
+EXPORT_C int poll_saved_image(PluginCoreState *state, int ticket){
+	return state->get_store().get_save_queue().poll(ticket);
+}
+
+EXPORT_C int wait_for_saved_image(PluginCoreState *state, int ticket){
+	return state->get_store().get_save_queue().wait(ticket);
+}
+
+EXPORT_C int wait_for_saved_images(PluginCoreState *state){
+	return state->get_store().get_save_queue().wait_all();
 }
 
 EXPORT_C double borderless_clock(){
-	return clock() / (double)CLOCKS_PER_SEC;
+	return get_monotonic_clock_ns() * 1e-9;
+}
+
+EXPORT_C unsigned long long borderless_clock_ns(){
+	return get_monotonic_clock_ns();
 }
 
 EXPORT_C char *double_to_string(double x){
@@ -102,3 +175,11 @@ EXPORT_C char *double_to_string(double x){
 EXPORT_C void release_double_to_string(char *s){
 	delete[] s;
 }
+
+EXPORT_C void borderless_begin_phase(PluginCoreState *state, const char *name){
+	state->get_profile().begin_phase(name);
+}
+
+EXPORT_C void borderless_end_phase(PluginCoreState *state){
+	state->get_profile().end_phase();
+}
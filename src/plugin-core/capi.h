@@ -36,12 +36,94 @@ struct u8_quad{
 
 typedef struct u8_quad u8_quad;
 
+/* Pixel formats. Channels are always stored in RGBA order, and the stride of
+   an image is the size of a pixel in bytes (4, 8, or 16, respectively). */
+enum pixel_format{
+	PIXEL_FORMAT_RGBA8 = 0,
+	/* Unsigned 16-bit integers. */
+	PIXEL_FORMAT_RGBA16 = 1,
+	/* 32-bit floats. Nominally in the range [0; 1], but not clamped until the
+	   image is converted or displayed. */
+	PIXEL_FORMAT_RGBA32F = 2
+};
+
+typedef enum pixel_format pixel_format;
+
+/* Planes that can be requested with get_image_plane(). */
+enum image_channel{
+	IMAGE_CHANNEL_RED = 0,
+	IMAGE_CHANNEL_GREEN = 1,
+	IMAGE_CHANNEL_BLUE = 2,
+	IMAGE_CHANNEL_ALPHA = 3,
+	/* Rec. 709 luma of the red, green, and blue channels. */
+	IMAGE_CHANNEL_LUMA = 4
+};
+
+typedef enum image_channel image_channel;
+
+/* Results of asynchronous saves. */
+enum save_status{
+	SAVE_PENDING = -1,
+	SAVE_FAILED = 0,
+	SAVE_SUCCEEDED = 1
+};
+
+typedef enum save_status save_status;
+
+/* Algorithms accepted by dither_image(). */
+enum dither_algorithm{
+	DITHER_FLOYD_STEINBERG = 0,
+	DITHER_JARVIS = 1,
+	DITHER_STUCKI = 2,
+	DITHER_ATKINSON = 3,
+	/* Ordered dither with an 8x8 Bayer matrix. */
+	DITHER_BAYER = 4
+};
+
+typedef enum dither_algorithm dither_algorithm;
+
+#define DITHER_MAX_PALETTE_SIZE 256
+
+struct dither_options{
+	dither_algorithm algorithm;
+	/* Number of evenly spaced levels per channel, at least 2. Ignored if a
+	   palette is given. */
+	int levels;
+	/* Optional palette of up to DITHER_MAX_PALETTE_SIZE colors. Every pixel
+	   is replaced with the nearest color of the palette. Alpha is ignored. */
+	const u8_quad *palette;
+	int palette_size;
+	/* If nonzero, the luma of the image is dithered and written to red,
+	   green, and blue. Otherwise each color channel is dithered. */
+	int grayscale;
+	/* If nonzero, error diffusion alternates direction every row. This
+	   removes most directional artifacts, but since each row then depends on
+	   the whole of the previous one, it also limits parallelism. */
+	int serpentine;
+	/* Maximum number of threads. Zero uses one per core. */
+	int threads;
+};
+
+typedef struct dither_options dither_options;
+
+/* A pixel dependency of a filter: pixel (x, y) reads the result of pixel
+   (x + dx, y + dy). */
+struct wavefront_dependency{
+	int dx, dy;
+};
+
+typedef struct wavefront_dependency wavefront_dependency;
+
+/* Processes the pixels in [x0; x1) x [y0; y1), in raster order. */
+typedef void (*wavefront_callback)(void *user_data, int x0, int y0, int x1, int y1);
+
 /* Note: Paths must be UTF-8 strings.*/
 
 /* Image constructors. */
 
 EXPORT_C Image *load_image(PluginCoreState *state, const char *path);
 EXPORT_C Image *allocate_image(PluginCoreState *state, int w, int h);
+EXPORT_C Image *allocate_image_with_format(PluginCoreState *state, int w, int h, pixel_format format);
 EXPORT_C Image *clone_image(Image *image);
 EXPORT_C Image *clone_image_without_data(Image *image);
 EXPORT_C void unload_image(Image *image);
@@ -50,12 +132,75 @@ EXPORT_C void unload_image(Image *image);
 /* Image property accessors. */
 
 EXPORT_C void get_image_dimensions(Image *image, int *w, int *h);
+/* The data should be reinterpreted according to the format of the image. */
 EXPORT_C u8 *get_image_pixel_data(Image *image, int *stride, int *pitch);
+EXPORT_C pixel_format get_image_format(Image *image);
+/* Converts the image in place. Pointers previously returned by
+   get_image_pixel_data() become invalid. Returns zero on failure.
+   Converting a freshly loaded image to PIXEL_FORMAT_RGBA16 or
+   PIXEL_FORMAT_RGBA32F preserves the full precision of the file, where the
+   Qt version in use is able to decode it. */
+EXPORT_C int convert_image_format(Image *image, pixel_format format);
+
+
+/* Planar access. */
+
+/* Returns a single channel of the image as a separate array of floats in the
+   range [0; 1], regardless of the format of the image. pitch receives the size
+   of a row in elements. The plane is built from the pixels the first time it's
+   requested and kept with the image. If writable is nonzero, the plane will be
+   written back to the pixels when committed.
+   The pointer remains valid until release_image_planes() is called or the
+   image is unloaded. get_image_pixel_data() and convert_image_format() commit
+   the planes and stop writing them back; call get_image_plane() again (it
+   returns the same pointer) to refresh a plane from the pixels before using
+   it again. */
+EXPORT_C float *get_image_plane(Image *image, image_channel channel, int writable, int *pitch);
+/* Writes every writable plane back into the pixels of the image, in a single
+   pass. A luma plane is written to the red, green, and blue channels. Nothing
+   is done unless a writable plane was requested since the last commit.
+   Planes are also committed automatically before the image is displayed or
+   saved. Planes remain valid after a commit. */
+EXPORT_C void commit_image_planes(Image *image);
+/* Commits the planes and frees them. Every pointer returned by
+   get_image_plane() for this image becomes invalid. */
+EXPORT_C void release_image_planes(Image *image);
+
+
+/* Dithering. */
+
+/* Fills options with the defaults: Floyd-Steinberg to 2 levels of luma, not
+   serpentine, on every core. */
+EXPORT_C void get_default_dither_options(dither_options *options);
+/* Dithers the image in place, in any format. Alpha is preserved. Error
+   diffusion runs as a wavefront, with each row following the one above it on
+   another thread. Returns zero on failure. */
+EXPORT_C int dither_image(Image *image, const dither_options *options);
+
+
+/* Wavefront scheduling. */
+
+/* Divides a w x h area into tiles of tile_w x tile_h pixels (64 x 1 if zero)
+   and calls callback once for every tile, on every core, such that a tile only
+   starts once all the tiles it depends on through the stencil have finished.
+   This allows filters whose pixels depend on already processed neighbors
+   (error diffusion, recursive filters) to run in parallel, as a diagonal
+   wavefront.
+   Every dependency must come before its pixel in raster order (dy < 0, or
+   dy == 0 and dx < 0). Returns zero if the stencil isn't causal, or if it
+   can't be scheduled with the given tiles; e.g. (x + 1, y - 1) requires tiles
+   one pixel tall. The callback may be called from any thread, including the
+   calling one, and shouldn't call the display functions. */
+EXPORT_C int run_wavefront(int w, int h, int tile_w, int tile_h, const wavefront_dependency *stencil, int stencil_size, wavefront_callback callback, void *user_data);
 
 
 /* Image display functions. */
 EXPORT_C Image *get_displayed_image(PluginCoreState *state);
 EXPORT_C void display_in_current_window(PluginCoreState *state, Image *image);
+/* When the displayed image is animated, the filter runs once per frame, and
+   the displayed image is the frame being filtered. Passes its index and the
+   number of frames; for still images, 0 and 1. */
+EXPORT_C void get_frame_info(PluginCoreState *state, int *index, int *count);
 
 /* Utility functions. */
 
@@ -65,11 +210,41 @@ EXPORT_C void debug_print(const char *string);
 EXPORT_C void show_message_box(const char *string);
 
 
-/* Miscellaneous functions. */
+/* Saving. */
 
+/* Encodes and writes the image before returning. Returns zero on failure. */
 EXPORT_C int save_image(Image *image, const char *path);
+/* Takes a snapshot of the image and returns a ticket for it at once, while the
+   snapshot is encoded and written on a background thread. The image may be
+   modified or unloaded right away. The snapshot shares the pixels of images
+   that haven't been accessed since they were loaded, and is a copy otherwise.
+   Returns zero on failure. */
+EXPORT_C int save_image_async(Image *image, const char *path);
+/* Return a save_status. Once a ticket's result has been returned, the ticket
+   is no longer valid. Only the results of the latest 1024 finished saves are
+   kept for tickets that haven't been asked about; older tickets are unknown.
+   When the filter returns, it waits for every save in progress, and a failure
+   nobody asked about is shown as an error. */
+EXPORT_C int poll_saved_image(PluginCoreState *state, int ticket);
+EXPORT_C int wait_for_saved_image(PluginCoreState *state, int ticket);
+/* Waits for every save in progress. Returns zero if any of those not yet
+   waited on failed. */
+EXPORT_C int wait_for_saved_images(PluginCoreState *state);
+
+
+/* Miscellaneous functions. */
+
+/* Monotonic wall clock. Only differences between two readings are meaningful. */
 EXPORT_C double borderless_clock();
+EXPORT_C unsigned long long borderless_clock_ns();
 EXPORT_C char *double_to_string(double);
 EXPORT_C void release_double_to_string(char *);
 
+
+/* Profiling functions. Phases may be nested, and are shown in the timing
+   breakdown of the run once the filter finishes. */
+
+EXPORT_C void borderless_begin_phase(PluginCoreState *state, const char *name);
+EXPORT_C void borderless_end_phase(PluginCoreState *state);
+
 #endif
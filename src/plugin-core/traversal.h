@@ -0,0 +1,212 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#ifndef TRAVERSAL_H
+#define TRAVERSAL_H
+
+/* Orders in which the pixels of an image may be visited. */
+enum traversal_order{
+	/* Left to right, top to bottom. */
+	TRAVERSAL_RASTER = 0,
+	/* Like raster, but odd rows are visited right to left. */
+	TRAVERSAL_SERPENTINE = 1,
+	/* Along anti-diagonals, alternating direction, starting at the top left
+	   corner. Same order as zig_zag_order() in the Lua API. */
+	TRAVERSAL_ZIGZAG = 2,
+	/* Hilbert curve inside square tiles, tiles in raster order. */
+	TRAVERSAL_HILBERT = 3,
+	/* Z-order curve inside square tiles, tiles in raster order. */
+	TRAVERSAL_MORTON = 4
+};
+
+typedef enum traversal_order traversal_order;
+
+#ifdef __cplusplus
+
+// Generates the coordinates of every pixel of a w x h image, each exactly once,
+// in the given order. Header-only so that the core, the Lua interpreter, and
+// the C++ runtime library share the same definition.
+class TraversalGenerator{
+	int w, h;
+	traversal_order order;
+	int x, y;
+	bool started,
+		finished;
+	// Curve orders.
+	int tile_size,
+		tile_x,
+		tile_y,
+		tile_index;
+	// Zig-zag order.
+	int diagonal;
+
+	static const int max_tile_size = 64;
+
+	static void hilbert_to_xy(int n, int d, int &x, int &y){
+		x = y = 0;
+		for (int s = 1; s < n; s *= 2){
+			int rx = 1 & (d / 2);
+			int ry = 1 & (d ^ rx);
+			if (!ry){
+				if (rx){
+					x = s - 1 - x;
+					y = s - 1 - y;
+				}
+				int t = x;
+				x = y;
+				y = t;
+			}
+			x += s * rx;
+			y += s * ry;
+			d /= 4;
+		}
+	}
+	static int compact_bits(unsigned v){
+		v &= 0x55555555;
+		v = (v | (v >> 1)) & 0x33333333;
+		v = (v | (v >> 2)) & 0x0F0F0F0F;
+		v = (v | (v >> 4)) & 0x00FF00FF;
+		v = (v | (v >> 8)) & 0x0000FFFF;
+		return (int)v;
+	}
+	bool next_raster(){
+		if (!this->started)
+			return this->x = 0, this->y = 0, true;
+		if (++this->x < this->w)
+			return true;
+		this->x = 0;
+		return ++this->y < this->h;
+	}
+	bool next_serpentine(){
+		if (!this->started)
+			return this->x = 0, this->y = 0, true;
+		bool leftwards = this->y % 2 != 0;
+		this->x += leftwards ? -1 : 1;
+		if (this->x >= 0 && this->x < this->w)
+			return true;
+		if (++this->y >= this->h)
+			return false;
+		this->x = leftwards ? 0 : this->w - 1;
+		return true;
+	}
+	void start_diagonal(){
+		int low = this->diagonal - (this->w - 1);
+		int high = this->diagonal < this->h - 1 ? this->diagonal : this->h - 1;
+		if (low < 0)
+			low = 0;
+		this->y = this->diagonal % 2 ? low : high;
+		this->x = this->diagonal - this->y;
+	}
+	bool next_zigzag(){
+		if (!this->started){
+			this->diagonal = 0;
+			this->start_diagonal();
+			return true;
+		}
+		if (this->diagonal % 2){
+			// Down and to the left.
+			if (this->x > 0 && this->y < this->h - 1){
+				this->x--;
+				this->y++;
+				return true;
+			}
+		}else{
+			// Up and to the right.
+			if (this->y > 0 && this->x < this->w - 1){
+				this->x++;
+				this->y--;
+				return true;
+			}
+		}
+		if (++this->diagonal > this->w + this->h - 2)
+			return false;
+		this->start_diagonal();
+		return true;
+	}
+	bool next_curve(){
+		if (!this->started){
+			this->tile_x = this->tile_y = 0;
+			this->tile_index = -1;
+		}
+		while (true){
+			if (++this->tile_index >= this->tile_size * this->tile_size){
+				this->tile_index = 0;
+				this->tile_x += this->tile_size;
+				if (this->tile_x >= this->w){
+					this->tile_x = 0;
+					this->tile_y += this->tile_size;
+					if (this->tile_y >= this->h)
+						return false;
+				}
+			}
+			int x, y;
+			if (this->order == TRAVERSAL_HILBERT)
+				hilbert_to_xy(this->tile_size, this->tile_index, x, y);
+			else{
+				x = compact_bits((unsigned)this->tile_index);
+				y = compact_bits((unsigned)this->tile_index >> 1);
+			}
+			x += this->tile_x;
+			y += this->tile_y;
+			// Tiles on the right and bottom edges may be partially outside.
+			if (x < this->w && y < this->h){
+				this->x = x;
+				this->y = y;
+				return true;
+			}
+		}
+	}
+public:
+	TraversalGenerator(int w, int h, traversal_order order = TRAVERSAL_RASTER): w(w), h(h), order(order){
+		// Sized after the shorter side, so that thin images don't spend most of
+		// the time skipping over coordinates that fall outside.
+		int side = w < h ? w : h;
+		this->tile_size = 1;
+		while (this->tile_size < max_tile_size && this->tile_size < side)
+			this->tile_size *= 2;
+		this->reset();
+	}
+	void reset(){
+		this->x = this->y = 0;
+		this->started = false;
+		this->finished = this->w <= 0 || this->h <= 0;
+	}
+	// Produces the next coordinates. Returns false once every pixel has been
+	// visited.
+	bool next(int &x, int &y){
+		if (this->finished)
+			return false;
+		bool ret;
+		switch (this->order){
+			case TRAVERSAL_SERPENTINE:
+				ret = this->next_serpentine();
+				break;
+			case TRAVERSAL_ZIGZAG:
+				ret = this->next_zigzag();
+				break;
+			case TRAVERSAL_HILBERT:
+			case TRAVERSAL_MORTON:
+				ret = this->next_curve();
+				break;
+			default:
+				ret = this->next_raster();
+				break;
+		}
+		this->started = true;
+		if (!ret){
+			this->finished = true;
+			return false;
+		}
+		x = this->x;
+		y = this->y;
+		return true;
+	}
+};
+
+#endif
+
+#endif
@@ -17,6 +17,7 @@ MainSettings::MainSettings(){
 	this->set_zoom_mode_for_new_windows(ZoomMode::Normal);
 	this->set_fullscreen_zoom_mode_for_new_windows(ZoomMode::AutoFit);
 	this->set_save_state_on_exit(true);
+	this->set_precompile_cpp_filters(false);
 }
 
 bool MainSettings::operator==(const MainSettings &other) const{
@@ -29,5 +30,6 @@ bool MainSettings::operator==(const MainSettings &other) const{
 	CHECK_EQUALITY(fullscreen_zoom_mode_for_new_windows);
 	CHECK_EQUALITY(keep_application_in_background);
 	CHECK_EQUALITY(save_state_on_exit);
+	CHECK_EQUALITY(precompile_cpp_filters);
 	return true;
 }
@@ -8,6 +8,7 @@ DEFINE_ENUM_INLINE_SETTER_GETTER(ZoomMode, zoom_mode_for_new_windows)
 DEFINE_ENUM_INLINE_SETTER_GETTER(ZoomMode, fullscreen_zoom_mode_for_new_windows)
 DEFINE_INLINE_SETTER_GETTER(keep_application_in_background)
 DEFINE_INLINE_SETTER_GETTER(save_state_on_exit)
+DEFINE_INLINE_SETTER_GETTER(precompile_cpp_filters)
 bool operator==(const MainSettings &other) const;
 bool operator!=(const MainSettings &other) const{
 	return !(*this == other);
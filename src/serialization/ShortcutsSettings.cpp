@@ -28,6 +28,7 @@ DEFINE_COMMAND_INTERNAL_NAME(minimize_all);
 DEFINE_COMMAND_INTERNAL_NAME(next);
 DEFINE_COMMAND_INTERNAL_NAME(quit);
 DEFINE_COMMAND_INTERNAL_NAME(quit2);
+DEFINE_COMMAND_INTERNAL_NAME(redo_filter);
 DEFINE_COMMAND_INTERNAL_NAME(reset_zoom);
 DEFINE_COMMAND_INTERNAL_NAME(right);
 DEFINE_COMMAND_INTERNAL_NAME(right_big);
@@ -38,6 +39,7 @@ DEFINE_COMMAND_INTERNAL_NAME(rotate_right_fine);
 DEFINE_COMMAND_INTERNAL_NAME(show_options);
 DEFINE_COMMAND_INTERNAL_NAME(toggle_fullscreen);
 DEFINE_COMMAND_INTERNAL_NAME(toggle_lock_zoom);
+DEFINE_COMMAND_INTERNAL_NAME(undo_filter);
 DEFINE_COMMAND_INTERNAL_NAME(up);
 DEFINE_COMMAND_INTERNAL_NAME(up_big);
 DEFINE_COMMAND_INTERNAL_NAME(zoom_in);
@@ -77,6 +79,8 @@ std::map<QString, ShortcutInfo> get_default_shortcuts() {
 	SETUP_DEFAULT_SHORTCUT1("Minimize all windows", minimize_all_command, "Shift+M");
 	SETUP_DEFAULT_SHORTCUT1("Rotate left", rotate_left_command, "L");
 	SETUP_DEFAULT_SHORTCUT1("Rotate right", rotate_right_command, "R");
+	SETUP_DEFAULT_SHORTCUT1("Undo filter", undo_filter_command, "Ctrl+Z");
+	SETUP_DEFAULT_SHORTCUT1("Redo filter", redo_filter_command, "Ctrl+Y");
 	return ret;
 }
 
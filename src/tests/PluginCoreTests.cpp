@@ -0,0 +1,297 @@
+/*
+Copyright (c), Helios
+All rights reserved.
+
+Distributed under a permissive license. See COPYING.txt for details.
+*/
+
+#include "plugin-core/Dither.h"
+#include "plugin-core/ImageStore.h"
+#include "plugin-core/ParallelEncoder.h"
+#include <QCoreApplication>
+#include <QFile>
+#include <QImage>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <vector>
+#ifdef WIN32
+#include <QtZlib/zlib.h>
+#else
+#include <zlib.h>
+#endif
+
+static int failures = 0;
+
+static void check(bool ok, const char *expression, const char *file, int line){
+	if (ok)
+		return;
+	std::cerr << file << ":" << line << ": check failed: " << expression << std::endl;
+	failures++;
+}
+
+#define CHECK(x) check(!!(x), #x, __FILE__, __LINE__)
+
+// A horizontal gray ramp, so that every palette color is needed somewhere.
+static QImage make_gray_ramp(int w, int h){
+	QImage ret(w, h, QImage::Format_ARGB32);
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++){
+			int v = x * 255 / (w - 1);
+			ret.setPixel(x, y, qRgb(v, v, v));
+		}
+	return ret;
+}
+
+// In grayscale mode, colors are picked by luma but written in full color.
+static void test_grayscale_palette_dither(dither_algorithm algorithm, pixel_format format){
+	const u8_quad palette[] = {
+		{{ 255, 255, 0, 255 }},
+		{{ 0, 0, 255, 255 }},
+	};
+	ImageStore store;
+	auto image = store.get_image(store.store(make_gray_ramp(64, 16)));
+	CHECK(image && image->convert_format(format));
+	if (!image)
+		return;
+	dither_options options;
+	get_default_dither_options(options);
+	options.algorithm = algorithm;
+	options.palette = palette;
+	options.palette_size = 2;
+	options.grayscale = 1;
+	CHECK(!dither(*image, options));
+
+	int w, h;
+	image->get_dimensions(w, h);
+	int counts[2] = {};
+	bool only_palette_colors = true;
+	for (int y = 0; y < h; y++){
+		for (int x = 0; x < w; x++){
+			auto pixel = image->get_pixel(x, y);
+			bool found = false;
+			for (int i = 0; i < 2; i++){
+				if (pixel.results[0] == palette[i].data[0] && pixel.results[1] == palette[i].data[1] && pixel.results[2] == palette[i].data[2]){
+					counts[i]++;
+					found = true;
+				}
+			}
+			only_palette_colors &= found;
+		}
+	}
+	CHECK(only_palette_colors);
+	CHECK(counts[0] > 0);
+	CHECK(counts[1] > 0);
+}
+
+// Just enough of a TIFF reader to decode what save_parallel() writes: a single
+// IFD in the native byte order, deflated strips and horizontal differencing.
+class TiffReader{
+	QByteArray data;
+	std::map<int, std::vector<std::uint32_t>> tags;
+
+	template <typename T>
+	bool read(size_t offset, T &dst) const{
+		if (offset + sizeof(T) > (size_t)this->data.size())
+			return false;
+		memcpy(&dst, this->data.constData() + offset, sizeof(T));
+		return true;
+	}
+public:
+	bool load(const QString &path){
+		QFile file(path);
+		if (!file.open(QFile::ReadOnly))
+			return false;
+		this->data = file.readAll();
+		const std::uint16_t one = 1;
+		char native = *(const char *)&one ? 'I' : 'M';
+		std::uint16_t magic;
+		std::uint32_t ifd;
+		if (this->data.size() < 8 || this->data[0] != native || this->data[1] != native || !this->read(2, magic) || magic != 42 || !this->read(4, ifd))
+			return false;
+		std::uint16_t count;
+		if (!this->read(ifd, count))
+			return false;
+		for (int i = 0; i < count; i++){
+			size_t entry = ifd + 2 + i * 12;
+			std::uint16_t tag, type;
+			std::uint32_t n;
+			if (!this->read(entry, tag) || !this->read(entry + 2, type) || !this->read(entry + 4, n))
+				return false;
+			// SHORT or LONG. Values that don't fit in the entry are
+			// elsewhere, at the offset the entry holds instead.
+			size_t size = type == 3 ? 2 : 4;
+			size_t offset = entry + 8;
+			if (n * size > 4){
+				std::uint32_t temp;
+				if (!this->read(entry + 8, temp))
+					return false;
+				offset = temp;
+			}
+			auto &values = this->tags[tag];
+			for (std::uint32_t j = 0; j < n; j++){
+				if (size == 2){
+					std::uint16_t value;
+					if (!this->read(offset + j * 2, value))
+						return false;
+					values.push_back(value);
+				}else{
+					std::uint32_t value;
+					if (!this->read(offset + j * 4, value))
+						return false;
+					values.push_back(value);
+				}
+			}
+		}
+		return true;
+	}
+	// Returns -1 if the tag isn't there.
+	long long get(int tag, size_t i = 0) const{
+		auto it = this->tags.find(tag);
+		if (it == this->tags.end() || i >= it->second.size())
+			return -1;
+		return it->second[i];
+	}
+	// Only for 8-bit samples.
+	bool decode(std::vector<std::uint8_t> &dst) const{
+		long long w = this->get(256),
+			h = this->get(257),
+			channels = this->get(277),
+			rows_per_strip = this->get(278);
+		if (w < 1 || h < 1 || channels < 1 || rows_per_strip < 1 || this->get(258) != 8 || this->get(259) != 8 || this->get(317) != 2)
+			return false;
+		auto row_size = (size_t)(w * channels);
+		dst.resize(row_size * h);
+		for (long long y0 = 0, strip = 0; y0 < h; y0 += rows_per_strip, strip++){
+			auto offset = this->get(273, strip),
+				size = this->get(279, strip);
+			if (offset < 0 || size < 0 || offset + size > this->data.size())
+				return false;
+			auto rows = std::min(rows_per_strip, h - y0);
+			uLongf length = (uLongf)(row_size * rows);
+			if (uncompress(&dst[row_size * y0], &length, (const Bytef *)this->data.constData() + offset, (uLong)size) != Z_OK || length != row_size * rows)
+				return false;
+		}
+		for (long long y = 0; y < h; y++){
+			auto row = &dst[row_size * y];
+			for (size_t i = (size_t)channels; i < row_size; i++)
+				row[i] += row[i - channels];
+		}
+		return true;
+	}
+};
+
+// Large enough to be written in more than one strip.
+static void test_grayscale_tiff_round_trip(){
+	const int w = 1024,
+		h = 2100;
+	QImage image(w, h, QImage::Format_Grayscale8);
+	for (int y = 0; y < h; y++){
+		auto row = image.scanLine(y);
+		for (int x = 0; x < w; x++)
+			row[x] = (std::uint8_t)(x * 7 + y * 3);
+	}
+	QTemporaryDir dir;
+	CHECK(dir.isValid());
+	auto path = dir.path() + "/gray.tif";
+	CHECK(!save_parallel(image, path, "tif", -1, false));
+
+	TiffReader reader;
+	CHECK(reader.load(path));
+	CHECK(reader.get(256) == w);
+	CHECK(reader.get(257) == h);
+	CHECK(reader.get(277) == 1);
+	// BlackIsZero.
+	CHECK(reader.get(262) == 1);
+	CHECK(reader.get(338) < 0);
+	CHECK(reader.get(273, 1) >= 0);
+
+	std::vector<std::uint8_t> pixels;
+	CHECK(reader.decode(pixels));
+	bool same = pixels.size() == (size_t)w * h;
+	for (int y = 0; same && y < h; y++)
+		same = !memcmp(&pixels[(size_t)w * y], image.constScanLine(y), w);
+	CHECK(same);
+}
+
+static int count_png_chunks(const QByteArray &png, const char *type){
+	int ret = 0;
+	// Past the signature, every chunk is a length, a type, the data, and a CRC.
+	for (int offset = 8; offset + 8 <= png.size();){
+		auto p = (const std::uint8_t *)png.constData() + offset;
+		std::uint32_t length = (std::uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+		if (!memcmp(p + 4, type, 4))
+			ret++;
+		offset += 12 + length;
+	}
+	return ret;
+}
+
+// Tall enough for every format to be compressed in more than one band.
+static void test_png_round_trip(QImage::Format format, bool fast){
+	const int w = 1024,
+		h = 2100;
+	QImage image(w, h, format);
+	for (int y = 0; y < h; y++){
+		auto row = image.scanLine(y);
+		for (int i = 0; i < image.bytesPerLine(); i++)
+			row[i] = (std::uint8_t)(i * 7 + y * 3 + i / 5 * y);
+	}
+	QTemporaryDir dir;
+	CHECK(dir.isValid());
+	auto path = dir.path() + "/image.png";
+	CHECK(!save_parallel(image, path, "png", -1, fast));
+
+	QFile file(path);
+	CHECK(file.open(QFile::ReadOnly));
+	CHECK(count_png_chunks(file.readAll(), "IDAT") > 1);
+
+	QImage loaded(path);
+	CHECK(!loaded.isNull());
+	loaded = loaded.convertToFormat(format);
+	bool same = loaded.width() == w && loaded.height() == h;
+	auto row_size = (size_t)w * image.depth() / 8;
+	for (int y = 0; same && y < h; y++)
+		same = !memcmp(loaded.constScanLine(y), image.constScanLine(y), row_size);
+	CHECK(same);
+}
+
+int main(int argc, char **argv){
+	QCoreApplication app(argc, argv);
+
+	const dither_algorithm algorithms[] = {
+		DITHER_FLOYD_STEINBERG,
+		DITHER_BAYER,
+	};
+	const pixel_format formats[] = {
+		PIXEL_FORMAT_RGBA8,
+		PIXEL_FORMAT_RGBA16,
+	};
+	for (auto algorithm : algorithms)
+		for (auto format : formats)
+			test_grayscale_palette_dither(algorithm, format);
+	test_grayscale_tiff_round_trip();
+
+	const QImage::Format png_formats[] = {
+		QImage::Format_RGB888,
+		QImage::Format_RGBA8888,
+		QImage::Format_Grayscale8,
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+		QImage::Format_RGBA64,
+#endif
+	};
+	for (auto format : png_formats){
+		test_png_round_trip(format, false);
+		test_png_round_trip(format, true);
+	}
+
+	if (failures){
+		std::cerr << failures << " check(s) failed.\n";
+		return 1;
+	}
+	std::cout << "All checks passed.\n";
+	return 0;
+}